@@ -0,0 +1,517 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+#define ARCHIVE_PATH_LENGTH 4096
+// a segment file doubles up to this many chunks at a time
+#define ARCHIVE_GROW_MAX_CHUNKS 256
+
+// clang-format off
+static WEATHER_ERROR open_segment (WeatherArchive *archive, const char *key, int create, ArchiveSegment **segment);
+static WEATHER_ERROR map_segment (ArchiveSegment *segment, size_t size);
+static WEATHER_ERROR grow_segment (ArchiveSegment *segment, size_t size);
+static WEATHER_ERROR lock_segment (ArchiveSegment *segment, int operation);
+static void unlock_segment (ArchiveSegment *segment);
+static WEATHER_ERROR find_segment (WeatherArchive *archive, const char *parameter, const char *location, int create, ArchiveSegment **segment);
+static size_t first_at_or_after (const ArchiveChunk *chunk, int64_t time);
+static size_t first_chunk_reaching (const ArchiveSegment *segment, int64_t time);
+static WEATHER_ERROR place_point (ArchiveSegment *segment, int64_t time, double value);
+static void insert_point (ArchiveChunk *chunk, int64_t time, double value);
+static WEATHER_ERROR add_chunk (ArchiveSegment *segment, ArchiveChunk **chunk);
+static int contains_time (const ArchiveSegment *segment, int64_t time);
+// clang-format on
+
+static ArchiveHeader *
+segment_header (const ArchiveSegment *segment)
+{
+  return (ArchiveHeader *) segment->map;
+}
+
+static ArchiveChunk *
+segment_chunk (const ArchiveSegment *segment, size_t index)
+{
+  return (ArchiveChunk *) ((char *) segment->map + sizeof (ArchiveHeader))
+	 + index;
+}
+
+static int
+make_key (const char *parameter, const char *location, char *key)
+{
+  int nwritten = snprintf (key, ARCHIVE_MAX_KEY, "%s@%s", parameter, location);
+  return nwritten > 0 && nwritten < ARCHIVE_MAX_KEY;
+}
+
+WEATHER_ERROR
+archive_open (WeatherArchive *archive, const char *root)
+{
+  if (!archive || !root || strlen (root) == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (archive, 0, sizeof (*archive));
+  if (mkdir (root, 0755) != 0 && errno != EEXIST)
+  {
+    ERROR (strerror (errno));
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  size_t len = strlen (root) + 1;
+  archive->root = malloc (len);
+  if (!archive->root)
+    return WEATHER_ERROR_INVALID_MEMORY;
+  memcpy (archive->root, root, len);
+
+  return WEATHER_SUCCESS;
+}
+
+void
+archive_close (WeatherArchive *archive)
+{
+  if (!archive)
+    return;
+
+  ArchiveSegment *segment = archive->segments;
+  while (segment)
+  {
+    ArchiveSegment *next = segment->next;
+    if (segment->map)
+      munmap (segment->map, segment->map_size);
+    close (segment->fd);
+    free (segment);
+    segment = next;
+  }
+
+  free (archive->root);
+  memset (archive, 0, sizeof (*archive));
+}
+
+WEATHER_ERROR
+archive_append (WeatherArchive *archive, const char *parameter,
+		const char *location, const int64_t *times,
+		const double *values, size_t npoints)
+{
+  if (!archive || !archive->root || !parameter || !location
+      || (npoints && (!times || !values)))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  ArchiveSegment *segment = NULL;
+  WEATHER_ERROR status
+    = find_segment (archive, parameter, location, 1, &segment);
+  if (WEATHER_SUCCESS == status)
+    status = lock_segment (segment, LOCK_EX);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  for (size_t i = 0; i < npoints && WEATHER_SUCCESS == status; i++)
+    if (!contains_time (segment, times[i]))
+      status = place_point (segment, times[i], values[i]);
+
+  unlock_segment (segment);
+  return status;
+}
+
+WEATHER_ERROR
+archive_count (WeatherArchive *archive, const char *parameter,
+	       const char *location, int64_t from, int64_t to, size_t *npoints)
+{
+  if (!archive || !archive->root || !parameter || !location || !npoints
+      || from > to)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  *npoints = 0;
+
+  ArchiveSegment *segment = NULL;
+  WEATHER_ERROR status
+    = find_segment (archive, parameter, location, 0, &segment);
+  if (WEATHER_SUCCESS != status || !segment)
+    return status;
+
+  status = lock_segment (segment, LOCK_SH);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  // only the chunk headers and two binary searches per chunk
+  ArchiveHeader *header = segment_header (segment);
+  for (size_t c = first_chunk_reaching (segment, from); c < header->nchunks;
+       c++)
+  {
+    ArchiveChunk *chunk = segment_chunk (segment, c);
+    if (chunk->min_time > to)
+      break;
+
+    size_t first = first_at_or_after (chunk, from);
+    size_t past = to == INT64_MAX ? chunk->count
+				  : first_at_or_after (chunk, to + 1);
+    *npoints += past - first;
+  }
+
+  unlock_segment (segment);
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+archive_read (WeatherArchive *archive, const char *parameter,
+	      const char *location, int64_t from, int64_t to, int64_t *times,
+	      double *values, size_t max_points, size_t *npoints)
+{
+  if (!archive || !archive->root || !parameter || !location || !times
+      || !values || !npoints || from > to)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  *npoints = 0;
+
+  ArchiveSegment *segment = NULL;
+  WEATHER_ERROR status
+    = find_segment (archive, parameter, location, 0, &segment);
+  if (WEATHER_SUCCESS != status || !segment)
+    return status; // nothing archived yet is not an error
+
+  status = lock_segment (segment, LOCK_SH);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  // the chunks follow each other in time, so the points come out sorted
+  ArchiveHeader *header = segment_header (segment);
+  for (size_t c = first_chunk_reaching (segment, from);
+       c < header->nchunks && WEATHER_SUCCESS == status; c++)
+  {
+    ArchiveChunk *chunk = segment_chunk (segment, c);
+    if (chunk->min_time > to)
+      break;
+
+    for (size_t i = first_at_or_after (chunk, from);
+	 i < chunk->count && chunk->times[i] <= to; i++)
+    {
+      if (*npoints == max_points)
+      {
+	status = WEATHER_ERROR_INVALID_MEMORY;
+	break;
+      }
+      times[*npoints] = chunk->times[i];
+      values[*npoints] = chunk->values[i];
+      (*npoints)++;
+    }
+  }
+
+  unlock_segment (segment);
+  return status;
+}
+
+static WEATHER_ERROR
+open_segment (WeatherArchive *archive, const char *key, int create,
+	      ArchiveSegment **segment)
+{
+  *segment = NULL;
+  for (ArchiveSegment *open = archive->segments; open; open = open->next)
+  {
+    if (strcmp (open->key, key) == 0)
+    {
+      *segment = open;
+      return WEATHER_SUCCESS;
+    }
+  }
+
+  // the key is hashed for the file name since parameters and locations are
+  // full of characters that do not belong in paths
+  uint64_t hash = weather_hash (key);
+
+  char path[ARCHIVE_PATH_LENGTH];
+  int nwritten = snprintf (path, sizeof (path), "%s/%016llx.seg",
+			   archive->root, (unsigned long long) hash);
+  if (nwritten < 0 || (size_t) nwritten >= sizeof (path))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  int fd = open (path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+  if (fd < 0)
+  {
+    if (!create && errno == ENOENT)
+      return WEATHER_SUCCESS;
+    ERROR (strerror (errno));
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  ArchiveSegment *opened = calloc (1, sizeof (*opened));
+  if (!opened)
+  {
+    close (fd);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+  opened->fd = fd;
+  snprintf (opened->key, sizeof (opened->key), "%s", key);
+
+  // another process may be creating the same segment right now
+  struct stat info;
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  if (flock (fd, LOCK_EX) != 0 || fstat (fd, &info) != 0)
+    status = WEATHER_ERROR_INVALID_CONFIG;
+  else if (info.st_size == 0)
+  {
+    status = grow_segment (opened, sizeof (ArchiveHeader));
+    if (WEATHER_SUCCESS == status)
+    {
+      ArchiveHeader *header = segment_header (opened);
+      memcpy (header->magic, ARCHIVE_MAGIC, sizeof (header->magic));
+      header->version = ARCHIVE_VERSION;
+      header->chunk_points = ARCHIVE_CHUNK_POINTS;
+      snprintf (header->key, sizeof (header->key), "%s", key);
+    }
+  }
+  else
+  {
+    status = map_segment (opened, (size_t) info.st_size);
+    if (WEATHER_SUCCESS == status)
+    {
+      ArchiveHeader *header = segment_header (opened);
+      if (memcmp (header->magic, ARCHIVE_MAGIC, sizeof (header->magic)) != 0
+	  || header->version != ARCHIVE_VERSION
+	  || header->chunk_points != ARCHIVE_CHUNK_POINTS
+	  || strncmp (header->key, key, sizeof (header->key)) != 0
+	  || opened->map_size
+	       < sizeof (ArchiveHeader) + header->nchunks * sizeof (ArchiveChunk))
+      {
+	ERROR ("Archive segment is corrupt or belongs to another key");
+	status = WEATHER_ERROR_INVALID_CONFIG;
+      }
+    }
+  }
+  flock (fd, LOCK_UN);
+
+  if (WEATHER_SUCCESS != status)
+  {
+    if (opened->map)
+      munmap (opened->map, opened->map_size);
+    close (fd);
+    free (opened);
+    return status;
+  }
+
+  opened->next = archive->segments;
+  archive->segments = opened;
+  *segment = opened;
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+map_segment (ArchiveSegment *segment, size_t size)
+{
+  if (segment->map)
+    munmap (segment->map, segment->map_size);
+
+  segment->map
+    = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+  if (segment->map == MAP_FAILED)
+  {
+    segment->map = NULL;
+    segment->map_size = 0;
+    ERROR (strerror (errno));
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  segment->map_size = size;
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+grow_segment (ArchiveSegment *segment, size_t size)
+{
+  // only ever called under LOCK_EX, no reader maps the file meanwhile
+  if (ftruncate (segment->fd, (off_t) size) != 0)
+  {
+    ERROR (strerror (errno));
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+  return map_segment (segment, size);
+}
+
+static WEATHER_ERROR
+add_chunk (ArchiveSegment *segment, ArchiveChunk **chunk)
+{
+  uint64_t nchunks = segment_header (segment)->nchunks;
+  size_t needed
+    = sizeof (ArchiveHeader) + (nchunks + 1) * sizeof (ArchiveChunk);
+
+  // the file doubles, so a long series is not one ftruncate and remap per
+  // chunk. room past nchunks is zero filled and never read
+  if (needed > segment->map_size)
+  {
+    uint64_t more = nchunks ? nchunks - 1 : 0;
+    if (more > ARCHIVE_GROW_MAX_CHUNKS)
+      more = ARCHIVE_GROW_MAX_CHUNKS;
+    WEATHER_ERROR status
+      = grow_segment (segment, needed + more * sizeof (ArchiveChunk));
+    if (WEATHER_SUCCESS != status)
+      return status;
+  }
+
+  // ftruncate zero fills the new chunk so it is a valid empty chunk the
+  // moment nchunks covers it
+  *chunk = segment_chunk (segment, nchunks);
+  segment_header (segment)->nchunks = nchunks + 1;
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+lock_segment (ArchiveSegment *segment, int operation)
+{
+  if (flock (segment->fd, operation) != 0)
+  {
+    ERROR (strerror (errno));
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  // other processes grow the file, the mapping has to follow before any
+  // chunk past its end is touched. only the mapping, the size is theirs
+  struct stat info;
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  if (fstat (segment->fd, &info) != 0)
+    status = WEATHER_ERROR_INVALID_CONFIG;
+  else if ((size_t) info.st_size > segment->map_size)
+    status = map_segment (segment, (size_t) info.st_size);
+
+  if (WEATHER_SUCCESS == status
+      && segment->map_size < sizeof (ArchiveHeader)
+			       + segment_header (segment)->nchunks
+				   * sizeof (ArchiveChunk))
+  {
+    ERROR ("Archive segment is corrupt");
+    status = WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  if (WEATHER_SUCCESS != status)
+    flock (segment->fd, LOCK_UN);
+  return status;
+}
+
+static void
+unlock_segment (ArchiveSegment *segment)
+{
+  flock (segment->fd, LOCK_UN);
+}
+
+static WEATHER_ERROR
+find_segment (WeatherArchive *archive, const char *parameter,
+	      const char *location, int create, ArchiveSegment **segment)
+{
+  char key[ARCHIVE_MAX_KEY];
+  if (!make_key (parameter, location, key))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  return open_segment (archive, key, create, segment);
+}
+
+static size_t
+first_at_or_after (const ArchiveChunk *chunk, int64_t time)
+{
+  size_t lo = 0;
+  size_t hi = chunk->count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (chunk->times[mid] < time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static size_t
+first_chunk_reaching (const ArchiveSegment *segment, int64_t time)
+{
+  // chunks never overlap and follow each other in time
+  size_t lo = 0;
+  size_t hi = segment_header (segment)->nchunks;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (segment_chunk (segment, mid)->max_time < time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static WEATHER_ERROR
+place_point (ArchiveSegment *segment, int64_t time, double value)
+{
+  uint64_t nchunks = segment_header (segment)->nchunks;
+  size_t c = first_chunk_reaching (segment, time);
+  ArchiveChunk *chunk = NULL;
+
+  // past everything: the last chunk while it has room, then a new one
+  if (c == nchunks)
+  {
+    chunk = nchunks ? segment_chunk (segment, nchunks - 1) : NULL;
+    if (!chunk || chunk->count == ARCHIVE_CHUNK_POINTS)
+    {
+      WEATHER_ERROR status = add_chunk (segment, &chunk);
+      if (WEATHER_SUCCESS != status)
+	return status;
+      chunk->min_time = time;
+      chunk->max_time = time;
+    }
+    insert_point (chunk, time, value);
+    return WEATHER_SUCCESS;
+  }
+
+  // a straggler goes into the first chunk reaching its time. a full chunk
+  // hands its latest point on to the next one, which starts after it
+  for (;;)
+  {
+    chunk = segment_chunk (segment, c);
+    if (chunk->count < ARCHIVE_CHUNK_POINTS)
+    {
+      insert_point (chunk, time, value);
+      return WEATHER_SUCCESS;
+    }
+
+    int64_t carried_time = chunk->times[chunk->count - 1];
+    double carried_value = chunk->values[chunk->count - 1];
+    chunk->count--;
+    chunk->max_time = chunk->times[chunk->count - 1];
+    insert_point (chunk, time, value);
+    time = carried_time;
+    value = carried_value;
+
+    if (++c == segment_header (segment)->nchunks)
+      return place_point (segment, time, value);
+  }
+}
+
+static void
+insert_point (ArchiveChunk *chunk, int64_t time, double value)
+{
+  // the chunk has room and does not hold time yet
+  size_t at = first_at_or_after (chunk, time);
+  memmove (&chunk->times[at + 1], &chunk->times[at],
+	   (chunk->count - at) * sizeof (int64_t));
+  memmove (&chunk->values[at + 1], &chunk->values[at],
+	   (chunk->count - at) * sizeof (double));
+  chunk->times[at] = time;
+  chunk->values[at] = value;
+  chunk->count++;
+
+  if (time < chunk->min_time)
+    chunk->min_time = time;
+  if (time > chunk->max_time)
+    chunk->max_time = time;
+}
+
+static int
+contains_time (const ArchiveSegment *segment, int64_t time)
+{
+  // only the one chunk that can hold it
+  size_t c = first_chunk_reaching (segment, time);
+  if (c == segment_header (segment)->nchunks)
+    return 0;
+
+  ArchiveChunk *chunk = segment_chunk (segment, c);
+  size_t at = first_at_or_after (chunk, time);
+  return at < chunk->count && chunk->times[at] == time;
+}
@@ -0,0 +1,86 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "weather.h"
+
+// local append-only archive for historical values. every parameter/location
+// pair gets its own segment file under the archive root, made of fixed size
+// chunks that hold a column of timestamps followed by a column of values.
+// the chunk headers carry the min/max time so lookups only touch the chunks
+// that overlap the requested range, and everything is read through mmap.
+// chunks never overlap and follow each other in time, so the chunk for a
+// time is found by binary search. the file grows by doubling, the chunks
+// past nchunks are spare room.
+//
+// values older than ARCHIVE_SETTLE_SECONDS are considered final, anything
+// newer can still be revised by the api and is never archived.
+//
+// several processes may share an archive. every read and append holds a
+// flock on the segment (shared for reads, exclusive for appends) and
+// remaps it first when another process has grown the file.
+#define ARCHIVE_MAGIC "WXAR"
+#define ARCHIVE_VERSION 2 // 1 let chunks overlap
+#define ARCHIVE_CHUNK_POINTS 512
+#define ARCHIVE_MAX_KEY 112
+#define ARCHIVE_SETTLE_SECONDS (2 * 24 * 3600)
+
+typedef struct
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t chunk_points;
+  uint32_t reserved;
+  uint64_t nchunks;
+  char key[ARCHIVE_MAX_KEY]; // parameter@location, guards against hash clashes
+} ArchiveHeader;
+
+typedef struct
+{
+  int64_t min_time;
+  int64_t max_time;
+  uint32_t count;
+  uint32_t reserved;
+  int64_t times[ARCHIVE_CHUNK_POINTS]; // sorted within the chunk
+  double values[ARCHIVE_CHUNK_POINTS];
+} ArchiveChunk;
+
+typedef struct ArchiveSegment
+{
+  char key[ARCHIVE_MAX_KEY];
+  int fd;
+  void *map;
+  size_t map_size;
+  struct ArchiveSegment *next;
+} ArchiveSegment;
+
+typedef struct
+{
+  char *root;
+  ArchiveSegment *segments; // segments opened so far, kept mapped
+} WeatherArchive;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR archive_open (WeatherArchive *archive, const char *root);
+void archive_close (WeatherArchive *archive);
+// points already in the archive are skipped, the archive is append only.
+// a point older than ones already archived is sorted into the chunk its
+// time falls in
+WEATHER_ERROR archive_append (WeatherArchive *archive, const char *parameter, const char *location, const int64_t *times, const double *values, size_t npoints);
+// how many points archive_read would return for [from, to]
+WEATHER_ERROR archive_count (WeatherArchive *archive, const char *parameter, const char *location, int64_t from, int64_t to, size_t *npoints);
+// returns the archived points in [from, to] sorted by time
+WEATHER_ERROR archive_read (WeatherArchive *archive, const char *parameter, const char *location, int64_t from, int64_t to, int64_t *times, double *values, size_t max_points, size_t *npoints);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// timing and reporting shared by the benchmarks, times are in seconds
+
+static inline double
+bench_now (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+// cpu time of the whole process, every thread included
+static inline double
+bench_cpu_now (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+static inline int
+bench_compare (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static inline void
+bench_print_header (void)
+{
+  printf ("%-36s %10s %10s %10s %10s\n", "", "mean ms", "p50 ms", "p95 ms",
+	  "max ms");
+}
+
+// sorts samples in place
+static inline void
+bench_print_row (const char *name, double *samples, size_t count)
+{
+  if (!count)
+    return;
+
+  qsort (samples, count, sizeof (*samples), bench_compare);
+
+  double sum = 0;
+  for (size_t i = 0; i < count; i++)
+    sum += samples[i];
+
+  printf ("%-36s %10.3f %10.3f %10.3f %10.3f\n", name, sum / count * 1e3,
+	  samples[count / 2] * 1e3, samples[(count * 95) / 100] * 1e3,
+	  samples[count - 1] * 1e3);
+}
+
+#endif
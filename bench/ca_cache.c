@@ -0,0 +1,160 @@
+// what handle reuse and the ca store cache buy per request.
+//
+//   bench/ca_cache [url] [requests]
+//
+// runs the same request with four handle strategies and prints the cpu time
+// each request cost the process, then the latency. the cpu figures are what
+// the ca cache is about: the two "new connection" rows pay for a full tls
+// handshake every time, the difference between them is the cost of loading
+// the ca bundle, which the network wait in the latency rows drowns out. METEOMATICS_USERNAME / METEOMATICS_PASSWORD are
+// used when set, BENCH_CA_BUNDLE points curl at another bundle (handy for a
+// local server with a self-signed certificate).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+
+#include "bench.h"
+#include "request.h"
+
+#define DEFAULT_URL "https://api.meteomatics.com/now/t_2m:C/47.4,9.4/json"
+#define DEFAULT_REQUESTS 50
+
+typedef enum
+{
+  STRATEGY_FRESH_HANDLE,
+  STRATEGY_NEW_CONNECTION_NO_CA_CACHE,
+  STRATEGY_NEW_CONNECTION_CA_CACHE,
+  STRATEGY_REUSED_HANDLE,
+  STRATEGY_COUNT
+} STRATEGY;
+
+static IMMUTABLE_CHAR_PTR STRATEGY_NAMES[STRATEGY_COUNT]
+  = {"fresh handle per request", "new connection, no ca cache",
+     "new connection, ca cache", "reused handle"};
+
+// clang-format off
+static void configure (CURL *curl, STRATEGY strategy);
+static WEATHER_ERROR run (STRATEGY strategy, const char *url, const WeatherConfig *config, size_t requests, double *cpu, double *wall);
+// clang-format on
+
+int
+main (int argc, char **argv)
+{
+  const char *url = argc > 1 ? argv[1] : DEFAULT_URL;
+  size_t requests = argc > 2 ? strtoul (argv[2], NULL, 10) : DEFAULT_REQUESTS;
+  if (requests == 0)
+    ERROR_EXIT ("requests must be positive\n");
+
+  if (CURLE_OK != curl_global_init (CURL_GLOBAL_ALL))
+    ERROR_EXIT ("curl_global_init failed\n");
+
+  const char *username = getenv ("METEOMATICS_USERNAME");
+  const char *password = getenv ("METEOMATICS_PASSWORD");
+  WeatherConfig config = {.username = username ? username : "bench",
+			  .password = password ? password : "bench"};
+
+  double *cpu = malloc (STRATEGY_COUNT * requests * sizeof (double));
+  double *wall = malloc (STRATEGY_COUNT * requests * sizeof (double));
+  if (!cpu || !wall)
+    ERROR_EXIT ("out of memory\n");
+
+  int ok[STRATEGY_COUNT];
+  for (int strategy = 0; strategy < STRATEGY_COUNT; strategy++)
+  {
+    ok[strategy] = WEATHER_SUCCESS
+		   == run ((STRATEGY) strategy, url, &config, requests,
+			   cpu + strategy * requests, wall + strategy * requests);
+    if (!ok[strategy])
+      fprintf (stderr, "%s: request failed\n", STRATEGY_NAMES[strategy]);
+  }
+
+  printf ("%s, %zu requests per strategy\n\ncpu time per request\n", url,
+	  requests);
+  bench_print_header ();
+  for (int strategy = 0; strategy < STRATEGY_COUNT; strategy++)
+    if (ok[strategy])
+      bench_print_row (STRATEGY_NAMES[strategy], cpu + strategy * requests,
+		       requests);
+
+  printf ("\nlatency\n");
+  bench_print_header ();
+  for (int strategy = 0; strategy < STRATEGY_COUNT; strategy++)
+    if (ok[strategy])
+      bench_print_row (STRATEGY_NAMES[strategy], wall + strategy * requests,
+		       requests);
+
+  free (cpu);
+  free (wall);
+  curl_global_cleanup ();
+  return EXIT_SUCCESS;
+}
+
+static void
+configure (CURL *curl, STRATEGY strategy)
+{
+  const char *bundle = getenv ("BENCH_CA_BUNDLE");
+  if (bundle)
+    curl_easy_setopt (curl, CURLOPT_CAINFO, bundle);
+
+  if (STRATEGY_NEW_CONNECTION_NO_CA_CACHE == strategy
+      || STRATEGY_NEW_CONNECTION_CA_CACHE == strategy)
+  {
+    curl_easy_setopt (curl, CURLOPT_FORBID_REUSE, 1L);
+    curl_easy_setopt (curl, CURLOPT_SSL_SESSIONID_CACHE, 0L);
+  }
+
+#if LIBCURL_VERSION_NUM >= 0x075700
+  if (STRATEGY_NEW_CONNECTION_NO_CA_CACHE == strategy)
+    curl_easy_setopt (curl, CURLOPT_CA_CACHE_TIMEOUT, 0L);
+#endif
+}
+
+static WEATHER_ERROR
+run (STRATEGY strategy, const char *url, const WeatherConfig *config,
+     size_t requests, double *cpu, double *wall)
+{
+  CURL *kept = NULL;
+  ResponseBuffer response = {0};
+  WEATHER_ERROR status = init_response_buffer (&response);
+
+  for (size_t i = 0; WEATHER_SUCCESS == status && i < requests; i++)
+  {
+    CURL *curl = kept;
+    if (!curl)
+    {
+      curl = curl_easy_init ();
+      if (!curl)
+      {
+	status = WEATHER_ERROR_NETWORK;
+	break;
+      }
+    }
+
+    response.size = 0;
+    setup_easy_handle (curl, url, config, &response);
+    configure (curl, strategy);
+
+    // straight to curl, perform_with_handle would set the defaults again.
+    // the cleanup of a fresh handle is part of what it costs
+    double started = bench_now ();
+    double cpu_started = bench_cpu_now ();
+    CURLcode res = curl_easy_perform (curl);
+    if (STRATEGY_FRESH_HANDLE == strategy)
+      curl_easy_cleanup (curl);
+    else
+      kept = curl;
+    cpu[i] = bench_cpu_now () - cpu_started;
+    wall[i] = bench_now () - started;
+    if (CURLE_OK != res)
+    {
+      ERROR (curl_easy_strerror (res));
+      status = WEATHER_ERROR_NETWORK;
+    }
+  }
+
+  if (kept)
+    curl_easy_cleanup (kept);
+  cleanup_response_buffer (&response);
+  return status;
+}
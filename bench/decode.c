@@ -0,0 +1,159 @@
+// what the compile time schema decoder saves over the generic path.
+//
+//   bench/decode [iterations]
+//
+// builds responses for the default query (three parameters at one location)
+// over a day, a month and a year of hourly steps, then decodes each one
+// iterations times both ways: json_loads followed by decode_series, and the
+// specialised decoder reading the text directly. both results are compared
+// once before timing starts.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+
+#include "bench.h"
+#include "decode.h"
+#include "default_schema.h"
+
+#define DEFAULT_ITERATIONS 200
+#define BENCH_PARAMETER(name, parameter) parameter,
+#define BENCH_COLUMN(name, parameter) forecast->name,
+
+static const char *const PARAMETERS[] = {DEFAULT_SCHEMA (BENCH_PARAMETER)};
+#define NPARAMETERS (sizeof (PARAMETERS) / sizeof (PARAMETERS[0]))
+
+static const size_t HOURS[] = {24, 24 * 30, 24 * 365};
+
+// clang-format off
+static char *build_response (size_t hours);
+static int same (const WeatherSeries *series, size_t nseries, const DefaultForecast *forecast);
+// clang-format on
+
+int
+main (int argc, char **argv)
+{
+  size_t iterations
+    = argc > 1 ? strtoul (argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+  if (iterations == 0)
+    ERROR_EXIT ("iterations must be positive\n");
+
+  double *samples = malloc (iterations * sizeof (double));
+  if (!samples)
+    ERROR_EXIT ("out of memory\n");
+
+  printf ("%s, %zu iterations per row\n\n", default_forecast_parameters (),
+	  iterations);
+  bench_print_header ();
+
+  for (size_t h = 0; h < sizeof (HOURS) / sizeof (HOURS[0]); h++)
+  {
+    char *text = build_response (HOURS[h]);
+    if (!text)
+      ERROR_EXIT ("failed to build the response\n");
+    size_t size = strlen (text);
+
+    // both have to agree before their timings mean anything
+    json_t *root = json_loads (text, 0, NULL);
+    WeatherSeries *series = NULL;
+    size_t nseries = 0;
+    DefaultForecast forecast;
+    if (!root || WEATHER_SUCCESS != decode_series (root, &series, &nseries)
+	|| WEATHER_SUCCESS != default_forecast_decode (text, size, &forecast)
+	|| !same (series, nseries, &forecast))
+      ERROR_EXIT ("the decoders disagree\n");
+    decode_free_series (series, nseries);
+    default_forecast_free (&forecast);
+    json_decref (root);
+
+    char name[64];
+    for (size_t i = 0; i < iterations; i++)
+    {
+      double start = bench_now ();
+      root = json_loads (text, 0, NULL);
+      decode_series (root, &series, &nseries);
+      samples[i] = bench_now () - start;
+      decode_free_series (series, nseries);
+      json_decref (root);
+    }
+    snprintf (name, sizeof (name), "generic, %zu hours", HOURS[h]);
+    bench_print_row (name, samples, iterations);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+      double start = bench_now ();
+      default_forecast_decode (text, size, &forecast);
+      samples[i] = bench_now () - start;
+      default_forecast_free (&forecast);
+    }
+    snprintf (name, sizeof (name), "schema, %zu hours", HOURS[h]);
+    bench_print_row (name, samples, iterations);
+
+    free (text);
+  }
+
+  free (samples);
+  return EXIT_SUCCESS;
+}
+
+static char *
+build_response (size_t hours)
+{
+  WeatherSeries series[NPARAMETERS];
+  int64_t *times = malloc (hours * sizeof (int64_t));
+  double *values = malloc (NPARAMETERS * hours * sizeof (double));
+  if (!times || !values)
+  {
+    free (times);
+    free (values);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < hours; i++)
+    times[i] = 1729641600 + (int64_t) i * 3600;
+  for (size_t p = 0; p < NPARAMETERS; p++)
+  {
+    for (size_t i = 0; i < hours; i++)
+      values[p * hours + i] = round ((10 + p + sin (i / 6.0) * 5) * 10) / 10;
+    series[p] = (WeatherSeries){.parameter = (char *) PARAMETERS[p],
+				.location = "37.7749,-122.4194",
+				.lat = 37.7749,
+				.lon = -122.4194,
+				.times = times,
+				.values = values + p * hours,
+				.count = hours};
+  }
+
+  // compact like the api sends it
+  json_t *root = NULL;
+  char *text = NULL;
+  if (WEATHER_SUCCESS == decode_build_json (series, NPARAMETERS, &root))
+    text = json_dumps (root, JSON_COMPACT);
+  json_decref (root);
+  free (times);
+  free (values);
+  return text;
+}
+
+static int
+same (const WeatherSeries *series, size_t nseries,
+      const DefaultForecast *forecast)
+{
+  const double *columns[] = {DEFAULT_SCHEMA (BENCH_COLUMN)};
+  if (nseries != NPARAMETERS)
+    return 0;
+
+  for (size_t p = 0; p < nseries; p++)
+  {
+    if (series[p].count != forecast->axis.count
+	|| series[p].lat != forecast->axis.lat
+	|| series[p].lon != forecast->axis.lon)
+      return 0;
+    for (size_t i = 0; i < series[p].count; i++)
+      if (series[p].times[i] != forecast->axis.times[i]
+	  || series[p].values[i] != columns[p][i])
+	return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,298 @@
+// socket options against body size.
+//
+//   bench/transport [requests] [url]
+//
+// without a url the benchmark starts its own http server on the loopback
+// interface and runs a matrix of body sizes (a point query, a small grid and
+// a large grid) against curl receive buffer sizes and nagle on or off, over
+// one kept-alive connection per cell. the write count per request is how
+// often write_callback ran for the last request of the row.
+// with a url only that url is fetched and just the transport options vary,
+// METEOMATICS_USERNAME / METEOMATICS_PASSWORD and BENCH_CA_BUNDLE are used
+// as in bench/ca_cache.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <curl/curl.h>
+
+#include "bench.h"
+#include "request.h"
+#include "transport.h"
+
+#define DEFAULT_REQUESTS 50
+#define MOCK_MAX_BODY (8 * 1024 * 1024)
+
+static const size_t BODY_SIZES[] = {512, 256 * 1024, 8 * 1024 * 1024};
+static const long BUFFER_SIZES[] = {16 * 1024, 64 * 1024, 512 * 1024};
+
+typedef struct
+{
+  int listener;
+  char *body;
+} MockServer;
+
+typedef struct
+{
+  ResponseBuffer response;
+  size_t writes;
+} Sink;
+
+// clang-format off
+static WEATHER_ERROR mock_start (MockServer *server, int *port);
+static void *mock_serve (void *arg);
+static void mock_connection (MockServer *server, int fd);
+static size_t counting_write (void *contents, size_t size, size_t nmemb, void *userp);
+static WEATHER_ERROR run (const char *url, const WeatherConfig *config, const TransportOptions *options, size_t requests, double *samples, size_t *writes);
+static void format_size (char *out, size_t len, size_t bytes);
+// clang-format on
+
+int
+main (int argc, char **argv)
+{
+  size_t requests = argc > 1 ? strtoul (argv[1], NULL, 10) : DEFAULT_REQUESTS;
+  const char *url = argc > 2 ? argv[2] : NULL;
+  if (requests == 0)
+    ERROR_EXIT ("requests must be positive\n");
+
+  if (CURLE_OK != curl_global_init (CURL_GLOBAL_ALL))
+    ERROR_EXIT ("curl_global_init failed\n");
+
+  const char *username = getenv ("METEOMATICS_USERNAME");
+  const char *password = getenv ("METEOMATICS_PASSWORD");
+  WeatherConfig config = {.username = username ? username : "bench",
+			  .password = password ? password : "bench"};
+
+  MockServer server = {0};
+  int port = 0;
+  if (!url && WEATHER_SUCCESS != mock_start (&server, &port))
+    ERROR_EXIT ("failed to start the mock server\n");
+
+  double *samples = malloc (requests * sizeof (double));
+  if (!samples)
+    ERROR_EXIT ("out of memory\n");
+
+  size_t sizes = url ? 1 : sizeof (BODY_SIZES) / sizeof (BODY_SIZES[0]);
+  for (size_t s = 0; s < sizes; s++)
+  {
+    char target[API_MAX_URL_LENGTH];
+    char body[32];
+    if (url)
+      snprintf (target, sizeof (target), "%s", url);
+    else
+    {
+      snprintf (target, sizeof (target), "http://127.0.0.1:%d/%zu", port,
+		BODY_SIZES[s]);
+      format_size (body, sizeof (body), BODY_SIZES[s]);
+    }
+
+    printf ("%s%s, %zu requests per row\n\n", url ? url : body,
+	    url ? "" : " body", requests);
+    bench_print_header ();
+
+    for (size_t b = 0; b < sizeof (BUFFER_SIZES) / sizeof (BUFFER_SIZES[0]);
+	 b++)
+      for (int nodelay = 1; nodelay >= 0; nodelay--)
+      {
+	TransportOptions options;
+	transport_defaults (&options);
+	options.buffer_size = BUFFER_SIZES[b];
+	options.nodelay = nodelay;
+
+	size_t writes = 0;
+	if (WEATHER_SUCCESS
+	    != run (target, &config, &options, requests, samples, &writes))
+	{
+	  fprintf (stderr, "%s: request failed\n", target);
+	  continue;
+	}
+
+	char buffer[32];
+	char name[64];
+	format_size (buffer, sizeof (buffer), (size_t) BUFFER_SIZES[b]);
+	snprintf (name, sizeof (name), "buf %s, nagle %s, %zu writes", buffer,
+		  nodelay ? "off" : "on", writes);
+	bench_print_row (name, samples, requests);
+      }
+    printf ("\n");
+  }
+
+  // the server thread blocks in accept until the process exits
+  free (samples);
+  curl_global_cleanup ();
+  return EXIT_SUCCESS;
+}
+
+static WEATHER_ERROR
+mock_start (MockServer *server, int *port)
+{
+  server->body = malloc (MOCK_MAX_BODY);
+  if (!server->body)
+    return WEATHER_ERROR_INVALID_MEMORY;
+  memset (server->body, '0', MOCK_MAX_BODY);
+
+  server->listener = socket (AF_INET, SOCK_STREAM, 0);
+  if (server->listener < 0)
+    return WEATHER_ERROR_NETWORK;
+
+  struct sockaddr_in address = {.sin_family = AF_INET,
+				.sin_addr.s_addr = htonl (INADDR_LOOPBACK)};
+  socklen_t len = sizeof (address);
+  if (bind (server->listener, (struct sockaddr *) &address, sizeof (address))
+	!= 0
+      || listen (server->listener, 16) != 0
+      || getsockname (server->listener, (struct sockaddr *) &address, &len)
+	   != 0)
+  {
+    close (server->listener);
+    return WEATHER_ERROR_NETWORK;
+  }
+  *port = ntohs (address.sin_port);
+
+  pthread_t thread;
+  if (pthread_create (&thread, NULL, mock_serve, server) != 0)
+  {
+    close (server->listener);
+    return WEATHER_ERROR_NETWORK;
+  }
+  pthread_detach (thread);
+  return WEATHER_SUCCESS;
+}
+
+static void *
+mock_serve (void *arg)
+{
+  MockServer *server = arg;
+  for (;;)
+  {
+    int fd = accept (server->listener, NULL, NULL);
+    if (fd < 0)
+      continue;
+    mock_connection (server, fd);
+    close (fd);
+  }
+  return NULL;
+}
+
+// keep-alive http/1.1, GET /<bytes> answers with that many bytes
+static void
+mock_connection (MockServer *server, int fd)
+{
+  char request[4096];
+  size_t have = 0;
+
+  for (;;)
+  {
+    char *end = NULL;
+    request[have] = '\0';
+    while (!(end = strstr (request, "\r\n\r\n")))
+    {
+      if (have == sizeof (request) - 1)
+	return;
+      ssize_t got
+	= recv (fd, request + have, sizeof (request) - 1 - have, 0);
+      if (got <= 0)
+	return;
+      have += (size_t) got;
+      request[have] = '\0';
+    }
+
+    size_t bytes = 0;
+    if (strncmp (request, "GET /", 5) == 0)
+      bytes = strtoul (request + 5, NULL, 10);
+    if (bytes > MOCK_MAX_BODY)
+      bytes = MOCK_MAX_BODY;
+
+    char header[128];
+    int header_len = snprintf (header, sizeof (header),
+			       "HTTP/1.1 200 OK\r\n"
+			       "Content-Type: application/json\r\n"
+			       "Content-Length: %zu\r\n\r\n",
+			       bytes);
+    if (send (fd, header, (size_t) header_len, MSG_NOSIGNAL | MSG_MORE) < 0)
+      return;
+    for (size_t sent = 0; sent < bytes;)
+    {
+      ssize_t put = send (fd, server->body + sent, bytes - sent, MSG_NOSIGNAL);
+      if (put <= 0)
+	return;
+      sent += (size_t) put;
+    }
+
+    // whatever followed the request belongs to the next one
+    size_t used = (size_t) (end + 4 - request);
+    memmove (request, request + used, have - used);
+    have -= used;
+  }
+}
+
+static size_t
+counting_write (void *contents, size_t size, size_t nmemb, void *userp)
+{
+  Sink *sink = userp;
+  sink->writes++;
+  return write_callback (contents, size, nmemb, &sink->response);
+}
+
+static WEATHER_ERROR
+run (const char *url, const WeatherConfig *config,
+     const TransportOptions *options, size_t requests, double *samples,
+     size_t *writes)
+{
+  Sink sink = {0};
+  WEATHER_ERROR status = init_response_buffer (&sink.response);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  CURL *curl = curl_easy_init ();
+  if (!curl)
+  {
+    cleanup_response_buffer (&sink.response);
+    return WEATHER_ERROR_NETWORK;
+  }
+
+  status = transport_apply (options, curl);
+  const char *bundle = getenv ("BENCH_CA_BUNDLE");
+
+  // the first request opens the connection and is not counted
+  for (size_t i = 0; WEATHER_SUCCESS == status && i <= requests; i++)
+  {
+    sink.response.size = 0;
+    setup_easy_handle (curl, url, config, &sink.response);
+    curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, counting_write);
+    curl_easy_setopt (curl, CURLOPT_WRITEDATA, &sink);
+    if (bundle)
+      curl_easy_setopt (curl, CURLOPT_CAINFO, bundle);
+
+    size_t before = sink.writes;
+    double started = bench_now ();
+    CURLcode res = curl_easy_perform (curl);
+    if (i > 0)
+      samples[i - 1] = bench_now () - started;
+    *writes = sink.writes - before;
+    if (CURLE_OK != res)
+    {
+      ERROR (curl_easy_strerror (res));
+      status = WEATHER_ERROR_NETWORK;
+    }
+  }
+
+  curl_easy_cleanup (curl);
+  cleanup_response_buffer (&sink.response);
+  return status;
+}
+
+static void
+format_size (char *out, size_t len, size_t bytes)
+{
+  if (bytes >= 1024 * 1024)
+    snprintf (out, len, "%zu MiB", bytes / (1024 * 1024));
+  else if (bytes >= 1024)
+    snprintf (out, len, "%zu KiB", bytes / 1024);
+  else
+    snprintf (out, len, "%zu B", bytes);
+}
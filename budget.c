@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "budget.h"
+#include "metrics.h"
+
+WEATHER_ERROR
+budget_init (MemoryBudget *budget, size_t limit)
+{
+  if (!budget || limit == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (budget, 0, sizeof (*budget));
+  budget->limit = limit;
+  return WEATHER_SUCCESS;
+}
+
+int
+budget_charge (MemoryBudget *budget, size_t bytes, int force)
+{
+  size_t used = atomic_load (&budget->used);
+  size_t wanted;
+
+  do
+  {
+    wanted = used + bytes;
+    if (wanted > budget->limit && !force)
+    {
+      atomic_fetch_add (&budget->refused, 1);
+      metrics_count (METRIC_BUDGET_REFUSED, 1);
+      return 0;
+    }
+  }
+  while (!atomic_compare_exchange_weak (&budget->used, &used, wanted));
+
+  if (wanted > budget->limit)
+  {
+    atomic_fetch_add (&budget->overdrafts, 1);
+    metrics_count (METRIC_BUDGET_OVERDRAFTS, 1);
+  }
+  atomic_fetch_add (&budget->charges, 1);
+  metrics_gauge_add (METRIC_BUDGET_USED, (int64_t) bytes);
+
+  size_t peak = atomic_load (&budget->peak);
+  while (wanted > peak
+	 && !atomic_compare_exchange_weak (&budget->peak, &peak, wanted))
+    ;
+  if (wanted > peak)
+    metrics_gauge_max (METRIC_BUDGET_PEAK, (int64_t) wanted);
+
+  return 1;
+}
+
+void
+budget_release (MemoryBudget *budget, size_t bytes)
+{
+  if (!bytes)
+    return;
+
+  atomic_fetch_sub (&budget->used, bytes);
+  atomic_fetch_add (&budget->generation, 1);
+  metrics_gauge_add (METRIC_BUDGET_USED, -(int64_t) bytes);
+}
+
+int
+budget_available (MemoryBudget *budget, size_t bytes)
+{
+  return atomic_load (&budget->used) + bytes <= budget->limit;
+}
+
+uint64_t
+budget_generation (MemoryBudget *budget)
+{
+  return atomic_load (&budget->generation);
+}
+
+void
+budget_report (MemoryBudget *budget, FILE *stream)
+{
+  fprintf (stream,
+	   "memory budget: %zu of %zu bytes in use, peak %zu, %zu charges, "
+	   "%zu refused, %zu overdrafts\n",
+	   atomic_load (&budget->used), budget->limit,
+	   atomic_load (&budget->peak), atomic_load (&budget->charges),
+	   atomic_load (&budget->refused), atomic_load (&budget->overdrafts));
+}
@@ -0,0 +1,55 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+// meteomatics.hpp only hands budgets around by pointer. a lock free
+// std::atomic is laid out like the c one, so the struct still matches
+#include <atomic>
+typedef std::atomic<size_t> budget_counter_t;
+typedef std::atomic<uint_fast64_t> budget_generation_t;
+#else
+#include <stdatomic.h>
+typedef atomic_size_t budget_counter_t;
+typedef atomic_uint_fast64_t budget_generation_t;
+#endif
+
+#include "weather.h"
+
+// memory budget shared by every response buffer that is attached to it,
+// possibly across engines and threads. response buffers charge the budget
+// when they grow and give it back when they are cleaned up. a charge that
+// would go over the limit is refused unless it is forced, forced charges are
+// how the oldest transfer keeps making progress when everything else waits.
+typedef struct
+{
+  size_t limit;
+  budget_counter_t used;
+  budget_counter_t peak;
+  budget_generation_t generation; // bumped on every release
+
+  budget_counter_t charges;
+  budget_counter_t refused;
+  budget_counter_t overdrafts; // forced charges that went over the limit
+} MemoryBudget;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR budget_init (MemoryBudget *budget, size_t limit);
+// 1 when the bytes were charged
+int budget_charge (MemoryBudget *budget, size_t bytes, int force);
+void budget_release (MemoryBudget *budget, size_t bytes);
+int budget_available (MemoryBudget *budget, size_t bytes);
+uint64_t budget_generation (MemoryBudget *budget);
+void budget_report (MemoryBudget *budget, FILE *stream);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+
+#include "canonical.h"
+#include "decode.h"
+
+// clang-format off
+static WEATHER_ERROR strip (const char *text, char *out, size_t out_size);
+static void canonical_datetime (char *datetime, size_t size);
+static WEATHER_ERROR format_period (int64_t seconds, char *out, size_t out_size);
+static WEATHER_ERROR canonical_parameters (char *parameters, size_t size);
+static void canonical_location (char *location, size_t size, double grid);
+static int compare_names (const void *a, const void *b);
+// clang-format on
+
+WEATHER_ERROR
+canonical_query (const WeatherConfig *query, double grid,
+		 CanonicalQuery *canonical)
+{
+  if (!query || !canonical || !query->datetime || !query->parameters
+      || !query->location || !query->format || !(grid >= 0))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (canonical, 0, sizeof (*canonical));
+  WEATHER_ERROR status
+    = strip (query->datetime, canonical->datetime, sizeof (canonical->datetime));
+  if (WEATHER_SUCCESS == status)
+    status = strip (query->parameters, canonical->parameters,
+		    sizeof (canonical->parameters));
+  if (WEATHER_SUCCESS == status)
+    status = strip (query->location, canonical->location,
+		    sizeof (canonical->location));
+  if (WEATHER_SUCCESS == status)
+    status
+      = strip (query->format, canonical->format, sizeof (canonical->format));
+  if (WEATHER_SUCCESS == status)
+    status = canonical_parameters (canonical->parameters,
+				   sizeof (canonical->parameters));
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  canonical_datetime (canonical->datetime, sizeof (canonical->datetime));
+  canonical_location (canonical->location, sizeof (canonical->location), grid);
+
+  canonical->config = *query;
+  canonical->config.datetime = canonical->datetime;
+  canonical->config.parameters = canonical->parameters;
+  canonical->config.location = canonical->location;
+  canonical->config.format = canonical->format;
+  canonical->rewritten = strcmp (query->datetime, canonical->datetime) != 0
+			 || strcmp (query->parameters, canonical->parameters)
+			      != 0
+			 || strcmp (query->location, canonical->location) != 0
+			 || strcmp (query->format, canonical->format) != 0;
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+strip (const char *text, char *out, size_t out_size)
+{
+  size_t length = 0;
+  for (; *text; text++)
+  {
+    if (isspace ((unsigned char) *text))
+      continue;
+    if (length + 1 >= out_size)
+      return WEATHER_ERROR_URL_CONSTRUCTION;
+    out[length++] = *text;
+  }
+  out[length] = '\0';
+  return WEATHER_SUCCESS;
+}
+
+static void
+canonical_datetime (char *datetime, size_t size)
+{
+  // left alone unless the whole of it reads as a time or a range
+  int64_t start, end, step;
+  if (WEATHER_SUCCESS
+      != decode_parse_time_range (datetime, &start, &end, &step))
+    return;
+
+  char start_text[32];
+  char end_text[32];
+  char period[32];
+  if (WEATHER_SUCCESS
+      != decode_format_time (start, start_text, sizeof (start_text)))
+    return;
+
+  if (step == 0)
+  {
+    snprintf (datetime, size, "%s", start_text);
+    return;
+  }
+
+  end -= (end - start) % step;
+  if (WEATHER_SUCCESS == decode_format_time (end, end_text, sizeof (end_text))
+      && WEATHER_SUCCESS == format_period (step, period, sizeof (period)))
+    snprintf (datetime, size, "%s--%s:%s", start_text, end_text, period);
+}
+
+static WEATHER_ERROR
+format_period (int64_t seconds, char *out, size_t out_size)
+{
+  int64_t parts[] = {seconds / 86400, seconds % 86400 / 3600,
+		     seconds % 3600 / 60, seconds % 60};
+  const char units[] = "DHMS";
+
+  if (out_size < 2)
+    return WEATHER_ERROR_URL_CONSTRUCTION;
+  snprintf (out, out_size, "P");
+
+  size_t length = 1;
+  int in_time = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    if (!parts[i])
+      continue;
+
+    // the time designator goes before the first of hours, minutes, seconds
+    const char *designator = i > 0 && !in_time ? "T" : "";
+    in_time |= i > 0;
+    int nwritten = snprintf (out + length, out_size - length, "%s%lld%c",
+			     designator, (long long) parts[i], units[i]);
+    if (nwritten < 0 || length + (size_t) nwritten >= out_size)
+      return WEATHER_ERROR_URL_CONSTRUCTION;
+    length += (size_t) nwritten;
+  }
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+canonical_parameters (char *parameters, size_t size)
+{
+  // an empty name is a mistake in the query, strtok would drop it silently
+  size_t count = 1;
+  for (const char *p = parameters; *p; p++)
+    count += *p == ',';
+  if (!*parameters || *parameters == ','
+      || parameters[strlen (parameters) - 1] == ','
+      || strstr (parameters, ",,"))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  char *copy = malloc (size);
+  char **names = malloc (count * sizeof (char *));
+  if (!copy || !names)
+  {
+    free (copy);
+    free (names);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  memcpy (copy, parameters, strlen (parameters) + 1);
+  count = 0;
+  char *saved = NULL;
+  for (char *name = strtok_r (copy, ",", &saved); name;
+       name = strtok_r (NULL, ",", &saved))
+    names[count++] = name;
+  qsort (names, count, sizeof (char *), compare_names);
+
+  // the joined names are never longer than what they came from
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i && strcmp (names[i], names[i - 1]) == 0)
+      continue;
+    length += (size_t) snprintf (parameters + length, size - length, "%s%s",
+				 length ? "," : "", names[i]);
+  }
+  parameters[length] = '\0';
+
+  free (copy);
+  free (names);
+  return WEATHER_SUCCESS;
+}
+
+static void
+canonical_location (char *location, size_t size, double grid)
+{
+  char *out = malloc (size);
+  if (!out)
+    return;
+
+  // only lists of plain points, anything else keeps its spelling
+  size_t length = 0;
+  const char *at = location;
+  int points = 1;
+  while (points && *at)
+  {
+    double lat, lon;
+    int consumed = 0;
+    if (sscanf (at, "%lf,%lf%n", &lat, &lon, &consumed) != 2
+	|| (at[consumed] != '\0' && at[consumed] != '+') || !isfinite (lat)
+	|| !isfinite (lon))
+    {
+      points = 0;
+      break;
+    }
+
+    if (grid > 0)
+    {
+      lat = round (lat / grid) * grid;
+      lon = round (lon / grid) * grid;
+    }
+
+    // + 0.0 turns -0 into 0, both would otherwise be spelled
+    char point[64];
+    if (WEATHER_SUCCESS
+	  != decode_format_location (lat + 0.0, lon + 0.0, point, sizeof (point))
+	|| length + strlen (point) + 2 > size)
+    {
+      points = 0;
+      break;
+    }
+    length += (size_t) snprintf (out + length, size - length, "%s%s",
+				 length ? "+" : "", point);
+
+    at += consumed;
+    if (*at == '+')
+      at++;
+  }
+
+  if (points && length)
+    memcpy (location, out, length + 1);
+  free (out);
+}
+
+static int
+compare_names (const void *a, const void *b)
+{
+  return strcmp (*(char *const *) a, *(char *const *) b);
+}
@@ -0,0 +1,47 @@
+#ifndef CANONICAL_H
+#define CANONICAL_H
+
+#include "request.h"
+#include "weather.h"
+
+// one spelling for queries that ask for the same thing. caches and request
+// dedup compare keys built from the query text, so without this "47.0,8"
+// and "47,8", "t_2m:C,precip_1h:mm" and "precip_1h:mm,t_2m:C", or PT60M
+// and PT1H count as different queries.
+//
+//   whitespace is dropped everywhere
+//   parameters are sorted and listed once
+//   timestamps are spelled in utc like 2024-10-23T00:00:00Z, steps in days,
+//   hours, minutes and seconds (P1DT6H), and a range ends on its last step
+//   points (lat,lon, several joined with +) are spelled the way
+//   decode_format_location does it, snapped to multiples of grid degrees
+//   first unless grid is 0
+//
+// what cannot be read this way (now, grids, named locations) only loses its
+// whitespace. snapping moves the point and with it the answer, pick a grid
+// finer than the model resolves, 0.01 is about a kilometre.
+typedef struct
+{
+  char datetime[API_MAX_URL_LENGTH];
+  char parameters[API_MAX_URL_LENGTH];
+  char location[API_MAX_URL_LENGTH];
+  char format[API_MAX_URL_LENGTH];
+  WeatherConfig config; // the query, pointing at the buffers above
+  int rewritten; // spelled differently from the query
+} CanonicalQuery;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// username and password are carried over as they are. a parameter list
+// with an empty name in it ("t_2m:C,,precip_1h:mm") is not a query
+WEATHER_ERROR canonical_query (const WeatherConfig *query, double grid, CanonicalQuery *canonical);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,541 @@
+#include <string.h>
+#include <time.h>
+
+#include "canonical.h"
+#include "client.h"
+#include "decode.h"
+#include "metrics.h"
+
+typedef struct
+{
+  WeatherClient *client;
+  int64_t now;
+  size_t outstanding;
+} WarmState;
+
+// one query on its way in for client_warm
+typedef struct
+{
+  WarmState *state;
+  char *url;
+  WEATHER_ERROR status;
+} WarmFetch;
+
+static pthread_once_t global_once = PTHREAD_ONCE_INIT;
+static CURLcode global_status = CURLE_FAILED_INIT; // written once, under the once
+
+// clang-format off
+static void global_init (void);
+static ClientThread *thread_state (WeatherClient *client);
+static void release_thread (void *value);
+static void free_thread (ClientThread *state);
+static char *duplicate (const char *text);
+static WEATHER_ERROR answer_from_cache (WeatherClient *client, const WeatherConfig *query, json_t **root);
+static WEATHER_ERROR read_cached (SeriesCache *cache, const SeriesInterval *range, WeatherSeries *series);
+static void store_in_cache (WeatherClient *client, const char *url, int64_t now, const json_t *root);
+static void on_warmed (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+// clang-format on
+
+WEATHER_ERROR
+client_global_init (void)
+{
+  pthread_once (&global_once, global_init);
+  return CURLE_OK == global_status ? WEATHER_SUCCESS : WEATHER_ERROR_NETWORK;
+}
+
+WEATHER_ERROR
+client_init (WeatherClient *client, const char *username, const char *password)
+{
+  if (!client)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (client, 0, sizeof (*client));
+
+  WeatherConfig credentials = {.username = username, .password = password};
+  WEATHER_ERROR status = validate_config (&credentials);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  status = client_global_init ();
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  client->username = duplicate (username);
+  client->password = duplicate (password);
+  if (!client->username || !client->password)
+  {
+    free (client->username);
+    free (client->password);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  if (pthread_key_create (&client->key, release_thread) != 0)
+  {
+    free (client->username);
+    free (client->password);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  pthread_mutex_init (&client->lock, NULL);
+  pthread_mutex_init (&client->cache_lock, NULL);
+  transport_defaults (&client->transport);
+  client->ready = 1;
+  return WEATHER_SUCCESS;
+}
+
+void
+client_cleanup (WeatherClient *client)
+{
+  if (!client || !client->ready)
+    return;
+
+  // no destructor runs for the key after this, the states go here instead
+  pthread_key_delete (client->key);
+
+  while (client->threads)
+  {
+    ClientThread *state = client->threads;
+    client->threads = state->next;
+    free_thread (state);
+  }
+
+  pthread_mutex_destroy (&client->lock);
+  pthread_mutex_destroy (&client->cache_lock);
+  free (client->username);
+  free (client->password);
+  memset (client, 0, sizeof (*client));
+}
+
+void
+client_set_tls_cache (WeatherClient *client, TlsSessionCache *cache)
+{
+  if (client)
+    client->tls = cache;
+}
+
+void
+client_set_transport (WeatherClient *client, const TransportOptions *options)
+{
+  if (client && options)
+    client->transport = *options;
+}
+
+void
+client_set_grid (WeatherClient *client, double grid)
+{
+  if (client)
+    client->grid = grid;
+}
+
+void
+client_set_cache (WeatherClient *client, SeriesCache *cache)
+{
+  if (client)
+    client->cache = cache;
+}
+
+void
+client_set_prefetcher (WeatherClient *client, Prefetcher *prefetcher)
+{
+  if (client)
+    client->prefetcher = prefetcher;
+}
+
+WEATHER_ERROR
+client_get (WeatherClient *client, const char *url, const char **body,
+	    size_t *size)
+{
+  if (!client || !client->ready || !url || !body)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  ClientThread *state = thread_state (client);
+  if (!state)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  // one huge answer should not pin its buffer for the thread's lifetime
+  if (state->response.capacity > CLIENT_KEEP_BUFFER)
+  {
+    cleanup_response_buffer (&state->response);
+    if (WEATHER_SUCCESS != init_response_buffer (&state->response))
+      return WEATHER_ERROR_INVALID_MEMORY;
+  }
+  state->response.size = 0;
+  state->response.data[0] = '\0';
+
+  WeatherConfig credentials
+    = {.username = client->username, .password = client->password};
+  WEATHER_ERROR status
+    = perform_with_handle (state->easy, url, &credentials, &state->response);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  *body = state->response.data;
+  if (size)
+    *size = state->response.size;
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+client_fetch (WeatherClient *client, const WeatherConfig *query, json_t **root)
+{
+  if (!client || !client->ready || !query || !root)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  WeatherConfig spelled = *query;
+  spelled.username = client->username;
+  spelled.password = client->password;
+
+  // the cache, the prefetcher and the api all see the one spelling, so a
+  // point snapped to the grid is looked up where its answer was stored
+  *root = NULL;
+  CanonicalQuery canonical;
+  WEATHER_ERROR status
+    = canonical_query (&spelled, client->grid, &canonical);
+  if (WEATHER_SUCCESS != status)
+    return status;
+  if (canonical.rewritten)
+    metrics_count (METRIC_CANONICAL_REWRITES, 1);
+  const WeatherConfig config = canonical.config;
+
+  char url[API_MAX_URL_LENGTH];
+  status = construct_url (&config, url, sizeof (url));
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  // the url is what the prefetcher knows the query by, hits count as much
+  // as misses towards making it recur
+  int64_t now = (int64_t) time (NULL);
+  if (client->prefetcher && client->cache)
+  {
+    pthread_mutex_lock (&client->cache_lock);
+    prefetch_record_query (client->prefetcher, url, now);
+    pthread_mutex_unlock (&client->cache_lock);
+  }
+
+  if (client->cache)
+    status = answer_from_cache (client, &config, root);
+  if (WEATHER_SUCCESS != status || *root)
+    return status;
+
+  const char *body = NULL;
+  status = client_get (client, url, &body, NULL);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  status = process_json (body, root);
+  if (WEATHER_SUCCESS == status && client->cache)
+    store_in_cache (client, url, now, *root);
+  return status;
+}
+
+WEATHER_ERROR
+client_warm (WeatherClient *client, RequestEngine *engine, int64_t now,
+	     size_t *warmed)
+{
+  if (!client || !client->ready || !engine || !client->cache
+      || !client->prefetcher)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  if (warmed)
+    *warmed = 0;
+
+  // the keys belong to the prefetcher, which may forget them as soon as
+  // the lock is let go
+  WarmState state = {.client = client, .now = now};
+  WarmFetch *fetches = NULL;
+  const char *keys[CLIENT_WARM_MAX];
+  size_t nkeys = 0;
+  pthread_mutex_lock (&client->cache_lock);
+  WEATHER_ERROR status
+    = prefetch_due (client->prefetcher, now, keys, CLIENT_WARM_MAX, &nkeys);
+  if (WEATHER_SUCCESS == status && nkeys)
+  {
+    fetches = calloc (nkeys, sizeof (WarmFetch));
+    for (size_t i = 0; fetches && i < nkeys; i++)
+      fetches[i] = (WarmFetch){.state = &state, .url = duplicate (keys[i])};
+    if (!fetches)
+      status = WEATHER_ERROR_INVALID_MEMORY;
+  }
+  pthread_mutex_unlock (&client->cache_lock);
+
+  // every query goes out before the first one is waited for
+  for (size_t i = 0; i < nkeys && WEATHER_SUCCESS == status; i++)
+  {
+    fetches[i].status = fetches[i].url ? WEATHER_SUCCESS
+				       : WEATHER_ERROR_INVALID_MEMORY;
+    if (WEATHER_SUCCESS == fetches[i].status)
+      fetches[i].status = engine_submit (engine, fetches[i].url,
+					 ENGINE_PRIORITY_BULK, on_warmed,
+					 &fetches[i]);
+    if (WEATHER_SUCCESS == fetches[i].status)
+      state.outstanding++;
+  }
+
+  while (state.outstanding && WEATHER_SUCCESS == status)
+    status = engine_perform (engine, CLIENT_WARM_POLL_MS, NULL);
+
+  // the callbacks point at the fetches, none may be left behind
+  for (size_t i = 0; i < nkeys && state.outstanding; i++)
+    engine_cancel (engine, &fetches[i]);
+
+  // a query that failed to warm is simply fetched when it is asked for
+  for (size_t i = 0; fetches && i < nkeys; i++)
+  {
+    if (warmed && WEATHER_SUCCESS == fetches[i].status)
+      (*warmed)++;
+    free (fetches[i].url);
+  }
+  free (fetches);
+  return status;
+}
+
+static void
+global_init (void)
+{
+  global_status = curl_global_init (CURL_GLOBAL_ALL);
+}
+
+static ClientThread *
+thread_state (WeatherClient *client)
+{
+  ClientThread *state = pthread_getspecific (client->key);
+  if (state)
+    return state;
+
+  state = calloc (1, sizeof (*state));
+  if (!state)
+    return NULL;
+
+  state->client = client;
+  state->easy = curl_easy_init ();
+  if (!state->easy
+      || WEATHER_SUCCESS != init_response_buffer (&state->response))
+  {
+    free_thread (state);
+    return NULL;
+  }
+
+  // timeouts must not use signals once several threads are involved
+  curl_easy_setopt (state->easy, CURLOPT_NOSIGNAL, 1L);
+  if (client->tls)
+    tls_cache_attach (client->tls, state->easy);
+  transport_apply (&client->transport, state->easy);
+
+  pthread_mutex_lock (&client->lock);
+  state->next = client->threads;
+  if (client->threads)
+    client->threads->prev = state;
+  client->threads = state;
+  pthread_mutex_unlock (&client->lock);
+
+  pthread_setspecific (client->key, state);
+  return state;
+}
+
+static void
+release_thread (void *value)
+{
+  ClientThread *state = value;
+  WeatherClient *client = state->client;
+
+  pthread_mutex_lock (&client->lock);
+  if (state->prev)
+    state->prev->next = state->next;
+  else
+    client->threads = state->next;
+  if (state->next)
+    state->next->prev = state->prev;
+  pthread_mutex_unlock (&client->lock);
+
+  free_thread (state);
+}
+
+static void
+free_thread (ClientThread *state)
+{
+  if (state->easy)
+    curl_easy_cleanup (state->easy);
+  cleanup_response_buffer (&state->response);
+  free (state);
+}
+
+static char *
+duplicate (const char *text)
+{
+  size_t len = strlen (text) + 1;
+  char *copy = malloc (len);
+  if (copy)
+    memcpy (copy, text, len);
+  return copy;
+}
+
+static WEATHER_ERROR
+answer_from_cache (WeatherClient *client, const WeatherConfig *query,
+		   json_t **root)
+{
+  // time series at a single point only, anything else goes to the api
+  int64_t start, end, step;
+  double lat, lon;
+  int consumed = 0;
+  if (!query->datetime || !query->parameters || !query->location
+      || WEATHER_SUCCESS
+	   != decode_parse_time_range (query->datetime, &start, &end, &step)
+      || sscanf (query->location, "%lf,%lf%n", &lat, &lon, &consumed) != 2
+      || query->location[consumed] != '\0')
+    return WEATHER_SUCCESS;
+
+  char location[64];
+  WEATHER_ERROR status
+    = decode_format_location (lat, lon, location, sizeof (location));
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  // a single point in time is a range of one
+  SeriesInterval range = {.start = start, .end = end, .step = step ? step : 1};
+  range.end -= (range.end - range.start) % range.step;
+  size_t npoints = (size_t) ((range.end - range.start) / range.step) + 1;
+
+  size_t nparameters = 1;
+  for (const char *p = query->parameters; *p; p++)
+    nparameters += *p == ',';
+
+  WeatherSeries *series = calloc (nparameters, sizeof (WeatherSeries));
+  if (!series)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  size_t nseries = 0;
+  int complete = 1;
+  const char *parameter = query->parameters;
+  pthread_mutex_lock (&client->cache_lock);
+  while (WEATHER_SUCCESS == status && complete && nseries < nparameters)
+  {
+    size_t len = strcspn (parameter, ",");
+    WeatherSeries *current = &series[nseries++];
+
+    current->parameter = strndup (parameter, len);
+    current->location = duplicate (location);
+    current->lat = lat;
+    current->lon = lon;
+    current->times = malloc (npoints * sizeof (int64_t));
+    current->values = malloc (npoints * sizeof (double));
+    if (!current->parameter || !current->location || !current->times
+	|| !current->values)
+    {
+      status = WEATHER_ERROR_INVALID_MEMORY;
+      break;
+    }
+
+    status = read_cached (client->cache, &range, current);
+    complete = current->count == npoints;
+    parameter += len + (parameter[len] == ',');
+  }
+  pthread_mutex_unlock (&client->cache_lock);
+
+  if (WEATHER_SUCCESS == status && complete)
+    status = decode_build_json (series, nseries, root);
+
+  decode_free_series (series, nseries);
+  return status;
+}
+
+static WEATHER_ERROR
+read_cached (SeriesCache *cache, const SeriesInterval *range,
+	     WeatherSeries *series)
+{
+  // the points are only trusted where a cover vouches for them
+  SeriesInterval *gaps = NULL;
+  size_t ngaps = 0;
+  WEATHER_ERROR status = series_cache_gaps (cache, series->parameter,
+					    series->location, range, &gaps,
+					    &ngaps);
+  free (gaps);
+  if (WEATHER_SUCCESS != status || ngaps)
+    return status;
+
+  const CompressedSeries *cached
+    = series_cache_get (cache, series->parameter, series->location);
+  if (!cached)
+    return WEATHER_SUCCESS;
+
+  size_t npoints = (size_t) ((range->end - range->start) / range->step) + 1;
+  int64_t times[SERIES_BLOCK_POINTS];
+  double values[SERIES_BLOCK_POINTS];
+  for (size_t block = series_find_block (cached, range->start);
+       block < cached->nblocks && cached->blocks[block].first_time <= range->end;
+       block++)
+  {
+    size_t count = series_decode_block (cached, block, times, values);
+    for (size_t i = 0; i < count && series->count < npoints; i++)
+    {
+      int64_t offset = times[i] - range->start;
+      if (offset < 0 || times[i] > range->end || offset % range->step != 0)
+	continue;
+
+      series->times[series->count] = times[i];
+      series->values[series->count++] = values[i];
+    }
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+static void
+on_warmed (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  WarmFetch *fetch = userdata;
+  fetch->state->outstanding--;
+
+  json_t *root = NULL;
+  if (WEATHER_SUCCESS == status)
+    status = process_json (request->response.data, &root);
+  if (WEATHER_SUCCESS == status)
+    store_in_cache (fetch->state->client, fetch->url, fetch->state->now, root);
+
+  fetch->status = status;
+  json_decref (root);
+}
+
+static void
+store_in_cache (WeatherClient *client, const char *url, int64_t now,
+		const json_t *root)
+{
+  // the answer is already there, a cache that cannot take it is no reason
+  // to fail the request
+  WeatherSeries *series = NULL;
+  size_t nseries = 0;
+  if (WEATHER_SUCCESS != decode_series (root, &series, &nseries))
+    return;
+
+  pthread_mutex_lock (&client->cache_lock);
+  for (size_t i = 0; i < nseries; i++)
+  {
+    const WeatherSeries *current = &series[i];
+    if (!current->count
+	|| WEATHER_SUCCESS
+	     != series_cache_put (client->cache, current->parameter,
+				  current->location, current->times,
+				  current->values, current->count))
+      continue;
+
+    // the api sends every point it was asked for, evenly spaced points are
+    // the whole of their range
+    SeriesInterval range
+      = {.start = current->times[0],
+	 .end = current->times[current->count - 1],
+	 .step = current->count > 1 ? current->times[1] - current->times[0] : 1};
+    int even = range.step > 0;
+    for (size_t t = 2; even && t < current->count; t++)
+      even = current->times[t] - current->times[t - 1] == range.step;
+    if (even)
+      series_cache_cover (client->cache, current->parameter, current->location,
+			  &range);
+  }
+
+  // whether the data changed is what tells the prefetcher about model runs
+  if (client->prefetcher)
+    prefetch_record_response (client->prefetcher, url, now,
+			      prefetch_content_hash (series, nseries));
+  pthread_mutex_unlock (&client->cache_lock);
+
+  decode_free_series (series, nseries);
+}
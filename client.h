@@ -0,0 +1,105 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <curl/curl.h>
+#include <jansson.h>
+
+#include "engine.h"
+#include "prefetch.h"
+#include "request.h"
+#include "series_cache.h"
+#include "tls_cache.h"
+#include "transport.h"
+#include "weather.h"
+
+// a client that any number of threads can share. curl is initialised once
+// per process through pthread_once, everything else lives in the client:
+// the credentials and, per thread that uses it, an easy handle and a
+// response buffer. those are created on a thread's first request, reused
+// for every request after that (keeping its connections and tls sessions
+// warm) and released when the thread exits or the client is cleaned up.
+//
+// requests never take a lock, the client's mutex is only held while a
+// thread registers or goes away. a client with a series cache (see
+// client_set_cache) also holds cache_lock while it reads or fills the
+// cache or its prefetcher, never across a request.
+#define CLIENT_KEEP_BUFFER (1024 * 1024) // larger buffers are not kept around
+#define CLIENT_WARM_MAX 64 // queries per client_warm
+#define CLIENT_WARM_POLL_MS 1000
+
+typedef struct WeatherClient WeatherClient;
+
+typedef struct ClientThread
+{
+  WeatherClient *client;
+  CURL *easy;
+  ResponseBuffer response;
+  struct ClientThread *prev;
+  struct ClientThread *next;
+} ClientThread;
+
+struct WeatherClient
+{
+  char *username;
+  char *password;
+  pthread_key_t key;
+  pthread_mutex_t lock;
+  ClientThread *threads;
+  TlsSessionCache *tls; // optional, set before the first request
+  SeriesCache *cache; // optional too, guarded by cache_lock
+  Prefetcher *prefetcher; // optional, needs the cache, same lock
+  pthread_mutex_t cache_lock;
+  TransportOptions transport;
+  double grid; // degrees queries are snapped to, see client_set_grid
+  int ready;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// curl_global_init, exactly once however many threads race here. clients
+// call it themselves, curl_global_cleanup is left to process exit
+WEATHER_ERROR client_global_init (void);
+WEATHER_ERROR client_init (WeatherClient *client, const char *username, const char *password);
+// no thread may be using the client any more
+void client_cleanup (WeatherClient *client);
+// threads share tls sessions through the cache, which must outlive the
+// client. call it before any request, handles that exist keep going without
+void client_set_tls_cache (WeatherClient *client, TlsSessionCache *cache);
+// copied, like the tls cache it only reaches handles created afterwards
+void client_set_transport (WeatherClient *client, const TransportOptions *options);
+// client_fetch answers time series at a single point from the cache when
+// it covers every parameter over the whole range, and puts what the api
+// sends into it. set it before any request. the cache must outlive the
+// client and is only touched under cache_lock, use it through the client
+void client_set_cache (WeatherClient *client, SeriesCache *cache);
+// client_fetch puts every query into one spelling (canonical.h) before the
+// cache and the api see it, with points snapped to multiples of grid
+// degrees. 0, the default, leaves the points where they are
+void client_set_grid (WeatherClient *client, double grid);
+// client_fetch records every query and response with the prefetcher, which
+// learns from them which queries recur and when new model runs come out.
+// same rules as the cache
+void client_set_prefetcher (WeatherClient *client, Prefetcher *prefetcher);
+// fetches the queries the prefetcher says are due at now on the engine,
+// concurrently and at bulk priority, and puts the answers into the cache so
+// client_fetch finds them warm. call it from a background thread, around
+// prefetch_next_wakeup. the engine must use the client's credentials.
+// *warmed (optional) is set to the queries that came back
+WEATHER_ERROR client_warm (WeatherClient *client, RequestEngine *engine, int64_t now, size_t *warmed);
+// *body stays valid until the calling thread's next request on this client
+WEATHER_ERROR client_get (WeatherClient *client, const char *url, const char **body, size_t *size);
+// the query's credentials are ignored, the client's are used. the answer
+// is for the canonical query, see client_set_grid
+WEATHER_ERROR client_fetch (WeatherClient *client, const WeatherConfig *query, json_t **root);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,384 @@
+#include <string.h>
+
+#include "coverage.h"
+#include "request.h"
+
+#define COVERAGE_POLL_MS 1000
+
+// where each point of the range came from
+#define POINT_MISSING 0
+#define POINT_CACHED 1
+#define POINT_FETCHED 2
+
+typedef struct
+{
+  SeriesCache *cache;
+  CoverageResult *result;
+  SeriesInterval range;
+  size_t npoints; // in range
+  char location[64];
+  unsigned char *sources; // npoints per parameter
+  size_t outstanding;
+} CoverageState;
+
+// one gap, for the parameters that miss it
+typedef struct
+{
+  CoverageState *state;
+  SeriesInterval range;
+  unsigned char *missing; // per parameter
+  WEATHER_ERROR status;
+} CoverageRequest;
+
+// clang-format off
+static WEATHER_ERROR init_series (CoverageState *state, const CoverageQuery *query);
+static void read_cached (CoverageState *state, size_t parameter, const CompressedSeries *cached);
+static WEATHER_ERROR add_gaps (CoverageState *state, size_t parameter, CoverageRequest **requests, size_t *nrequests, size_t *capacity);
+static WEATHER_ERROR submit (RequestEngine *engine, CoverageRequest *request, size_t nparameters);
+static void on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+static void merge (CoverageRequest *request, const WeatherSeries *series);
+static void compact (CoverageState *state);
+// clang-format on
+
+WEATHER_ERROR
+coverage_fetch (SeriesCache *cache, RequestEngine *engine,
+		const CoverageQuery *query, CoverageResult *result)
+{
+  if (!cache || !engine || !query || !result || !query->parameters
+      || !*query->parameters || query->end < query->start || query->step < 0
+      || (query->step == 0 && query->end != query->start))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (result, 0, sizeof (*result));
+
+  // a single point in time is a range of one, whatever the step
+  CoverageState state = {.cache = cache, .result = result};
+  state.range = (SeriesInterval){.start = query->start,
+				 .end = query->end,
+				 .step = query->step ? query->step : 1};
+  state.npoints = (size_t) ((query->end - query->start) / state.range.step) + 1;
+  state.range.end
+    = state.range.start + (int64_t) (state.npoints - 1) * state.range.step;
+
+  WEATHER_ERROR status = decode_format_location (
+    query->lat, query->lon, state.location, sizeof (state.location));
+  if (WEATHER_SUCCESS == status)
+    status = init_series (&state, query);
+
+  CoverageRequest *requests = NULL;
+  size_t nrequests = 0;
+  size_t capacity = 0;
+  for (size_t p = 0; p < result->nseries && WEATHER_SUCCESS == status; p++)
+  {
+    const CompressedSeries *cached
+      = series_cache_get (cache, result->series[p].parameter, state.location);
+    if (cached)
+      read_cached (&state, p, cached);
+    status = add_gaps (&state, p, &requests, &nrequests, &capacity);
+  }
+
+  // every gap goes out before the first one is waited for
+  for (size_t r = 0; r < nrequests && WEATHER_SUCCESS == status; r++)
+  {
+    requests[r].state = &state;
+    requests[r].status = submit (engine, &requests[r], result->nseries);
+    if (WEATHER_SUCCESS == requests[r].status)
+      state.outstanding++;
+  }
+  result->requests = nrequests;
+
+  while (state.outstanding && WEATHER_SUCCESS == status)
+    status = engine_perform (engine, COVERAGE_POLL_MS, NULL);
+
+  // the callbacks point at the requests, none may be left behind
+  for (size_t r = 0; r < nrequests && state.outstanding; r++)
+    engine_cancel (engine, &requests[r]);
+
+  for (size_t r = 0; r < nrequests; r++)
+  {
+    if (WEATHER_SUCCESS == status)
+      status = requests[r].status;
+    free (requests[r].missing);
+  }
+  free (requests);
+
+  if (WEATHER_SUCCESS == status)
+    compact (&state);
+  free (state.sources);
+
+  if (WEATHER_SUCCESS != status)
+    coverage_free (result);
+  return status;
+}
+
+void
+coverage_free (CoverageResult *result)
+{
+  if (!result)
+    return;
+
+  decode_free_series (result->series, result->nseries);
+  memset (result, 0, sizeof (*result));
+}
+
+static WEATHER_ERROR
+init_series (CoverageState *state, const CoverageQuery *query)
+{
+  CoverageResult *result = state->result;
+  size_t nparameters = 1;
+  for (const char *p = query->parameters; *p; p++)
+    nparameters += *p == ',';
+
+  result->series = calloc (nparameters, sizeof (WeatherSeries));
+  state->sources = calloc (nparameters * state->npoints, 1);
+  if (!result->series || !state->sources)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  // every point of the range has its slot until compact
+  const char *parameter = query->parameters;
+  while (result->nseries < nparameters)
+  {
+    size_t len = strcspn (parameter, ",");
+    WeatherSeries *series = &result->series[result->nseries++];
+
+    series->parameter = strndup (parameter, len);
+    series->location = strdup (state->location);
+    series->lat = query->lat;
+    series->lon = query->lon;
+    series->times = malloc (state->npoints * sizeof (int64_t));
+    series->values = malloc (state->npoints * sizeof (double));
+    if (!series->parameter || !series->location || !series->times
+	|| !series->values || !len)
+      return len ? WEATHER_ERROR_INVALID_MEMORY : WEATHER_ERROR_INVALID_CONFIG;
+
+    for (size_t i = 0; i < state->npoints; i++)
+      series->times[i] = state->range.start + (int64_t) i * state->range.step;
+    series->count = state->npoints;
+    parameter += len + (parameter[len] == ',');
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+static void
+read_cached (CoverageState *state, size_t parameter,
+	     const CompressedSeries *cached)
+{
+  WeatherSeries *series = &state->result->series[parameter];
+  unsigned char *sources = state->sources + parameter * state->npoints;
+  int64_t times[SERIES_BLOCK_POINTS];
+  double values[SERIES_BLOCK_POINTS];
+
+  // only the blocks that reach into the range are decoded
+  for (size_t block = series_find_block (cached, state->range.start);
+       block < cached->nblocks
+       && cached->blocks[block].first_time <= state->range.end;
+       block++)
+  {
+    size_t count = series_decode_block (cached, block, times, values);
+    for (size_t i = 0; i < count; i++)
+    {
+      int64_t offset = times[i] - state->range.start;
+      if (offset < 0 || times[i] > state->range.end
+	  || offset % state->range.step != 0)
+	continue;
+
+      size_t index = (size_t) (offset / state->range.step);
+      series->values[index] = values[i];
+      sources[index] = POINT_CACHED;
+    }
+  }
+}
+
+static WEATHER_ERROR
+add_gaps (CoverageState *state, size_t parameter, CoverageRequest **requests,
+	  size_t *nrequests, size_t *capacity)
+{
+  const char *name = state->result->series[parameter].parameter;
+  SeriesInterval *gaps = NULL;
+  size_t ngaps = 0;
+  WEATHER_ERROR status = series_cache_gaps (state->cache, name, state->location,
+					    &state->range, &gaps, &ngaps);
+
+  // parameters missing the same part share its request
+  for (size_t g = 0; g < ngaps && WEATHER_SUCCESS == status; g++)
+  {
+    CoverageRequest *request = NULL;
+    for (size_t r = 0; r < *nrequests && !request; r++)
+      if ((*requests)[r].range.start == gaps[g].start
+	  && (*requests)[r].range.end == gaps[g].end)
+	request = &(*requests)[r];
+
+    if (!request)
+    {
+      if (*nrequests == *capacity)
+      {
+	size_t larger_capacity = *capacity ? *capacity * 2 : 8;
+	CoverageRequest *larger
+	  = realloc (*requests, larger_capacity * sizeof (CoverageRequest));
+	if (!larger)
+	{
+	  status = WEATHER_ERROR_INVALID_MEMORY;
+	  break;
+	}
+	*requests = larger;
+	*capacity = larger_capacity;
+      }
+
+      request = &(*requests)[(*nrequests)++];
+      *request = (CoverageRequest){
+	.range = gaps[g],
+	.missing = calloc (state->result->nseries, 1)};
+      if (!request->missing)
+      {
+	status = WEATHER_ERROR_INVALID_MEMORY;
+	break;
+      }
+    }
+    request->missing[parameter] = 1;
+  }
+
+  free (gaps);
+  return status;
+}
+
+static WEATHER_ERROR
+submit (RequestEngine *engine, CoverageRequest *request, size_t nparameters)
+{
+  const CoverageState *state = request->state;
+  const CoverageResult *result = state->result;
+
+  char parameters[API_MAX_URL_LENGTH];
+  size_t length = 0;
+  for (size_t p = 0; p < nparameters; p++)
+  {
+    if (!request->missing[p])
+      continue;
+    int nwritten = snprintf (parameters + length, sizeof (parameters) - length,
+			     "%s%s", length ? "," : "",
+			     result->series[p].parameter);
+    if (nwritten < 0 || (size_t) nwritten >= sizeof (parameters) - length)
+      return WEATHER_ERROR_URL_CONSTRUCTION;
+    length += (size_t) nwritten;
+  }
+
+  // a gap of one point is asked for as a single time
+  char start[32];
+  char end[32];
+  char datetime[96];
+  WEATHER_ERROR status
+    = decode_format_time (request->range.start, start, sizeof (start));
+  if (WEATHER_SUCCESS == status)
+    status = decode_format_time (request->range.end, end, sizeof (end));
+  if (WEATHER_SUCCESS != status)
+    return status;
+  if (request->range.start == request->range.end)
+    snprintf (datetime, sizeof (datetime), "%s", start);
+  else
+    snprintf (datetime, sizeof (datetime), "%s--%s:PT%lldS", start, end,
+	      (long long) request->range.step);
+
+  WeatherConfig config = {.datetime = datetime,
+			  .parameters = parameters,
+			  .location = state->location,
+			  .format = "json"};
+  char url[API_MAX_URL_LENGTH];
+  status = construct_url (&config, url, sizeof (url));
+  if (WEATHER_SUCCESS == status)
+    status = engine_submit (engine, url, ENGINE_PRIORITY_STANDARD, on_fetched,
+			    request);
+  return status;
+}
+
+static void
+on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  CoverageRequest *gap = userdata;
+  gap->state->outstanding--;
+
+  WeatherSeries *series = NULL;
+  size_t nseries = 0;
+  if (WEATHER_SUCCESS == status)
+  {
+    json_t *root = NULL;
+    status = process_json (request->response.data, &root);
+    if (WEATHER_SUCCESS == status)
+      status = decode_series (root, &series, &nseries);
+    if (root)
+      json_decref (root);
+  }
+
+  for (size_t i = 0; i < nseries; i++)
+    merge (gap, &series[i]);
+
+  decode_free_series (series, nseries);
+  gap->status = status;
+}
+
+static void
+merge (CoverageRequest *request, const WeatherSeries *series)
+{
+  CoverageState *state = request->state;
+  CoverageResult *result = state->result;
+
+  size_t parameter = result->nseries;
+  for (size_t p = 0; p < result->nseries && parameter == result->nseries; p++)
+    if (request->missing[p]
+	&& strcmp (result->series[p].parameter, series->parameter) == 0)
+      parameter = p;
+  if (parameter == result->nseries)
+    return;
+
+  // the answer covers the gap only if it holds every point of it
+  WeatherSeries *out = &result->series[parameter];
+  unsigned char *sources = state->sources + parameter * state->npoints;
+  size_t expected = (size_t) ((request->range.end - request->range.start)
+			      / request->range.step)
+		    + 1;
+  size_t matched = 0;
+  for (size_t i = 0; i < series->count; i++)
+  {
+    int64_t offset = series->times[i] - state->range.start;
+    if (series->times[i] < request->range.start
+	|| series->times[i] > request->range.end
+	|| offset % state->range.step != 0)
+      continue;
+
+    size_t index = (size_t) (offset / state->range.step);
+    out->values[index] = series->values[i];
+    sources[index] = POINT_FETCHED;
+    matched++;
+  }
+
+  // keyed by our spelling of the location, the one lookups use
+  if (WEATHER_SUCCESS
+	== series_cache_put (state->cache, out->parameter, state->location,
+			     series->times, series->values, series->count)
+      && matched == expected)
+    series_cache_cover (state->cache, out->parameter, state->location,
+			&request->range);
+}
+
+static void
+compact (CoverageState *state)
+{
+  CoverageResult *result = state->result;
+  for (size_t p = 0; p < result->nseries; p++)
+  {
+    WeatherSeries *series = &result->series[p];
+    const unsigned char *sources = state->sources + p * state->npoints;
+    size_t kept = 0;
+    for (size_t i = 0; i < state->npoints; i++)
+    {
+      if (POINT_MISSING == sources[i])
+	continue;
+      if (POINT_CACHED == sources[i])
+	result->points_cached++;
+      else
+	result->points_fetched++;
+      series->times[kept] = series->times[i];
+      series->values[kept++] = series->values[i];
+    }
+    series->count = kept;
+  }
+}
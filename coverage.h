@@ -0,0 +1,55 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decode.h"
+#include "engine.h"
+#include "series_cache.h"
+#include "weather.h"
+
+// time ranges at a single location, answered from the series cache as far
+// as its covered ranges go. for every parameter the cache says which parts
+// of the range it cannot vouch for, parameters missing the same part share
+// a request, and all of those requests run concurrently on the engine.
+// what comes back is put into the cache, recorded as covered and merged
+// with the cached points into one series per parameter.
+//
+// holding hours 0 to 48 and asking for 24 to 72 fetches 49 to 72 only.
+typedef struct
+{
+  const char *parameters; // comma separated
+  double lat;
+  double lon;
+  int64_t start;
+  int64_t end;
+  int64_t step; // seconds, 0 for a single point in time
+} CoverageQuery;
+
+typedef struct
+{
+  WeatherSeries *series; // one per parameter, in query order
+  size_t nseries;
+  size_t requests;
+  size_t points_cached;
+  size_t points_fetched;
+} CoverageResult;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// drives the engine until every gap is in. fails if any request did, the
+// gaps that did come back stay cached. points the api did not send are
+// left out of the series
+WEATHER_ERROR coverage_fetch (SeriesCache *cache, RequestEngine *engine, const CoverageQuery *query, CoverageResult *result);
+void coverage_free (CoverageResult *result);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
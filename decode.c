@@ -0,0 +1,420 @@
+#include <string.h>
+
+#include "decode.h"
+
+// clang-format off
+static WEATHER_ERROR decode_coordinate (const char *parameter, const json_t *coordinate, WeatherSeries *out);
+static WEATHER_ERROR parse_duration (const char *text, int64_t *seconds);
+static void civil_from_days (int64_t days, int *year, unsigned *month, unsigned *day);
+static char *duplicate (const char *text);
+// clang-format on
+
+WEATHER_ERROR
+decode_series (const json_t *root, WeatherSeries **series, size_t *nseries)
+{
+  if (!root || !series || !nseries)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  *series = NULL;
+  *nseries = 0;
+
+  json_t *data = json_object_get (root, "data");
+  if (!json_is_array (data))
+    return WEATHER_ERROR_JSON;
+
+  size_t total = 0;
+  for (size_t i = 0; i < json_array_size (data); i++)
+  {
+    json_t *coordinates
+      = json_object_get (json_array_get (data, i), "coordinates");
+    if (!json_is_array (coordinates))
+      return WEATHER_ERROR_JSON;
+    total += json_array_size (coordinates);
+  }
+
+  if (total == 0)
+    return WEATHER_SUCCESS;
+
+  WeatherSeries *out = calloc (total, sizeof (WeatherSeries));
+  if (!out)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  size_t n = 0;
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  for (size_t i = 0; i < json_array_size (data) && WEATHER_SUCCESS == status;
+       i++)
+  {
+    json_t *entry = json_array_get (data, i);
+    const char *parameter
+      = json_string_value (json_object_get (entry, "parameter"));
+    json_t *coordinates = json_object_get (entry, "coordinates");
+
+    if (!parameter)
+    {
+      status = WEATHER_ERROR_JSON;
+      break;
+    }
+
+    for (size_t j = 0; j < json_array_size (coordinates); j++)
+    {
+      status
+	= decode_coordinate (parameter, json_array_get (coordinates, j), &out[n]);
+      if (WEATHER_SUCCESS != status)
+	break;
+      n++;
+    }
+  }
+
+  if (WEATHER_SUCCESS != status)
+  {
+    decode_free_series (out, n < total ? n + 1 : n);
+    return status;
+  }
+
+  *series = out;
+  *nseries = n;
+  return WEATHER_SUCCESS;
+}
+
+void
+decode_free_series (WeatherSeries *series, size_t nseries)
+{
+  if (!series)
+    return;
+
+  for (size_t i = 0; i < nseries; i++)
+  {
+    free (series[i].parameter);
+    free (series[i].location);
+    free (series[i].times);
+    free (series[i].values);
+  }
+  free (series);
+}
+
+WEATHER_ERROR
+decode_parse_time (const char *text, int64_t *time)
+{
+  if (!text || !time)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  int year, month, day, hour, minute, second, consumed = 0;
+  if (sscanf (text, "%4d-%2d-%2dT%2d:%2d:%2d%n", &year, &month, &day, &hour,
+	      &minute, &second, &consumed)
+	!= 6
+      || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23
+      || minute > 59 || second > 60)
+    return WEATHER_ERROR_JSON;
+
+  const char *rest = text + consumed;
+
+  // fractional seconds are dropped, the api works on whole seconds
+  if (*rest == '.')
+    while (*++rest >= '0' && *rest <= '9')
+      ;
+
+  int64_t offset = 0;
+  if (*rest == '+' || *rest == '-')
+  {
+    int off_hour, off_minute;
+    if (sscanf (rest + 1, "%2d:%2d", &off_hour, &off_minute) != 2)
+      return WEATHER_ERROR_JSON;
+    offset = (off_hour * 3600 + off_minute * 60) * (*rest == '-' ? -1 : 1);
+  }
+  else if (*rest != 'Z' && *rest != '\0')
+    return WEATHER_ERROR_JSON;
+
+  *time = decode_days_from_civil (year, (unsigned) month, (unsigned) day)
+	    * 86400
+	  + hour * 3600 + minute * 60 + second - offset;
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+decode_parse_time_range (const char *text, int64_t *start, int64_t *end,
+			 int64_t *step)
+{
+  if (!text || !start || !end || !step)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  const char *separator = strstr (text, "--");
+  if (!separator)
+  {
+    *step = 0;
+    WEATHER_ERROR status = decode_parse_time (text, start);
+    *end = *start;
+    return status;
+  }
+
+  const char *period = strstr (separator + 2, ":P");
+  if (!period || separator - text >= 64 || period - separator - 2 >= 64)
+    return WEATHER_ERROR_JSON;
+
+  char start_text[64];
+  char end_text[64];
+  snprintf (start_text, sizeof (start_text), "%.*s", (int) (separator - text),
+	    text);
+  snprintf (end_text, sizeof (end_text), "%.*s",
+	    (int) (period - separator - 2), separator + 2);
+
+  WEATHER_ERROR status = decode_parse_time (start_text, start);
+  if (WEATHER_SUCCESS == status)
+    status = decode_parse_time (end_text, end);
+  if (WEATHER_SUCCESS == status)
+    status = parse_duration (period + 1, step);
+  if (WEATHER_SUCCESS == status && (*end < *start || *step <= 0))
+    status = WEATHER_ERROR_JSON;
+
+  return status;
+}
+
+WEATHER_ERROR
+decode_format_time (int64_t time, char *text, size_t text_size)
+{
+  if (!text || text_size == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  int64_t days = time / 86400;
+  int64_t seconds = time % 86400;
+  if (seconds < 0)
+  {
+    seconds += 86400;
+    days--;
+  }
+
+  int year;
+  unsigned month, day;
+  civil_from_days (days, &year, &month, &day);
+
+  int nwritten = snprintf (text, text_size, "%04d-%02u-%02uT%02d:%02d:%02dZ",
+			   year, month, day, (int) (seconds / 3600),
+			   (int) (seconds / 60 % 60), (int) (seconds % 60));
+  if (nwritten < 0 || (size_t) nwritten >= text_size)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+decode_build_json (const WeatherSeries *series, size_t nseries, json_t **root)
+{
+  if ((!series && nseries) || !root)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  json_t *out = json_object ();
+  json_t *data = json_array ();
+  if (!out || !data)
+  {
+    json_decref (out);
+    json_decref (data);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+  json_object_set_new (out, "version", json_string ("3.0"));
+  json_object_set_new (out, "data", data);
+  json_object_set_new (out, "status", json_string ("OK"));
+
+  for (size_t i = 0; i < nseries; i++)
+  {
+    // series of the same parameter share one entry, like the api does it
+    json_t *entry = NULL;
+    for (size_t j = 0; j < json_array_size (data) && !entry; j++)
+    {
+      json_t *candidate = json_array_get (data, j);
+      const char *parameter
+	= json_string_value (json_object_get (candidate, "parameter"));
+      if (strcmp (parameter, series[i].parameter) == 0)
+	entry = candidate;
+    }
+
+    if (!entry)
+    {
+      entry = json_object ();
+      json_object_set_new (entry, "parameter",
+			   json_string (series[i].parameter));
+      json_object_set_new (entry, "coordinates", json_array ());
+      json_array_append_new (data, entry);
+    }
+
+    json_t *coordinate = json_object ();
+    json_t *dates = json_array ();
+    json_object_set_new (coordinate, "lat", json_real (series[i].lat));
+    json_object_set_new (coordinate, "lon", json_real (series[i].lon));
+    json_object_set_new (coordinate, "dates", dates);
+    json_array_append_new (json_object_get (entry, "coordinates"), coordinate);
+
+    for (size_t k = 0; k < series[i].count; k++)
+    {
+      char date[32];
+      decode_format_time (series[i].times[k], date, sizeof (date));
+
+      json_t *point = json_object ();
+      json_object_set_new (point, "date", json_string (date));
+      json_object_set_new (point, "value", json_real (series[i].values[k]));
+      json_array_append_new (dates, point);
+    }
+  }
+
+  *root = out;
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+decode_format_location (double lat, double lon, char *location,
+			size_t location_size)
+{
+  if (!location || location_size == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  char lat_text[32];
+  char lon_text[32];
+  char *parts[] = {lat_text, lon_text};
+  double coords[] = {lat, lon};
+
+  for (int i = 0; i < 2; i++)
+  {
+    snprintf (parts[i], sizeof (lat_text), "%.6f", coords[i]);
+    // strip the zeros %f pads with so 37.774900 is spelled 37.7749
+    char *end = parts[i] + strlen (parts[i]) - 1;
+    while (*end == '0')
+      *end-- = '\0';
+    if (*end == '.')
+      *end = '\0';
+  }
+
+  int nwritten = snprintf (location, location_size, "%s,%s", lat_text, lon_text);
+  if (nwritten < 0 || (size_t) nwritten >= location_size)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  return WEATHER_SUCCESS;
+}
+
+int64_t
+decode_days_from_civil (int64_t year, unsigned month, unsigned day)
+{
+  // howard hinnant's days_from_civil, avoids timegm and the TZ environment
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  unsigned yoe = (unsigned) (year - era * 400);
+  unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t) doe - 719468;
+}
+
+static WEATHER_ERROR
+decode_coordinate (const char *parameter, const json_t *coordinate,
+		   WeatherSeries *out)
+{
+  json_t *lat = json_object_get (coordinate, "lat");
+  json_t *lon = json_object_get (coordinate, "lon");
+  json_t *dates = json_object_get (coordinate, "dates");
+  if (!json_is_number (lat) || !json_is_number (lon) || !json_is_array (dates))
+    return WEATHER_ERROR_JSON;
+
+  char location[64];
+  out->lat = json_number_value (lat);
+  out->lon = json_number_value (lon);
+  WEATHER_ERROR status
+    = decode_format_location (out->lat, out->lon, location, sizeof (location));
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  size_t count = json_array_size (dates);
+  out->parameter = duplicate (parameter);
+  out->location = duplicate (location);
+  out->times = malloc ((count ? count : 1) * sizeof (int64_t));
+  out->values = malloc ((count ? count : 1) * sizeof (double));
+  if (!out->parameter || !out->location || !out->times || !out->values)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    json_t *date = json_array_get (dates, i);
+    json_t *value = json_object_get (date, "value");
+    if (!json_is_number (value))
+      return WEATHER_ERROR_JSON;
+
+    status = decode_parse_time (
+      json_string_value (json_object_get (date, "date")), &out->times[i]);
+    if (WEATHER_SUCCESS != status)
+      return status;
+
+    out->values[i] = json_number_value (value);
+  }
+
+  out->count = count;
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+parse_duration (const char *text, int64_t *seconds)
+{
+  // the subset of iso 8601 durations the api uses for steps: P1D, PT1H30M...
+  if (*text++ != 'P')
+    return WEATHER_ERROR_JSON;
+
+  int in_time = 0;
+  *seconds = 0;
+  while (*text)
+  {
+    if (*text == 'T')
+    {
+      in_time = 1;
+      text++;
+      continue;
+    }
+
+    char *end;
+    long amount = strtol (text, &end, 10);
+    if (end == text || amount < 0)
+      return WEATHER_ERROR_JSON;
+
+    switch (*end)
+    {
+    case 'D':
+      *seconds += amount * 86400;
+      break;
+    case 'H':
+      *seconds += amount * 3600;
+      break;
+    case 'M':
+      // months are ambiguous, only minutes are accepted
+      if (!in_time)
+	return WEATHER_ERROR_JSON;
+      *seconds += amount * 60;
+      break;
+    case 'S':
+      *seconds += amount;
+      break;
+    default:
+      return WEATHER_ERROR_JSON;
+    }
+    text = end + 1;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+static void
+civil_from_days (int64_t days, int *year, unsigned *month, unsigned *day)
+{
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  unsigned doe = (unsigned) (days - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+
+  *day = doy - (153 * mp + 2) / 5 + 1;
+  *month = mp < 10 ? mp + 3 : mp - 9;
+  *year = (int) (yoe + era * 400 + (*month <= 2));
+}
+
+static char *
+duplicate (const char *text)
+{
+  size_t len = strlen (text) + 1;
+  char *copy = malloc (len);
+  if (copy)
+    memcpy (copy, text, len);
+  return copy;
+}
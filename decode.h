@@ -0,0 +1,46 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <jansson.h>
+
+#include "weather.h"
+
+// one parameter at one location, as found under "data" in the api response
+typedef struct
+{
+  char *parameter;
+  char *location; // "lat,lon" the same way it is spelled in the request
+  double lat;
+  double lon;
+  int64_t *times; // unix seconds
+  double *values;
+  size_t count;
+} WeatherSeries;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR decode_series (const json_t *root, WeatherSeries **series, size_t *nseries);
+void decode_free_series (WeatherSeries *series, size_t nseries);
+// parses the api's "2024-10-23T00:00:00Z" timestamps
+WEATHER_ERROR decode_parse_time (const char *text, int64_t *time);
+// "start--end:PT1H" style ranges, a single timestamp gives start == end and
+// a step of 0
+WEATHER_ERROR decode_parse_time_range (const char *text, int64_t *start, int64_t *end, int64_t *step);
+WEATHER_ERROR decode_format_time (int64_t time, char *text, size_t text_size);
+// days since 1970-01-01 of a proleptic gregorian date
+int64_t decode_days_from_civil (int64_t year, unsigned month, unsigned day);
+// the inverse of decode_series, builds the api's response layout
+WEATHER_ERROR decode_build_json (const WeatherSeries *series, size_t nseries, json_t **root);
+WEATHER_ERROR decode_format_location (double lat, double lon, char *location, size_t location_size);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
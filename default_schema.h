@@ -0,0 +1,17 @@
+#ifndef DEFAULT_SCHEMA_H
+#define DEFAULT_SCHEMA_H
+
+#include "schema.h"
+
+// the cli's default query as a schema, shared with bench/decode so both
+// decode the same columns. the parameters are DEFAULT_PARAMETERS in main.c
+// in canonical order, which is how the query goes out and so how the api
+// answers it. the schema decoder expects them in exactly this order
+#define DEFAULT_SCHEMA(X)                                                      \
+  X (precipitation, "precip_1h:mm")                                            \
+  X (temperature, "t_2m:C")                                                    \
+  X (wind_speed, "wind_speed_10m:ms")
+
+SCHEMA_DEFINE (DefaultForecast, default_forecast, DEFAULT_SCHEMA)
+
+#endif
@@ -0,0 +1,624 @@
+#include <string.h>
+
+#include "engine.h"
+#include "metrics.h"
+#include "probes.h"
+
+#define ENGINE_RUN_TIMEOUT_MS 1000
+#define ENGINE_BULK_TIMEOUT 600L
+
+// clang-format off
+static WEATHER_ERROR start_queued (RequestEngine *engine);
+static int claim_slot (RequestEngine *engine, ENGINE_PRIORITY priority);
+static void start_request (RequestEngine *engine, EngineRequest *request);
+static int gate_open (RequestEngine *engine);
+static int admit (RequestEngine *engine);
+static EngineRequest *oldest_running (RequestEngine *engine);
+static void resume_waiting (RequestEngine *engine);
+static size_t gated_write (void *contents, size_t size, size_t nmemb, void *userp);
+static size_t collect_done (RequestEngine *engine);
+static void finish (RequestEngine *engine, EngineRequest *request, WEATHER_ERROR status);
+static EngineRequest *unlink_queued (RequestEngine *engine, const void *userdata);
+static EngineRequest *find_active (RequestEngine *engine, const void *userdata);
+static char *duplicate (const char *text);
+// clang-format on
+
+WEATHER_ERROR
+engine_init (RequestEngine *engine, const char *username, const char *password,
+	     size_t max_active)
+{
+  if (!engine || !username || !password)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (engine, 0, sizeof (*engine));
+  engine->max_active = max_active ? max_active : ENGINE_DEFAULT_MAX_ACTIVE;
+  transport_defaults (&engine->transport);
+
+  // interactive may use every slot, standard leaves a quarter free for it
+  // and bulk never takes more than half
+  engine->budget[ENGINE_PRIORITY_INTERACTIVE].max_active = engine->max_active;
+  engine->budget[ENGINE_PRIORITY_STANDARD].max_active
+    = engine->max_active - engine->max_active / 4;
+  engine->budget[ENGINE_PRIORITY_BULK].max_active
+    = engine->max_active / 2 ? engine->max_active / 2 : 1;
+  engine->budget[ENGINE_PRIORITY_INTERACTIVE].timeout = 30L;
+  engine->budget[ENGINE_PRIORITY_STANDARD].timeout = 30L;
+  engine->budget[ENGINE_PRIORITY_BULK].timeout = ENGINE_BULK_TIMEOUT;
+
+  engine->username = duplicate (username);
+  engine->password = duplicate (password);
+  engine->multi = curl_multi_init ();
+  if (!engine->username || !engine->password || !engine->multi)
+  {
+    engine_cleanup (engine);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  // let http/2 put many requests on one connection to the api
+  curl_multi_setopt (engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  return WEATHER_SUCCESS;
+}
+
+void
+engine_cleanup (RequestEngine *engine)
+{
+  if (!engine)
+    return;
+
+  while (engine->active_head)
+    finish (engine, engine->active_head, WEATHER_ERROR_NETWORK);
+
+  for (int priority = 0; priority < ENGINE_PRIORITY_COUNT; priority++)
+  {
+    while (engine->queue_head[priority])
+    {
+      EngineRequest *request = engine->queue_head[priority];
+      engine->queue_head[priority] = request->next;
+      engine->queued--;
+      metrics_gauge_add (METRIC_QUEUE_DEPTH, -1);
+      finish (engine, request, WEATHER_ERROR_NETWORK);
+    }
+  }
+
+  if (engine->multi)
+    curl_multi_cleanup (engine->multi);
+  free (engine->username);
+  free (engine->password);
+  memset (engine, 0, sizeof (*engine));
+}
+
+WEATHER_ERROR
+engine_set_budget (RequestEngine *engine, ENGINE_PRIORITY priority,
+		   size_t max_active, long timeout)
+{
+  if (!engine || priority < 0 || priority >= ENGINE_PRIORITY_COUNT
+      || max_active == 0 || timeout <= 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  engine->budget[priority].max_active = max_active;
+  engine->budget[priority].timeout = timeout;
+  return start_queued (engine);
+}
+
+void
+engine_set_gate (RequestEngine *engine, EngineGate gate, void *userdata)
+{
+  if (!engine)
+    return;
+
+  engine->gate = gate;
+  engine->gate_userdata = userdata;
+  resume_waiting (engine);
+}
+
+void
+engine_set_memory_budget (RequestEngine *engine, MemoryBudget *budget,
+			  size_t admission)
+{
+  if (!engine)
+    return;
+
+  // transfers already running keep the budget they were started with
+  engine->memory = budget;
+  engine->admission = admission ? admission : ENGINE_DEFAULT_ADMISSION;
+  resume_waiting (engine);
+}
+
+void
+engine_set_tls_cache (RequestEngine *engine, TlsSessionCache *cache)
+{
+  if (engine)
+    engine->tls = cache;
+}
+
+void
+engine_set_transport (RequestEngine *engine, const TransportOptions *options)
+{
+  if (engine && options)
+    engine->transport = *options;
+}
+
+WEATHER_ERROR
+engine_submit (RequestEngine *engine, const char *url,
+	       ENGINE_PRIORITY priority, EngineCallback callback,
+	       void *userdata)
+{
+  if (!engine || !engine->multi || !url || !callback || priority < 0
+      || priority >= ENGINE_PRIORITY_COUNT)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  size_t length = strlen (url);
+  if (length >= ENGINE_MAX_URL_LENGTH)
+    return WEATHER_ERROR_URL_CONSTRUCTION;
+
+  EngineRequest *request = calloc (1, sizeof (*request) + length + 1);
+  if (!request)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  request->url = (char *) (request + 1);
+  memcpy (request->url, url, length + 1);
+  request->priority = priority;
+  request->engine = engine;
+  request->callback = callback;
+  request->userdata = userdata;
+  trace_begin_detached (&request->span, "engine_request");
+
+  if (engine->queue_tail[priority])
+    engine->queue_tail[priority]->next = request;
+  else
+    engine->queue_head[priority] = request;
+  engine->queue_tail[priority] = request;
+  engine->queued++;
+  metrics_gauge_add (METRIC_QUEUE_DEPTH, 1);
+
+  return start_queued (engine);
+}
+
+size_t
+engine_cancel (RequestEngine *engine, const void *userdata)
+{
+  if (!engine)
+    return 0;
+
+  // a callback may submit or cancel in turn, so every round starts over
+  // instead of holding on to a neighbour that could be gone by then
+  size_t cancelled = 0;
+  EngineRequest *request;
+  while ((request = unlink_queued (engine, userdata)))
+  {
+    finish (engine, request, WEATHER_ERROR_CANCELLED);
+    cancelled++;
+  }
+  while ((request = find_active (engine, userdata)))
+  {
+    finish (engine, request, WEATHER_ERROR_CANCELLED);
+    cancelled++;
+  }
+
+  // the slots that came free go to whatever is waiting
+  if (cancelled)
+    start_queued (engine);
+  return cancelled;
+}
+
+WEATHER_ERROR
+engine_perform (RequestEngine *engine, int timeout_ms, size_t *pending)
+{
+  if (!engine || !engine->multi)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  if (engine->held || engine->starved)
+    resume_waiting (engine);
+
+  int running = 0;
+  CURLMcode code = curl_multi_perform (engine->multi, &running);
+
+  // only wait when nothing finished, a completed transfer leaves no socket
+  // behind to wake the poll up
+  if (CURLM_OK == code && collect_done (engine) == 0)
+  {
+    code = curl_multi_poll (engine->multi, NULL, 0, timeout_ms, NULL);
+    if (CURLM_OK == code)
+      code = curl_multi_perform (engine->multi, &running);
+    if (CURLM_OK == code)
+      collect_done (engine);
+  }
+
+  if (CURLM_OK != code)
+  {
+    ERROR (curl_multi_strerror (code));
+    return WEATHER_ERROR_NETWORK;
+  }
+
+  WEATHER_ERROR status = start_queued (engine);
+
+  if (pending)
+    *pending = engine->active + engine->queued;
+  return status;
+}
+
+WEATHER_ERROR
+engine_run (RequestEngine *engine)
+{
+  size_t pending = 1;
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+
+  while (WEATHER_SUCCESS == status && pending)
+    status = engine_perform (engine, ENGINE_RUN_TIMEOUT_MS, &pending);
+
+  return status;
+}
+
+static WEATHER_ERROR
+start_queued (RequestEngine *engine)
+{
+  // new transfers would only be held right away
+  int open = gate_open (engine);
+
+  for (int priority = 0; priority < ENGINE_PRIORITY_COUNT; priority++)
+  {
+    // paused bulk transfers get their slot back before new bulk work starts
+    if (ENGINE_PRIORITY_BULK == priority)
+    {
+      for (EngineRequest *request = engine->active_head;
+	   request && engine->paused; request = request->next)
+      {
+	if (!request->paused || engine->active >= engine->max_active
+	    || engine->active_class[priority]
+		 >= engine->budget[priority].max_active)
+	  continue;
+
+	if (!request->held && !request->starved)
+	  curl_easy_pause (request->easy, CURLPAUSE_CONT);
+	request->paused = 0;
+	engine->paused--;
+	engine->active++;
+	engine->active_class[priority]++;
+      }
+    }
+
+    while (open && engine->queue_head[priority]
+	   && engine->active_class[priority]
+		< engine->budget[priority].max_active)
+    {
+      // less urgent classes would need the same memory
+      if (!admit (engine))
+      {
+	engine->deferred++;
+	open = 0;
+	break;
+      }
+      if (!claim_slot (engine, priority))
+	break;
+
+      EngineRequest *request = engine->queue_head[priority];
+      engine->queue_head[priority] = request->next;
+      if (!engine->queue_head[priority])
+	engine->queue_tail[priority] = NULL;
+      request->next = NULL;
+      engine->queued--;
+      metrics_gauge_add (METRIC_QUEUE_DEPTH, -1);
+
+      start_request (engine, request);
+    }
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+static int
+claim_slot (RequestEngine *engine, ENGINE_PRIORITY priority)
+{
+  if (engine->active < engine->max_active)
+    return 1;
+
+  if (ENGINE_PRIORITY_BULK == priority)
+    return 0;
+
+  // all slots taken, borrow one from the bulk transfer that started last,
+  // it has the least to lose from waiting
+  for (EngineRequest *request = engine->active_head; request;
+       request = request->next)
+  {
+    if (ENGINE_PRIORITY_BULK != request->priority || request->paused)
+      continue;
+
+    curl_easy_pause (request->easy, CURLPAUSE_RECV);
+    request->paused = 1;
+    engine->paused++;
+    engine->active--;
+    engine->active_class[ENGINE_PRIORITY_BULK]--;
+    engine->preemptions++;
+    return 1;
+  }
+
+  return 0;
+}
+
+static void
+start_request (RequestEngine *engine, EngineRequest *request)
+{
+  WEATHER_ERROR status = init_response_buffer (&request->response);
+  if (WEATHER_SUCCESS != status)
+  {
+    finish (engine, request, status);
+    return;
+  }
+
+  request->easy = curl_easy_init ();
+  if (!request->easy)
+  {
+    finish (engine, request, WEATHER_ERROR_NETWORK);
+    return;
+  }
+
+  if (engine->memory)
+  {
+    // the first buffer is already allocated, admission made room for it
+    budget_charge (engine->memory, request->response.capacity, 1);
+    request->response.budget = engine->memory;
+    request->response.charged = request->response.capacity;
+  }
+
+  WeatherConfig credentials
+    = {.username = engine->username, .password = engine->password};
+  setup_easy_handle (request->easy, request->url, &credentials,
+		     &request->response);
+  curl_easy_setopt (request->easy, CURLOPT_PRIVATE, request);
+  curl_easy_setopt (request->easy, CURLOPT_WRITEFUNCTION, gated_write);
+  curl_easy_setopt (request->easy, CURLOPT_WRITEDATA, request);
+  curl_easy_setopt (request->easy, CURLOPT_TIMEOUT,
+		    engine->budget[request->priority].timeout);
+  if (engine->tls)
+    tls_cache_attach (engine->tls, request->easy);
+  transport_apply (&engine->transport, request->easy);
+
+  if (CURLM_OK != curl_multi_add_handle (engine->multi, request->easy))
+  {
+    curl_easy_cleanup (request->easy);
+    request->easy = NULL;
+    finish (engine, request, WEATHER_ERROR_NETWORK);
+    return;
+  }
+
+  // new transfers go to the front, so preemption finds the youngest first
+  request->next = engine->active_head;
+  if (engine->active_head)
+    engine->active_head->prev = request;
+  engine->active_head = request;
+  engine->active++;
+  engine->active_class[request->priority]++;
+
+  request->started = metrics_now ();
+  request->started_ns = trace_now_ns ();
+  trace_record (&request->span, "engine_queue", request->span.start_ns,
+		request->started_ns, WEATHER_SUCCESS);
+  WEATHER_PROBE2 (request_start, &request->response, request->url);
+  metrics_count (METRIC_REQUESTS, 1);
+  metrics_gauge_add (METRIC_IN_FLIGHT, 1);
+}
+
+static int
+gate_open (RequestEngine *engine)
+{
+  return !engine->gate || engine->gate (engine->gate_userdata);
+}
+
+static int
+admit (RequestEngine *engine)
+{
+  // with nothing in flight here waiting cannot free anything up
+  return !engine->memory || engine->active == 0
+	 || budget_available (engine->memory, engine->admission);
+}
+
+static EngineRequest *
+oldest_running (RequestEngine *engine)
+{
+  EngineRequest *oldest = NULL;
+  for (EngineRequest *request = engine->active_head; request;
+       request = request->next)
+    if (!request->paused)
+      oldest = request;
+  return oldest;
+}
+
+static void
+resume_waiting (RequestEngine *engine)
+{
+  int open = gate_open (engine);
+  EngineRequest *oldest = engine->starved ? oldest_running (engine) : NULL;
+
+  for (EngineRequest *request = engine->active_head;
+       request && (engine->held || engine->starved); request = request->next)
+  {
+    int resumed = 0;
+
+    if (request->held && open)
+    {
+      request->held = 0;
+      engine->held--;
+      resumed = 1;
+    }
+
+    // retry once memory came back, or when it is the oldest and may overdraw
+    if (request->starved
+	&& (request == oldest || !request->response.budget
+	    || budget_generation (request->response.budget)
+		 != request->starved_generation))
+    {
+      request->starved = 0;
+      engine->starved--;
+      resumed = 1;
+    }
+
+    // a preempted transfer stays paused, the write callback checks again
+    // whenever it is resumed
+    if (resumed && !request->held && !request->starved && !request->paused)
+      curl_easy_pause (request->easy, CURLPAUSE_CONT);
+  }
+}
+
+static size_t
+gated_write (void *contents, size_t size, size_t nmemb, void *userp)
+{
+  EngineRequest *request = userp;
+  RequestEngine *engine = request->engine;
+
+  // an error page is cut short right away, holding it only keeps the slot
+  if (request->response.http_status >= 400)
+    return write_callback (contents, size, nmemb, &request->response);
+
+  // curl keeps the chunk and hands it over again once we unpause
+  if (!gate_open (engine))
+  {
+    if (!request->held)
+    {
+      request->held = 1;
+      engine->held++;
+      engine->holds++;
+    }
+    return CURL_WRITEFUNC_PAUSE;
+  }
+
+  ResponseBuffer *response = &request->response;
+  uint64_t generation = 0;
+  if (response->budget)
+  {
+    generation = budget_generation (response->budget);
+    response->overdraft = request == oldest_running (engine);
+  }
+
+  size_t written = write_callback (contents, size, nmemb, response);
+  if (CURL_WRITEFUNC_PAUSE == written && !request->starved)
+  {
+    request->starved = 1;
+    request->starved_generation = generation;
+    engine->starved++;
+    engine->starvations++;
+  }
+  return written;
+}
+
+static size_t
+collect_done (RequestEngine *engine)
+{
+  CURLMsg *message;
+  int remaining;
+  size_t done = 0;
+
+  while ((message = curl_multi_info_read (engine->multi, &remaining)))
+  {
+    if (CURLMSG_DONE != message->msg)
+      continue;
+
+    EngineRequest *request = NULL;
+    curl_easy_getinfo (message->easy_handle, CURLINFO_PRIVATE,
+		       (char **) &request);
+
+    finish (engine, request,
+	    transfer_status (&request->response, message->data.result));
+    done++;
+  }
+
+  return done;
+}
+
+static void
+finish (RequestEngine *engine, EngineRequest *request, WEATHER_ERROR status)
+{
+  if (request->easy)
+  {
+    trace_transfer_phases (&request->span, request->easy,
+			   request->started_ns);
+    curl_multi_remove_handle (engine->multi, request->easy);
+    curl_easy_cleanup (request->easy);
+    request->easy = NULL;
+
+    if (request->prev)
+      request->prev->next = request->next;
+    else
+      engine->active_head = request->next;
+    if (request->next)
+      request->next->prev = request->prev;
+
+    metrics_gauge_add (METRIC_IN_FLIGHT, -1);
+    metrics_observe (METRIC_REQUEST_SECONDS, metrics_now () - request->started);
+    metrics_count (METRIC_RESPONSE_BYTES, request->response.size);
+    WEATHER_PROBE3 (transfer_end, &request->response, status,
+		    request->response.size);
+
+    if (request->held)
+      engine->held--;
+    if (request->starved)
+      engine->starved--;
+    if (request->paused)
+      engine->paused--;
+    else
+    {
+      engine->active--;
+      engine->active_class[request->priority]--;
+    }
+  }
+
+  if (WEATHER_SUCCESS == status)
+    engine->completed++;
+  else
+  {
+    engine->failed++;
+    metrics_error (status);
+  }
+
+  request->callback (request, status, request->userdata);
+  trace_end (&request->span, status);
+
+  cleanup_response_buffer (&request->response);
+  free (request);
+}
+
+static EngineRequest *
+unlink_queued (RequestEngine *engine, const void *userdata)
+{
+  for (int priority = 0; priority < ENGINE_PRIORITY_COUNT; priority++)
+  {
+    EngineRequest *previous = NULL;
+    for (EngineRequest *request = engine->queue_head[priority]; request;
+	 previous = request, request = request->next)
+    {
+      if (request->userdata != userdata)
+	continue;
+
+      if (previous)
+	previous->next = request->next;
+      else
+	engine->queue_head[priority] = request->next;
+      if (engine->queue_tail[priority] == request)
+	engine->queue_tail[priority] = previous;
+      request->next = NULL;
+      engine->queued--;
+      metrics_gauge_add (METRIC_QUEUE_DEPTH, -1);
+      return request;
+    }
+  }
+  return NULL;
+}
+
+static EngineRequest *
+find_active (RequestEngine *engine, const void *userdata)
+{
+  for (EngineRequest *request = engine->active_head; request;
+       request = request->next)
+    if (request->userdata == userdata)
+      return request;
+  return NULL;
+}
+
+static char *
+duplicate (const char *text)
+{
+  size_t len = strlen (text) + 1;
+  char *copy = malloc (len);
+  if (copy)
+    memcpy (copy, text, len);
+  return copy;
+}
@@ -0,0 +1,159 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <curl/curl.h>
+
+#include "budget.h"
+#include "request.h"
+#include "tls_cache.h"
+#include "transport.h"
+#include "weather.h"
+
+// concurrent request engine on top of a curl multi handle. requests are
+// queued by engine_submit and started as long as fewer than max_active are
+// in flight, engine_perform drives the transfers and runs the completion
+// callbacks on the calling thread.
+//
+// every request belongs to a priority class with its own queue and its own
+// cap on concurrent transfers. free slots always go to the most urgent
+// class first, and when all slots are taken an interactive or standard
+// request preempts a running bulk transfer: the bulk transfer is paused
+// (keeping what it received so far) and resumed once a slot frees up.
+//
+// an optional gate lets a downstream consumer push back: while it returns 0
+// transfers stop reading (their write callback pauses them, the socket and
+// the http/2 window fill up and the server slows down) and nothing new is
+// started. held transfers continue on the first engine_perform after the gate
+// opens again, call curl_multi_wakeup to get there sooner.
+//
+// with a memory budget attached every response buffer is charged as it
+// grows. a transfer only starts while admission bytes are free, and one
+// whose buffer cannot grow is paused until some memory comes back. the
+// oldest transfer that is not preempted may always go over the limit, so
+// the engine keeps finishing work even when the budget is tight.
+#define ENGINE_DEFAULT_MAX_ACTIVE 16
+// queries that pack many points (routes) go past API_MAX_URL_LENGTH, servers
+// commonly stop at 8 KiB
+#define ENGINE_MAX_URL_LENGTH 8192
+#define ENGINE_DEFAULT_ADMISSION (64 * 1024)
+
+typedef enum
+{
+  ENGINE_PRIORITY_INTERACTIVE = 0,
+  ENGINE_PRIORITY_STANDARD = 1,
+  ENGINE_PRIORITY_BULK = 2,
+  ENGINE_PRIORITY_COUNT
+} ENGINE_PRIORITY;
+
+typedef struct
+{
+  size_t max_active; // concurrent transfers for the class
+  long timeout; // seconds, bulk transfers may sit paused for a while
+} EngineClassBudget;
+
+typedef struct EngineRequest EngineRequest;
+typedef struct RequestEngine RequestEngine;
+
+// returns 0 while downstream has no room for more data, called from the
+// engine thread
+typedef int (*EngineGate) (void *userdata);
+
+// the request is freed once the callback returns, set response.data to NULL
+// to keep the body (it is then the callback's to free)
+typedef void (*EngineCallback) (EngineRequest *request, WEATHER_ERROR status,
+				void *userdata);
+
+struct EngineRequest
+{
+  char *url; // in the same allocation as the request
+  ResponseBuffer response;
+  CURL *easy;
+  ENGINE_PRIORITY priority;
+  int paused; // preempted by a more urgent request
+  int held; // paused by the gate
+  int starved; // paused until the memory budget changes
+  double started; // metrics_now when the transfer began
+  int64_t started_ns; // the same for the trace
+  TraceSpan span; // detached, from submission to the callback
+  uint64_t starved_generation;
+  RequestEngine *engine;
+  EngineCallback callback;
+  void *userdata;
+  struct EngineRequest *prev;
+  struct EngineRequest *next;
+};
+
+struct RequestEngine
+{
+  CURLM *multi;
+  char *username;
+  char *password;
+  size_t max_active;
+  size_t active; // transfers holding a slot, paused ones do not
+  EngineRequest *active_head; // in flight, paused included
+
+  EngineClassBudget budget[ENGINE_PRIORITY_COUNT];
+  size_t active_class[ENGINE_PRIORITY_COUNT];
+  EngineRequest *queue_head[ENGINE_PRIORITY_COUNT]; // waiting for a slot
+  EngineRequest *queue_tail[ENGINE_PRIORITY_COUNT];
+  size_t queued;
+  size_t paused;
+
+  EngineGate gate;
+  void *gate_userdata;
+  size_t held;
+  size_t holds; // times a transfer was held back
+
+  MemoryBudget *memory;
+  size_t admission; // bytes that must be free to start a transfer
+  size_t starved;
+  size_t starvations; // times a transfer ran out of budget
+  size_t deferred; // times queued work waited for memory
+
+  TlsSessionCache *tls; // shared tls sessions, optional
+  TransportOptions transport;
+
+  size_t completed;
+  size_t failed;
+  size_t preemptions;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR engine_init (RequestEngine *engine, const char *username, const char *password, size_t max_active);
+// requests still queued or in flight complete with WEATHER_ERROR_NETWORK
+void engine_cleanup (RequestEngine *engine);
+WEATHER_ERROR engine_set_budget (RequestEngine *engine, ENGINE_PRIORITY priority, size_t max_active, long timeout);
+// NULL removes the gate and lets held transfers continue
+void engine_set_gate (RequestEngine *engine, EngineGate gate, void *userdata);
+// NULL detaches the budget, admission of 0 picks ENGINE_DEFAULT_ADMISSION.
+// a budget shared with other engines frees memory without waking this one,
+// starved transfers then continue on the next engine_perform
+void engine_set_memory_budget (RequestEngine *engine, MemoryBudget *budget, size_t admission);
+// transfers started from now on resume sessions through the cache, which
+// has to outlive the engine
+void engine_set_tls_cache (RequestEngine *engine, TlsSessionCache *cache);
+// copied, applies to transfers started from now on. engine_init sets
+// transport_defaults
+void engine_set_transport (RequestEngine *engine, const TransportOptions *options);
+WEATHER_ERROR engine_submit (RequestEngine *engine, const char *url, ENGINE_PRIORITY priority, EngineCallback callback, void *userdata);
+// completes every request submitted with userdata, queued or in flight, with
+// WEATHER_ERROR_CANCELLED before returning. returns how many there were
+size_t engine_cancel (RequestEngine *engine, const void *userdata);
+// waits at most timeout_ms for activity, pending is set to the number of
+// requests queued or in flight afterwards
+WEATHER_ERROR engine_perform (RequestEngine *engine, int timeout_ms, size_t *pending);
+// runs until every submitted request has completed
+WEATHER_ERROR engine_run (RequestEngine *engine);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
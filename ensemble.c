@@ -0,0 +1,366 @@
+#include <math.h>
+#include <string.h>
+
+#include "ensemble.h"
+#include "request.h"
+
+#define ENSEMBLE_POLL_MS 1000
+
+// ENSEMBLE_LANES timesteps side by side, the compiler picks the widest
+// registers the target has for them
+typedef double Lane __attribute__ ((vector_size (ENSEMBLE_ALIGN)));
+typedef int64_t LaneMask __attribute__ ((vector_size (ENSEMBLE_ALIGN)));
+
+// macros rather than functions, a vector passed by value is an abi question
+// on targets without registers that wide. arguments are evaluated twice
+#define LANE_SELECT(mask, a, b)                                                \
+  ((Lane) (((mask) & (LaneMask) (a)) | (~(mask) & (LaneMask) (b))))
+#define LANE_MIN(a, b) LANE_SELECT ((a) < (b), a, b)
+#define LANE_MAX(a, b) LANE_SELECT ((a) > (b), a, b)
+
+static const double DEFAULT_PERCENTILES[] = {0.1, 0.5, 0.9};
+
+// one model's request and what came back
+typedef struct
+{
+  Ensemble *ensemble;
+  size_t model;
+  size_t *outstanding;
+  WeatherSeries *series;
+  size_t nseries;
+} EnsembleMember;
+
+// clang-format off
+static void on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+static WEATHER_ERROR assemble (Ensemble *ensemble, const EnsembleMember *members);
+static void free_series (Ensemble *ensemble);
+static const WeatherSeries *find_series (const EnsembleMember *member, const WeatherSeries *like);
+static WEATHER_ERROR init_series (EnsembleSeries *out, const WeatherSeries *like, size_t nmodels, size_t npercentiles);
+static void compute (EnsembleSeries *series, size_t nmodels, const double *levels, size_t nlevels, Lane *sorted);
+static char *duplicate (const char *text);
+// clang-format on
+
+WEATHER_ERROR
+ensemble_fetch (RequestEngine *engine, const EnsembleQuery *query,
+		Ensemble *ensemble)
+{
+  if (!ensemble)
+    return WEATHER_ERROR_INVALID_CONFIG;
+  memset (ensemble, 0, sizeof (*ensemble));
+
+  if (!engine || !query || !query->models || !query->nmodels
+      || !query->datetime || !query->parameters || !query->location
+      || (!query->percentiles && query->npercentiles))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  const double *levels
+    = query->percentiles ? query->percentiles : DEFAULT_PERCENTILES;
+  size_t nlevels = query->percentiles
+		     ? query->npercentiles
+		     : sizeof (DEFAULT_PERCENTILES) / sizeof (double);
+  for (size_t p = 0; p < nlevels; p++)
+    if (!(levels[p] >= 0 && levels[p] <= 1))
+      return WEATHER_ERROR_INVALID_CONFIG;
+
+  ensemble->nmodels = query->nmodels;
+  ensemble->npercentiles = nlevels;
+  ensemble->status = calloc (query->nmodels, sizeof (WEATHER_ERROR));
+  ensemble->percentiles = malloc ((nlevels ? nlevels : 1) * sizeof (double));
+  EnsembleMember *members = calloc (query->nmodels, sizeof (EnsembleMember));
+  if (!ensemble->status || !ensemble->percentiles || !members)
+  {
+    free (members);
+    ensemble_free (ensemble);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+  memcpy (ensemble->percentiles, levels, nlevels * sizeof (double));
+
+  WeatherConfig config = {.datetime = query->datetime,
+			  .parameters = query->parameters,
+			  .location = query->location,
+			  .format = "json"};
+  // multi point locations need the engine's limit, not the api default
+  char base[ENGINE_MAX_URL_LENGTH];
+  WEATHER_ERROR status = construct_url (&config, base, sizeof (base));
+  if (WEATHER_SUCCESS != status)
+  {
+    for (size_t m = 0; m < query->nmodels; m++)
+      ensemble->status[m] = status;
+    free (members);
+    return status;
+  }
+
+  // every model goes out before the first one is waited for
+  size_t outstanding = 0;
+  for (size_t m = 0; m < query->nmodels; m++)
+  {
+    members[m] = (EnsembleMember){.ensemble = ensemble,
+				  .model = m,
+				  .outstanding = &outstanding};
+
+    char url[ENGINE_MAX_URL_LENGTH];
+    int nwritten
+      = snprintf (url, sizeof (url), "%s?model=%s", base, query->models[m]);
+    if (nwritten < 0 || (size_t) nwritten >= sizeof (url))
+    {
+      ensemble->status[m] = WEATHER_ERROR_URL_CONSTRUCTION;
+      continue;
+    }
+
+    // a transfer that cannot start completes inside engine_submit
+    outstanding++;
+    WEATHER_ERROR submitted = engine_submit (
+      engine, url, ENGINE_PRIORITY_STANDARD, on_fetched, &members[m]);
+    if (WEATHER_SUCCESS != submitted)
+    {
+      outstanding--;
+      ensemble->status[m] = submitted;
+    }
+  }
+
+  while (outstanding && WEATHER_SUCCESS == status)
+    status = engine_perform (engine, ENSEMBLE_POLL_MS, NULL);
+
+  // the callbacks point at members, none may be left behind
+  for (size_t m = 0; m < query->nmodels && outstanding; m++)
+    engine_cancel (engine, &members[m]);
+
+  if (WEATHER_SUCCESS == status)
+    status = assemble (ensemble, members);
+
+  for (size_t m = 0; m < query->nmodels; m++)
+    decode_free_series (members[m].series, members[m].nseries);
+  free (members);
+
+  // what went wrong with each model stays for the caller
+  if (WEATHER_SUCCESS != status)
+    free_series (ensemble);
+  return status;
+}
+
+void
+ensemble_free (Ensemble *ensemble)
+{
+  if (!ensemble)
+    return;
+
+  free_series (ensemble);
+  free (ensemble->status);
+  free (ensemble->percentiles);
+  memset (ensemble, 0, sizeof (*ensemble));
+}
+
+static void
+on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  EnsembleMember *member = userdata;
+  (*member->outstanding)--;
+
+  if (WEATHER_SUCCESS == status)
+  {
+    json_t *root = NULL;
+    status = process_json (request->response.data, &root);
+    if (WEATHER_SUCCESS == status)
+      status = decode_series (root, &member->series, &member->nseries);
+    if (root)
+      json_decref (root);
+  }
+
+  member->ensemble->status[member->model] = status;
+}
+
+static WEATHER_ERROR
+assemble (Ensemble *ensemble, const EnsembleMember *members)
+{
+  // the first model to answer decides which series there are
+  const EnsembleMember *first = NULL;
+  for (size_t m = 0; m < ensemble->nmodels && !first; m++)
+    if (WEATHER_SUCCESS == ensemble->status[m])
+      first = &members[m];
+  if (!first)
+    return ensemble->status[0];
+  if (!first->nseries)
+    return WEATHER_SUCCESS;
+
+  ensemble->series = calloc (first->nseries, sizeof (EnsembleSeries));
+  Lane *sorted
+    = aligned_alloc (ENSEMBLE_ALIGN, ensemble->nmodels * sizeof (Lane));
+  if (!ensemble->series || !sorted)
+  {
+    free (sorted);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  for (size_t s = 0; s < first->nseries; s++)
+  {
+    const WeatherSeries *like = &first->series[s];
+    EnsembleSeries *out = &ensemble->series[ensemble->nseries++];
+    WEATHER_ERROR status = init_series (out, like, ensemble->nmodels,
+					ensemble->npercentiles);
+    if (WEATHER_SUCCESS != status)
+    {
+      free (sorted);
+      return status;
+    }
+
+    for (size_t m = 0; m < ensemble->nmodels; m++)
+    {
+      const WeatherSeries *match = WEATHER_SUCCESS == ensemble->status[m]
+				     ? find_series (&members[m], like)
+				     : NULL;
+      double *row = out->members + m * out->stride;
+
+      if (match && match->count == like->count
+	  && memcmp (match->times, like->times, like->count * sizeof (int64_t))
+	       == 0)
+      {
+	memcpy (row, match->values, like->count * sizeof (double));
+	out->present[m] = 1;
+	out->nmembers++;
+      }
+      else
+	for (size_t t = 0; t < like->count; t++)
+	  row[t] = NAN;
+    }
+
+    compute (out, ensemble->nmodels, ensemble->percentiles,
+	     ensemble->npercentiles, sorted);
+  }
+
+  free (sorted);
+  return WEATHER_SUCCESS;
+}
+
+static void
+free_series (Ensemble *ensemble)
+{
+  for (size_t i = 0; i < ensemble->nseries; i++)
+  {
+    EnsembleSeries *series = &ensemble->series[i];
+    free (series->parameter);
+    free (series->location);
+    free (series->times);
+    free (series->present);
+    free (series->members); // the statistics share its allocation
+  }
+  free (ensemble->series);
+  ensemble->series = NULL;
+  ensemble->nseries = 0;
+}
+
+static const WeatherSeries *
+find_series (const EnsembleMember *member, const WeatherSeries *like)
+{
+  for (size_t i = 0; i < member->nseries; i++)
+    if (strcmp (member->series[i].parameter, like->parameter) == 0
+	&& strcmp (member->series[i].location, like->location) == 0)
+      return &member->series[i];
+  return NULL;
+}
+
+static WEATHER_ERROR
+init_series (EnsembleSeries *out, const WeatherSeries *like, size_t nmodels,
+	     size_t npercentiles)
+{
+  out->lat = like->lat;
+  out->lon = like->lon;
+  out->count = like->count;
+  out->stride = (like->count + ENSEMBLE_LANES - 1) / ENSEMBLE_LANES
+		* ENSEMBLE_LANES;
+
+  // members, mean, spread, min, max and the percentiles in one block
+  size_t rows = nmodels + 4 + npercentiles;
+  size_t size = rows * out->stride * sizeof (double);
+  out->parameter = duplicate (like->parameter);
+  out->location = duplicate (like->location);
+  out->times = malloc ((like->count ? like->count : 1) * sizeof (int64_t));
+  out->present = calloc (nmodels, 1);
+  out->members = aligned_alloc (ENSEMBLE_ALIGN, size ? size : ENSEMBLE_ALIGN);
+  if (!out->parameter || !out->location || !out->times || !out->present
+      || !out->members)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  memset (out->members, 0, size);
+  if (like->count)
+    memcpy (out->times, like->times, like->count * sizeof (int64_t));
+
+  out->mean = out->members + nmodels * out->stride;
+  out->spread = out->mean + out->stride;
+  out->min = out->spread + out->stride;
+  out->max = out->min + out->stride;
+  out->percentiles = out->max + out->stride;
+  return WEATHER_SUCCESS;
+}
+
+static void
+compute (EnsembleSeries *series, size_t nmodels, const double *levels,
+	 size_t nlevels, Lane *sorted)
+{
+  size_t n = series->nmembers;
+  if (!n)
+    return;
+
+  for (size_t t = 0; t < series->stride; t += ENSEMBLE_LANES)
+  {
+    Lane sum = {0};
+    size_t k = 0;
+    for (size_t m = 0; m < nmodels; m++)
+    {
+      if (!series->present[m])
+	continue;
+
+      Lane value;
+      memcpy (&value, series->members + m * series->stride + t,
+	      sizeof (value));
+      sum += value;
+
+      // insertion sort on every lane at once: the smaller one stays and
+      // the larger one moves on, no compare and branch per timestep
+      for (size_t j = 0; j < k; j++)
+      {
+	Lane low = LANE_MIN (sorted[j], value);
+	value = LANE_MAX (sorted[j], value);
+	sorted[j] = low;
+      }
+      sorted[k++] = value;
+    }
+
+    Lane mean = sum / (double) n;
+    Lane variance = {0};
+    for (size_t j = 0; j < n; j++)
+    {
+      Lane deviation = sorted[j] - mean;
+      variance += deviation * deviation;
+    }
+    variance /= (double) n;
+
+    memcpy (series->mean + t, &mean, sizeof (mean));
+    memcpy (series->min + t, &sorted[0], sizeof (mean));
+    memcpy (series->max + t, &sorted[n - 1], sizeof (mean));
+    for (size_t l = 0; l < ENSEMBLE_LANES; l++)
+      series->spread[t + l] = sqrt (variance[l]);
+
+    // linear between the two closest ranks
+    for (size_t p = 0; p < nlevels; p++)
+    {
+      double position = levels[p] * (double) (n - 1);
+      size_t below = (size_t) position;
+      size_t above = below + 1 < n ? below + 1 : below;
+      double fraction = position - (double) below;
+      Lane value
+	= sorted[below] + (sorted[above] - sorted[below]) * fraction;
+      memcpy (series->percentiles + p * series->stride + t, &value,
+	      sizeof (value));
+    }
+  }
+}
+
+static char *
+duplicate (const char *text)
+{
+  size_t len = strlen (text) + 1;
+  char *copy = malloc (len);
+  if (copy)
+    memcpy (copy, text, len);
+  return copy;
+}
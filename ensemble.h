@@ -0,0 +1,86 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decode.h"
+#include "engine.h"
+#include "weather.h"
+
+// the same query against several forecast models at once. every model is
+// one request on the engine (the query with ?model= appended), all of them
+// in flight together, and the answers are lined up per parameter and
+// location into a matrix of members by timestep. for every timestep the
+// mean, spread (standard deviation over the members), min, max and the
+// requested percentiles are worked out.
+//
+// rows are stride doubles long, stride being count rounded up to
+// ENSEMBLE_LANES, and start on a vector boundary. the statistics are
+// computed ENSEMBLE_LANES timesteps at a time with gcc vector extensions,
+// the percentiles through a branch free insertion sort that sorts every
+// lane on its own. the padding at the end of each row holds zeros.
+//
+// a model that failed, lacks a series or answered with other timesteps is
+// left out of that series: its row is NaN and present[] is 0.
+#define ENSEMBLE_LANES 4
+#define ENSEMBLE_ALIGN (ENSEMBLE_LANES * sizeof (double))
+
+typedef struct
+{
+  const char *datetime;
+  const char *parameters;
+  const char *location; // several points joined with + work too
+  const char *const *models;
+  size_t nmodels;
+  const double *percentiles; // between 0 and 1, NULL for 0.1, 0.5 and 0.9
+  size_t npercentiles;
+} EnsembleQuery;
+
+typedef struct
+{
+  char *parameter;
+  char *location;
+  double lat;
+  double lon;
+  size_t count; // timesteps
+  size_t stride; // between rows, a multiple of ENSEMBLE_LANES
+  int64_t *times;
+  unsigned char *present; // per model
+  size_t nmembers; // models present
+  double *members; // a row per model, in query order
+  double *mean;
+  double *spread;
+  double *min;
+  double *max;
+  double *percentiles; // a row per percentile
+} EnsembleSeries;
+
+typedef struct
+{
+  size_t nmodels;
+  WEATHER_ERROR *status; // per model
+  double *percentiles;
+  size_t npercentiles;
+  EnsembleSeries *series;
+  size_t nseries;
+} Ensemble;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// drives the engine until every model answered. succeeds when at least one
+// model did. either way ensemble->status says how each went (it is NULL when
+// the query was refused or memory ran out first), a failure leaves no
+// series, and ensemble_free has to be called
+WEATHER_ERROR ensemble_fetch (RequestEngine *engine, const EnsembleQuery *query, Ensemble *ensemble);
+void ensemble_free (Ensemble *ensemble);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,583 @@
+#include <math.h>
+#include <string.h>
+
+#include "decode.h"
+#include "grid_cache.h"
+#include "metrics.h"
+#include "probes.h"
+#include "request.h"
+
+#define GRID_CACHE_INITIAL_BUCKETS 64
+#define GRID_POLL_MS 1000
+#define GRID_TILE_SIZE (GRID_TILE_CELLS * GRID_TILE_CELLS)
+// how far an edge may sit off the lattice and still count as on it
+#define GRID_EPSILON 1e-9
+// the same for coordinates in a response, which come back rounded
+#define GRID_RESPONSE_TOLERANCE 1e-3
+
+// lattice indices, both ends included
+typedef struct
+{
+  int64_t lat_first;
+  int64_t lat_last;
+  int64_t lon_first;
+  int64_t lon_last;
+} GridSpan;
+
+typedef struct
+{
+  GridCache *cache;
+  const GridQuery *query;
+  GridRegion *region;
+  GridSpan span; // of the region
+  GridSpan world; // every point the api has
+  size_t outstanding;
+} GridAssembly;
+
+// a missing tile on its way in
+typedef struct
+{
+  GridAssembly *assembly;
+  int64_t row; // tile, not point
+  int64_t col;
+  char *key; // handed to the cache once the tile is in
+  WEATHER_ERROR status;
+} GridFetch;
+
+// clang-format off
+static GridSpan lattice_span (double lat_min, double lat_max, double lon_min, double lon_max, const GridQuery *query);
+static int64_t tile_of (int64_t index);
+static void copy_tile (const GridAssembly *assembly, int64_t row, int64_t col, const double *values);
+static WEATHER_ERROR tile_url (const GridFetch *fetch, char *url, size_t url_size);
+static void on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+static WEATHER_ERROR parse_tile (const GridFetch *fetch, const char *text, double *values);
+static WEATHER_ERROR insert (GridCache *cache, char *key, double *values);
+static char *make_key (const GridQuery *query, int64_t row, int64_t col);
+static GridTile *find_tile (GridCache *cache, const char *key, uint64_t hash);
+static WEATHER_ERROR grow_buckets (GridCache *cache);
+static void lru_unlink (GridCache *cache, GridTile *tile);
+static void lru_push_front (GridCache *cache, GridTile *tile);
+static void remove_tile (GridCache *cache, GridTile *tile);
+static void evict (GridCache *cache, const GridTile *keep);
+// clang-format on
+
+WEATHER_ERROR
+grid_cache_init (GridCache *cache, size_t max_memory)
+{
+  if (!cache || max_memory == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (cache, 0, sizeof (*cache));
+  cache->buckets = calloc (GRID_CACHE_INITIAL_BUCKETS, sizeof (GridTile *));
+  if (!cache->buckets)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  cache->nbuckets = GRID_CACHE_INITIAL_BUCKETS;
+  cache->max_memory = max_memory;
+  return WEATHER_SUCCESS;
+}
+
+void
+grid_cache_cleanup (GridCache *cache)
+{
+  if (!cache)
+    return;
+
+  while (cache->lru_head)
+    remove_tile (cache, cache->lru_head);
+
+  free (cache->buckets);
+  memset (cache, 0, sizeof (*cache));
+}
+
+WEATHER_ERROR
+grid_cache_fetch (GridCache *cache, RequestEngine *engine,
+		  const GridQuery *query, GridRegion *region)
+{
+  if (!cache || !engine || !query || !region || !query->parameter
+      || !*query->parameter || strchr (query->parameter, ',')
+      || !(query->res_lat > 0) || !(query->res_lon > 0)
+      || !(query->lat_min <= query->lat_max)
+      || !(query->lon_min <= query->lon_max))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  GridAssembly assembly = {.cache = cache, .query = query, .region = region};
+  assembly.world = lattice_span (-90, 90, -180, 180, query);
+  assembly.span = lattice_span (query->lat_min, query->lat_max,
+				query->lon_min, query->lon_max, query);
+
+  // the box is clipped to the world, nothing may be left of it
+  GridSpan *span = &assembly.span;
+  if (span->lat_first < assembly.world.lat_first)
+    span->lat_first = assembly.world.lat_first;
+  if (span->lat_last > assembly.world.lat_last)
+    span->lat_last = assembly.world.lat_last;
+  if (span->lon_first < assembly.world.lon_first)
+    span->lon_first = assembly.world.lon_first;
+  if (span->lon_last > assembly.world.lon_last)
+    span->lon_last = assembly.world.lon_last;
+  if (span->lat_first > span->lat_last || span->lon_first > span->lon_last)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (region, 0, sizeof (*region));
+  region->lat_first = (double) span->lat_last * query->res_lat;
+  region->lon_first = (double) span->lon_first * query->res_lon;
+  region->res_lat = query->res_lat;
+  region->res_lon = query->res_lon;
+  region->rows = (size_t) (span->lat_last - span->lat_first + 1);
+  region->cols = (size_t) (span->lon_last - span->lon_first + 1);
+
+  int64_t row_first = tile_of (span->lat_first);
+  int64_t row_last = tile_of (span->lat_last);
+  int64_t col_first = tile_of (span->lon_first);
+  int64_t col_last = tile_of (span->lon_last);
+  region->tiles
+    = (size_t) ((row_last - row_first + 1) * (col_last - col_first + 1));
+
+  region->values = malloc (region->rows * region->cols * sizeof (double));
+  GridFetch *fetches = calloc (region->tiles, sizeof (GridFetch));
+  if (!region->values || !fetches)
+  {
+    free (fetches);
+    grid_region_free (region);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  // cached tiles are copied out straight away, so whatever the fetched
+  // ones evict later has already been used
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  size_t nfetches = 0;
+  for (int64_t row = row_first;
+       row <= row_last && WEATHER_SUCCESS == status; row++)
+    for (int64_t col = col_first; col <= col_last; col++)
+    {
+      char *key = make_key (query, row, col);
+      if (!key)
+      {
+	status = WEATHER_ERROR_INVALID_MEMORY;
+	break;
+      }
+
+      GridTile *tile = find_tile (cache, key, weather_hash (key));
+      if (!tile)
+      {
+	WEATHER_PROBE2 (cache_miss, "grid", key);
+	cache->misses++;
+	metrics_count (METRIC_GRID_CACHE_MISSES, 1);
+	fetches[nfetches++] = (GridFetch){
+	  .assembly = &assembly, .row = row, .col = col, .key = key};
+	continue;
+      }
+
+      WEATHER_PROBE2 (cache_hit, "grid", key);
+      free (key);
+      cache->hits++;
+      metrics_count (METRIC_GRID_CACHE_HITS, 1);
+      lru_unlink (cache, tile);
+      lru_push_front (cache, tile);
+      copy_tile (&assembly, row, col, tile->values);
+    }
+
+  // every missing tile goes out before the first one is waited for
+  for (size_t f = 0; f < nfetches && WEATHER_SUCCESS == status; f++)
+  {
+    char url[API_MAX_URL_LENGTH];
+    fetches[f].status = tile_url (&fetches[f], url, sizeof (url));
+    if (WEATHER_SUCCESS != fetches[f].status)
+      continue;
+
+    assembly.outstanding++;
+    WEATHER_ERROR submitted = engine_submit (
+      engine, url, ENGINE_PRIORITY_STANDARD, on_fetched, &fetches[f]);
+    if (WEATHER_SUCCESS != submitted)
+    {
+      assembly.outstanding--;
+      fetches[f].status = submitted;
+    }
+  }
+
+  while (assembly.outstanding && WEATHER_SUCCESS == status)
+    status = engine_perform (engine, GRID_POLL_MS, NULL);
+
+  // the callbacks point at the fetches, none may be left behind
+  for (size_t f = 0; f < nfetches && assembly.outstanding; f++)
+    engine_cancel (engine, &fetches[f]);
+
+  for (size_t f = 0; f < nfetches; f++)
+  {
+    if (WEATHER_SUCCESS == status)
+      status = fetches[f].status;
+    if (WEATHER_SUCCESS == fetches[f].status)
+      region->tiles_fetched++;
+    free (fetches[f].key);
+  }
+  free (fetches);
+
+  if (WEATHER_SUCCESS != status)
+    grid_region_free (region);
+  return status;
+}
+
+void
+grid_region_free (GridRegion *region)
+{
+  if (!region)
+    return;
+
+  free (region->values);
+  memset (region, 0, sizeof (*region));
+}
+
+static GridSpan
+lattice_span (double lat_min, double lat_max, double lon_min, double lon_max,
+	      const GridQuery *query)
+{
+  // inward, a point just off the lattice by rounding still belongs
+  return (GridSpan){
+    .lat_first = (int64_t) ceil (lat_min / query->res_lat - GRID_EPSILON),
+    .lat_last = (int64_t) floor (lat_max / query->res_lat + GRID_EPSILON),
+    .lon_first = (int64_t) ceil (lon_min / query->res_lon - GRID_EPSILON),
+    .lon_last = (int64_t) floor (lon_max / query->res_lon + GRID_EPSILON)};
+}
+
+static int64_t
+tile_of (int64_t index)
+{
+  // rounds down for negative indices too
+  return index >= 0 ? index / GRID_TILE_CELLS
+		    : -((-index - 1) / GRID_TILE_CELLS) - 1;
+}
+
+static void
+copy_tile (const GridAssembly *assembly, int64_t row, int64_t col,
+	   const double *values)
+{
+  const GridSpan *span = &assembly->span;
+  GridRegion *region = assembly->region;
+  int64_t lat_base = row * GRID_TILE_CELLS;
+  int64_t lon_base = col * GRID_TILE_CELLS;
+
+  int64_t lat_first = lat_base > span->lat_first ? lat_base : span->lat_first;
+  int64_t lat_last = lat_base + GRID_TILE_CELLS - 1 < span->lat_last
+		       ? lat_base + GRID_TILE_CELLS - 1
+		       : span->lat_last;
+  int64_t lon_first = lon_base > span->lon_first ? lon_base : span->lon_first;
+  int64_t lon_last = lon_base + GRID_TILE_CELLS - 1 < span->lon_last
+		       ? lon_base + GRID_TILE_CELLS - 1
+		       : span->lon_last;
+  size_t width = (size_t) (lon_last - lon_first + 1);
+
+  // tiles run south to north, the region north to south
+  for (int64_t lat = lat_first; lat <= lat_last; lat++)
+    memcpy (region->values
+	      + (size_t) (span->lat_last - lat) * region->cols
+	      + (size_t) (lon_first - span->lon_first),
+	    values + (size_t) (lat - lat_base) * GRID_TILE_CELLS
+	      + (size_t) (lon_first - lon_base),
+	    width * sizeof (double));
+}
+
+static WEATHER_ERROR
+tile_url (const GridFetch *fetch, char *url, size_t url_size)
+{
+  const GridAssembly *assembly = fetch->assembly;
+  const GridQuery *query = assembly->query;
+  const GridSpan *world = &assembly->world;
+
+  // the whole tile, less what lies beyond the poles or the date line
+  int64_t south = fetch->row * GRID_TILE_CELLS;
+  int64_t north = south + GRID_TILE_CELLS - 1;
+  int64_t west = fetch->col * GRID_TILE_CELLS;
+  int64_t east = west + GRID_TILE_CELLS - 1;
+  if (south < world->lat_first)
+    south = world->lat_first;
+  if (north > world->lat_last)
+    north = world->lat_last;
+  if (west < world->lon_first)
+    west = world->lon_first;
+  if (east > world->lon_last)
+    east = world->lon_last;
+
+  char datetime[32];
+  char location[160];
+  WEATHER_ERROR status
+    = decode_format_time (query->time, datetime, sizeof (datetime));
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  int nwritten = snprintf (
+    location, sizeof (location), "%.10g,%.10g_%.10g,%.10g:%.10g,%.10g",
+    (double) north * query->res_lat, (double) west * query->res_lon,
+    (double) south * query->res_lat, (double) east * query->res_lon,
+    query->res_lat, query->res_lon);
+  if (nwritten < 0 || (size_t) nwritten >= sizeof (location))
+    return WEATHER_ERROR_URL_CONSTRUCTION;
+
+  WeatherConfig config = {.datetime = datetime,
+			  .parameters = query->parameter,
+			  .location = location,
+			  .format = "csv"};
+  return construct_url (&config, url, url_size);
+}
+
+static void
+on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  GridFetch *fetch = userdata;
+  GridAssembly *assembly = fetch->assembly;
+  assembly->outstanding--;
+
+  double *values = NULL;
+  if (WEATHER_SUCCESS == status)
+  {
+    values = malloc (GRID_TILE_SIZE * sizeof (double));
+    status = values ? parse_tile (fetch, request->response.data, values)
+		    : WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  if (WEATHER_SUCCESS == status)
+  {
+    copy_tile (assembly, fetch->row, fetch->col, values);
+    status = insert (assembly->cache, fetch->key, values);
+  }
+
+  if (WEATHER_SUCCESS == status)
+    fetch->key = NULL; // the cache has it now
+  else
+    free (values);
+  fetch->status = status;
+}
+
+static WEATHER_ERROR
+parse_tile (const GridFetch *fetch, const char *text, double *values)
+{
+  if (!text)
+    return WEATHER_ERROR_JSON;
+
+  const GridQuery *query = fetch->assembly->query;
+  int64_t lat_base = fetch->row * GRID_TILE_CELLS;
+  int64_t lon_base = fetch->col * GRID_TILE_CELLS;
+  for (size_t i = 0; i < GRID_TILE_SIZE; i++)
+    values[i] = NAN;
+
+  // lines before the data line describe the query
+  const char *at = text;
+  while (*at && strncmp (at, "data;", 5) != 0)
+  {
+    at += strcspn (at, "\n");
+    if (*at)
+      at++;
+  }
+  if (!*at)
+    return WEATHER_ERROR_JSON;
+  at += 5;
+
+  // the rest of the data line holds the longitudes
+  size_t ncols = 1;
+  for (const char *p = at; *p && *p != '\r' && *p != '\n'; p++)
+    ncols += *p == ';';
+  size_t *offsets = malloc (ncols * sizeof (size_t));
+  if (!offsets)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  for (size_t c = 0; c < ncols && WEATHER_SUCCESS == status; c++)
+  {
+    char *end;
+    double index = strtod (at, &end) / query->res_lon;
+    int64_t offset = (int64_t) llround (index) - lon_base;
+    if (end == at || fabs (index - round (index)) > GRID_RESPONSE_TOLERANCE
+	|| offset < 0 || offset >= GRID_TILE_CELLS
+	|| (c + 1 < ncols) != (*end == ';'))
+      status = WEATHER_ERROR_JSON;
+    offsets[c] = (size_t) offset;
+    at = *end == ';' ? end + 1 : end;
+  }
+
+  // then a row per latitude, the latitude first
+  while (WEATHER_SUCCESS == status)
+  {
+    at += strspn (at, "\r\n");
+    if (!*at)
+      break;
+
+    char *end;
+    double index = strtod (at, &end) / query->res_lat;
+    int64_t offset = (int64_t) llround (index) - lat_base;
+    if (end == at || *end != ';'
+	|| fabs (index - round (index)) > GRID_RESPONSE_TOLERANCE
+	|| offset < 0 || offset >= GRID_TILE_CELLS)
+    {
+      status = WEATHER_ERROR_JSON;
+      break;
+    }
+
+    double *row = values + offset * GRID_TILE_CELLS;
+    at = end + 1;
+    for (size_t c = 0; c < ncols; c++)
+    {
+      double value = strtod (at, &end);
+      if (end == at || (c + 1 < ncols) != (*end == ';'))
+      {
+	status = WEATHER_ERROR_JSON;
+	break;
+      }
+      row[offsets[c]] = value;
+      at = *end == ';' ? end + 1 : end;
+    }
+  }
+
+  free (offsets);
+  return status;
+}
+
+static WEATHER_ERROR
+insert (GridCache *cache, char *key, double *values)
+{
+  uint64_t hash = weather_hash (key);
+  GridTile *tile = find_tile (cache, key, hash);
+  if (tile)
+  {
+    free (tile->values);
+    free (key);
+    tile->values = values;
+    lru_unlink (cache, tile);
+    lru_push_front (cache, tile);
+    return WEATHER_SUCCESS;
+  }
+
+  if (cache->count >= cache->nbuckets)
+  {
+    WEATHER_ERROR status = grow_buckets (cache);
+    if (WEATHER_SUCCESS != status)
+      return status;
+  }
+
+  tile = calloc (1, sizeof (*tile));
+  if (!tile)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  tile->key = key;
+  tile->hash = hash;
+  tile->values = values;
+  size_t bucket = hash % cache->nbuckets;
+  tile->next = cache->buckets[bucket];
+  cache->buckets[bucket] = tile;
+  cache->count++;
+  cache->memory_used
+    += sizeof (*tile) + strlen (key) + 1 + GRID_TILE_SIZE * sizeof (double);
+  lru_push_front (cache, tile);
+
+  evict (cache, tile);
+  return WEATHER_SUCCESS;
+}
+
+static char *
+make_key (const GridQuery *query, int64_t row, int64_t col)
+{
+  size_t len = strlen (query->parameter) + 128;
+  char *key = malloc (len);
+  if (key)
+    snprintf (key, len, "%s@%lld@%.10g,%.10g@%lld,%lld", query->parameter,
+	      (long long) query->time, query->res_lat, query->res_lon,
+	      (long long) row, (long long) col);
+  return key;
+}
+
+static GridTile *
+find_tile (GridCache *cache, const char *key, uint64_t hash)
+{
+  for (GridTile *tile = cache->buckets[hash % cache->nbuckets]; tile;
+       tile = tile->next)
+  {
+    if (tile->hash == hash && strcmp (tile->key, key) == 0)
+      return tile;
+  }
+  return NULL;
+}
+
+static WEATHER_ERROR
+grow_buckets (GridCache *cache)
+{
+  size_t new_count = cache->nbuckets * 2;
+  GridTile **new_buckets = calloc (new_count, sizeof (*new_buckets));
+  if (!new_buckets)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  for (size_t i = 0; i < cache->nbuckets; i++)
+  {
+    GridTile *tile = cache->buckets[i];
+    while (tile)
+    {
+      GridTile *next = tile->next;
+      size_t bucket = tile->hash % new_count;
+      tile->next = new_buckets[bucket];
+      new_buckets[bucket] = tile;
+      tile = next;
+    }
+  }
+
+  free (cache->buckets);
+  cache->buckets = new_buckets;
+  cache->nbuckets = new_count;
+  return WEATHER_SUCCESS;
+}
+
+static void
+lru_unlink (GridCache *cache, GridTile *tile)
+{
+  if (tile->lru_prev)
+    tile->lru_prev->lru_next = tile->lru_next;
+  else
+    cache->lru_head = tile->lru_next;
+
+  if (tile->lru_next)
+    tile->lru_next->lru_prev = tile->lru_prev;
+  else
+    cache->lru_tail = tile->lru_prev;
+
+  tile->lru_prev = NULL;
+  tile->lru_next = NULL;
+}
+
+static void
+lru_push_front (GridCache *cache, GridTile *tile)
+{
+  tile->lru_prev = NULL;
+  tile->lru_next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->lru_prev = tile;
+  cache->lru_head = tile;
+  if (!cache->lru_tail)
+    cache->lru_tail = tile;
+}
+
+static void
+remove_tile (GridCache *cache, GridTile *tile)
+{
+  GridTile **link = &cache->buckets[tile->hash % cache->nbuckets];
+  while (*link != tile)
+    link = &(*link)->next;
+  *link = tile->next;
+
+  lru_unlink (cache, tile);
+  cache->memory_used
+    -= sizeof (*tile) + strlen (tile->key) + 1 + GRID_TILE_SIZE * sizeof (double);
+  cache->count--;
+
+  free (tile->values);
+  free (tile->key);
+  free (tile);
+}
+
+static void
+evict (GridCache *cache, const GridTile *keep)
+{
+  // the tile just written stays, even if it is over budget on its own
+  while (cache->memory_used > cache->max_memory && cache->lru_tail
+	 && cache->lru_tail != keep)
+  {
+    remove_tile (cache, cache->lru_tail);
+    cache->evictions++;
+  }
+}
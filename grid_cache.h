@@ -0,0 +1,91 @@
+#ifndef GRID_CACHE_H
+#define GRID_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+#include "weather.h"
+
+// cache for grid queries (one parameter at one time over a bounding box)
+// that also answers boxes it has never seen, as long as they overlap ones
+// it has. grid points sit on a global lattice, point (i, j) at latitude
+// i * res_lat and longitude j * res_lon, and the lattice is cut into tiles
+// of GRID_TILE_CELLS by GRID_TILE_CELLS points. a tile is cached per
+// parameter, time and resolution.
+//
+// a query is split into the tiles it touches, the missing ones are fetched
+// concurrently on the engine (one csv request per tile), and the region is
+// put together from the tiles a row at a time with memcpy. least recently
+// used tiles go first once max_memory is reached.
+#define GRID_TILE_CELLS 64
+
+typedef struct GridTile
+{
+  char *key;
+  uint64_t hash;
+  double *values; // GRID_TILE_CELLS rows of GRID_TILE_CELLS, south first
+  struct GridTile *next; // hash chain
+  struct GridTile *lru_prev;
+  struct GridTile *lru_next;
+} GridTile;
+
+typedef struct
+{
+  GridTile **buckets;
+  size_t nbuckets;
+  size_t count;
+  size_t memory_used;
+  size_t max_memory;
+  GridTile *lru_head; // most recently used
+  GridTile *lru_tail;
+
+  size_t hits; // tiles
+  size_t misses;
+  size_t evictions;
+} GridCache;
+
+typedef struct
+{
+  const char *parameter; // a single one
+  int64_t time;
+  double lat_min;
+  double lat_max;
+  double lon_min;
+  double lon_max;
+  double res_lat; // degrees between grid points
+  double res_lon;
+} GridQuery;
+
+// the lattice points inside the box, rows north to south
+typedef struct
+{
+  double lat_first; // northernmost row
+  double lon_first; // westernmost column
+  double res_lat;
+  double res_lon;
+  size_t rows;
+  size_t cols;
+  double *values; // rows * cols
+  size_t tiles;
+  size_t tiles_fetched;
+} GridRegion;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR grid_cache_init (GridCache *cache, size_t max_memory);
+void grid_cache_cleanup (GridCache *cache);
+// drives the engine until every missing tile is in. fails if any of them
+// could not be fetched, the tiles that could stay cached
+WEATHER_ERROR grid_cache_fetch (GridCache *cache, RequestEngine *engine, const GridQuery *query, GridRegion *region);
+void grid_region_free (GridRegion *region);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
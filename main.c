@@ -5,74 +5,51 @@
 #include <curl/curl.h>
 #include <jansson.h>
 #include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "weather.h"
+#include "archive.h"
+#include "canonical.h"
+#include "decode.h"
+#include "default_schema.h"
+#include "engine.h"
+#include "ensemble.h"
+#include "metrics.h"
+#include "pack.h"
+#include "parquet.h"
+#include "probes.h"
+#include "request.h"
+#include "tls_cache.h"
+#include "transport.h"
+#include "trace.h"
 
-#define ERROR(msg)                                                             \
-  do                                                                           \
-  {                                                                            \
-    fprintf (stderr, "Error: %s at %s:%d\n", msg, __FILE__, __LINE__);         \
-  } while (0)
-
-#define ERROR_EXIT(msg)                                                        \
-  do                                                                           \
-  {                                                                            \
-    ERROR (msg);                                                               \
-    exit (EXIT_FAILURE);                                                       \
-  } while (0)
-
-#define API_MAX_URL_LENGTH 512
-#define API_MAX_RESPONSE_SIZE (10 * 1024 * 1024) // 10MB
-#define API_INITIAL_BUFFER_SIZE 4096
-
-typedef enum
-{
-  WEATHER_SUCCESS = 0,
-  WEATHER_ERROR_INVALID_CONFIG = -1,
-  WEATHER_ERROR_INVALID_MEMORY = -2,
-  WEATHER_ERROR_URL_CONSTRUCTION = -3,
-  WEATHER_ERROR_NETWORK = -4,
-  WEATHER_ERROR_JSON = -5
-} WEATHER_ERROR;
-
-typedef struct
-{
-  char *data;
-  size_t size;
-  size_t capacity;
-  size_t max_response_size;
-} ResponseBuffer;
-
-typedef struct
-{
-  const char *username;
-  const char *password;
-  const char *datetime;
-  const char *parameters;
-  const char *location;
-  const char *format;
-} WeatherConfig;
-
-typedef const char *const IMMUTABLE_CHAR_PTR;
-
-static IMMUTABLE_CHAR_PTR API_BASE_URL = "https://api.meteomatics.com";
 static IMMUTABLE_CHAR_PTR DEFAULT_DATETIME = "2024-10-23T00:00:00Z";
 // this can all be found on the API docs for the webpage it's for the request
 // for example 2m:C gives us celcius and the 2m i think 2m above sea level ?
 static IMMUTABLE_CHAR_PTR DEFAULT_PARAMETERS
   = "t_2m:C,precip_1h:mm,wind_speed_10m:ms";
+// the same parameters in canonical order are DEFAULT_SCHEMA
 // this is Sanfran (the long / lat)
 static IMMUTABLE_CHAR_PTR DEFAULT_LOCATION = "37.7749,-122.4194";
 static IMMUTABLE_CHAR_PTR DEFAULT_FORMAT = "json";
+static const double DEFAULT_TRACE_SAMPLE = 1.0;
+#define MAX_MODELS 32
 
 // clang-format off
-static WEATHER_ERROR cleanup_response_buffer (ResponseBuffer *buffer);
-
-static WEATHER_ERROR init_response_buffer (ResponseBuffer *buffer);
-static WEATHER_ERROR validate_config (const WeatherConfig *config);
-static WEATHER_ERROR construct_url (const WeatherConfig *config, char *url, size_t url_size);
-// this is the callback for the opts that libcurl needs
-static size_t write_callback (void *contents, size_t size, size_t nmemb, void *userp);
-static WEATHER_ERROR perform_request (const char *url, const WeatherConfig *config, ResponseBuffer *response);
-static WEATHER_ERROR process_json (const char *json_data, json_t **processed_root);
+static void open_trace (void);
+// answers the query from the local archive, *root stays NULL when it cannot
+static WEATHER_ERROR load_from_archive (WeatherArchive *archive, const WeatherConfig *config, json_t **root);
+// the series the sinks below get, read straight from the response text by
+// the schema when the query is the default one
+static WEATHER_ERROR decode_for_sinks (const WeatherConfig *query, const ResponseBuffer *response, const json_t *root, WeatherSeries **series, size_t *nseries);
+static WEATHER_ERROR forecast_series (DefaultForecast *forecast, WeatherSeries **series, size_t *nseries);
+static WEATHER_ERROR store_in_archive (WeatherArchive *archive, const WeatherSeries *series, size_t nseries);
+static WEATHER_ERROR write_pack (const char *path, const WeatherSeries *series, size_t nseries);
+static WEATHER_ERROR write_parquet (const char *path, const WeatherSeries *series, size_t nseries);
+// the query against every model in the comma separated list, side by side
+static WEATHER_ERROR run_ensemble (const WeatherConfig *config, const char *models, TlsSessionCache *tls, const TransportOptions *transport);
+static json_t *ensemble_json (const Ensemble *ensemble, const char *const *models);
 // clang-format on
 
 int
@@ -84,6 +61,34 @@ main (int argc, char **argv)
 
   WEATHER_ERROR status = WEATHER_SUCCESS;
   ResponseBuffer response = {0};
+  WeatherArchive archive = {0};
+  TlsSessionCache tls = {0};
+  json_t *processed_json = NULL;
+  TraceSpan query_span;
+
+  // historical data never changes so it is kept on disk if asked to
+  const char *archive_root = getenv ("METEOMATICS_ARCHIVE_DIR");
+  if (archive_root && WEATHER_SUCCESS != archive_open (&archive, archive_root))
+    ERROR ("Failed to open archive, continuing without it\n");
+
+  // resuming last run's tls session saves a round trip on the handshake
+  const char *tls_path = getenv ("METEOMATICS_TLS_CACHE");
+  if (tls_path && WEATHER_SUCCESS != tls_cache_init (&tls, tls_path))
+    ERROR ("Failed to set up TLS session cache, continuing without it\n");
+
+  TransportOptions transport;
+  transport_defaults (&transport);
+  const char *transport_spec = getenv ("METEOMATICS_TRANSPORT");
+  if (transport_spec
+      && WEATHER_SUCCESS != transport_parse (&transport, transport_spec))
+  {
+    ERROR ("Ignoring invalid METEOMATICS_TRANSPORT\n");
+    transport_defaults (&transport);
+  }
+
+  // everything below is one trace, the stages are its spans
+  open_trace ();
+  trace_begin (&query_span, "weather_query");
 
   status = init_response_buffer (&response);
   if (WEATHER_SUCCESS != status)
@@ -104,26 +109,96 @@ main (int argc, char **argv)
   status = validate_config (&config);
   if (WEATHER_SUCCESS != status)
   {
-    ERROR ("Invalid Configuration\n");
+    ERROR ("Missing credentials, set METEOMATICS_USERNAME and "
+	   "METEOMATICS_PASSWORD\n");
+    goto cleanup;
+  }
+
+  // one spelling per query, points snapped to METEOMATICS_COORDINATE_GRID
+  // degrees when it is set
+  const char *grid_spec = getenv ("METEOMATICS_COORDINATE_GRID");
+  char *grid_end = NULL;
+  double grid = grid_spec ? strtod (grid_spec, &grid_end) : 0;
+  if (grid_spec
+      && (grid_end == grid_spec || *grid_end || !(grid >= 0) || isinf (grid)))
+  {
+    ERROR ("Ignoring invalid METEOMATICS_COORDINATE_GRID\n");
+    fprintf (stderr, "METEOMATICS_COORDINATE_GRID=%s\n", grid_spec);
+    grid = 0;
+  }
+
+  CanonicalQuery canonical;
+  status = canonical_query (&config, grid, &canonical);
+  if (WEATHER_SUCCESS != status)
+  {
+    ERROR ("Failed to canonicalize the query\n");
     goto cleanup;
   }
+  if (canonical.rewritten)
+    metrics_count (METRIC_CANONICAL_REWRITES, 1);
+
+  // comparing forecast models, all of them are fetched at once
+  const char *models = getenv ("METEOMATICS_MODELS");
+  if (models)
+  {
+    status = run_ensemble (&canonical.config, models, &tls, &transport);
+    if (WEATHER_SUCCESS != status)
+      ERROR ("Failed to fetch the ensemble\n");
+    goto cleanup;
+  }
+
+  if (archive.root)
+  {
+    // as written first, exact points beat snapped ones
+    status = load_from_archive (&archive, &config, &processed_json);
+    if (WEATHER_SUCCESS == status && !processed_json && canonical.rewritten)
+    {
+      status
+	= load_from_archive (&archive, &canonical.config, &processed_json);
+      if (processed_json)
+	metrics_count (METRIC_CANONICAL_ARCHIVE_HITS, 1);
+    }
+    if (WEATHER_SUCCESS != status)
+      ERROR ("Failed to read from archive\n");
+    metrics_count (processed_json ? METRIC_ARCHIVE_HITS : METRIC_ARCHIVE_MISSES,
+		   1);
+    if (processed_json)
+      WEATHER_PROBE2 (cache_hit, "archive", config.location);
+    else
+      WEATHER_PROBE2 (cache_miss, "archive", config.location);
+    if (processed_json)
+      goto output;
+  }
 
   char url[API_MAX_URL_LENGTH] = {0};
-  status = construct_url (&config, url, sizeof (url));
+  status = construct_url (&canonical.config, url, sizeof (url));
   if (WEATHER_SUCCESS != status)
   {
     ERROR ("Failed to construct URL\n");
     goto cleanup;
   }
 
-  status = perform_request (url, &config, &response);
+  CURL *curl = curl_easy_init ();
+  if (!curl)
+  {
+    status = WEATHER_ERROR_NETWORK;
+    goto cleanup;
+  }
+  if (tls.share)
+    tls_cache_attach (&tls, curl);
+  transport_apply (&transport, curl);
+
+  status = perform_with_handle (curl, url, &config, &response);
+  curl_easy_cleanup (curl);
   if (WEATHER_SUCCESS != status)
   {
     ERROR ("Failed to perform API request\n");
+    if (response.http_status >= 400)
+      fprintf (stderr, "HTTP %ld: %s\n", response.http_status,
+	       response.size ? response.data : "(no body)");
     goto cleanup;
   }
 
-  json_t *processed_json = NULL;
   status = process_json (response.data, &processed_json);
   if (WEATHER_SUCCESS != status)
   {
@@ -131,6 +206,38 @@ main (int argc, char **argv)
     goto cleanup;
   }
 
+output:;
+
+  // what came from the archive goes back to the pack and parquet sinks only
+  int fetched = response.size > 0;
+  const char *pack_path = getenv ("METEOMATICS_PACK_FILE");
+  const char *parquet_path = getenv ("METEOMATICS_PARQUET_FILE");
+  WeatherSeries *series = NULL;
+  size_t nseries = 0;
+  WEATHER_ERROR decoded = WEATHER_SUCCESS;
+  if ((fetched && archive.root) || pack_path || parquet_path)
+    decoded = decode_for_sinks (&canonical.config, &response, processed_json,
+				&series, &nseries);
+  if (WEATHER_SUCCESS != decoded)
+    ERROR ("Failed to decode the series\n");
+
+  // a broken archive should not cost us the answer we already have
+  if (WEATHER_SUCCESS == decoded && fetched && archive.root
+      && WEATHER_SUCCESS != store_in_archive (&archive, series, nseries))
+    ERROR ("Failed to write to archive\n");
+
+  // other processes map this instead of parsing the json again
+  if (WEATHER_SUCCESS == decoded && pack_path
+      && WEATHER_SUCCESS != write_pack (pack_path, series, nseries))
+    ERROR ("Failed to write pack file\n");
+
+  if (WEATHER_SUCCESS == decoded && parquet_path
+      && WEATHER_SUCCESS != write_parquet (parquet_path, series, nseries))
+    ERROR ("Failed to write parquet file\n");
+  decode_free_series (series, nseries);
+
+  TraceSpan output_span;
+  trace_begin (&output_span, "output");
   char *formatted_output = json_dumps (processed_json, JSON_INDENT (2));
   if (formatted_output)
   {
@@ -142,168 +249,385 @@ main (int argc, char **argv)
     ERROR ("Failed to format JSON output\n");
     status = WEATHER_ERROR_JSON;
   }
+  trace_end (&output_span, status);
 
 cleanup:
+  trace_end (&query_span, status);
+  trace_close ();
+
   if (processed_json)
     json_decref (processed_json);
 
   cleanup_response_buffer (&response);
+  archive_close (&archive);
+  tls_cache_cleanup (&tls);
   curl_global_cleanup ();
 
+  // picked up by the node exporter's textfile collector, for example
+  const char *metrics_path = getenv ("METEOMATICS_METRICS_FILE");
+  if (metrics_path && WEATHER_SUCCESS != metrics_write_file (metrics_path))
+    ERROR ("Failed to write metrics\n");
+
   return (status == WEATHER_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+static void
+open_trace (void)
+{
+  const char *path = getenv ("METEOMATICS_TRACE_FILE");
+  if (!path)
+    return;
+
+  const char *format = getenv ("METEOMATICS_TRACE_FORMAT");
+  const char *sample = getenv ("METEOMATICS_TRACE_SAMPLE");
+  double rate = sample ? strtod (sample, NULL) : DEFAULT_TRACE_SAMPLE;
+
+  if (WEATHER_SUCCESS
+      != trace_open (path,
+		     format && strcmp (format, "otlp") == 0 ? TRACE_FORMAT_OTLP
+							   : TRACE_FORMAT_CHROME,
+		     rate))
+    ERROR ("Failed to start tracing, continuing without it\n");
+}
+
 static WEATHER_ERROR
-init_response_buffer (ResponseBuffer *buffer)
+load_from_archive (WeatherArchive *archive, const WeatherConfig *config,
+		   json_t **root)
 {
-  if (!buffer)
+  if (!archive || !config || !root)
     return WEATHER_ERROR_INVALID_CONFIG;
 
-  buffer->data = malloc (API_INITIAL_BUFFER_SIZE);
-  if (!buffer->data)
+  *root = NULL;
+
+  // only single points in time ranges that have settled can be answered,
+  // anything else (grids, "now", recent forecasts) goes to the api
+  int64_t start, end, step;
+  if (WEATHER_SUCCESS
+	!= decode_parse_time_range (config->datetime, &start, &end, &step)
+      || end >= (int64_t) time (NULL) - ARCHIVE_SETTLE_SECONDS)
+    return WEATHER_SUCCESS;
+
+  double lat, lon;
+  int consumed = 0;
+  if (sscanf (config->location, "%lf,%lf%n", &lat, &lon, &consumed) != 2
+      || config->location[consumed] != '\0')
+    return WEATHER_SUCCESS;
+
+  char location[64];
+  WEATHER_ERROR status
+    = decode_format_location (lat, lon, location, sizeof (location));
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  size_t expected = step ? (size_t) ((end - start) / step) + 1 : 1;
+  size_t nparameters = 1;
+  for (const char *p = config->parameters; *p; p++)
+    nparameters += *p == ',';
+
+  WeatherSeries *series = calloc (nparameters, sizeof (WeatherSeries));
+  if (!series)
     return WEATHER_ERROR_INVALID_MEMORY;
 
-  buffer->max_response_size = API_MAX_RESPONSE_SIZE;
-  buffer->capacity = API_INITIAL_BUFFER_SIZE;
-  buffer->data[0] = '\0';
-  buffer->size = 0;
+  size_t nseries = 0;
+  const char *parameter = config->parameters;
+  while (WEATHER_SUCCESS == status && nseries < nparameters)
+  {
+    size_t len = strcspn (parameter, ",");
+    WeatherSeries *current = &series[nseries++];
+
+    current->parameter = strndup (parameter, len);
+    current->location = strdup (location);
+    current->lat = lat;
+    current->lon = lon;
+    if (!current->parameter || !current->location)
+    {
+      status = WEATHER_ERROR_INVALID_MEMORY;
+      break;
+    }
 
-  return WEATHER_SUCCESS;
+    // every archived point in range is read, points between the steps
+    // (hourly data under a six hourly query) included
+    size_t archived = 0;
+    status = archive_count (archive, current->parameter, location, start, end,
+			    &archived);
+    if (WEATHER_SUCCESS != status || archived < expected)
+      break; // not fully archived, ask the api
+
+    current->times = malloc (archived * sizeof (int64_t));
+    current->values = malloc (archived * sizeof (double));
+    if (!current->times || !current->values)
+    {
+      status = WEATHER_ERROR_INVALID_MEMORY;
+      break;
+    }
+
+    status = archive_read (archive, current->parameter, location, start, end,
+			   current->times, current->values, archived,
+			   &current->count);
+    if (WEATHER_SUCCESS != status)
+      break;
+
+    // keep only the points on the requested step
+    size_t kept = 0;
+    for (size_t i = 0; i < current->count; i++)
+    {
+      if (step && (current->times[i] - start) % step != 0)
+	continue;
+      current->times[kept] = current->times[i];
+      current->values[kept++] = current->values[i];
+    }
+    current->count = kept;
+
+    if (kept != expected)
+      break; // not fully archived, ask the api
+
+    parameter += len + (parameter[len] == ',');
+  }
+
+  if (WEATHER_SUCCESS == status && nseries == nparameters
+      && series[nseries - 1].count == expected)
+    status = decode_build_json (series, nseries, root);
+
+  decode_free_series (series, nseries);
+  return status;
 }
 
 static WEATHER_ERROR
-validate_config (const WeatherConfig *config)
+decode_for_sinks (const WeatherConfig *query, const ResponseBuffer *response,
+		  const json_t *root, WeatherSeries **series, size_t *nseries)
 {
-  if (!config)
-    return WEATHER_ERROR_INVALID_CONFIG;
-
-  if (!config->username || !config->password || strlen (config->username) == 0
-      || strlen (config->password) == 0)
+  // anything the schema does not expect is read the general way
+  if (response->size
+      && strcmp (query->parameters, default_forecast_parameters ()) == 0)
   {
-    ERROR ("Error: Missing credentials in environment variables\n");
-    return WEATHER_ERROR_INVALID_CONFIG;
+    DefaultForecast forecast;
+    if (WEATHER_SUCCESS
+	== default_forecast_decode (response->data, response->size, &forecast))
+    {
+      WEATHER_ERROR status = forecast_series (&forecast, series, nseries);
+      default_forecast_free (&forecast);
+      return status;
+    }
   }
 
-  return WEATHER_SUCCESS;
+  return decode_series (root, series, nseries);
 }
 
 static WEATHER_ERROR
-construct_url (const WeatherConfig *config, char *url, size_t url_size)
+forecast_series (DefaultForecast *forecast, WeatherSeries **series,
+		 size_t *nseries)
 {
-  if (!config || !url || url_size == 0)
-    return WEATHER_ERROR_INVALID_CONFIG;
+#define FORECAST_PARAMETER(name, parameter) parameter,
+#define FORECAST_COLUMN(name, parameter) &forecast->name,
+  static const char *const parameters[] = {DEFAULT_SCHEMA (FORECAST_PARAMETER)};
+  double **columns[] = {DEFAULT_SCHEMA (FORECAST_COLUMN)};
+#undef FORECAST_PARAMETER
+#undef FORECAST_COLUMN
+  size_t count = sizeof (parameters) / sizeof (parameters[0]);
+
+  char location[64];
+  WEATHER_ERROR status
+    = decode_format_location (forecast->axis.lat, forecast->axis.lon,
+			      location, sizeof (location));
+  if (WEATHER_SUCCESS != status)
+    return status;
 
-  int nwritten
-    = snprintf (url, url_size, "%s/%s/%s/%s/%s", API_BASE_URL, config->datetime,
-		config->parameters, config->location, config->format);
+  WeatherSeries *out = calloc (count, sizeof (WeatherSeries));
+  if (!out)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  // the columns change hands, every series gets its own copy of the axis
+  size_t bytes = forecast->axis.count * sizeof (int64_t);
+  for (size_t i = 0; i < count && WEATHER_SUCCESS == status; i++)
+  {
+    out[i].parameter = strdup (parameters[i]);
+    out[i].location = strdup (location);
+    out[i].lat = forecast->axis.lat;
+    out[i].lon = forecast->axis.lon;
+    out[i].times = malloc (bytes ? bytes : 1);
+    out[i].values = *columns[i];
+    out[i].count = forecast->axis.count;
+    *columns[i] = NULL;
+    if (!out[i].parameter || !out[i].location || !out[i].times)
+      status = WEATHER_ERROR_INVALID_MEMORY;
+    else
+      memcpy (out[i].times, forecast->axis.times, bytes);
+  }
 
-  if (nwritten < 0 || (size_t) nwritten >= url_size)
-    return WEATHER_ERROR_URL_CONSTRUCTION;
+  if (WEATHER_SUCCESS != status)
+  {
+    decode_free_series (out, count);
+    return status;
+  }
 
+  *series = out;
+  *nseries = count;
   return WEATHER_SUCCESS;
 }
 
-static size_t
-write_callback (void *contents, size_t size, size_t nmemb, void *userp)
+static WEATHER_ERROR
+store_in_archive (WeatherArchive *archive, const WeatherSeries *series,
+		  size_t nseries)
 {
-  size_t realsize = size * nmemb;
-  ResponseBuffer *buffer = (ResponseBuffer *) userp;
+  if (!archive || (!series && nseries))
+    return WEATHER_ERROR_INVALID_CONFIG;
 
-  if (buffer->size + realsize > buffer->capacity)
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  int64_t settled = (int64_t) time (NULL) - ARCHIVE_SETTLE_SECONDS;
+  for (size_t i = 0; i < nseries && WEATHER_SUCCESS == status; i++)
   {
-    size_t new_size = buffer->capacity * 2;
-
-    if (new_size > buffer->max_response_size)
-    {
-      fprintf (stderr, "Response too large (exceeds %zu bytes)\n",
-	       buffer->max_response_size);
-      return 0; // this will tell libcurl there was an error
-    }
+    size_t count = 0;
+    while (count < series[i].count && series[i].times[count] < settled)
+      count++;
 
-    char *new_data = realloc (buffer->data, new_size);
-    if (!new_data)
-    {
-      fprintf (stderr, "Failed to allocate memory (exceeds %zu bytes)\n",
-	       buffer->max_response_size);
-      return 0; // this will tell libcurl there was an error
-    }
-
-    buffer->data = new_data;
-    buffer->capacity = new_size;
+    status = archive_append (archive, series[i].parameter, series[i].location,
+			     series[i].times, series[i].values, count);
   }
 
-  memcpy (buffer->data + buffer->size, contents, realsize);
-  buffer->size += realsize;
-  buffer->data[buffer->size] = '\0';
-
-  return realsize;
+  return status;
 }
 
 static WEATHER_ERROR
-perform_request (const char *url, const WeatherConfig *config,
-		 ResponseBuffer *response)
+write_pack (const char *path, const WeatherSeries *series, size_t nseries)
 {
-  if (!url || !config || !response)
-    return WEATHER_ERROR_INVALID_CONFIG;
-
-  CURL *curl = curl_easy_init ();
-  if (!curl)
-    return WEATHER_ERROR_NETWORK;
-
-  curl_easy_setopt (curl, CURLOPT_URL, url);
-  curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, write_callback);
-  curl_easy_setopt (curl, CURLOPT_WRITEDATA, response);
-  curl_easy_setopt (curl, CURLOPT_USERNAME, config->username);
-  curl_easy_setopt (curl, CURLOPT_PASSWORD, config->password);
-  curl_easy_setopt (curl, CURLOPT_TIMEOUT, 30L);
-  curl_easy_setopt (curl, CURLOPT_SSL_VERIFYPEER, 1L);
-  curl_easy_setopt (curl, CURLOPT_SSL_VERIFYHOST, 2L);
-
-  CURLcode res = curl_easy_perform (curl);
-  curl_easy_cleanup (curl);
+  return pack_save (path, series, nseries);
+}
 
-  if (CURLE_OK != res)
+static WEATHER_ERROR
+write_parquet (const char *path, const WeatherSeries *series, size_t nseries)
+{
+  ParquetWriter writer;
+  WEATHER_ERROR status;
+  status = parquet_open (&writer, path, 0);
+  if (WEATHER_SUCCESS == status)
   {
-    ERROR (curl_easy_strerror (res));
-    return WEATHER_ERROR_NETWORK;
+    status = parquet_write_series (&writer, series, nseries);
+    WEATHER_ERROR closed = parquet_close (&writer);
+    if (WEATHER_SUCCESS == status)
+      status = closed;
   }
 
-  return WEATHER_SUCCESS;
+  return status;
 }
 
 static WEATHER_ERROR
-process_json (const char *json_data, json_t **processed_root)
+run_ensemble (const WeatherConfig *config, const char *models,
+	      TlsSessionCache *tls, const TransportOptions *transport)
 {
-  if (!json_data || !processed_root)
+  char names[1024];
+  if (strlen (models) >= sizeof (names))
+    return WEATHER_ERROR_INVALID_CONFIG;
+  strcpy (names, models);
+
+  const char *list[MAX_MODELS];
+  size_t nmodels = 0;
+  for (char *name = strtok (names, ","); name && nmodels < MAX_MODELS;
+       name = strtok (NULL, ","))
+    list[nmodels++] = name;
+  if (!nmodels)
     return WEATHER_ERROR_INVALID_CONFIG;
 
-  json_error_t error;
-  json_t *root = json_loads (json_data, 0, &error);
-  if (!root)
+  RequestEngine engine;
+  WEATHER_ERROR status
+    = engine_init (&engine, config->username, config->password, nmodels);
+  if (WEATHER_SUCCESS != status)
+    return status;
+  if (tls->share)
+    engine_set_tls_cache (&engine, tls);
+  engine_set_transport (&engine, transport);
+
+  EnsembleQuery query = {.datetime = config->datetime,
+			 .parameters = config->parameters,
+			 .location = config->location,
+			 .models = list,
+			 .nmodels = nmodels};
+  Ensemble ensemble;
+  status = ensemble_fetch (&engine, &query, &ensemble);
+  engine_cleanup (&engine);
+  if (WEATHER_SUCCESS != status)
   {
-    fprintf (stderr, "JSON parsing error on line %d: %s\n", error.line,
-	     error.text);
-    return WEATHER_ERROR_JSON;
+    for (size_t m = 0; m < ensemble.nmodels; m++)
+      fprintf (stderr, "model %s: error %d\n", list[m], ensemble.status[m]);
+    ensemble_free (&ensemble);
+    return status;
   }
 
-  json_object_del (root, "user");     // dont want to leak my API key / Name
-  json_object_del (root, "password"); // dont want to leak my API key / Name
-  json_object_del (root,
-		   "credentials"); // dont want to leak my API key / Name
+  json_t *root = ensemble_json (&ensemble, list);
+  char *text = root ? json_dumps (root, JSON_INDENT (2)) : NULL;
+  if (text)
+    printf ("%s\n", text);
+  else
+    status = WEATHER_ERROR_INVALID_MEMORY;
 
-  *processed_root = root;
-  return WEATHER_SUCCESS;
+  free (text);
+  json_decref (root);
+  ensemble_free (&ensemble);
+  return status;
 }
 
-static WEATHER_ERROR
-cleanup_response_buffer (ResponseBuffer *buffer)
+static json_t *
+ensemble_json (const Ensemble *ensemble, const char *const *models)
 {
-  if (buffer && buffer->data)
+  json_t *root = json_object ();
+  json_t *status = json_object ();
+  json_t *levels = json_array ();
+  json_t *data = json_array ();
+  if (!root || !status || !levels || !data)
   {
-    free (buffer->data);
-    buffer->data = NULL;
-    buffer->size = 0;
-    buffer->capacity = 0;
+    json_decref (root);
+    json_decref (status);
+    json_decref (levels);
+    json_decref (data);
+    return NULL;
   }
-  return WEATHER_SUCCESS;
+  json_object_set_new (root, "models", status);
+  json_object_set_new (root, "percentiles", levels);
+  json_object_set_new (root, "data", data);
+
+  for (size_t m = 0; m < ensemble->nmodels; m++)
+    json_object_set_new (status, models[m],
+			 json_integer (ensemble->status[m]));
+  for (size_t p = 0; p < ensemble->npercentiles; p++)
+    json_array_append_new (levels, json_real (ensemble->percentiles[p]));
+
+  for (size_t i = 0; i < ensemble->nseries; i++)
+  {
+    const EnsembleSeries *series = &ensemble->series[i];
+    json_t *entry = json_object ();
+    json_t *dates = json_array ();
+    json_object_set_new (entry, "parameter", json_string (series->parameter));
+    json_object_set_new (entry, "location", json_string (series->location));
+    json_object_set_new (entry, "dates", dates);
+    json_array_append_new (data, entry);
+
+    for (size_t t = 0; t < series->count; t++)
+    {
+      char date[32];
+      decode_format_time (series->times[t], date, sizeof (date));
+
+      json_t *point = json_object ();
+      json_t *members = json_object ();
+      json_t *percentiles = json_array ();
+      json_object_set_new (point, "date", json_string (date));
+      json_object_set_new (point, "mean", json_real (series->mean[t]));
+      json_object_set_new (point, "spread", json_real (series->spread[t]));
+      json_object_set_new (point, "min", json_real (series->min[t]));
+      json_object_set_new (point, "max", json_real (series->max[t]));
+      json_object_set_new (point, "percentiles", percentiles);
+      json_object_set_new (point, "members", members);
+      json_array_append_new (dates, point);
+
+      for (size_t p = 0; p < ensemble->npercentiles; p++)
+	json_array_append_new (
+	  percentiles, json_real (series->percentiles[p * series->stride + t]));
+      // models left out of this series have no value to show
+      for (size_t m = 0; m < ensemble->nmodels; m++)
+	if (series->present[m])
+	  json_object_set_new (
+	    members, models[m],
+	    json_real (series->members[m * series->stride + t]));
+    }
+  }
+
+  return root;
 }
@@ -0,0 +1,668 @@
+#ifndef METEOMATICS_HPP
+#define METEOMATICS_HPP
+
+// header only c++20 api over the c client. nothing here needs a manual
+// cleanup call: buffers, json documents, decoded series and clients release
+// themselves, they can be moved but not copied, and failures come back as
+// Result<T> holding either the value or a std::error_code. decoded values
+// are handed out as std::span views onto the arrays the decoder filled, no
+// copy is made on the way.
+//
+//   auto client = meteomatics::Client::create (user, password);
+//   auto series = client->fetch ({"now", "t_2m:C", "47.4,9.4"});
+//   for (const auto &s : *series)
+//     use (s.parameter, s.times, s.values);
+//
+// link with the library's objects, libcurl, jansson and pthread as usual.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <variant>
+
+#include "client.h"
+#include "decode.h"
+#include "request.h"
+#include "weather.h"
+
+namespace meteomatics
+{
+
+class ErrorCategory : public std::error_category
+{
+public:
+  const char *
+  name () const noexcept override
+  {
+    return "meteomatics";
+  }
+
+  std::string
+  message (int code) const override
+  {
+    switch (code)
+    {
+    case WEATHER_ERROR_INVALID_CONFIG:
+      return "invalid configuration";
+    case WEATHER_ERROR_INVALID_MEMORY:
+      return "out of memory";
+    case WEATHER_ERROR_URL_CONSTRUCTION:
+      return "url construction failed";
+    case WEATHER_ERROR_NETWORK:
+      return "network error";
+    case WEATHER_ERROR_JSON:
+      return "malformed json";
+    case WEATHER_ERROR_HTTP_CLIENT:
+      return "request rejected by the api";
+    case WEATHER_ERROR_HTTP_AUTH:
+      return "not authorized";
+    case WEATHER_ERROR_HTTP_NOT_FOUND:
+      return "not found";
+    case WEATHER_ERROR_HTTP_RATE_LIMIT:
+      return "rate limited";
+    case WEATHER_ERROR_HTTP_SERVER:
+      return "api server error";
+    case WEATHER_ERROR_CANCELLED:
+      return "cancelled";
+    default:
+      return "unknown error";
+    }
+  }
+};
+
+inline const std::error_category &
+error_category ()
+{
+  static const ErrorCategory category;
+  return category;
+}
+
+inline std::error_code
+make_error (WEATHER_ERROR error)
+{
+  return {static_cast<int> (error), error_category ()};
+}
+
+// what std::expected would be, kept to c++20. value() on an error throws
+// std::system_error, check first when that is not wanted
+template <typename T> class [[nodiscard]] Result
+{
+public:
+  Result (T value) : state_ (std::move (value)) {}
+  Result (std::error_code error) : state_ (error) {}
+  Result (WEATHER_ERROR error) : state_ (make_error (error)) {}
+
+  bool
+  has_value () const noexcept
+  {
+    return state_.index () == 0;
+  }
+
+  explicit
+  operator bool () const noexcept
+  {
+    return has_value ();
+  }
+
+  T &
+  value () &
+  {
+    check ();
+    return std::get<0> (state_);
+  }
+
+  const T &
+  value () const &
+  {
+    check ();
+    return std::get<0> (state_);
+  }
+
+  T &&
+  value () &&
+  {
+    check ();
+    return std::get<0> (std::move (state_));
+  }
+
+  T &
+  operator* () &
+  {
+    return value ();
+  }
+
+  const T &
+  operator* () const &
+  {
+    return value ();
+  }
+
+  T *
+  operator->()
+  {
+    return &value ();
+  }
+
+  const T *
+  operator->() const
+  {
+    return &value ();
+  }
+
+  std::error_code
+  error () const noexcept
+  {
+    return has_value () ? std::error_code () : std::get<1> (state_);
+  }
+
+private:
+  void
+  check () const
+  {
+    if (!has_value ())
+      throw std::system_error (std::get<1> (state_));
+  }
+
+  std::variant<T, std::error_code> state_;
+};
+
+template <> class [[nodiscard]] Result<void>
+{
+public:
+  Result () = default;
+  Result (std::error_code error) : error_ (error) {}
+  Result (WEATHER_ERROR error)
+    : error_ (error == WEATHER_SUCCESS ? std::error_code ()
+				       : make_error (error))
+  {}
+
+  bool
+  has_value () const noexcept
+  {
+    return !error_;
+  }
+
+  explicit
+  operator bool () const noexcept
+  {
+    return has_value ();
+  }
+
+  void
+  value () const
+  {
+    if (error_)
+      throw std::system_error (error_);
+  }
+
+  std::error_code
+  error () const noexcept
+  {
+    return error_;
+  }
+
+private:
+  std::error_code error_;
+};
+
+// curl_global_init, once per process. Client::create calls it too
+inline Result<void>
+global_init ()
+{
+  return client_global_init ();
+}
+
+// an owned json document
+class Json
+{
+public:
+  Json () = default;
+  explicit Json (json_t *root) noexcept : root_ (root) {}
+  Json (Json &&other) noexcept : root_ (std::exchange (other.root_, nullptr))
+  {}
+  Json &
+  operator= (Json &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset ();
+      root_ = std::exchange (other.root_, nullptr);
+    }
+    return *this;
+  }
+  Json (const Json &) = delete;
+  Json &operator= (const Json &) = delete;
+  ~Json () { reset (); }
+
+  json_t *
+  get () const noexcept
+  {
+    return root_;
+  }
+
+  // ownership goes back to the caller, who then owes the json_decref
+  json_t *
+  release () noexcept
+  {
+    return std::exchange (root_, nullptr);
+  }
+
+  static Result<Json>
+  parse (const char *text)
+  {
+    json_t *root = nullptr;
+    WEATHER_ERROR status = process_json (text, &root);
+    if (WEATHER_SUCCESS != status)
+      return status;
+    return Json (root);
+  }
+
+private:
+  void
+  reset () noexcept
+  {
+    if (root_)
+      json_decref (root_);
+    root_ = nullptr;
+  }
+
+  json_t *root_ = nullptr;
+};
+
+// one decoded series, every member points into the SeriesSet it came from
+struct SeriesView
+{
+  std::string_view parameter;
+  std::string_view location;
+  double lat;
+  double lon;
+  std::span<const int64_t> times; // unix seconds
+  std::span<const double> values;
+};
+
+// the output of decode_series, owned
+class SeriesSet
+{
+public:
+  class iterator
+  {
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = SeriesView;
+    using difference_type = std::ptrdiff_t;
+
+    iterator () = default;
+    iterator (const SeriesSet *set, size_t index) : set_ (set), index_ (index)
+    {}
+
+    SeriesView
+    operator* () const
+    {
+      return (*set_)[index_];
+    }
+    SeriesView
+    operator[] (difference_type n) const
+    {
+      return (*set_)[index_ + n];
+    }
+    iterator &
+    operator++ ()
+    {
+      ++index_;
+      return *this;
+    }
+    iterator
+    operator++ (int)
+    {
+      iterator before = *this;
+      ++index_;
+      return before;
+    }
+    iterator &
+    operator-- ()
+    {
+      --index_;
+      return *this;
+    }
+    iterator
+    operator-- (int)
+    {
+      iterator before = *this;
+      --index_;
+      return before;
+    }
+    iterator &
+    operator+= (difference_type n)
+    {
+      index_ += n;
+      return *this;
+    }
+    iterator &
+    operator-= (difference_type n)
+    {
+      index_ -= n;
+      return *this;
+    }
+    friend iterator
+    operator+ (iterator it, difference_type n)
+    {
+      return it += n;
+    }
+    friend iterator
+    operator+ (difference_type n, iterator it)
+    {
+      return it += n;
+    }
+    friend iterator
+    operator- (iterator it, difference_type n)
+    {
+      return it -= n;
+    }
+    friend difference_type
+    operator- (const iterator &a, const iterator &b)
+    {
+      return static_cast<difference_type> (a.index_)
+	     - static_cast<difference_type> (b.index_);
+    }
+    friend bool
+    operator== (const iterator &a, const iterator &b)
+    {
+      return a.index_ == b.index_;
+    }
+    friend auto
+    operator<=> (const iterator &a, const iterator &b)
+    {
+      return a.index_ <=> b.index_;
+    }
+
+  private:
+    const SeriesSet *set_ = nullptr;
+    size_t index_ = 0;
+  };
+
+  SeriesSet () = default;
+  SeriesSet (WeatherSeries *series, size_t count) noexcept
+    : series_ (series), count_ (count)
+  {}
+  SeriesSet (SeriesSet &&other) noexcept
+    : series_ (std::exchange (other.series_, nullptr)),
+      count_ (std::exchange (other.count_, 0))
+  {}
+  SeriesSet &
+  operator= (SeriesSet &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset ();
+      series_ = std::exchange (other.series_, nullptr);
+      count_ = std::exchange (other.count_, 0);
+    }
+    return *this;
+  }
+  SeriesSet (const SeriesSet &) = delete;
+  SeriesSet &operator= (const SeriesSet &) = delete;
+  ~SeriesSet () { reset (); }
+
+  static Result<SeriesSet>
+  decode (const Json &root)
+  {
+    WeatherSeries *series = nullptr;
+    size_t count = 0;
+    WEATHER_ERROR status = decode_series (root.get (), &series, &count);
+    if (WEATHER_SUCCESS != status)
+      return status;
+    return SeriesSet (series, count);
+  }
+
+  size_t
+  size () const noexcept
+  {
+    return count_;
+  }
+
+  bool
+  empty () const noexcept
+  {
+    return count_ == 0;
+  }
+
+  SeriesView
+  operator[] (size_t index) const
+  {
+    const WeatherSeries &s = series_[index];
+    return {s.parameter,
+	    s.location,
+	    s.lat,
+	    s.lon,
+	    {s.times, s.count},
+	    {s.values, s.count}};
+  }
+
+  iterator
+  begin () const
+  {
+    return {this, 0};
+  }
+
+  iterator
+  end () const
+  {
+    return {this, count_};
+  }
+
+  // the underlying c array, for the c apis (pack_write, parquet_write_series)
+  const WeatherSeries *
+  data () const noexcept
+  {
+    return series_;
+  }
+
+private:
+  void
+  reset () noexcept
+  {
+    if (series_)
+      decode_free_series (series_, count_);
+    series_ = nullptr;
+    count_ = 0;
+  }
+
+  WeatherSeries *series_ = nullptr;
+  size_t count_ = 0;
+};
+
+// a response body that owns its buffer
+class Response
+{
+public:
+  Response () = default;
+  // takes over a buffer filled elsewhere, the engine hands bodies over so
+  explicit Response (ResponseBuffer buffer) noexcept : buffer_ (buffer) {}
+  Response (Response &&other) noexcept : buffer_ (other.buffer_)
+  {
+    other.buffer_ = {};
+  }
+  Response &
+  operator= (Response &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset ();
+      buffer_ = other.buffer_;
+      other.buffer_ = {};
+    }
+    return *this;
+  }
+  Response (const Response &) = delete;
+  Response &operator= (const Response &) = delete;
+  ~Response () { reset (); }
+
+  std::string_view
+  text () const noexcept
+  {
+    return {buffer_.data ? buffer_.data : "", buffer_.size};
+  }
+
+  std::span<const char>
+  bytes () const noexcept
+  {
+    return {buffer_.data, buffer_.size};
+  }
+
+  long
+  http_status () const noexcept
+  {
+    return buffer_.http_status;
+  }
+
+  Result<Json>
+  json () const
+  {
+    if (!buffer_.data)
+      return WEATHER_ERROR_INVALID_CONFIG;
+    return Json::parse (buffer_.data);
+  }
+
+  // one request on the calling thread's handle, see perform_request
+  static Result<Response>
+  perform (const std::string &url, const std::string &username,
+	   const std::string &password)
+  {
+    Response response;
+    WEATHER_ERROR status = init_response_buffer (&response.buffer_);
+    if (WEATHER_SUCCESS != status)
+      return status;
+
+    WeatherConfig credentials = {};
+    credentials.username = username.c_str ();
+    credentials.password = password.c_str ();
+    status = perform_request (url.c_str (), &credentials, &response.buffer_);
+    if (WEATHER_SUCCESS != status)
+      return status;
+    return response;
+  }
+
+private:
+  void
+  reset () noexcept
+  {
+    if (buffer_.data)
+      cleanup_response_buffer (&buffer_);
+    buffer_ = {};
+  }
+
+  ResponseBuffer buffer_ = {};
+};
+
+struct Query
+{
+  std::string datetime;
+  std::string parameters;
+  std::string location;
+  std::string format = "json";
+};
+
+// WeatherClient, movable. the c client is pinned on the heap because its
+// per thread state points back at it
+class Client
+{
+public:
+  static Result<Client>
+  create (const std::string &username, const std::string &password)
+  {
+    std::unique_ptr<WeatherClient, Deleter> client (new WeatherClient);
+    WEATHER_ERROR status
+      = client_init (client.get (), username.c_str (), password.c_str ());
+    if (WEATHER_SUCCESS != status)
+    {
+      delete client.release (); // nothing to clean up after a failed init
+      return status;
+    }
+    return Client (std::move (client));
+  }
+
+  // must be set before the first request, the cache has to outlive the
+  // client
+  void
+  set_tls_cache (TlsSessionCache *cache) noexcept
+  {
+    client_set_tls_cache (client_.get (), cache);
+  }
+
+  void
+  set_transport (const TransportOptions &options) noexcept
+  {
+    client_set_transport (client_.get (), &options);
+  }
+
+  // borrowed from the calling thread's buffer, valid until that thread's
+  // next request on this client
+  Result<std::string_view>
+  get (const std::string &url)
+  {
+    const char *body = nullptr;
+    size_t size = 0;
+    WEATHER_ERROR status = client_get (client_.get (), url.c_str (), &body,
+				       &size);
+    if (WEATHER_SUCCESS != status)
+      return status;
+    return std::string_view (body, size);
+  }
+
+  Result<Json>
+  fetch_json (const Query &query)
+  {
+    WeatherConfig config = {};
+    config.datetime = query.datetime.c_str ();
+    config.parameters = query.parameters.c_str ();
+    config.location = query.location.c_str ();
+    config.format = query.format.c_str ();
+
+    json_t *root = nullptr;
+    WEATHER_ERROR status = client_fetch (client_.get (), &config, &root);
+    if (WEATHER_SUCCESS != status)
+      return status;
+    return Json (root);
+  }
+
+  Result<SeriesSet>
+  fetch (const Query &query)
+  {
+    Result<Json> root = fetch_json (query);
+    if (!root)
+      return root.error ();
+    return SeriesSet::decode (*root);
+  }
+
+  WeatherClient *
+  native () const noexcept
+  {
+    return client_.get ();
+  }
+
+private:
+  struct Deleter
+  {
+    void
+    operator() (WeatherClient *client) const noexcept
+    {
+      client_cleanup (client);
+      delete client;
+    }
+  };
+
+  explicit Client (std::unique_ptr<WeatherClient, Deleter> client)
+    : client_ (std::move (client))
+  {}
+
+  std::unique_ptr<WeatherClient, Deleter> client_;
+};
+
+} // namespace meteomatics
+
+#endif
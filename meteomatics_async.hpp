@@ -0,0 +1,751 @@
+#ifndef METEOMATICS_ASYNC_HPP
+#define METEOMATICS_ASYNC_HPP
+
+// c++20 coroutines over the request engine. an AsyncClient owns one engine,
+// that is one curl multi handle, and whichever thread calls run drives it:
+// the transfers make progress on that thread and every coroutine waiting on
+// one is resumed there. a query in flight costs a coroutine frame and an
+// easy handle, not a thread, so thousands of them fit on one client. to use
+// more cores give each of a handful of threads a client of its own.
+//
+//   meteomatics::Task<void>
+//   report (meteomatics::AsyncClient &client, std::stop_token stop)
+//   {
+//     std::vector<meteomatics::Task<meteomatics::Result<SeriesSet>>> batch;
+//     for (const auto &location : locations)
+//       batch.push_back (client.fetch ({"now", "t_2m:C", location}, stop));
+//     for (auto &series : co_await meteomatics::when_all (std::move (batch)))
+//       ...
+//   }
+//
+//   auto client = meteomatics::AsyncClient::create (user, password, 64);
+//   client->run (report (*client, source.get_token ()));
+//
+// cancellation goes through std::stop_token. a stop requested from any
+// thread takes the request out of the engine, queued or already running,
+// and the await completes with WEATHER_ERROR_CANCELLED.
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "engine.h"
+#include "meteomatics.hpp"
+
+namespace meteomatics
+{
+
+// how long run sleeps in the engine when nothing happens, a stop request
+// wakes it up early
+inline constexpr int async_poll_ms = 1000;
+
+class AsyncClient;
+
+namespace detail
+{
+
+// where a finished task keeps its result until the awaiter collects it
+template <typename T> class TaskResult
+{
+public:
+  void
+  return_value (T value)
+  {
+    value_.emplace (std::move (value));
+  }
+
+  void
+  unhandled_exception () noexcept
+  {
+    exception_ = std::current_exception ();
+  }
+
+  T
+  take ()
+  {
+    if (exception_)
+      std::rethrow_exception (exception_);
+    return std::move (*value_);
+  }
+
+private:
+  std::optional<T> value_;
+  std::exception_ptr exception_;
+};
+
+template <> class TaskResult<void>
+{
+public:
+  void
+  return_void () noexcept
+  {}
+
+  void
+  unhandled_exception () noexcept
+  {
+    exception_ = std::current_exception ();
+  }
+
+  void
+  take ()
+  {
+    if (exception_)
+      std::rethrow_exception (exception_);
+  }
+
+private:
+  std::exception_ptr exception_;
+};
+
+// passes control on to the awaiter without growing the stack
+struct ResumeContinuation
+{
+  std::coroutine_handle<> continuation;
+
+  bool
+  await_ready () const noexcept
+  {
+    return false;
+  }
+
+  std::coroutine_handle<>
+  await_suspend (std::coroutine_handle<>) const noexcept
+  {
+    return continuation;
+  }
+
+  void
+  await_resume () const noexcept
+  {}
+};
+
+} // namespace detail
+
+// a lazy coroutine. it starts once it is awaited or handed to
+// AsyncClient::run or spawn, and resumes its awaiter when it returns. an
+// exception leaving it is rethrown to the awaiter. destroying the task
+// destroys the frame, so it has to stay around until it finished
+template <typename T = void> class [[nodiscard]] Task
+{
+public:
+  struct promise_type : detail::TaskResult<T>
+  {
+    std::coroutine_handle<> continuation = std::noop_coroutine ();
+
+    Task
+    get_return_object () noexcept
+    {
+      return Task (std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+
+    std::suspend_always
+    initial_suspend () const noexcept
+    {
+      return {};
+    }
+
+    detail::ResumeContinuation
+    final_suspend () const noexcept
+    {
+      return {continuation};
+    }
+  };
+
+  Task () = default;
+  Task (Task &&other) noexcept : handle_ (std::exchange (other.handle_, {}))
+  {}
+  Task &
+  operator= (Task &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset ();
+      handle_ = std::exchange (other.handle_, {});
+    }
+    return *this;
+  }
+  Task (const Task &) = delete;
+  Task &operator= (const Task &) = delete;
+  ~Task () { reset (); }
+
+  auto
+  operator co_await () const noexcept
+  {
+    struct Awaiter
+    {
+      std::coroutine_handle<promise_type> handle;
+
+      bool
+      await_ready () const noexcept
+      {
+	return handle.done ();
+      }
+
+      std::coroutine_handle<>
+      await_suspend (std::coroutine_handle<> waiting) const noexcept
+      {
+	handle.promise ().continuation = waiting;
+	return handle;
+      }
+
+      T
+      await_resume () const
+      {
+	return handle.promise ().take ();
+      }
+    };
+    return Awaiter{handle_};
+  }
+
+private:
+  friend class AsyncClient;
+
+  explicit Task (std::coroutine_handle<promise_type> handle) noexcept
+    : handle_ (handle)
+  {}
+
+  void
+  reset () noexcept
+  {
+    if (handle_)
+      handle_.destroy ();
+    handle_ = {};
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail
+{
+
+struct WhenAllCounter
+{
+  size_t remaining = 0;
+  std::coroutine_handle<> parent;
+};
+
+// one task of a when_all, the last one to finish resumes the parent
+class WhenAllPart
+{
+public:
+  struct promise_type
+  {
+    WhenAllCounter *counter = nullptr;
+
+    WhenAllPart
+    get_return_object () noexcept
+    {
+      return WhenAllPart (
+	std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+
+    std::suspend_always
+    initial_suspend () const noexcept
+    {
+      return {};
+    }
+
+    auto
+    final_suspend () const noexcept
+    {
+      struct Arrive
+      {
+	WhenAllCounter *counter;
+
+	bool
+	await_ready () const noexcept
+	{
+	  return false;
+	}
+
+	std::coroutine_handle<>
+	await_suspend (std::coroutine_handle<>) const noexcept
+	{
+	  if (--counter->remaining == 0)
+	    return counter->parent;
+	  return std::noop_coroutine ();
+	}
+
+	void
+	await_resume () const noexcept
+	{}
+      };
+      return Arrive{counter};
+    }
+
+    void
+    return_void () noexcept
+    {}
+
+    // the part catches everything itself
+    void
+    unhandled_exception () noexcept
+    {
+      std::terminate ();
+    }
+  };
+
+  WhenAllPart (WhenAllPart &&other) noexcept
+    : handle_ (std::exchange (other.handle_, {}))
+  {}
+  WhenAllPart &operator= (WhenAllPart &&) = delete;
+  ~WhenAllPart ()
+  {
+    if (handle_)
+      handle_.destroy ();
+  }
+
+  void
+  start (WhenAllCounter *counter)
+  {
+    handle_.promise ().counter = counter;
+    handle_.resume ();
+  }
+
+private:
+  explicit WhenAllPart (std::coroutine_handle<promise_type> handle) noexcept
+    : handle_ (handle)
+  {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T> struct WhenAllState
+{
+  WhenAllCounter counter;
+  std::vector<std::optional<T>> results;
+  std::exception_ptr exception;
+};
+
+template <typename T>
+WhenAllPart
+when_all_part (Task<T> task, WhenAllState<T> &state, size_t index)
+{
+  try
+  {
+    state.results[index].emplace (co_await task);
+  }
+  catch (...)
+  {
+    if (!state.exception)
+      state.exception = std::current_exception ();
+  }
+}
+
+// starts every part, then waits for the last of them
+struct StartAll
+{
+  std::vector<WhenAllPart> &parts;
+  WhenAllCounter &counter;
+
+  bool
+  await_ready () const noexcept
+  {
+    return parts.empty ();
+  }
+
+  bool
+  await_suspend (std::coroutine_handle<> parent)
+  {
+    // the extra count keeps parts that finish straight away from resuming
+    // the parent before it is suspended
+    counter.parent = parent;
+    counter.remaining = parts.size () + 1;
+    for (WhenAllPart &part : parts)
+      part.start (&counter);
+    return --counter.remaining > 0;
+  }
+
+  void
+  await_resume () const noexcept
+  {}
+};
+
+// runs a task to the end, then frees itself
+struct Detached
+{
+  struct promise_type
+  {
+    Detached
+    get_return_object () noexcept
+    {
+      return {};
+    }
+
+    std::suspend_never
+    initial_suspend () const noexcept
+    {
+      return {};
+    }
+
+    std::suspend_never
+    final_suspend () const noexcept
+    {
+      return {};
+    }
+
+    void
+    return_void () noexcept
+    {}
+
+    void
+    unhandled_exception () noexcept
+    {
+      std::terminate ();
+    }
+  };
+};
+
+} // namespace detail
+
+// awaits all tasks at once and returns their results in the order of the
+// tasks. when one of them throws, the first exception is rethrown after
+// every task has finished
+template <typename T>
+Task<std::vector<T>>
+when_all (std::vector<Task<T>> tasks)
+{
+  detail::WhenAllState<T> state;
+  state.results.resize (tasks.size ());
+
+  std::vector<detail::WhenAllPart> parts;
+  parts.reserve (tasks.size ());
+  for (size_t i = 0; i < tasks.size (); i++)
+    parts.push_back (detail::when_all_part (std::move (tasks[i]), state, i));
+
+  co_await detail::StartAll{parts, state.counter};
+
+  if (state.exception)
+    std::rethrow_exception (state.exception);
+
+  std::vector<T> results;
+  results.reserve (state.results.size ());
+  for (std::optional<T> &result : state.results)
+    results.push_back (std::move (*result));
+  co_return results;
+}
+
+// a RequestEngine driven by coroutines, movable. everything but stop
+// requests belongs to the thread that calls run: awaiting, spawning and
+// destroying the client. requests still pending when the client goes away
+// are dropped without resuming the coroutines waiting on them
+class AsyncClient
+{
+  struct State;
+
+public:
+  // co_await yields a Result<Response>
+  class [[nodiscard]] Request
+  {
+  public:
+    Request (State *state, std::string url, ENGINE_PRIORITY priority,
+	     std::stop_token stop)
+      : state_ (state), url_ (std::move (url)), priority_ (priority),
+	stop_ (std::move (stop))
+    {}
+    Request (const Request &) = delete;
+    Request &operator= (const Request &) = delete;
+
+    // a coroutine destroyed while it waits takes its request along
+    ~Request ()
+    {
+      if (submitted_ && !done_)
+      {
+	waiter_ = {};
+	engine_cancel (&state_->engine, this);
+      }
+      cleanup_response_buffer (&body_);
+    }
+
+    bool
+    await_ready () const noexcept
+    {
+      return false;
+    }
+
+    bool
+    await_suspend (std::coroutine_handle<> waiter)
+    {
+      if (stop_.stop_requested ())
+      {
+	status_ = WEATHER_ERROR_CANCELLED;
+	return false;
+      }
+
+      // a transfer that cannot start fails inside engine_submit already
+      waiter_ = waiter;
+      submitting_ = true;
+      WEATHER_ERROR status = engine_submit (&state_->engine, url_.c_str (),
+					    priority_, complete, this);
+      submitting_ = false;
+      if (WEATHER_SUCCESS != status)
+      {
+	status_ = status;
+	return false;
+      }
+      submitted_ = true;
+      if (done_)
+	return false;
+
+      if (stop_.stop_possible ())
+	on_stop_.emplace (stop_, Cancel{this});
+      return true;
+    }
+
+    Result<Response>
+    await_resume ()
+    {
+      if (WEATHER_SUCCESS != status_)
+	return status_;
+      return Response (std::exchange (body_, ResponseBuffer{}));
+    }
+
+  private:
+    struct Cancel
+    {
+      Request *request;
+
+      void
+      operator() () const
+      {
+	request->state_->cancel (request);
+      }
+    };
+
+    static void
+    complete (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+    {
+      Request *self = static_cast<Request *> (userdata);
+
+      // waits for a stop callback running on another thread, none can come
+      // in after this and leave a stale pointer behind
+      self->on_stop_.reset ();
+      self->state_->forget (self);
+
+      self->status_ = status;
+      if (WEATHER_SUCCESS == status)
+      {
+	// the engine already gave the charged memory back
+	self->body_ = request->response;
+	self->body_.budget = nullptr;
+	self->body_.charged = 0;
+	request->response.data = nullptr;
+      }
+
+      self->done_ = true;
+      if (self->waiter_ && !self->submitting_)
+	self->state_->ready.push_back (self->waiter_);
+    }
+
+    State *state_;
+    std::string url_;
+    ENGINE_PRIORITY priority_;
+    std::stop_token stop_;
+    std::optional<std::stop_callback<Cancel>> on_stop_;
+    std::coroutine_handle<> waiter_;
+    bool submitting_ = false;
+    bool submitted_ = false;
+    bool done_ = false;
+    WEATHER_ERROR status_ = WEATHER_SUCCESS;
+    ResponseBuffer body_ = {};
+  };
+
+  // max_active of 0 picks ENGINE_DEFAULT_MAX_ACTIVE
+  static Result<AsyncClient>
+  create (const std::string &username, const std::string &password,
+	  size_t max_active = 0)
+  {
+    Result<void> ready = global_init ();
+    if (!ready)
+      return ready.error ();
+
+    auto state = std::make_unique<State> ();
+    WEATHER_ERROR status = engine_init (&state->engine, username.c_str (),
+					password.c_str (), max_active);
+    if (WEATHER_SUCCESS != status)
+      return status;
+    return AsyncClient (std::move (state));
+  }
+
+  // for engine_set_budget, engine_set_transport and the like, before run
+  RequestEngine *
+  native () const noexcept
+  {
+    return &state_->engine;
+  }
+
+  Request
+  get (std::string url, std::stop_token stop = {},
+       ENGINE_PRIORITY priority = ENGINE_PRIORITY_STANDARD)
+  {
+    return Request (state_.get (), std::move (url), priority,
+		    std::move (stop));
+  }
+
+  Task<Result<SeriesSet>>
+  fetch (Query query, std::stop_token stop = {},
+	 ENGINE_PRIORITY priority = ENGINE_PRIORITY_STANDARD)
+  {
+    return fetch_series (state_.get (), std::move (query), std::move (stop),
+			 priority);
+  }
+
+  // starts the task right away and lets it finish while run drives the
+  // engine. an exception it throws comes out of run
+  void
+  spawn (Task<void> task)
+  {
+    state_->spawned++;
+    detach (std::move (task), state_.get ());
+  }
+
+  // drives the engine on the calling thread until the task returned, and
+  // returns what it returned
+  template <typename T>
+  T
+  run (Task<T> task)
+  {
+    task.handle_.resume ();
+    while (!task.handle_.done ())
+      step ();
+    return task.handle_.promise ().take ();
+  }
+
+  // until every spawned task has finished
+  void
+  run ()
+  {
+    while (state_->spawned || !state_->ready.empty ())
+      step ();
+  }
+
+private:
+  struct State
+  {
+    RequestEngine engine = {};
+    std::vector<std::coroutine_handle<>> ready; // completed, to resume
+    std::vector<std::coroutine_handle<>> resuming;
+    size_t spawned = 0;
+    std::exception_ptr failure;
+
+    std::mutex mutex; // guards cancelled, stop callbacks run on any thread
+    std::vector<Request *> cancelled;
+
+    State () = default;
+    State (const State &) = delete;
+    State &operator= (const State &) = delete;
+    ~State () { engine_cleanup (&engine); }
+
+    void
+    cancel (Request *request)
+    {
+      {
+	std::lock_guard<std::mutex> lock (mutex);
+	cancelled.push_back (request);
+      }
+      curl_multi_wakeup (engine.multi);
+    }
+
+    void
+    forget (Request *request)
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      std::erase (cancelled, request);
+    }
+
+    std::vector<Request *>
+    take_cancelled ()
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      return std::exchange (cancelled, {});
+    }
+  };
+
+  explicit AsyncClient (std::unique_ptr<State> state)
+    : state_ (std::move (state))
+  {}
+
+  static Task<Result<SeriesSet>>
+  fetch_series (State *state, Query query, std::stop_token stop,
+		ENGINE_PRIORITY priority)
+  {
+    WeatherConfig config = {};
+    config.datetime = query.datetime.c_str ();
+    config.parameters = query.parameters.c_str ();
+    config.location = query.location.c_str ();
+    config.format = query.format.c_str ();
+
+    // the engine takes urls up to its own limit, multi point queries need
+    // it. the frame is on the heap, the buffer costs no stack
+    char url[ENGINE_MAX_URL_LENGTH];
+    WEATHER_ERROR status = construct_url (&config, url, sizeof (url));
+    if (WEATHER_SUCCESS != status)
+      co_return status;
+
+    Result<Response> response
+      = co_await Request (state, url, priority, std::move (stop));
+    if (!response)
+      co_return response.error ();
+
+    Result<Json> root = response->json ();
+    if (!root)
+      co_return root.error ();
+    co_return SeriesSet::decode (*root);
+  }
+
+  static detail::Detached
+  detach (Task<void> task, State *state)
+  {
+    try
+    {
+      co_await task;
+    }
+    catch (...)
+    {
+      if (!state->failure)
+	state->failure = std::current_exception ();
+    }
+    state->spawned--;
+  }
+
+  void
+  step ()
+  {
+    State &state = *state_;
+
+    // engine_cancel only queues the waiters up, nothing is resumed here
+    for (Request *request : state.take_cancelled ())
+      engine_cancel (&state.engine, request);
+
+    if (state.ready.empty ())
+    {
+      WEATHER_ERROR status
+	= engine_perform (&state.engine, async_poll_ms, nullptr);
+      if (WEATHER_SUCCESS != status)
+	throw std::system_error (make_error (status));
+    }
+
+    // coroutines resumed now may complete others, those wait for the next
+    // round so the stack stays flat
+    state.resuming.swap (state.ready);
+    for (std::coroutine_handle<> handle : state.resuming)
+      handle.resume ();
+    state.resuming.clear ();
+
+    if (state.failure)
+      std::rethrow_exception (std::exchange (state.failure, nullptr));
+  }
+
+  std::unique_ptr<State> state_;
+};
+
+} // namespace meteomatics
+
+#endif
@@ -0,0 +1,513 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define METRICS_BACKLOG 8
+#define METRICS_READ_TIMEOUT_SECONDS 1
+// accept failing for want of descriptors or memory is retried after this
+// long, doubling up to the maximum while it keeps failing
+#define METRICS_ACCEPT_BACKOFF_MS 10
+#define METRICS_ACCEPT_BACKOFF_MAX_MS 1000
+
+typedef struct MetricsShard
+{
+  atomic_uint_fast64_t counters[METRIC_COUNTER_COUNT];
+  atomic_uint_fast64_t errors[METRIC_ERROR_SLOTS];
+  atomic_int_fast64_t gauges[METRIC_GAUGE_COUNT];
+  atomic_uint_fast64_t buckets[METRIC_HISTOGRAM_COUNT][METRIC_BUCKETS + 1];
+  atomic_uint_fast64_t sum_ns[METRIC_HISTOGRAM_COUNT];
+  struct MetricsShard *next;
+} MetricsShard;
+
+typedef struct
+{
+  const char *name;
+  const char *labels; // NULL or the inside of {}
+  const char *help;
+} MetricInfo;
+
+// metrics sharing a name are next to each other, the header goes out once
+static const MetricInfo COUNTERS[METRIC_COUNTER_COUNT] = {
+  [METRIC_REQUESTS] = {"meteomatics_requests_total", NULL,
+		       "Requests sent to the api."},
+  [METRIC_RESPONSE_BYTES] = {"meteomatics_response_bytes_total", NULL,
+			     "Response body bytes received."},
+  [METRIC_SERIES_CACHE_HITS] = {"meteomatics_cache_hits_total",
+				"cache=\"series\"", "Cache lookups answered."},
+  [METRIC_ARCHIVE_HITS] = {"meteomatics_cache_hits_total", "cache=\"archive\"",
+			   "Cache lookups answered."},
+  [METRIC_SERIES_CACHE_MISSES] = {"meteomatics_cache_misses_total",
+				  "cache=\"series\"",
+				  "Cache lookups that missed."},
+  [METRIC_ARCHIVE_MISSES] = {"meteomatics_cache_misses_total",
+			     "cache=\"archive\"", "Cache lookups that missed."},
+  [METRIC_GRID_CACHE_HITS] = {"meteomatics_cache_hits_total",
+			      "cache=\"grid\"", "Cache lookups answered."},
+  [METRIC_GRID_CACHE_MISSES] = {"meteomatics_cache_misses_total",
+				"cache=\"grid\"", "Cache lookups that missed."},
+  [METRIC_CANONICAL_REWRITES]
+  = {"meteomatics_canonical_rewrites_total", NULL,
+     "Queries whose spelling canonicalization changed."},
+  [METRIC_CANONICAL_ARCHIVE_HITS]
+  = {"meteomatics_canonical_hits_total", "cache=\"archive\"",
+     "Lookups that only hit under the canonical spelling."},
+  [METRIC_CANONICAL_DEDUP_HITS]
+  = {"meteomatics_canonical_hits_total", "cache=\"dedup\"",
+     "Lookups that only hit under the canonical spelling."},
+  [METRIC_BUDGET_REFUSED] = {"meteomatics_budget_refused_total", NULL,
+			     "Memory budget charges refused at the limit."},
+  [METRIC_BUDGET_OVERDRAFTS]
+  = {"meteomatics_budget_overdrafts_total", NULL,
+     "Forced memory budget charges that went over the limit."},
+  [METRIC_TLS_SESSIONS_IMPORTED]
+  = {"meteomatics_tls_sessions_total", "direction=\"imported\"",
+     "TLS sessions carried over between runs through the ticket file."},
+  [METRIC_TLS_SESSIONS_EXPORTED]
+  = {"meteomatics_tls_sessions_total", "direction=\"exported\"",
+     "TLS sessions carried over between runs through the ticket file."},
+};
+
+static const METRIC_COUNTER COUNTER_ORDER[METRIC_COUNTER_COUNT]
+  = {METRIC_REQUESTS,	       METRIC_RESPONSE_BYTES,
+     METRIC_SERIES_CACHE_HITS,   METRIC_ARCHIVE_HITS,
+     METRIC_GRID_CACHE_HITS,	       METRIC_SERIES_CACHE_MISSES,
+     METRIC_ARCHIVE_MISSES,      METRIC_GRID_CACHE_MISSES,
+     METRIC_CANONICAL_REWRITES,  METRIC_CANONICAL_ARCHIVE_HITS,
+     METRIC_CANONICAL_DEDUP_HITS, METRIC_BUDGET_REFUSED,
+     METRIC_BUDGET_OVERDRAFTS,	  METRIC_TLS_SESSIONS_IMPORTED,
+     METRIC_TLS_SESSIONS_EXPORTED};
+
+static const MetricInfo GAUGES[METRIC_GAUGE_COUNT] = {
+  [METRIC_QUEUE_DEPTH] = {"meteomatics_queue_depth", NULL,
+			  "Requests waiting for a transfer slot."},
+  [METRIC_IN_FLIGHT] = {"meteomatics_in_flight", NULL,
+			"Transfers in progress, paused ones included."},
+  [METRIC_BUDGET_USED] = {"meteomatics_budget_used_bytes", NULL,
+			  "Response memory charged to budgets."},
+  [METRIC_BUDGET_PEAK] = {"meteomatics_budget_peak_bytes", NULL,
+			  "Highest memory in use of any one budget."},
+};
+
+static const MetricInfo HISTOGRAMS[METRIC_HISTOGRAM_COUNT] = {
+  [METRIC_REQUEST_SECONDS] = {"meteomatics_request_seconds", NULL,
+			      "Time from starting a transfer to its end."},
+  [METRIC_DECODE_SECONDS] = {"meteomatics_decode_seconds", NULL,
+			     "Time spent parsing response bodies."},
+};
+
+static const double BUCKETS[METRIC_BUCKETS]
+  = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+     0.1,    0.25,    0.5,    1.0,   2.5,    5.0,   10.0, 30.0};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static MetricsShard *shards;
+static _Thread_local MetricsShard *local_shard;
+static atomic_int_fast64_t maxima[METRIC_GAUGE_COUNT];
+
+// clang-format off
+static MetricsShard *shard (void);
+static const char *error_name (int slot);
+static void header (FILE *stream, const MetricInfo *info, const char *type, const char **last);
+static void *serve_loop (void *userdata);
+static void answer (int client);
+// clang-format on
+
+void
+metrics_count (METRIC_COUNTER counter, uint64_t n)
+{
+  MetricsShard *current = shard ();
+  if (current && counter >= 0 && counter < METRIC_COUNTER_COUNT)
+    atomic_fetch_add_explicit (&current->counters[counter], n,
+			       memory_order_relaxed);
+}
+
+void
+metrics_error (WEATHER_ERROR error)
+{
+  int slot = -(int) error;
+  if (slot <= 0 || slot >= METRIC_ERROR_SLOTS)
+    return;
+
+  MetricsShard *current = shard ();
+  if (current)
+    atomic_fetch_add_explicit (&current->errors[slot], 1,
+			       memory_order_relaxed);
+}
+
+void
+metrics_gauge_add (METRIC_GAUGE gauge, int64_t delta)
+{
+  MetricsShard *current = shard ();
+  if (current && gauge >= 0 && gauge < METRIC_GAUGE_COUNT)
+    atomic_fetch_add_explicit (&current->gauges[gauge], delta,
+			       memory_order_relaxed);
+}
+
+void
+metrics_gauge_max (METRIC_GAUGE gauge, int64_t value)
+{
+  if (gauge < 0 || gauge >= METRIC_GAUGE_COUNT)
+    return;
+
+  int_fast64_t current = atomic_load_explicit (&maxima[gauge],
+					       memory_order_relaxed);
+  while (value > current
+	 && !atomic_compare_exchange_weak_explicit (&maxima[gauge], &current,
+						    value, memory_order_relaxed,
+						    memory_order_relaxed))
+    ;
+}
+
+void
+metrics_observe (METRIC_HISTOGRAM histogram, double seconds)
+{
+  MetricsShard *current = shard ();
+  if (!current || histogram < 0 || histogram >= METRIC_HISTOGRAM_COUNT)
+    return;
+
+  if (seconds < 0)
+    seconds = 0;
+
+  // buckets are stored one by one and summed up when rendering
+  size_t bucket = 0;
+  while (bucket < METRIC_BUCKETS && seconds > BUCKETS[bucket])
+    bucket++;
+
+  atomic_fetch_add_explicit (&current->buckets[histogram][bucket], 1,
+			     memory_order_relaxed);
+  atomic_fetch_add_explicit (&current->sum_ns[histogram],
+			     (uint64_t) (seconds * 1e9), memory_order_relaxed);
+}
+
+double
+metrics_now (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+WEATHER_ERROR
+metrics_render (FILE *stream)
+{
+  if (!stream)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  uint64_t counters[METRIC_COUNTER_COUNT] = {0};
+  uint64_t errors[METRIC_ERROR_SLOTS] = {0};
+  int64_t gauges[METRIC_GAUGE_COUNT] = {0};
+  uint64_t buckets[METRIC_HISTOGRAM_COUNT][METRIC_BUCKETS + 1] = {{0}};
+  uint64_t sum_ns[METRIC_HISTOGRAM_COUNT] = {0};
+
+  pthread_mutex_lock (&registry_lock);
+  for (MetricsShard *current = shards; current; current = current->next)
+  {
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+      counters[i] += atomic_load_explicit (&current->counters[i],
+					   memory_order_relaxed);
+    for (int i = 0; i < METRIC_ERROR_SLOTS; i++)
+      errors[i]
+	+= atomic_load_explicit (&current->errors[i], memory_order_relaxed);
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++)
+      gauges[i]
+	+= atomic_load_explicit (&current->gauges[i], memory_order_relaxed);
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+    {
+      for (int b = 0; b <= METRIC_BUCKETS; b++)
+	buckets[i][b] += atomic_load_explicit (&current->buckets[i][b],
+					       memory_order_relaxed);
+      sum_ns[i]
+	+= atomic_load_explicit (&current->sum_ns[i], memory_order_relaxed);
+    }
+  }
+  pthread_mutex_unlock (&registry_lock);
+  for (int i = 0; i < METRIC_GAUGE_COUNT; i++)
+    gauges[i] += atomic_load_explicit (&maxima[i], memory_order_relaxed);
+
+  const char *last = NULL;
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+  {
+    const MetricInfo *info = &COUNTERS[COUNTER_ORDER[i]];
+    header (stream, info, "counter", &last);
+    if (info->labels)
+      fprintf (stream, "%s{%s} %llu\n", info->name, info->labels,
+	       (unsigned long long) counters[COUNTER_ORDER[i]]);
+    else
+      fprintf (stream, "%s %llu\n", info->name,
+	       (unsigned long long) counters[COUNTER_ORDER[i]]);
+  }
+
+  fprintf (stream, "# HELP meteomatics_errors_total Failed operations by "
+		   "error.\n# TYPE meteomatics_errors_total counter\n");
+  for (int slot = 1; slot < METRIC_ERROR_SLOTS; slot++)
+  {
+    const char *name = error_name (slot);
+    if (name || errors[slot])
+      fprintf (stream, "meteomatics_errors_total{error=\"%s\"} %llu\n",
+	       name ? name : "other", (unsigned long long) errors[slot]);
+  }
+
+  for (int i = 0; i < METRIC_GAUGE_COUNT; i++)
+  {
+    header (stream, &GAUGES[i], "gauge", &last);
+    fprintf (stream, "%s %lld\n", GAUGES[i].name, (long long) gauges[i]);
+  }
+
+  for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+  {
+    header (stream, &HISTOGRAMS[i], "histogram", &last);
+
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++)
+    {
+      cumulative += buckets[i][b];
+      fprintf (stream, "%s_bucket{le=\"%g\"} %llu\n", HISTOGRAMS[i].name,
+	       BUCKETS[b], (unsigned long long) cumulative);
+    }
+    cumulative += buckets[i][METRIC_BUCKETS];
+    fprintf (stream, "%s_bucket{le=\"+Inf\"} %llu\n", HISTOGRAMS[i].name,
+	     (unsigned long long) cumulative);
+    fprintf (stream, "%s_sum %.9f\n", HISTOGRAMS[i].name,
+	     (double) sum_ns[i] / 1e9);
+    fprintf (stream, "%s_count %llu\n", HISTOGRAMS[i].name,
+	     (unsigned long long) cumulative);
+  }
+
+  return ferror (stream) ? WEATHER_ERROR_INVALID_MEMORY : WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+metrics_write_file (const char *path)
+{
+  if (!path)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  char temporary[4096];
+  int len = snprintf (temporary, sizeof (temporary), "%s.XXXXXX", path);
+  if (len < 0 || (size_t) len >= sizeof (temporary))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  // a temporary of our own, two writers of one path never share it. the
+  // collector reading the file runs as another user
+  int fd = mkstemp (temporary);
+  FILE *stream = NULL;
+  if (fd >= 0 && fchmod (fd, 0644) == 0)
+    stream = fdopen (fd, "w");
+  if (!stream)
+  {
+    if (fd >= 0)
+    {
+      close (fd);
+      unlink (temporary);
+    }
+    ERROR ("Failed to open metrics file\n");
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  WEATHER_ERROR status = metrics_render (stream);
+  if (fclose (stream) != 0 && WEATHER_SUCCESS == status)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+
+  if (WEATHER_SUCCESS != status || rename (temporary, path) != 0)
+  {
+    unlink (temporary);
+    return WEATHER_SUCCESS != status ? status : WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+metrics_serve (MetricsServer *server, unsigned short port)
+{
+  if (!server)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (server, 0, sizeof (*server));
+  server->fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (server->fd < 0)
+    return WEATHER_ERROR_NETWORK;
+
+  int reuse = 1;
+  setsockopt (server->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+
+  // scrapers run next to us, nothing here is meant for the network
+  struct sockaddr_in address = {.sin_family = AF_INET,
+				.sin_port = htons (port),
+				.sin_addr.s_addr = htonl (INADDR_LOOPBACK)};
+  if (bind (server->fd, (struct sockaddr *) &address, sizeof (address)) != 0
+      || listen (server->fd, METRICS_BACKLOG) != 0
+      || pthread_create (&server->thread, NULL, serve_loop, server) != 0)
+  {
+    ERROR ("Failed to start metrics endpoint\n");
+    close (server->fd);
+    server->fd = -1;
+    return WEATHER_ERROR_NETWORK;
+  }
+
+  server->running = 1;
+  return WEATHER_SUCCESS;
+}
+
+void
+metrics_stop (MetricsServer *server)
+{
+  if (!server || !server->running)
+    return;
+
+  atomic_store (&server->stop, 1);
+  shutdown (server->fd, SHUT_RDWR); // wakes the accept up
+  pthread_join (server->thread, NULL);
+  close (server->fd);
+  server->fd = -1;
+  server->running = 0;
+}
+
+static MetricsShard *
+shard (void)
+{
+  if (local_shard)
+    return local_shard;
+
+  // the only lock on the recording side, once per thread
+  MetricsShard *created = calloc (1, sizeof (*created));
+  if (!created)
+    return NULL;
+
+  pthread_mutex_lock (&registry_lock);
+  created->next = shards;
+  shards = created;
+  pthread_mutex_unlock (&registry_lock);
+
+  local_shard = created;
+  return created;
+}
+
+static const char *
+error_name (int slot)
+{
+  switch (-slot)
+  {
+  case WEATHER_ERROR_INVALID_CONFIG:
+    return "invalid_config";
+  case WEATHER_ERROR_INVALID_MEMORY:
+    return "invalid_memory";
+  case WEATHER_ERROR_URL_CONSTRUCTION:
+    return "url_construction";
+  case WEATHER_ERROR_NETWORK:
+    return "network";
+  case WEATHER_ERROR_JSON:
+    return "json";
+  case WEATHER_ERROR_HTTP_CLIENT:
+    return "http_client";
+  case WEATHER_ERROR_HTTP_AUTH:
+    return "http_auth";
+  case WEATHER_ERROR_HTTP_NOT_FOUND:
+    return "http_not_found";
+  case WEATHER_ERROR_HTTP_RATE_LIMIT:
+    return "http_rate_limit";
+  case WEATHER_ERROR_HTTP_SERVER:
+    return "http_server";
+  case WEATHER_ERROR_CANCELLED:
+    return "cancelled";
+  default:
+    return NULL;
+  }
+}
+
+static void
+header (FILE *stream, const MetricInfo *info, const char *type,
+	const char **last)
+{
+  if (*last && strcmp (*last, info->name) == 0)
+    return;
+
+  fprintf (stream, "# HELP %s %s\n# TYPE %s %s\n", info->name, info->help,
+	   info->name, type);
+  *last = info->name;
+}
+
+static void *
+serve_loop (void *userdata)
+{
+  MetricsServer *server = userdata;
+  long backoff_ms = 0;
+
+  while (!atomic_load (&server->stop))
+  {
+    int client = accept (server->fd, NULL, NULL);
+    if (client < 0)
+    {
+      // interrupted, a client that gave up, or shut down and about to see
+      // stop. anything else (EMFILE, ENFILE, ENOBUFS) stays until something
+      // is freed, spinning on it would only burn a core
+      if (errno == EINTR || errno == ECONNABORTED
+	  || atomic_load (&server->stop))
+	continue;
+
+      backoff_ms = backoff_ms ? backoff_ms * 2 : METRICS_ACCEPT_BACKOFF_MS;
+      if (backoff_ms > METRICS_ACCEPT_BACKOFF_MAX_MS)
+	backoff_ms = METRICS_ACCEPT_BACKOFF_MAX_MS;
+      struct timespec pause = {.tv_sec = backoff_ms / 1000,
+			       .tv_nsec = (backoff_ms % 1000) * 1000000L};
+      nanosleep (&pause, NULL);
+      continue;
+    }
+
+    backoff_ms = 0;
+    answer (client);
+    close (client);
+  }
+
+  return NULL;
+}
+
+static void
+answer (int client)
+{
+  // the request itself does not matter, every path gets the metrics
+  struct timeval timeout = {.tv_sec = METRICS_READ_TIMEOUT_SECONDS};
+  setsockopt (client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+  char request[1024];
+  if (read (client, request, sizeof (request)) <= 0)
+    return;
+
+  char *body = NULL;
+  size_t body_size = 0;
+  FILE *stream = open_memstream (&body, &body_size);
+  if (!stream)
+    return;
+  WEATHER_ERROR status = metrics_render (stream);
+  fclose (stream);
+
+  char head[256];
+  int head_size
+    = snprintf (head, sizeof (head),
+		"HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\nConnection: close\r\n\r\n",
+		WEATHER_SUCCESS == status ? "200 OK"
+					  : "500 Internal Server Error",
+		WEATHER_SUCCESS == status ? body_size : 0);
+
+  if (send (client, head, (size_t) head_size, MSG_NOSIGNAL) == head_size
+      && WEATHER_SUCCESS == status)
+  {
+    size_t sent = 0;
+    while (sent < body_size)
+    {
+      ssize_t n = send (client, body + sent, body_size - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+	break;
+      sent += (size_t) n;
+    }
+  }
+
+  free (body);
+}
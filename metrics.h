@@ -0,0 +1,104 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<int> metrics_flag_t;
+#else
+#include <stdatomic.h>
+typedef atomic_int metrics_flag_t;
+#endif
+
+#include "weather.h"
+
+// process wide metrics in the prometheus text format. every thread updates
+// its own shard with relaxed atomic adds, so recording never takes a lock
+// and never bounces a cache line between threads. rendering sums the shards.
+// shards outlive their threads, a thread's counts stay in the totals.
+//
+// gauges are recorded as deltas for the same reason, +1 when something is
+// queued and -1 when it leaves, which also makes them add up across engines.
+// high water marks are the exception, metrics_gauge_max keeps them in one
+// place for the whole process. they only move on a new peak, which is rare.
+
+typedef enum
+{
+  METRIC_REQUESTS,
+  METRIC_RESPONSE_BYTES,
+  METRIC_SERIES_CACHE_HITS,
+  METRIC_SERIES_CACHE_MISSES,
+  METRIC_ARCHIVE_HITS,
+  METRIC_ARCHIVE_MISSES,
+  METRIC_GRID_CACHE_HITS, // tiles
+  METRIC_GRID_CACHE_MISSES,
+  METRIC_CANONICAL_REWRITES,
+  // hits the query as spelled would not have had, see canonical.h
+  METRIC_CANONICAL_ARCHIVE_HITS,
+  METRIC_CANONICAL_DEDUP_HITS,
+  METRIC_BUDGET_REFUSED, // charges refused by memory budgets
+  METRIC_BUDGET_OVERDRAFTS, // forced charges that went over the limit
+  METRIC_TLS_SESSIONS_IMPORTED, // read back from the ticket file
+  METRIC_TLS_SESSIONS_EXPORTED, // written to it
+  METRIC_COUNTER_COUNT
+} METRIC_COUNTER;
+
+typedef enum
+{
+  METRIC_QUEUE_DEPTH, // engine requests waiting for a slot
+  METRIC_IN_FLIGHT,
+  METRIC_BUDGET_USED, // bytes charged to memory budgets
+  METRIC_BUDGET_PEAK, // the highest peak of any one budget, by maximum
+  METRIC_GAUGE_COUNT
+} METRIC_GAUGE;
+
+typedef enum
+{
+  METRIC_REQUEST_SECONDS,
+  METRIC_DECODE_SECONDS,
+  METRIC_HISTOGRAM_COUNT
+} METRIC_HISTOGRAM;
+
+// upper bounds in seconds, +Inf comes on top
+#define METRIC_BUCKETS 17
+// room for WEATHER_ERROR codes down to -(METRIC_ERROR_SLOTS - 1)
+#define METRIC_ERROR_SLOTS 16
+
+typedef struct
+{
+  pthread_t thread;
+  int fd;
+  metrics_flag_t stop;
+  int running;
+} MetricsServer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+void metrics_count (METRIC_COUNTER counter, uint64_t n);
+void metrics_error (WEATHER_ERROR error);
+void metrics_gauge_add (METRIC_GAUGE gauge, int64_t delta);
+// for gauges that are never added to
+void metrics_gauge_max (METRIC_GAUGE gauge, int64_t value);
+void metrics_observe (METRIC_HISTOGRAM histogram, double seconds);
+// monotonic seconds for timing observations
+double metrics_now (void);
+
+WEATHER_ERROR metrics_render (FILE *stream);
+// written next to path and renamed over it, so scrapers never see half a file
+WEATHER_ERROR metrics_write_file (const char *path);
+// answers every http request on 127.0.0.1:port with the metrics, from a
+// thread of its own
+WEATHER_ERROR metrics_serve (MetricsServer *server, unsigned short port);
+void metrics_stop (MetricsServer *server);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
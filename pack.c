@@ -0,0 +1,295 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pack.h"
+
+// clang-format off
+static size_t align_up (size_t offset);
+static const PackHeader *header_of (const PackView *view);
+static const PackEntry *entry_of (const PackView *view, size_t index);
+static int string_fits (const PackView *view, uint64_t offset);
+static int column_fits (const PackView *view, uint64_t offset, uint64_t count);
+// clang-format on
+
+size_t
+pack_size (const WeatherSeries *series, size_t nseries)
+{
+  size_t size = align_up (sizeof (PackHeader)) + nseries * sizeof (PackEntry);
+  for (size_t i = 0; i < nseries; i++)
+    size += strlen (series[i].parameter) + 1 + strlen (series[i].location) + 1;
+  size = align_up (size);
+
+  for (size_t i = 0; i < nseries; i++)
+    size += series[i].count * (sizeof (int64_t) + sizeof (double));
+  return size;
+}
+
+WEATHER_ERROR
+pack_write (const WeatherSeries *series, size_t nseries, void *out,
+	    size_t out_size)
+{
+  if ((!series && nseries) || !out || (uintptr_t) out % PACK_ALIGN
+      || nseries > UINT32_MAX)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  size_t size = pack_size (series, nseries);
+  if (out_size < size)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  uint8_t *base = out;
+  memset (base, 0, size);
+
+  PackHeader *header = (PackHeader *) base;
+  memcpy (header->magic, PACK_MAGIC, 4);
+  header->major = PACK_VERSION_MAJOR;
+  header->minor = PACK_VERSION_MINOR;
+  header->byte_order = PACK_BYTE_ORDER;
+  header->header_size = sizeof (PackHeader);
+  header->entry_size = sizeof (PackEntry);
+  header->nseries = (uint32_t) nseries;
+  header->total_size = size;
+  header->entries_offset = align_up (sizeof (PackHeader));
+
+  PackEntry *entries = (PackEntry *) (base + header->entries_offset);
+  size_t strings = header->entries_offset + nseries * sizeof (PackEntry);
+  for (size_t i = 0; i < nseries; i++)
+  {
+    size_t len = strlen (series[i].parameter) + 1;
+    memcpy (base + strings, series[i].parameter, len);
+    entries[i].parameter_offset = strings;
+    strings += len;
+
+    len = strlen (series[i].location) + 1;
+    memcpy (base + strings, series[i].location, len);
+    entries[i].location_offset = strings;
+    strings += len;
+  }
+
+  size_t columns = align_up (strings);
+  for (size_t i = 0; i < nseries; i++)
+  {
+    size_t bytes = series[i].count * sizeof (int64_t);
+    entries[i].count = series[i].count;
+    entries[i].lat = series[i].lat;
+    entries[i].lon = series[i].lon;
+
+    entries[i].times_offset = columns;
+    if (bytes)
+      memcpy (base + columns, series[i].times, bytes);
+    columns += bytes;
+
+    entries[i].values_offset = columns;
+    if (bytes)
+      memcpy (base + columns, series[i].values, bytes);
+    columns += bytes;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+pack_save (const char *path, const WeatherSeries *series, size_t nseries)
+{
+  if (!path)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  char temporary[4096];
+  int len = snprintf (temporary, sizeof (temporary), "%s.XXXXXX", path);
+  if (len < 0 || (size_t) len >= sizeof (temporary))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  // malloc is aligned well enough for the columns
+  size_t size = pack_size (series, nseries);
+  void *buffer = malloc (size);
+  if (!buffer)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  WEATHER_ERROR status = pack_write (series, nseries, buffer, size);
+  if (WEATHER_SUCCESS != status)
+  {
+    free (buffer);
+    return status;
+  }
+
+  // mkstemp creates it for the owner only, the pack is for other processes
+  int fd = mkstemp (temporary);
+  FILE *file = NULL;
+  if (fd >= 0 && fchmod (fd, 0644) == 0)
+    file = fdopen (fd, "wb");
+  if (!file)
+  {
+    if (fd >= 0)
+    {
+      close (fd);
+      unlink (temporary);
+    }
+    free (buffer);
+    ERROR ("Failed to open pack file\n");
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  if (fwrite (buffer, size, 1, file) != 1)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+  if (fclose (file) != 0 && WEATHER_SUCCESS == status)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+  free (buffer);
+
+  if (WEATHER_SUCCESS != status || rename (temporary, path) != 0)
+  {
+    unlink (temporary);
+    return WEATHER_SUCCESS != status ? status : WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+pack_view (PackView *view, const void *data, size_t size)
+{
+  if (!view || !data || (uintptr_t) data % PACK_ALIGN)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (view, 0, sizeof (*view));
+  view->base = data;
+  view->size = size;
+
+  const PackHeader *header = header_of (view);
+  if (size < sizeof (PackHeader) || memcmp (header->magic, PACK_MAGIC, 4) != 0
+      || header->byte_order != PACK_BYTE_ORDER
+      || header->major != PACK_VERSION_MAJOR
+      || header->header_size < sizeof (PackHeader)
+      || header->entry_size < sizeof (PackEntry)
+      || header->entry_size % PACK_ALIGN || header->total_size > size
+      || header->entries_offset % PACK_ALIGN
+      || header->entries_offset < header->header_size
+      || header->entries_offset > header->total_size
+      || (header->total_size - header->entries_offset) / header->entry_size
+	   < header->nseries)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  // the rest of the file is only trusted up to total_size
+  view->size = header->total_size;
+  for (size_t i = 0; i < header->nseries; i++)
+  {
+    const PackEntry *entry = entry_of (view, i);
+    if (!string_fits (view, entry->parameter_offset)
+	|| !string_fits (view, entry->location_offset)
+	|| !column_fits (view, entry->times_offset, entry->count)
+	|| !column_fits (view, entry->values_offset, entry->count))
+      return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+pack_map (PackView *view, const char *path)
+{
+  if (!view || !path)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  int fd = open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    ERROR (strerror (errno));
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  struct stat info;
+  if (fstat (fd, &info) != 0 || info.st_size < (off_t) sizeof (PackHeader))
+  {
+    close (fd);
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  // the mapping outlives the descriptor
+  void *map = mmap (NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+  {
+    ERROR (strerror (errno));
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  WEATHER_ERROR status = pack_view (view, map, (size_t) info.st_size);
+  if (WEATHER_SUCCESS != status)
+  {
+    munmap (map, (size_t) info.st_size);
+    memset (view, 0, sizeof (*view));
+    return status;
+  }
+
+  view->map = map;
+  view->map_size = (size_t) info.st_size;
+  return WEATHER_SUCCESS;
+}
+
+void
+pack_unmap (PackView *view)
+{
+  if (!view || !view->map)
+    return;
+
+  munmap (view->map, view->map_size);
+  memset (view, 0, sizeof (*view));
+}
+
+size_t
+pack_count (const PackView *view)
+{
+  return view && view->base ? header_of (view)->nseries : 0;
+}
+
+WEATHER_ERROR
+pack_series (const PackView *view, size_t index, PackSeries *series)
+{
+  if (!view || !view->base || !series || index >= pack_count (view))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  const PackEntry *entry = entry_of (view, index);
+  series->parameter = (const char *) (view->base + entry->parameter_offset);
+  series->location = (const char *) (view->base + entry->location_offset);
+  series->lat = entry->lat;
+  series->lon = entry->lon;
+  series->times = (const int64_t *) (view->base + entry->times_offset);
+  series->values = (const double *) (view->base + entry->values_offset);
+  series->count = entry->count;
+  return WEATHER_SUCCESS;
+}
+
+static size_t
+align_up (size_t offset)
+{
+  return (offset + PACK_ALIGN - 1) & ~(size_t) (PACK_ALIGN - 1);
+}
+
+static const PackHeader *
+header_of (const PackView *view)
+{
+  return (const PackHeader *) view->base;
+}
+
+static const PackEntry *
+entry_of (const PackView *view, size_t index)
+{
+  const PackHeader *header = header_of (view);
+  return (const PackEntry *) (view->base + header->entries_offset
+			      + index * header->entry_size);
+}
+
+static int
+string_fits (const PackView *view, uint64_t offset)
+{
+  return offset < view->size
+	 && memchr (view->base + offset, '\0', view->size - offset) != NULL;
+}
+
+static int
+column_fits (const PackView *view, uint64_t offset, uint64_t count)
+{
+  return offset % PACK_ALIGN == 0 && offset <= view->size
+	 && count <= (view->size - offset) / sizeof (int64_t);
+}
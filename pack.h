@@ -0,0 +1,102 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decode.h"
+#include "weather.h"
+
+// binary hand-off format for decoded series. another process maps the file
+// and reads the columns where they lie, nothing is parsed or copied:
+//
+//   PackHeader
+//   PackEntry[nseries]               entries_offset, entry_size apart
+//   strings                          parameter and location, nul terminated
+//   int64 times[count], double values[count] per series, 8 byte aligned
+//
+// everything is addressed by byte offsets from the start of the buffer, so a
+// pack can be written straight into shared memory and moved around freely.
+// integers and doubles are stored in the writer's byte order, byte_order
+// lets a reader on the other kind of machine refuse the pack.
+//
+// readers refuse another major version. a minor version only ever appends
+// fields to the header or the entries, which older readers skip over thanks
+// to header_size and entry_size.
+#define PACK_MAGIC "WXPK"
+#define PACK_VERSION_MAJOR 1
+#define PACK_VERSION_MINOR 0
+#define PACK_BYTE_ORDER 0x01020304u
+#define PACK_ALIGN 8
+
+typedef struct
+{
+  char magic[4];
+  uint16_t major;
+  uint16_t minor;
+  uint32_t byte_order;
+  uint32_t header_size;
+  uint32_t entry_size;
+  uint32_t nseries;
+  uint64_t total_size;
+  uint64_t entries_offset;
+} PackHeader;
+
+typedef struct
+{
+  uint64_t parameter_offset;
+  uint64_t location_offset;
+  uint64_t times_offset;
+  uint64_t values_offset;
+  uint64_t count;
+  double lat;
+  double lon;
+} PackEntry;
+
+// a validated pack, either a caller's buffer or a mapped file
+typedef struct
+{
+  const uint8_t *base;
+  size_t size;
+  void *map; // set by pack_map
+  size_t map_size;
+} PackView;
+
+// one series, every pointer points into the pack
+typedef struct
+{
+  const char *parameter;
+  const char *location;
+  double lat;
+  double lon;
+  const int64_t *times;
+  const double *values;
+  size_t count;
+} PackSeries;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+size_t pack_size (const WeatherSeries *series, size_t nseries);
+// out needs pack_size bytes and PACK_ALIGN alignment
+WEATHER_ERROR pack_write (const WeatherSeries *series, size_t nseries, void *out, size_t out_size);
+// written to a fresh file next to the path and renamed over it, readers
+// never see half a pack and concurrent writers never share a file
+WEATHER_ERROR pack_save (const char *path, const WeatherSeries *series, size_t nseries);
+
+// checks every offset once, after that pack_series cannot read out of bounds
+WEATHER_ERROR pack_view (PackView *view, const void *data, size_t size);
+WEATHER_ERROR pack_map (PackView *view, const char *path);
+// only for views from pack_map
+void pack_unmap (PackView *view);
+size_t pack_count (const PackView *view);
+WEATHER_ERROR pack_series (const PackView *view, size_t index, PackSeries *series);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1018 @@
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parquet.h"
+
+#define PARQUET_MAGIC "PAR1"
+#define PARQUET_CREATED_BY "meteomatics-c-client"
+#define PARQUET_DELTA_BLOCK 128
+#define PARQUET_DELTA_MINIBLOCKS 4
+#define PARQUET_THRIFT_DEPTH 8
+
+// the parts of parquet.thrift that get written here
+enum
+{
+  TYPE_INT64 = 2,
+  TYPE_DOUBLE = 5,
+  TYPE_BYTE_ARRAY = 6
+};
+enum
+{
+  ENCODING_PLAIN = 0,
+  ENCODING_RLE = 3,
+  ENCODING_DELTA_BINARY_PACKED = 5,
+  ENCODING_RLE_DICTIONARY = 8
+};
+enum
+{
+  PAGE_DATA = 0,
+  PAGE_DICTIONARY = 2
+};
+enum
+{
+  CONVERTED_NONE = -1,
+  CONVERTED_UTF8 = 0,
+  CONVERTED_TIMESTAMP_MILLIS = 9
+};
+#define REPETITION_REQUIRED 0
+#define CODEC_UNCOMPRESSED 0
+
+// thrift compact protocol field types
+enum
+{
+  THRIFT_TRUE = 1,
+  THRIFT_FALSE = 2,
+  THRIFT_I32 = 5,
+  THRIFT_I64 = 6,
+  THRIFT_BINARY = 8,
+  THRIFT_LIST = 9,
+  THRIFT_STRUCT = 12
+};
+
+typedef struct
+{
+  const char *name;
+  int type;
+  int converted;
+} ColumnInfo;
+
+static const ColumnInfo COLUMNS[PARQUET_COLUMN_COUNT] = {
+  {"parameter", TYPE_BYTE_ARRAY, CONVERTED_UTF8},
+  {"location", TYPE_BYTE_ARRAY, CONVERTED_UTF8},
+  {"lat", TYPE_DOUBLE, CONVERTED_NONE},
+  {"lon", TYPE_DOUBLE, CONVERTED_NONE},
+  {"time", TYPE_INT64, CONVERTED_TIMESTAMP_MILLIS},
+  {"value", TYPE_DOUBLE, CONVERTED_NONE},
+};
+
+typedef struct
+{
+  ParquetBuffer out;
+  int16_t last[PARQUET_THRIFT_DEPTH]; // previous field id per nesting level
+  int depth;
+} Thrift;
+
+// clang-format off
+static int buffer_reserve (ParquetBuffer *buffer, size_t extra);
+static void buffer_put (ParquetBuffer *buffer, const void *data, size_t len);
+static void buffer_byte (ParquetBuffer *buffer, uint8_t byte);
+static void buffer_varint (ParquetBuffer *buffer, uint64_t value);
+static void buffer_le64 (ParquetBuffer *buffer, uint64_t value);
+static uint64_t zigzag (int64_t value);
+
+static void thrift_field (Thrift *t, int16_t id, uint8_t type);
+static void thrift_i32 (Thrift *t, int16_t id, int32_t value);
+static void thrift_i64 (Thrift *t, int16_t id, int64_t value);
+static void thrift_bool (Thrift *t, int16_t id, int value);
+static void thrift_binary (Thrift *t, int16_t id, const void *data, size_t len);
+static void thrift_list (Thrift *t, int16_t id, uint8_t type, size_t count);
+static void thrift_struct (Thrift *t, int16_t id);
+static void thrift_element (Thrift *t);
+static void thrift_end (Thrift *t);
+
+static void dictionary_reset (ParquetDictionary *dictionary);
+static uint32_t *dictionary_slot (ParquetDictionary *dictionary, const void *key, size_t len);
+static WEATHER_ERROR lookup_series (ParquetWriter *writer, const WeatherSeries *series, uint32_t *keys, int *full);
+
+static WEATHER_ERROR flush_row_group (ParquetWriter *writer);
+static void write_column (ParquetWriter *writer, PARQUET_COLUMN column, ParquetChunk *chunk);
+static void write_page (ParquetWriter *writer, int type, size_t values, int encoding);
+static void write_bytes (ParquetWriter *writer, const void *data, size_t len);
+static WEATHER_ERROR write_footer (ParquetWriter *writer);
+static void write_column_meta (Thrift *t, const ParquetRowGroup *group, PARQUET_COLUMN column);
+
+static void encode_indices (ParquetBuffer *page, const uint32_t *indices, size_t count, int width);
+static void encode_deltas (ParquetBuffer *page, const int64_t *values, size_t count);
+static void pack_bits (ParquetBuffer *page, const uint64_t *values, size_t count, size_t total, int width);
+static int bit_width (uint64_t value);
+
+static void dictionary_statistics (const ParquetDictionary *dictionary, int type, ParquetChunk *chunk);
+static void double_statistics (ParquetChunk *chunk, double min, double max);
+static void statistic (uint8_t *out, uint32_t *len, uint64_t bits);
+static void release (ParquetWriter *writer);
+// clang-format on
+
+WEATHER_ERROR
+parquet_open (ParquetWriter *writer, const char *path, size_t row_group_rows)
+{
+  if (!writer || !path)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (writer, 0, sizeof (*writer));
+  writer->row_group_rows
+    = row_group_rows ? row_group_rows : PARQUET_DEFAULT_ROW_GROUP_ROWS;
+  // page sizes are 32 bit in the page headers
+  if (writer->row_group_rows > INT32_MAX / sizeof (double))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  size_t len = strlen (path);
+  writer->path = strdup (path);
+  writer->temporary = malloc (len + sizeof (".XXXXXX"));
+  writer->dictionaries
+    = calloc (PARQUET_DICTIONARY_COLUMNS, sizeof (ParquetDictionary));
+  writer->times = malloc (writer->row_group_rows * sizeof (int64_t));
+  writer->values = malloc (writer->row_group_rows * sizeof (double));
+  int allocated = writer->path && writer->temporary && writer->dictionaries
+		  && writer->times && writer->values;
+  for (int c = 0; c < PARQUET_DICTIONARY_COLUMNS; c++)
+  {
+    writer->indices[c] = malloc (writer->row_group_rows * sizeof (uint32_t));
+    allocated = allocated && writer->indices[c];
+  }
+  if (!allocated)
+  {
+    release (writer);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+  memcpy (writer->temporary, path, len);
+  memcpy (writer->temporary + len, ".XXXXXX", sizeof (".XXXXXX"));
+
+  // a name of its own, two backfills of one path never share a file.
+  // mkstemp keeps it to the owner, readers are other processes
+  int fd = mkstemp (writer->temporary);
+  if (fd >= 0 && fchmod (fd, 0644) == 0)
+    writer->file = fdopen (fd, "wb");
+  if (!writer->file)
+  {
+    if (fd >= 0)
+    {
+      close (fd);
+      unlink (writer->temporary);
+    }
+    ERROR ("Failed to open parquet file\n");
+    release (writer);
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  write_bytes (writer, PARQUET_MAGIC, 4);
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+parquet_write_series (ParquetWriter *writer, const WeatherSeries *series,
+		      size_t nseries)
+{
+  if (!writer || !writer->file || (!series && nseries))
+    return WEATHER_ERROR_INVALID_CONFIG;
+  if (writer->failed)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  for (size_t i = 0; i < nseries; i++)
+  {
+    const WeatherSeries *current = &series[i];
+    if (!current->parameter || !current->location)
+      return WEATHER_ERROR_INVALID_CONFIG;
+
+    size_t done = 0;
+    while (done < current->count)
+    {
+      WEATHER_ERROR status = WEATHER_SUCCESS;
+      if (writer->rows == writer->row_group_rows)
+	status = flush_row_group (writer);
+
+      uint32_t keys[PARQUET_DICTIONARY_COLUMNS];
+      int full = 0;
+      if (WEATHER_SUCCESS == status)
+	status = lookup_series (writer, current, keys, &full);
+      if (WEATHER_SUCCESS == status && full)
+      {
+	status = flush_row_group (writer);
+	if (WEATHER_SUCCESS == status)
+	  continue;
+      }
+      if (WEATHER_SUCCESS != status)
+	return status;
+
+      size_t take = current->count - done;
+      if (take > writer->row_group_rows - writer->rows)
+	take = writer->row_group_rows - writer->rows;
+
+      for (size_t k = 0; k < take; k++)
+      {
+	size_t row = writer->rows + k;
+	for (int c = 0; c < PARQUET_DICTIONARY_COLUMNS; c++)
+	  writer->indices[c][row] = keys[c];
+	writer->times[row] = current->times[done + k] * 1000;
+	writer->values[row] = current->values[done + k];
+      }
+      writer->rows += take;
+      done += take;
+    }
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+parquet_close (ParquetWriter *writer)
+{
+  if (!writer || !writer->file)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  WEATHER_ERROR status = flush_row_group (writer);
+  if (WEATHER_SUCCESS == status)
+    status = write_footer (writer);
+
+  if (fclose (writer->file) != 0 && WEATHER_SUCCESS == status)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+  writer->file = NULL;
+
+  if (WEATHER_SUCCESS != status || rename (writer->temporary, writer->path) != 0)
+  {
+    unlink (writer->temporary);
+    if (WEATHER_SUCCESS == status)
+      status = WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  release (writer);
+  return status;
+}
+
+static int
+buffer_reserve (ParquetBuffer *buffer, size_t extra)
+{
+  if (buffer->failed)
+    return 0;
+  if (buffer->size + extra <= buffer->capacity)
+    return 1;
+
+  size_t capacity = buffer->capacity ? buffer->capacity : 256;
+  while (capacity < buffer->size + extra)
+    capacity *= 2;
+
+  uint8_t *data = realloc (buffer->data, capacity);
+  if (!data)
+  {
+    buffer->failed = 1;
+    return 0;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return 1;
+}
+
+static void
+buffer_put (ParquetBuffer *buffer, const void *data, size_t len)
+{
+  if (len && buffer_reserve (buffer, len))
+  {
+    memcpy (buffer->data + buffer->size, data, len);
+    buffer->size += len;
+  }
+}
+
+static void
+buffer_byte (ParquetBuffer *buffer, uint8_t byte)
+{
+  buffer_put (buffer, &byte, 1);
+}
+
+// uleb128
+static void
+buffer_varint (ParquetBuffer *buffer, uint64_t value)
+{
+  uint8_t bytes[10];
+  size_t len = 0;
+  do
+  {
+    bytes[len] = value & 0x7f;
+    value >>= 7;
+    if (value)
+      bytes[len] |= 0x80;
+    len++;
+  } while (value);
+  buffer_put (buffer, bytes, len);
+}
+
+// parquet is little endian whatever the machine is
+static void
+buffer_le64 (ParquetBuffer *buffer, uint64_t value)
+{
+  uint8_t bytes[8];
+  for (int i = 0; i < 8; i++)
+    bytes[i] = (uint8_t) (value >> (8 * i));
+  buffer_put (buffer, bytes, 8);
+}
+
+static uint64_t
+zigzag (int64_t value)
+{
+  return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static void
+thrift_field (Thrift *t, int16_t id, uint8_t type)
+{
+  int delta = id - t->last[t->depth];
+  if (delta > 0 && delta <= 15)
+    buffer_byte (&t->out, (uint8_t) (delta << 4 | type));
+  else
+  {
+    buffer_byte (&t->out, type);
+    buffer_varint (&t->out, zigzag (id));
+  }
+  t->last[t->depth] = id;
+}
+
+static void
+thrift_i32 (Thrift *t, int16_t id, int32_t value)
+{
+  thrift_field (t, id, THRIFT_I32);
+  buffer_varint (&t->out, zigzag (value));
+}
+
+static void
+thrift_i64 (Thrift *t, int16_t id, int64_t value)
+{
+  thrift_field (t, id, THRIFT_I64);
+  buffer_varint (&t->out, zigzag (value));
+}
+
+// the value is part of the field type, there is nothing after it
+static void
+thrift_bool (Thrift *t, int16_t id, int value)
+{
+  thrift_field (t, id, value ? THRIFT_TRUE : THRIFT_FALSE);
+}
+
+static void
+thrift_binary (Thrift *t, int16_t id, const void *data, size_t len)
+{
+  thrift_field (t, id, THRIFT_BINARY);
+  buffer_varint (&t->out, len);
+  buffer_put (&t->out, data, len);
+}
+
+// the elements follow, written with buffer_varint for integers and strings
+// or thrift_element for structs
+static void
+thrift_list (Thrift *t, int16_t id, uint8_t type, size_t count)
+{
+  thrift_field (t, id, THRIFT_LIST);
+  if (count < 15)
+    buffer_byte (&t->out, (uint8_t) (count << 4 | type));
+  else
+  {
+    buffer_byte (&t->out, 0xf0 | type);
+    buffer_varint (&t->out, count);
+  }
+}
+
+static void
+thrift_struct (Thrift *t, int16_t id)
+{
+  thrift_field (t, id, THRIFT_STRUCT);
+  thrift_element (t);
+}
+
+static void
+thrift_element (Thrift *t)
+{
+  t->depth++;
+  t->last[t->depth] = 0;
+}
+
+static void
+thrift_end (Thrift *t)
+{
+  buffer_byte (&t->out, 0);
+  if (t->depth > 0)
+    t->depth--;
+}
+
+static void
+dictionary_reset (ParquetDictionary *dictionary)
+{
+  dictionary->bytes.size = 0;
+  dictionary->count = 0;
+  memset (dictionary->slots, 0, sizeof (dictionary->slots));
+}
+
+// the slot holding the key, or the free one it would go into. the table is
+// twice the largest dictionary so there always is one
+static uint32_t *
+dictionary_slot (ParquetDictionary *dictionary, const void *key, size_t len)
+{
+  size_t mask = sizeof (dictionary->slots) / sizeof (dictionary->slots[0]) - 1;
+  size_t slot = weather_hash_bytes (key, len, WEATHER_HASH_SEED) & mask;
+
+  for (;; slot = (slot + 1) & mask)
+  {
+    uint32_t entry = dictionary->slots[slot];
+    if (!entry
+	|| (dictionary->lengths[entry - 1] == len
+	    && memcmp (dictionary->bytes.data + dictionary->offsets[entry - 1],
+		       key, len)
+		 == 0))
+      return &dictionary->slots[slot];
+  }
+}
+
+// every point of a series shares its dictionary entries, they are looked up
+// once. *full is set, and nothing added, when one dictionary has no room
+static WEATHER_ERROR
+lookup_series (ParquetWriter *writer, const WeatherSeries *series,
+	       uint32_t *keys, int *full)
+{
+  const void *key[PARQUET_DICTIONARY_COLUMNS]
+    = {series->parameter, series->location, &series->lat, &series->lon};
+  size_t len[PARQUET_DICTIONARY_COLUMNS]
+    = {strlen (series->parameter), strlen (series->location), sizeof (double),
+       sizeof (double)};
+  uint32_t *slots[PARQUET_DICTIONARY_COLUMNS];
+
+  for (int c = 0; c < PARQUET_DICTIONARY_COLUMNS; c++)
+  {
+    ParquetDictionary *dictionary = &writer->dictionaries[c];
+    slots[c] = dictionary_slot (dictionary, key[c], len[c]);
+    if (!*slots[c] && dictionary->count == PARQUET_MAX_DICTIONARY)
+    {
+      *full = 1;
+      return WEATHER_SUCCESS;
+    }
+  }
+
+  for (int c = 0; c < PARQUET_DICTIONARY_COLUMNS; c++)
+  {
+    ParquetDictionary *dictionary = &writer->dictionaries[c];
+    if (!*slots[c])
+    {
+      size_t offset = dictionary->bytes.size;
+      buffer_put (&dictionary->bytes, key[c], len[c]);
+      if (dictionary->bytes.failed || offset + len[c] > UINT32_MAX)
+	return WEATHER_ERROR_INVALID_MEMORY;
+
+      dictionary->offsets[dictionary->count] = (uint32_t) offset;
+      dictionary->lengths[dictionary->count] = (uint32_t) len[c];
+      *slots[c] = (uint32_t) ++dictionary->count;
+    }
+    keys[c] = *slots[c] - 1;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+flush_row_group (ParquetWriter *writer)
+{
+  if (writer->failed)
+    return WEATHER_ERROR_INVALID_MEMORY;
+  if (writer->rows == 0)
+    return WEATHER_SUCCESS;
+
+  if (writer->ngroups == writer->group_capacity)
+  {
+    size_t capacity = writer->group_capacity ? writer->group_capacity * 2 : 16;
+    ParquetRowGroup *groups
+      = realloc (writer->groups, capacity * sizeof (*groups));
+    if (!groups)
+      return WEATHER_ERROR_INVALID_MEMORY;
+    writer->groups = groups;
+    writer->group_capacity = capacity;
+  }
+
+  ParquetRowGroup *group = &writer->groups[writer->ngroups];
+  memset (group, 0, sizeof (*group));
+  group->offset = writer->offset;
+  group->rows = (int64_t) writer->rows;
+
+  for (int c = 0; c < PARQUET_COLUMN_COUNT; c++)
+    write_column (writer, (PARQUET_COLUMN) c, &group->columns[c]);
+  group->size = writer->offset - group->offset;
+  if (writer->failed)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  writer->ngroups++;
+  writer->total_rows += group->rows;
+  writer->rows = 0;
+  for (int c = 0; c < PARQUET_DICTIONARY_COLUMNS; c++)
+    dictionary_reset (&writer->dictionaries[c]);
+  return WEATHER_SUCCESS;
+}
+
+static void
+write_column (ParquetWriter *writer, PARQUET_COLUMN column, ParquetChunk *chunk)
+{
+  ParquetBuffer *page = &writer->page;
+  int64_t start = writer->offset;
+  size_t rows = writer->rows;
+
+  if (column < PARQUET_DICTIONARY_COLUMNS)
+  {
+    const ParquetDictionary *dictionary = &writer->dictionaries[column];
+    page->size = 0;
+    for (size_t i = 0; i < dictionary->count; i++)
+    {
+      const uint8_t *entry = dictionary->bytes.data + dictionary->offsets[i];
+      uint32_t len = dictionary->lengths[i];
+      if (TYPE_BYTE_ARRAY == COLUMNS[column].type)
+      {
+	uint8_t prefix[4]
+	  = {len & 0xff, (len >> 8) & 0xff, (len >> 16) & 0xff, len >> 24};
+	buffer_put (page, prefix, 4);
+	buffer_put (page, entry, len);
+      }
+      else
+      {
+	uint64_t bits;
+	memcpy (&bits, entry, sizeof (bits));
+	buffer_le64 (page, bits);
+      }
+    }
+    chunk->dictionary_offset = writer->offset;
+    write_page (writer, PAGE_DICTIONARY, dictionary->count, ENCODING_PLAIN);
+
+    // a lone entry still gets a 1 bit index, not every reader takes 0
+    int width = bit_width (dictionary->count - 1);
+    page->size = 0;
+    encode_indices (page, writer->indices[column], rows, width ? width : 1);
+    chunk->data_offset = writer->offset;
+    write_page (writer, PAGE_DATA, rows, ENCODING_RLE_DICTIONARY);
+
+    chunk->distinct = (int64_t) dictionary->count;
+    dictionary_statistics (dictionary, COLUMNS[column].type, chunk);
+  }
+  else if (PARQUET_COLUMN_TIME == column)
+  {
+    page->size = 0;
+    encode_deltas (page, writer->times, rows);
+    chunk->data_offset = writer->offset;
+    write_page (writer, PAGE_DATA, rows, ENCODING_DELTA_BINARY_PACKED);
+
+    int64_t min = writer->times[0];
+    int64_t max = writer->times[0];
+    for (size_t i = 1; i < rows; i++)
+    {
+      if (writer->times[i] < min)
+	min = writer->times[i];
+      if (writer->times[i] > max)
+	max = writer->times[i];
+    }
+    statistic (chunk->min, &chunk->min_len, (uint64_t) min);
+    statistic (chunk->max, &chunk->max_len, (uint64_t) max);
+    chunk->has_statistics = 1;
+  }
+  else
+  {
+    page->size = 0;
+    if (buffer_reserve (page, rows * sizeof (double)))
+      for (size_t i = 0; i < rows; i++)
+      {
+	uint64_t bits;
+	memcpy (&bits, &writer->values[i], sizeof (bits));
+	buffer_le64 (page, bits);
+      }
+    chunk->data_offset = writer->offset;
+    write_page (writer, PAGE_DATA, rows, ENCODING_PLAIN);
+
+    // nan has no order, it is left out of the statistics
+    double min = NAN;
+    double max = NAN;
+    for (size_t i = 0; i < rows; i++)
+      if (!isnan (writer->values[i]))
+      {
+	if (isnan (min) || writer->values[i] < min)
+	  min = writer->values[i];
+	if (isnan (max) || writer->values[i] > max)
+	  max = writer->values[i];
+      }
+    double_statistics (chunk, min, max);
+  }
+
+  chunk->size = writer->offset - start;
+}
+
+static void
+write_page (ParquetWriter *writer, int type, size_t values, int encoding)
+{
+  if (writer->page.failed)
+  {
+    writer->failed = 1;
+    return;
+  }
+
+  Thrift t = {0};
+  thrift_i32 (&t, 1, type);
+  thrift_i32 (&t, 2, (int32_t) writer->page.size); // uncompressed
+  thrift_i32 (&t, 3, (int32_t) writer->page.size); // compressed
+  if (PAGE_DATA == type)
+  {
+    // every column is required, there are no levels to encode
+    thrift_struct (&t, 5);
+    thrift_i32 (&t, 1, (int32_t) values);
+    thrift_i32 (&t, 2, encoding);
+    thrift_i32 (&t, 3, ENCODING_RLE);
+    thrift_i32 (&t, 4, ENCODING_RLE);
+    thrift_end (&t);
+  }
+  else
+  {
+    thrift_struct (&t, 7);
+    thrift_i32 (&t, 1, (int32_t) values);
+    thrift_i32 (&t, 2, encoding);
+    thrift_end (&t);
+  }
+  thrift_end (&t);
+
+  if (t.out.failed)
+    writer->failed = 1;
+  else
+    write_bytes (writer, t.out.data, t.out.size);
+  free (t.out.data);
+  write_bytes (writer, writer->page.data, writer->page.size);
+}
+
+static void
+write_bytes (ParquetWriter *writer, const void *data, size_t len)
+{
+  if (writer->failed || !len)
+    return;
+  if (fwrite (data, len, 1, writer->file) != 1)
+  {
+    writer->failed = 1;
+    return;
+  }
+  writer->offset += (int64_t) len;
+}
+
+static WEATHER_ERROR
+write_footer (ParquetWriter *writer)
+{
+  Thrift t = {0};
+  thrift_i32 (&t, 1, 1); // format version
+
+  thrift_list (&t, 2, THRIFT_STRUCT, 1 + PARQUET_COLUMN_COUNT);
+  thrift_element (&t);
+  thrift_binary (&t, 4, "schema", 6);
+  thrift_i32 (&t, 5, PARQUET_COLUMN_COUNT);
+  thrift_end (&t);
+  for (int c = 0; c < PARQUET_COLUMN_COUNT; c++)
+  {
+    const ColumnInfo *info = &COLUMNS[c];
+    thrift_element (&t);
+    thrift_i32 (&t, 1, info->type);
+    thrift_i32 (&t, 3, REPETITION_REQUIRED);
+    thrift_binary (&t, 4, info->name, strlen (info->name));
+    if (CONVERTED_NONE != info->converted)
+      thrift_i32 (&t, 6, info->converted);
+
+    // the same again as a logical type, which newer readers look at first
+    if (CONVERTED_UTF8 == info->converted)
+    {
+      thrift_struct (&t, 10);
+      thrift_struct (&t, 1); // STRING
+      thrift_end (&t);
+      thrift_end (&t);
+    }
+    else if (CONVERTED_TIMESTAMP_MILLIS == info->converted)
+    {
+      thrift_struct (&t, 10);
+      thrift_struct (&t, 8); // TIMESTAMP
+      thrift_bool (&t, 1, 1); // adjusted to utc
+      thrift_struct (&t, 2);
+      thrift_struct (&t, 1); // MILLIS
+      thrift_end (&t);
+      thrift_end (&t);
+      thrift_end (&t);
+      thrift_end (&t);
+    }
+    thrift_end (&t);
+  }
+
+  thrift_i64 (&t, 3, writer->total_rows);
+
+  thrift_list (&t, 4, THRIFT_STRUCT, writer->ngroups);
+  for (size_t g = 0; g < writer->ngroups; g++)
+  {
+    const ParquetRowGroup *group = &writer->groups[g];
+    thrift_element (&t);
+    thrift_list (&t, 1, THRIFT_STRUCT, PARQUET_COLUMN_COUNT);
+    for (int c = 0; c < PARQUET_COLUMN_COUNT; c++)
+      write_column_meta (&t, group, (PARQUET_COLUMN) c);
+    thrift_i64 (&t, 2, group->size);
+    thrift_i64 (&t, 3, group->rows);
+    thrift_i64 (&t, 5, group->offset);
+    thrift_i64 (&t, 6, group->size);
+    thrift_end (&t);
+  }
+
+  thrift_binary (&t, 6, PARQUET_CREATED_BY, strlen (PARQUET_CREATED_BY));
+
+  // min_value and max_value follow each type's natural order, readers
+  // ignore them unless that is spelled out
+  thrift_list (&t, 7, THRIFT_STRUCT, PARQUET_COLUMN_COUNT);
+  for (int c = 0; c < PARQUET_COLUMN_COUNT; c++)
+  {
+    thrift_element (&t);
+    thrift_struct (&t, 1); // TYPE_ORDER
+    thrift_end (&t);
+    thrift_end (&t);
+  }
+  thrift_end (&t);
+
+  if (t.out.failed || t.out.size > UINT32_MAX)
+  {
+    free (t.out.data);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  uint32_t len = (uint32_t) t.out.size;
+  uint8_t trailer[8] = {len & 0xff, (len >> 8) & 0xff, (len >> 16) & 0xff,
+			len >> 24,   'P',	  'A',		 'R',
+			'1'};
+  write_bytes (writer, t.out.data, t.out.size);
+  write_bytes (writer, trailer, sizeof (trailer));
+  free (t.out.data);
+  return writer->failed ? WEATHER_ERROR_INVALID_MEMORY : WEATHER_SUCCESS;
+}
+
+static void
+write_column_meta (Thrift *t, const ParquetRowGroup *group,
+		   PARQUET_COLUMN column)
+{
+  const ParquetChunk *chunk = &group->columns[column];
+  const ColumnInfo *info = &COLUMNS[column];
+  int dictionary = column < PARQUET_DICTIONARY_COLUMNS;
+
+  thrift_element (t);
+  thrift_i64 (t, 2,
+	      dictionary ? chunk->dictionary_offset : chunk->data_offset);
+  thrift_struct (t, 3);
+  thrift_i32 (t, 1, info->type);
+
+  if (dictionary)
+  {
+    thrift_list (t, 2, THRIFT_I32, 2);
+    buffer_varint (&t->out, zigzag (ENCODING_PLAIN));
+    buffer_varint (&t->out, zigzag (ENCODING_RLE_DICTIONARY));
+  }
+  else
+  {
+    thrift_list (t, 2, THRIFT_I32, 1);
+    buffer_varint (&t->out, zigzag (PARQUET_COLUMN_TIME == column
+				      ? ENCODING_DELTA_BINARY_PACKED
+				      : ENCODING_PLAIN));
+  }
+
+  thrift_list (t, 3, THRIFT_BINARY, 1);
+  buffer_varint (&t->out, strlen (info->name));
+  buffer_put (&t->out, info->name, strlen (info->name));
+
+  thrift_i32 (t, 4, CODEC_UNCOMPRESSED);
+  thrift_i64 (t, 5, group->rows);
+  thrift_i64 (t, 6, chunk->size);
+  thrift_i64 (t, 7, chunk->size);
+  thrift_i64 (t, 9, chunk->data_offset);
+  if (dictionary)
+    thrift_i64 (t, 11, chunk->dictionary_offset);
+
+  thrift_struct (t, 12);
+  thrift_i64 (t, 3, 0); // null count, every column is required
+  if (chunk->distinct)
+    thrift_i64 (t, 4, chunk->distinct);
+  if (chunk->has_statistics)
+  {
+    thrift_binary (t, 5, chunk->max, chunk->max_len);
+    thrift_binary (t, 6, chunk->min, chunk->min_len);
+  }
+  thrift_end (t);
+
+  thrift_end (t); // ColumnMetaData
+  thrift_end (t); // ColumnChunk
+}
+
+// the rle half of parquet's rle/bit-packed hybrid: a run of the same index
+// is its length and the index once. series give long runs, so bit packing
+// would only make this bigger
+static void
+encode_indices (ParquetBuffer *page, const uint32_t *indices, size_t count,
+		int width)
+{
+  buffer_byte (page, (uint8_t) width);
+  int bytes = (width + 7) / 8;
+
+  for (size_t i = 0; i < count;)
+  {
+    size_t run = 1;
+    while (i + run < count && indices[i + run] == indices[i])
+      run++;
+
+    buffer_varint (page, (uint64_t) run << 1);
+    for (int b = 0; b < bytes; b++)
+      buffer_byte (page, (uint8_t) (indices[i] >> (8 * b)));
+    i += run;
+  }
+}
+
+// blocks of 128 deltas in 4 miniblocks, each bit packed at its own width
+// after subtracting the block's smallest delta. hourly data has the same
+// delta everywhere and packs to width 0
+static void
+encode_deltas (ParquetBuffer *page, const int64_t *values, size_t count)
+{
+  size_t per_miniblock = PARQUET_DELTA_BLOCK / PARQUET_DELTA_MINIBLOCKS;
+
+  buffer_varint (page, PARQUET_DELTA_BLOCK);
+  buffer_varint (page, PARQUET_DELTA_MINIBLOCKS);
+  buffer_varint (page, count);
+  buffer_varint (page, zigzag (count ? values[0] : 0));
+
+  for (size_t i = 1; i < count; i += PARQUET_DELTA_BLOCK)
+  {
+    size_t block = count - i;
+    if (block > PARQUET_DELTA_BLOCK)
+      block = PARQUET_DELTA_BLOCK;
+
+    // wrapping arithmetic, the reader wraps the same way
+    uint64_t deltas[PARQUET_DELTA_BLOCK];
+    int64_t min = INT64_MAX;
+    for (size_t k = 0; k < block; k++)
+    {
+      int64_t delta
+	= (int64_t) ((uint64_t) values[i + k] - (uint64_t) values[i + k - 1]);
+      deltas[k] = (uint64_t) delta;
+      if (delta < min)
+	min = delta;
+    }
+    for (size_t k = 0; k < block; k++)
+      deltas[k] -= (uint64_t) min;
+    buffer_varint (page, zigzag (min));
+
+    // miniblocks past the last value are left out, only their width stays
+    size_t used = (block + per_miniblock - 1) / per_miniblock;
+    uint8_t widths[PARQUET_DELTA_MINIBLOCKS] = {0};
+    for (size_t m = 0; m < used; m++)
+    {
+      uint64_t bits = 0;
+      for (size_t k = m * per_miniblock;
+	   k < block && k < (m + 1) * per_miniblock; k++)
+	bits |= deltas[k];
+      widths[m] = (uint8_t) bit_width (bits);
+    }
+    buffer_put (page, widths, sizeof (widths));
+
+    for (size_t m = 0; m < used; m++)
+    {
+      size_t first = m * per_miniblock;
+      size_t n = block - first < per_miniblock ? block - first : per_miniblock;
+      pack_bits (page, deltas + first, n, per_miniblock, widths[m]);
+    }
+  }
+}
+
+// lsb first, total values worth of space with the ones past count zero
+static void
+pack_bits (ParquetBuffer *page, const uint64_t *values, size_t count,
+	   size_t total, int width)
+{
+  size_t bytes = total * (size_t) width / 8;
+  if (!bytes || !buffer_reserve (page, bytes))
+    return;
+
+  uint8_t *out = page->data + page->size;
+  memset (out, 0, bytes);
+  size_t bit = 0;
+  for (size_t k = 0; k < count; k++)
+    for (int b = 0; b < width; b++, bit++)
+      if ((values[k] >> b) & 1)
+	out[bit >> 3] |= (uint8_t) (1u << (bit & 7));
+  page->size += bytes;
+}
+
+static int
+bit_width (uint64_t value)
+{
+  return value ? 64 - __builtin_clzll (value) : 0;
+}
+
+static void
+dictionary_statistics (const ParquetDictionary *dictionary, int type,
+		       ParquetChunk *chunk)
+{
+  if (!dictionary->count)
+    return;
+
+  if (TYPE_DOUBLE == type)
+  {
+    double min = NAN;
+    double max = NAN;
+    for (size_t i = 0; i < dictionary->count; i++)
+    {
+      double value;
+      memcpy (&value, dictionary->bytes.data + dictionary->offsets[i],
+	      sizeof (value));
+      if (isnan (value))
+	continue;
+      if (isnan (min) || value < min)
+	min = value;
+      if (isnan (max) || value > max)
+	max = value;
+    }
+    double_statistics (chunk, min, max);
+    return;
+  }
+
+  // strings compare as unsigned bytes, a prefix sorts first
+  size_t min = 0;
+  size_t max = 0;
+  for (size_t i = 1; i < dictionary->count; i++)
+  {
+    for (int pass = 0; pass < 2; pass++)
+    {
+      size_t other = pass ? max : min;
+      uint32_t len = dictionary->lengths[i];
+      uint32_t other_len = dictionary->lengths[other];
+      int order = memcmp (dictionary->bytes.data + dictionary->offsets[i],
+			  dictionary->bytes.data + dictionary->offsets[other],
+			  len < other_len ? len : other_len);
+      if (!order)
+	order = (len > other_len) - (len < other_len);
+      if (!pass && order < 0)
+	min = i;
+      if (pass && order > 0)
+	max = i;
+    }
+  }
+
+  if (dictionary->lengths[min] > PARQUET_MAX_STATISTIC
+      || dictionary->lengths[max] > PARQUET_MAX_STATISTIC)
+    return;
+
+  chunk->min_len = dictionary->lengths[min];
+  chunk->max_len = dictionary->lengths[max];
+  memcpy (chunk->min, dictionary->bytes.data + dictionary->offsets[min],
+	  chunk->min_len);
+  memcpy (chunk->max, dictionary->bytes.data + dictionary->offsets[max],
+	  chunk->max_len);
+  chunk->has_statistics = 1;
+}
+
+// a zero bound is written as -0.0 for min and +0.0 for max, as the format
+// asks, so readers comparing with either sign stay correct
+static void
+double_statistics (ParquetChunk *chunk, double min, double max)
+{
+  if (isnan (min))
+    return;
+
+  if (min == 0)
+    min = -0.0;
+  if (max == 0)
+    max = 0.0;
+
+  uint64_t bits;
+  memcpy (&bits, &min, sizeof (bits));
+  statistic (chunk->min, &chunk->min_len, bits);
+  memcpy (&bits, &max, sizeof (bits));
+  statistic (chunk->max, &chunk->max_len, bits);
+  chunk->has_statistics = 1;
+}
+
+static void
+statistic (uint8_t *out, uint32_t *len, uint64_t bits)
+{
+  for (int i = 0; i < 8; i++)
+    out[i] = (uint8_t) (bits >> (8 * i));
+  *len = 8;
+}
+
+static void
+release (ParquetWriter *writer)
+{
+  if (writer->file)
+    fclose (writer->file);
+  if (writer->dictionaries)
+    for (int c = 0; c < PARQUET_DICTIONARY_COLUMNS; c++)
+      free (writer->dictionaries[c].bytes.data);
+  for (int c = 0; c < PARQUET_DICTIONARY_COLUMNS; c++)
+    free (writer->indices[c]);
+  free (writer->dictionaries);
+  free (writer->times);
+  free (writer->values);
+  free (writer->groups);
+  free (writer->page.data);
+  free (writer->path);
+  free (writer->temporary);
+  memset (writer, 0, sizeof (*writer));
+}
@@ -0,0 +1,122 @@
+#ifndef PARQUET_H
+#define PARQUET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+#include "weather.h"
+
+// parquet output for backfills. every point becomes a row of
+//
+//   parameter  string     dictionary
+//   location   string     dictionary
+//   lat, lon   double     dictionary
+//   time       timestamp  delta binary packed, milliseconds utc
+//   value      double     plain
+//
+// the four dictionary columns repeat for every point of a series, so their
+// indices run length encode down to a few bytes per series, and regular
+// time steps delta encode to almost nothing. pages are not compressed.
+//
+// rows are collected into a row group of row_group_rows and each full row
+// group is encoded and written out straight away, so memory stays at one row
+// group however long the backfill runs. only the footer (a few hundred bytes
+// per row group) is kept until parquet_close. every column chunk carries
+// min/max statistics, readers use them to skip row groups.
+#define PARQUET_DEFAULT_ROW_GROUP_ROWS (128 * 1024)
+#define PARQUET_MAX_DICTIONARY 4096 // a full dictionary ends the row group early
+#define PARQUET_MAX_STATISTIC 64 // longer strings get no min/max
+
+typedef enum
+{
+  PARQUET_COLUMN_PARAMETER,
+  PARQUET_COLUMN_LOCATION,
+  PARQUET_COLUMN_LAT,
+  PARQUET_COLUMN_LON,
+  PARQUET_DICTIONARY_COLUMNS, // the ones before this are dictionary encoded
+  PARQUET_COLUMN_TIME = PARQUET_DICTIONARY_COLUMNS,
+  PARQUET_COLUMN_VALUE,
+  PARQUET_COLUMN_COUNT
+} PARQUET_COLUMN;
+
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  int failed; // an allocation failed, everything after it was dropped
+} ParquetBuffer;
+
+typedef struct
+{
+  ParquetBuffer bytes; // the entries back to back
+  uint32_t offsets[PARQUET_MAX_DICTIONARY];
+  uint32_t lengths[PARQUET_MAX_DICTIONARY];
+  size_t count;
+  uint32_t slots[2 * PARQUET_MAX_DICTIONARY]; // entry + 1, 0 is free
+} ParquetDictionary;
+
+typedef struct
+{
+  int64_t dictionary_offset; // 0 when there is no dictionary page
+  int64_t data_offset;
+  int64_t size; // every page of the chunk, headers included
+  int64_t distinct;
+  uint8_t min[PARQUET_MAX_STATISTIC];
+  uint8_t max[PARQUET_MAX_STATISTIC];
+  uint32_t min_len;
+  uint32_t max_len;
+  int has_statistics;
+} ParquetChunk;
+
+typedef struct
+{
+  ParquetChunk columns[PARQUET_COLUMN_COUNT];
+  int64_t offset;
+  int64_t rows;
+  int64_t size;
+} ParquetRowGroup;
+
+typedef struct
+{
+  FILE *file;
+  char *path;
+  char *temporary; // from mkstemp next to path, renamed by parquet_close
+  int64_t offset;
+  int failed;
+
+  size_t row_group_rows;
+  size_t rows; // buffered for the current row group
+  ParquetDictionary *dictionaries; // PARQUET_DICTIONARY_COLUMNS of them
+  uint32_t *indices[PARQUET_DICTIONARY_COLUMNS];
+  int64_t *times;
+  double *values;
+
+  ParquetRowGroup *groups;
+  size_t ngroups;
+  size_t group_capacity;
+  int64_t total_rows;
+
+  ParquetBuffer page; // encoding space, reused for every page
+} ParquetWriter;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// row_group_rows of 0 picks PARQUET_DEFAULT_ROW_GROUP_ROWS
+WEATHER_ERROR parquet_open (ParquetWriter *writer, const char *path, size_t row_group_rows);
+WEATHER_ERROR parquet_write_series (ParquetWriter *writer, const WeatherSeries *series, size_t nseries);
+// writes the last row group and the footer. the file only appears at the
+// path when all of that worked, a failed writer leaves nothing behind
+WEATHER_ERROR parquet_close (ParquetWriter *writer);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
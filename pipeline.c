@@ -0,0 +1,283 @@
+#include <string.h>
+
+#include "pipeline.h"
+
+typedef struct
+{
+  Pipeline *pipeline;
+  void *userdata;
+  WEATHER_ERROR status;
+  char *body;
+  MemoryBudget *budget; // the body's charge, taken over from the engine
+  size_t charged;
+  PipelineResult *result; // what the consumer gets for it, allocated up front
+} FetchedBody;
+
+// clang-format off
+static int has_room (void *userdata);
+static void on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+static void *decode_loop (void *userdata);
+static PipelineResult *decode_body (FetchedBody *fetched);
+static void deliver_failure (FetchedBody *fetched, WEATHER_ERROR refused);
+static void free_fetched (FetchedBody *fetched);
+// clang-format on
+
+WEATHER_ERROR
+pipeline_init (Pipeline *pipeline, RequestEngine *engine,
+	       size_t fetched_capacity, size_t sink_capacity)
+{
+  if (!pipeline || !engine || !engine->multi)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (pipeline, 0, sizeof (*pipeline));
+  pipeline->engine = engine;
+
+  if (!fetched_capacity)
+    fetched_capacity = PIPELINE_DEFAULT_CAPACITY;
+  if (!sink_capacity)
+    sink_capacity = PIPELINE_DEFAULT_CAPACITY;
+
+  // transfers that were already receiving when the gate closed still
+  // complete, at most one per transfer in flight, paused ones included
+  WEATHER_ERROR status = queue_init (&pipeline->fetched, fetched_capacity,
+				     2 * engine->max_active);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  status = queue_init (&pipeline->decoded, sink_capacity, 0);
+  if (WEATHER_SUCCESS != status)
+  {
+    queue_cleanup (&pipeline->fetched);
+    return status;
+  }
+
+  if (pthread_create (&pipeline->decoder, NULL, decode_loop, pipeline) != 0)
+  {
+    queue_cleanup (&pipeline->fetched);
+    queue_cleanup (&pipeline->decoded);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  pipeline->running = 1;
+  engine_set_gate (engine, has_room, pipeline);
+  return WEATHER_SUCCESS;
+}
+
+void
+pipeline_cleanup (Pipeline *pipeline)
+{
+  if (!pipeline || !pipeline->running)
+    return;
+
+  engine_set_gate (pipeline->engine, NULL, NULL);
+
+  queue_close (&pipeline->fetched);
+  queue_close (&pipeline->decoded);
+  pthread_join (pipeline->decoder, NULL);
+
+  void *item;
+  while (queue_pop (&pipeline->fetched, &item, 0) == WEATHER_SUCCESS && item)
+    free_fetched (item);
+  while (queue_pop (&pipeline->decoded, &item, 0) == WEATHER_SUCCESS && item)
+    pipeline_free_result (item);
+
+  queue_cleanup (&pipeline->fetched);
+  queue_cleanup (&pipeline->decoded);
+  memset (pipeline, 0, sizeof (*pipeline));
+}
+
+WEATHER_ERROR
+pipeline_submit (Pipeline *pipeline, const char *url, ENGINE_PRIORITY priority,
+		 void *userdata)
+{
+  if (!pipeline || !pipeline->running || !url)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  // allocated up front so neither the completion callback nor the decoder
+  // ever has to, every submission gets its result
+  FetchedBody *fetched = calloc (1, sizeof (*fetched));
+  if (!fetched)
+    return WEATHER_ERROR_INVALID_MEMORY;
+  fetched->result = calloc (1, sizeof (PipelineResult));
+  if (!fetched->result)
+  {
+    free (fetched);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  fetched->pipeline = pipeline;
+  fetched->userdata = userdata;
+
+  WEATHER_ERROR status
+    = engine_submit (pipeline->engine, url, priority, on_fetched, fetched);
+  if (WEATHER_SUCCESS != status)
+  {
+    free_fetched (fetched);
+    return status;
+  }
+
+  pipeline->submitted++;
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+pipeline_next (Pipeline *pipeline, PipelineResult **result, int timeout_ms)
+{
+  if (!pipeline || !pipeline->running || !result)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  void *item = NULL;
+  WEATHER_ERROR status = queue_pop (&pipeline->decoded, &item, timeout_ms);
+  *result = item;
+  return status;
+}
+
+void
+pipeline_free_result (PipelineResult *result)
+{
+  if (!result)
+    return;
+
+  decode_free_series (result->series, result->count);
+  free (result);
+}
+
+void
+pipeline_finish (Pipeline *pipeline)
+{
+  if (pipeline && pipeline->running)
+    queue_close (&pipeline->fetched);
+}
+
+static int
+has_room (void *userdata)
+{
+  Pipeline *pipeline = userdata;
+
+  // raise the flag before looking, a decoder pop in between then either
+  // shows up in the count or sees the flag and wakes the engine
+  atomic_store (&pipeline->gate_closed, 1);
+  if (queue_has_room (&pipeline->fetched))
+  {
+    pipeline->stalled = 0;
+    return 1;
+  }
+
+  if (!pipeline->stalled)
+  {
+    pipeline->stalled = 1;
+    atomic_fetch_add (&pipeline->stalls, 1);
+  }
+  return 0;
+}
+
+static void
+on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  FetchedBody *fetched = userdata;
+
+  fetched->status = status;
+  if (WEATHER_SUCCESS == status)
+  {
+    fetched->body = request->response.data;
+    request->response.data = NULL;
+    // the charge goes with the body, a queued body still takes the memory
+    fetched->budget = request->response.budget;
+    fetched->charged = request->response.charged;
+    request->response.charged = 0;
+  }
+
+  // the engine thread must not block here, the slack covers every transfer
+  // that can still be in flight
+  WEATHER_ERROR queued = queue_offer (&fetched->pipeline->fetched, fetched);
+  if (WEATHER_SUCCESS != queued)
+    deliver_failure (fetched, queued);
+}
+
+static void *
+decode_loop (void *userdata)
+{
+  Pipeline *pipeline = userdata;
+
+  for (;;)
+  {
+    void *item = NULL;
+    queue_pop (&pipeline->fetched, &item, -1);
+    if (!item)
+      break;
+
+    if (atomic_exchange (&pipeline->gate_closed, 0))
+      curl_multi_wakeup (pipeline->engine->multi);
+
+    // the body's memory goes back to the budget in decode_body, transfers
+    // it starved may continue
+    int charged = ((FetchedBody *) item)->charged != 0;
+    PipelineResult *result = decode_body (item);
+    if (charged)
+      curl_multi_wakeup (pipeline->engine->multi);
+
+    // blocks while the consumer is behind, which is what closes the gate
+    if (WEATHER_SUCCESS != queue_push (&pipeline->decoded, result))
+    {
+      pipeline_free_result (result);
+      atomic_fetch_add (&pipeline->dropped, 1);
+      break;
+    }
+    atomic_fetch_add (&pipeline->decoded_count, 1);
+  }
+
+  queue_close (&pipeline->decoded);
+  return NULL;
+}
+
+static PipelineResult *
+decode_body (FetchedBody *fetched)
+{
+  PipelineResult *result = fetched->result;
+  fetched->result = NULL;
+  result->userdata = fetched->userdata;
+  result->status = fetched->status;
+
+  if (WEATHER_SUCCESS == result->status)
+  {
+    json_t *root = NULL;
+    result->status = process_json (fetched->body, &root);
+    if (WEATHER_SUCCESS == result->status)
+      result->status = decode_series (root, &result->series, &result->count);
+    if (root)
+      json_decref (root);
+  }
+
+  free_fetched (fetched);
+  return result;
+}
+
+static void
+deliver_failure (FetchedBody *fetched, WEATHER_ERROR refused)
+{
+  // the body cannot be queued, its result still reaches the consumer when
+  // the sink queue has room. only what does not fit there is dropped
+  Pipeline *pipeline = fetched->pipeline;
+  PipelineResult *result = fetched->result;
+  fetched->result = NULL;
+  result->userdata = fetched->userdata;
+  result->status
+    = WEATHER_SUCCESS == fetched->status ? refused : fetched->status;
+  free_fetched (fetched);
+
+  if (WEATHER_SUCCESS != queue_offer (&pipeline->decoded, result))
+  {
+    pipeline_free_result (result);
+    atomic_fetch_add (&pipeline->dropped, 1);
+  }
+}
+
+static void
+free_fetched (FetchedBody *fetched)
+{
+  if (fetched->charged)
+    budget_release (fetched->budget, fetched->charged);
+  free (fetched->result);
+  free (fetched->body);
+  free (fetched);
+}
@@ -0,0 +1,86 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<int> pipeline_flag_t;
+typedef std::atomic<size_t> pipeline_counter_t;
+#else
+#include <stdatomic.h>
+typedef atomic_int pipeline_flag_t;
+typedef atomic_size_t pipeline_counter_t;
+#endif
+
+#include "decode.h"
+#include "engine.h"
+#include "queue.h"
+#include "weather.h"
+
+// fetch -> decode -> sink with a bounded queue between each stage, so a
+// slow consumer slows the network down instead of piling up responses.
+//
+// the engine thread fetches, a decoder thread turns bodies into series and
+// the caller takes results with pipeline_next. when the sink queue is full
+// the decoder blocks, the fetched queue fills up behind it and the engine's
+// gate closes: running transfers pause in their write callback and no new
+// ones start until the decoder catches up. memory stays within
+// fetched_capacity bodies plus one per transfer in flight, plus
+// sink_capacity decoded results. with a memory budget on the engine, a body
+// stays charged until the decoder is done with it, queued or not.
+//
+// every submission comes back from pipeline_next exactly once, a body the
+// fetched queue had no room for as a result with an error status. only when
+// the sink queue is full or closed as well is it counted in dropped instead,
+// so a consumer waiting for all of them waits for submitted - dropped.
+#define PIPELINE_DEFAULT_CAPACITY 8
+
+typedef struct
+{
+  WEATHER_ERROR status;
+  WeatherSeries *series;
+  size_t count;
+  void *userdata; // as given to pipeline_submit
+} PipelineResult;
+
+typedef struct
+{
+  RequestEngine *engine;
+  BoundedQueue fetched; // response bodies waiting for the decoder
+  BoundedQueue decoded; // results waiting for the consumer
+  pthread_t decoder;
+  int running;
+  pipeline_flag_t gate_closed; // the engine looked, wake it on the next pop
+  int stalled; // engine thread only
+
+  size_t submitted;
+  pipeline_counter_t decoded_count;
+  pipeline_counter_t stalls; // times the gate closed
+  pipeline_counter_t dropped; // submissions that never got a result
+} Pipeline;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// capacities of 0 pick PIPELINE_DEFAULT_CAPACITY, the engine gets the
+// pipeline's gate and must not be shared with other gated consumers
+WEATHER_ERROR pipeline_init (Pipeline *pipeline, RequestEngine *engine, size_t fetched_capacity, size_t sink_capacity);
+// stops the decoder, drops whatever was not consumed and removes the gate.
+// the engine has to be idle or cleaned up first, its callbacks point here
+void pipeline_cleanup (Pipeline *pipeline);
+WEATHER_ERROR pipeline_submit (Pipeline *pipeline, const char *url, ENGINE_PRIORITY priority, void *userdata);
+// *result is NULL on timeout and once pipeline_finish has been drained
+WEATHER_ERROR pipeline_next (Pipeline *pipeline, PipelineResult **result, int timeout_ms);
+void pipeline_free_result (PipelineResult *result);
+// no more submissions, call once the engine has no requests left
+void pipeline_finish (Pipeline *pipeline);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
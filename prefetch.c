@@ -0,0 +1,411 @@
+#include <math.h>
+#include <string.h>
+
+#include "prefetch.h"
+
+#define PREFETCH_INITIAL_BUCKETS 64
+
+// clang-format off
+static PrefetchEntry *find_entry (const Prefetcher *prefetcher, const char *key, uint64_t hash);
+static WEATHER_ERROR grow_buckets (Prefetcher *prefetcher);
+static void forget_unpopular (Prefetcher *prefetcher, int64_t now);
+static double decayed_score (const PrefetchEntry *entry, int64_t now);
+static int64_t cycle_of (const Prefetcher *prefetcher, int64_t time);
+static int64_t target_cycle (const Prefetcher *prefetcher, int64_t now, int64_t offset);
+static int64_t change_cycle (const Prefetcher *prefetcher, int64_t now);
+static int wants_prefetch (const Prefetcher *prefetcher, const PrefetchEntry *entry, int64_t cycle, int64_t now);
+static int compare_scores (const void *a, const void *b);
+// clang-format on
+
+WEATHER_ERROR
+prefetch_init (Prefetcher *prefetcher, int64_t cycle_seconds)
+{
+  if (!prefetcher || cycle_seconds <= 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (prefetcher, 0, sizeof (*prefetcher));
+  prefetcher->buckets
+    = calloc (PREFETCH_INITIAL_BUCKETS, sizeof (PrefetchEntry *));
+  if (!prefetcher->buckets)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  prefetcher->nbuckets = PREFETCH_INITIAL_BUCKETS;
+  prefetcher->max_queries = PREFETCH_MAX_QUERIES;
+  prefetcher->cycle_seconds = cycle_seconds;
+  prefetcher->margin_seconds = PREFETCH_DEFAULT_MARGIN;
+  prefetcher->retry_seconds = PREFETCH_DEFAULT_RETRY;
+  return WEATHER_SUCCESS;
+}
+
+void
+prefetch_cleanup (Prefetcher *prefetcher)
+{
+  if (!prefetcher)
+    return;
+
+  for (size_t i = 0; prefetcher->buckets && i < prefetcher->nbuckets; i++)
+  {
+    PrefetchEntry *entry = prefetcher->buckets[i];
+    while (entry)
+    {
+      PrefetchEntry *next = entry->next;
+      free (entry->key);
+      free (entry);
+      entry = next;
+    }
+  }
+
+  free (prefetcher->buckets);
+  memset (prefetcher, 0, sizeof (*prefetcher));
+}
+
+WEATHER_ERROR
+prefetch_record_query (Prefetcher *prefetcher, const char *key, int64_t now)
+{
+  if (!prefetcher || !key)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  uint64_t hash = weather_hash (key);
+  PrefetchEntry *entry = find_entry (prefetcher, key, hash);
+  if (entry)
+  {
+    entry->score = decayed_score (entry, now) + 1.0;
+    entry->last_seen = now;
+    return WEATHER_SUCCESS;
+  }
+
+  if (prefetcher->count >= prefetcher->max_queries)
+  {
+    forget_unpopular (prefetcher, now);
+    if (prefetcher->count >= prefetcher->max_queries)
+      return WEATHER_SUCCESS; // the table is full of popular queries
+  }
+
+  if (prefetcher->count >= prefetcher->nbuckets)
+  {
+    WEATHER_ERROR status = grow_buckets (prefetcher);
+    if (WEATHER_SUCCESS != status)
+      return status;
+  }
+
+  entry = calloc (1, sizeof (*entry));
+  size_t len = strlen (key) + 1;
+  char *copy = malloc (len);
+  if (!entry || !copy)
+  {
+    free (entry);
+    free (copy);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+  memcpy (copy, key, len);
+
+  entry->key = copy;
+  entry->hash = hash;
+  entry->score = 1.0;
+  entry->last_seen = now;
+  entry->changed_cycle = INT64_MIN;
+  entry->last_attempt = INT64_MIN;
+  entry->attempt_cycle = INT64_MIN;
+
+  size_t bucket = hash % prefetcher->nbuckets;
+  entry->next = prefetcher->buckets[bucket];
+  prefetcher->buckets[bucket] = entry;
+  prefetcher->count++;
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+prefetch_record_response (Prefetcher *prefetcher, const char *key, int64_t now,
+			  uint64_t content_hash)
+{
+  if (!prefetcher || !key)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  PrefetchEntry *entry = find_entry (prefetcher, key, weather_hash (key));
+  if (!entry || entry->content_hash == content_hash)
+    return WEATHER_SUCCESS;
+
+  int first_response = entry->content_hash == 0;
+  int64_t cycle = change_cycle (prefetcher, now);
+  entry->content_hash = content_hash;
+
+  if (entry->last_attempt != INT64_MIN
+      && now - entry->last_attempt < prefetcher->retry_seconds)
+    prefetcher->useful_prefetches++;
+
+  // the very first response only tells us what the data looks like, not
+  // when it changed, and only the first change per cycle says anything
+  // about publication time
+  if (first_response || entry->changed_cycle == cycle)
+  {
+    entry->changed_cycle = cycle;
+    return WEATHER_SUCCESS;
+  }
+  entry->changed_cycle = cycle;
+
+  int64_t offset = now - cycle_of (prefetcher, now) * prefetcher->cycle_seconds;
+  size_t bin = (size_t) (offset * PREFETCH_OFFSET_BINS
+			 / prefetcher->cycle_seconds);
+
+  for (size_t i = 0; i < PREFETCH_OFFSET_BINS; i++)
+    prefetcher->offset_bins[i] *= PREFETCH_OFFSET_DECAY;
+  prefetcher->offset_bins[bin] += 1.0;
+  prefetcher->observations++;
+
+  return WEATHER_SUCCESS;
+}
+
+uint64_t
+prefetch_content_hash (const WeatherSeries *series, size_t nseries)
+{
+  // only times and values, responses also carry generation timestamps that
+  // change on every request
+  uint64_t hash = WEATHER_HASH_SEED;
+  for (size_t i = 0; series && i < nseries; i++)
+  {
+    hash = weather_hash_bytes (series[i].times,
+			       series[i].count * sizeof (int64_t), hash);
+    hash = weather_hash_bytes (series[i].values,
+			       series[i].count * sizeof (double), hash);
+  }
+  return hash ? hash : 1; // 0 means no response seen yet
+}
+
+int
+prefetch_publication_offset (const Prefetcher *prefetcher, int64_t *offset)
+{
+  if (!prefetcher || !offset
+      || prefetcher->observations < PREFETCH_MIN_OBSERVATIONS)
+    return 0;
+
+  double total = 0.0;
+  for (size_t i = 0; i < PREFETCH_OFFSET_BINS; i++)
+    total += prefetcher->offset_bins[i];
+
+  // a low percentile rather than the mode, a change is only noticed when
+  // someone asks so observations lag the actual publication
+  double cumulative = 0.0;
+  size_t bin = 0;
+  for (; bin < PREFETCH_OFFSET_BINS; bin++)
+  {
+    cumulative += prefetcher->offset_bins[bin];
+    if (cumulative >= total * PREFETCH_OFFSET_PERCENTILE)
+      break;
+  }
+
+  *offset = (int64_t) bin * prefetcher->cycle_seconds / PREFETCH_OFFSET_BINS;
+  return 1;
+}
+
+WEATHER_ERROR
+prefetch_due (Prefetcher *prefetcher, int64_t now, const char **keys,
+	      size_t max_keys, size_t *nkeys)
+{
+  if (!prefetcher || !keys || !nkeys)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  *nkeys = 0;
+
+  int64_t offset;
+  if (!prefetch_publication_offset (prefetcher, &offset) || max_keys == 0)
+    return WEATHER_SUCCESS;
+
+  int64_t cycle = target_cycle (prefetcher, now, offset);
+
+  PrefetchEntry **candidates
+    = malloc (prefetcher->count * sizeof (*candidates));
+  if (!candidates && prefetcher->count)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  size_t ncandidates = 0;
+  for (size_t i = 0; i < prefetcher->nbuckets; i++)
+  {
+    for (PrefetchEntry *entry = prefetcher->buckets[i]; entry;
+	 entry = entry->next)
+    {
+      if (!wants_prefetch (prefetcher, entry, cycle, now))
+	continue;
+
+      entry->score = decayed_score (entry, now);
+      entry->last_seen = now;
+      if (entry->score >= PREFETCH_MIN_SCORE)
+	candidates[ncandidates++] = entry;
+    }
+  }
+
+  qsort (candidates, ncandidates, sizeof (*candidates), compare_scores);
+
+  for (size_t i = 0; i < ncandidates && i < max_keys; i++)
+  {
+    if (candidates[i]->attempt_cycle != cycle)
+    {
+      candidates[i]->attempt_cycle = cycle;
+      candidates[i]->attempts = 0;
+    }
+    candidates[i]->attempts++;
+    candidates[i]->last_attempt = now;
+    keys[(*nkeys)++] = candidates[i]->key;
+  }
+  prefetcher->prefetches += *nkeys;
+
+  free (candidates);
+  return WEATHER_SUCCESS;
+}
+
+int64_t
+prefetch_next_wakeup (const Prefetcher *prefetcher, int64_t now)
+{
+  int64_t offset;
+  if (!prefetcher || !prefetch_publication_offset (prefetcher, &offset))
+    return INT64_MAX;
+
+  // either a retry of queries still waiting for this cycle's data or the
+  // next cycle's publication
+  int64_t cycle = target_cycle (prefetcher, now, offset);
+  int64_t wakeup = (cycle + 1) * prefetcher->cycle_seconds + offset
+		   + prefetcher->margin_seconds;
+
+  for (size_t i = 0; i < prefetcher->nbuckets; i++)
+  {
+    for (const PrefetchEntry *entry = prefetcher->buckets[i]; entry;
+	 entry = entry->next)
+    {
+      if (entry->changed_cycle >= cycle
+	  || (entry->attempt_cycle == cycle
+	      && entry->attempts >= PREFETCH_MAX_ATTEMPTS)
+	  || decayed_score (entry, now) < PREFETCH_MIN_SCORE)
+	continue;
+
+      int64_t retry = entry->last_attempt == INT64_MIN
+			? now
+			: entry->last_attempt + prefetcher->retry_seconds;
+      if (retry < wakeup)
+	wakeup = retry < now ? now : retry;
+    }
+  }
+
+  return wakeup;
+}
+
+static PrefetchEntry *
+find_entry (const Prefetcher *prefetcher, const char *key, uint64_t hash)
+{
+  for (PrefetchEntry *entry = prefetcher->buckets[hash % prefetcher->nbuckets];
+       entry; entry = entry->next)
+  {
+    if (entry->hash == hash && strcmp (entry->key, key) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+static WEATHER_ERROR
+grow_buckets (Prefetcher *prefetcher)
+{
+  size_t new_count = prefetcher->nbuckets * 2;
+  PrefetchEntry **new_buckets = calloc (new_count, sizeof (*new_buckets));
+  if (!new_buckets)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  for (size_t i = 0; i < prefetcher->nbuckets; i++)
+  {
+    PrefetchEntry *entry = prefetcher->buckets[i];
+    while (entry)
+    {
+      PrefetchEntry *next = entry->next;
+      size_t bucket = entry->hash % new_count;
+      entry->next = new_buckets[bucket];
+      new_buckets[bucket] = entry;
+      entry = next;
+    }
+  }
+
+  free (prefetcher->buckets);
+  prefetcher->buckets = new_buckets;
+  prefetcher->nbuckets = new_count;
+  return WEATHER_SUCCESS;
+}
+
+static void
+forget_unpopular (Prefetcher *prefetcher, int64_t now)
+{
+  for (size_t i = 0; i < prefetcher->nbuckets; i++)
+  {
+    PrefetchEntry **link = &prefetcher->buckets[i];
+    while (*link)
+    {
+      PrefetchEntry *entry = *link;
+      if (decayed_score (entry, now) >= PREFETCH_FORGET_SCORE)
+      {
+	link = &entry->next;
+	continue;
+      }
+
+      *link = entry->next;
+      free (entry->key);
+      free (entry);
+      prefetcher->count--;
+    }
+  }
+}
+
+static double
+decayed_score (const PrefetchEntry *entry, int64_t now)
+{
+  if (now <= entry->last_seen)
+    return entry->score;
+
+  double age = (double) (now - entry->last_seen);
+  return entry->score * exp2 (-age / PREFETCH_SCORE_HALF_LIFE);
+}
+
+static int64_t
+cycle_of (const Prefetcher *prefetcher, int64_t time)
+{
+  int64_t cycle = time / prefetcher->cycle_seconds;
+  if (time < 0 && time % prefetcher->cycle_seconds)
+    cycle--;
+  return cycle;
+}
+
+static int64_t
+target_cycle (const Prefetcher *prefetcher, int64_t now, int64_t offset)
+{
+  // the most recent cycle whose data should be out by now
+  return cycle_of (prefetcher, now - offset - prefetcher->margin_seconds);
+}
+
+static int64_t
+change_cycle (const Prefetcher *prefetcher, int64_t now)
+{
+  // the cycle whose run produced data first seen at now. changes are
+  // attributed to the nearest publication time so a run that comes out a
+  // little early or late still counts for its own cycle
+  int64_t offset;
+  if (!prefetch_publication_offset (prefetcher, &offset))
+    return cycle_of (prefetcher, now);
+
+  return cycle_of (prefetcher, now - offset + prefetcher->cycle_seconds / 2);
+}
+
+static int
+wants_prefetch (const Prefetcher *prefetcher, const PrefetchEntry *entry,
+		int64_t cycle, int64_t now)
+{
+  if (entry->changed_cycle >= cycle)
+    return 0; // already has this cycle's data
+
+  if (entry->attempt_cycle != cycle)
+    return 1;
+
+  return entry->attempts < PREFETCH_MAX_ATTEMPTS
+	 && now - entry->last_attempt >= prefetcher->retry_seconds;
+}
+
+static int
+compare_scores (const void *a, const void *b)
+{
+  double sa = (*(PrefetchEntry *const *) a)->score;
+  double sb = (*(PrefetchEntry *const *) b)->score;
+  return (sa < sb) - (sa > sb);
+}
@@ -0,0 +1,93 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decode.h"
+#include "weather.h"
+
+// predictive prefetching around model run publication.
+//
+// every user facing query is recorded with an exponentially decaying score,
+// the ones that keep coming back form the recurring set. every response is
+// recorded with a hash of its values, and the first time a query's values
+// change within a model cycle tells us roughly when that cycle's run was
+// published. those offsets (mod the cycle length) go into a histogram and a
+// low percentile of it is taken as the publication time.
+//
+// once the learned publication time (plus a margin) has passed in a cycle,
+// prefetch_due hands out the recurring queries that have not seen new data
+// yet so they can be fetched before users ask for them. queries that come
+// back unchanged are retried every retry_seconds until the data shows up,
+// at most PREFETCH_MAX_ATTEMPTS times per cycle.
+#define PREFETCH_DEFAULT_CYCLE (6 * 3600)
+#define PREFETCH_DEFAULT_MARGIN 120
+#define PREFETCH_DEFAULT_RETRY 300
+#define PREFETCH_MAX_ATTEMPTS 6
+#define PREFETCH_OFFSET_BINS 72
+#define PREFETCH_OFFSET_PERCENTILE 0.1
+#define PREFETCH_OFFSET_DECAY 0.97
+#define PREFETCH_MIN_OBSERVATIONS 3
+#define PREFETCH_SCORE_HALF_LIFE (24 * 3600)
+#define PREFETCH_MIN_SCORE 2.0
+#define PREFETCH_FORGET_SCORE 0.1
+#define PREFETCH_MAX_QUERIES 4096
+
+typedef struct PrefetchEntry
+{
+  char *key; // whatever identifies the query to the fetcher, e.g. the url
+  uint64_t hash;
+  double score;
+  int64_t last_seen;
+  uint64_t content_hash;
+  int64_t changed_cycle; // cycle in which new data was last seen
+  int64_t last_attempt;
+  int64_t attempt_cycle;
+  int attempts; // prefetches handed out for attempt_cycle
+  struct PrefetchEntry *next;
+} PrefetchEntry;
+
+typedef struct
+{
+  PrefetchEntry **buckets;
+  size_t nbuckets;
+  size_t count;
+  size_t max_queries;
+
+  int64_t cycle_seconds;
+  int64_t margin_seconds;
+  int64_t retry_seconds;
+
+  double offset_bins[PREFETCH_OFFSET_BINS];
+  size_t observations;
+
+  size_t prefetches; // queries handed out by prefetch_due
+  size_t useful_prefetches; // of those, how many brought new data
+} Prefetcher;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR prefetch_init (Prefetcher *prefetcher, int64_t cycle_seconds);
+void prefetch_cleanup (Prefetcher *prefetcher);
+WEATHER_ERROR prefetch_record_query (Prefetcher *prefetcher, const char *key, int64_t now);
+// content_hash should only cover the data, see prefetch_content_hash
+WEATHER_ERROR prefetch_record_response (Prefetcher *prefetcher, const char *key, int64_t now, uint64_t content_hash);
+uint64_t prefetch_content_hash (const WeatherSeries *series, size_t nseries);
+// returns 0 while nothing has been learned yet
+int prefetch_publication_offset (const Prefetcher *prefetcher, int64_t *offset);
+// fills keys (pointers owned by the prefetcher) with the queries to warm now,
+// most popular first
+WEATHER_ERROR prefetch_due (Prefetcher *prefetcher, int64_t now, const char **keys, size_t max_keys, size_t *nkeys);
+// when prefetch_due is next worth calling, for sleeping schedulers
+int64_t prefetch_next_wakeup (const Prefetcher *prefetcher, int64_t now);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
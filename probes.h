@@ -0,0 +1,45 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// usdt probes for bpftrace, perf and systemtap, provider "meteomatics".
+// with <sys/sdt.h> around (systemtap-sdt-dev / systemtap-sdt-devel) each
+// probe is a single nop plus a note in the binary and costs nothing until a
+// tracer attaches. without it, or with -DWEATHER_NO_PROBES, they compile to
+// nothing at all.
+//
+// transfers are identified by their ResponseBuffer pointer, the same value
+// shows up in request_start, first_byte, write_chunk and transfer_end.
+//
+//   request_start (buffer, url)
+//   first_byte (buffer, bytes)
+//   write_chunk (buffer, bytes, total)
+//   transfer_end (buffer, status, total)
+//   decode_start (json)         the body about to be parsed
+//   decode_end (status)
+//   cache_hit (cache, key)      cache is "series", "archive" or "grid"
+//   cache_miss (cache, key)
+//
+// for example, response sizes by status:
+//   bpftrace -e 'usdt:./main:meteomatics:transfer_end { @[arg1] = hist(arg2) }'
+
+#if !defined(WEATHER_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define WEATHER_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef WEATHER_HAVE_PROBES
+#include <sys/sdt.h>
+
+#define WEATHER_PROBE1(name, a) DTRACE_PROBE1 (meteomatics, name, a)
+#define WEATHER_PROBE2(name, a, b) DTRACE_PROBE2 (meteomatics, name, a, b)
+#define WEATHER_PROBE3(name, a, b, c)                                          \
+  DTRACE_PROBE3 (meteomatics, name, a, b, c)
+#else
+// arguments are not evaluated
+#define WEATHER_PROBE1(name, a) ((void) 0)
+#define WEATHER_PROBE2(name, a, b) ((void) 0)
+#define WEATHER_PROBE3(name, a, b, c) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "queue.h"
+
+// clang-format off
+static void put (BoundedQueue *queue, void *item);
+// clang-format on
+
+WEATHER_ERROR
+queue_init (BoundedQueue *queue, size_t capacity, size_t slack)
+{
+  if (!queue || capacity == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (queue, 0, sizeof (*queue));
+  queue->items = malloc ((capacity + slack) * sizeof (void *));
+  if (!queue->items)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  queue->capacity = capacity;
+  queue->slack = slack;
+  pthread_mutex_init (&queue->lock, NULL);
+  pthread_cond_init (&queue->not_empty, NULL);
+  pthread_cond_init (&queue->not_full, NULL);
+  return WEATHER_SUCCESS;
+}
+
+void
+queue_cleanup (BoundedQueue *queue)
+{
+  if (!queue || !queue->items)
+    return;
+
+  pthread_mutex_destroy (&queue->lock);
+  pthread_cond_destroy (&queue->not_empty);
+  pthread_cond_destroy (&queue->not_full);
+  free (queue->items);
+  memset (queue, 0, sizeof (*queue));
+}
+
+WEATHER_ERROR
+queue_push (BoundedQueue *queue, void *item)
+{
+  pthread_mutex_lock (&queue->lock);
+  while (!queue->closed && queue->count >= queue->capacity)
+    pthread_cond_wait (&queue->not_full, &queue->lock);
+
+  if (queue->closed)
+  {
+    pthread_mutex_unlock (&queue->lock);
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  put (queue, item);
+  pthread_mutex_unlock (&queue->lock);
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+queue_offer (BoundedQueue *queue, void *item)
+{
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+
+  pthread_mutex_lock (&queue->lock);
+  if (queue->closed)
+    status = WEATHER_ERROR_INVALID_CONFIG;
+  else if (queue->count >= queue->capacity + queue->slack)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+  else
+    put (queue, item);
+  pthread_mutex_unlock (&queue->lock);
+
+  return status;
+}
+
+WEATHER_ERROR
+queue_pop (BoundedQueue *queue, void **item, int timeout_ms)
+{
+  if (!queue || !item)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  *item = NULL;
+
+  struct timespec deadline;
+  if (timeout_ms >= 0)
+  {
+    clock_gettime (CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  pthread_mutex_lock (&queue->lock);
+  while (queue->count == 0 && !queue->closed)
+  {
+    if (timeout_ms < 0)
+      pthread_cond_wait (&queue->not_empty, &queue->lock);
+    else if (pthread_cond_timedwait (&queue->not_empty, &queue->lock,
+				     &deadline)
+	     == ETIMEDOUT)
+      break;
+  }
+
+  if (queue->count > 0)
+  {
+    *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % (queue->capacity + queue->slack);
+    queue->count--;
+    pthread_cond_signal (&queue->not_full);
+  }
+  pthread_mutex_unlock (&queue->lock);
+
+  return WEATHER_SUCCESS;
+}
+
+void
+queue_close (BoundedQueue *queue)
+{
+  pthread_mutex_lock (&queue->lock);
+  queue->closed = 1;
+  pthread_cond_broadcast (&queue->not_empty);
+  pthread_cond_broadcast (&queue->not_full);
+  pthread_mutex_unlock (&queue->lock);
+}
+
+size_t
+queue_count (BoundedQueue *queue)
+{
+  pthread_mutex_lock (&queue->lock);
+  size_t count = queue->count;
+  pthread_mutex_unlock (&queue->lock);
+  return count;
+}
+
+int
+queue_has_room (BoundedQueue *queue)
+{
+  return queue_count (queue) < queue->capacity;
+}
+
+static void
+put (BoundedQueue *queue, void *item)
+{
+  size_t size = queue->capacity + queue->slack;
+  queue->items[(queue->head + queue->count) % size] = item;
+  queue->count++;
+  if (queue->count > queue->high_water)
+    queue->high_water = queue->count;
+  pthread_cond_signal (&queue->not_empty);
+}
@@ -0,0 +1,51 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "weather.h"
+
+// bounded fifo of pointers shared between threads. queue_push blocks while
+// the queue holds capacity items, queue_offer never blocks and may use up
+// to slack extra slots, which is for producers like the curl event loop that
+// must not stall but whose overshoot is bounded by construction.
+typedef struct
+{
+  void **items;
+  size_t capacity;
+  size_t slack;
+  size_t head;
+  size_t count;
+  size_t high_water; // largest count seen
+  int closed;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} BoundedQueue;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR queue_init (BoundedQueue *queue, size_t capacity, size_t slack);
+void queue_cleanup (BoundedQueue *queue);
+// WEATHER_ERROR_INVALID_CONFIG once the queue is closed
+WEATHER_ERROR queue_push (BoundedQueue *queue, void *item);
+// WEATHER_ERROR_INVALID_MEMORY when even the slack is used up
+WEATHER_ERROR queue_offer (BoundedQueue *queue, void *item);
+// waits up to timeout_ms (forever when negative), *item is NULL on timeout
+// or when the queue is closed and drained
+WEATHER_ERROR queue_pop (BoundedQueue *queue, void **item, int timeout_ms);
+// wakes everybody up, pops drain what is left and pushes fail
+void queue_close (BoundedQueue *queue);
+size_t queue_count (BoundedQueue *queue);
+int queue_has_room (BoundedQueue *queue);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
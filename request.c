@@ -0,0 +1,390 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "probes.h"
+#include "request.h"
+#include "trace.h"
+
+static IMMUTABLE_CHAR_PTR API_BASE_URL = "https://api.meteomatics.com";
+
+// the handle perform_request keeps for each thread
+static pthread_once_t thread_handle_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_handle_key;
+static int thread_handle_ready;
+
+// clang-format off
+static void create_thread_handle_key (void);
+static void release_thread_handle (void *value);
+static CURL *thread_handle (void);
+// clang-format on
+
+WEATHER_ERROR
+init_response_buffer (ResponseBuffer *buffer)
+{
+  if (!buffer)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  buffer->data = malloc (API_INITIAL_BUFFER_SIZE);
+  if (!buffer->data)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  buffer->max_response_size = API_MAX_RESPONSE_SIZE;
+  buffer->capacity = API_INITIAL_BUFFER_SIZE;
+  buffer->data[0] = '\0';
+  buffer->size = 0;
+  buffer->budget = NULL;
+  buffer->charged = 0;
+  buffer->overdraft = 0;
+  buffer->http_status = 0;
+  buffer->received = 0;
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+validate_config (const WeatherConfig *config)
+{
+  if (!config)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  if (!config->username || !config->password || strlen (config->username) == 0
+      || strlen (config->password) == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+construct_url (const WeatherConfig *config, char *url, size_t url_size)
+{
+  if (!config || !url || url_size == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  TraceSpan span;
+  trace_begin (&span, "construct_url");
+
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  int nwritten
+    = snprintf (url, url_size, "%s/%s/%s/%s/%s", API_BASE_URL, config->datetime,
+		config->parameters, config->location, config->format);
+
+  if (nwritten < 0 || (size_t) nwritten >= url_size)
+    status = WEATHER_ERROR_URL_CONSTRUCTION;
+
+  trace_end (&span, status);
+  return status;
+}
+
+size_t
+write_callback (void *contents, size_t size, size_t nmemb, void *userp)
+{
+  size_t realsize = size * nmemb;
+  ResponseBuffer *buffer = (ResponseBuffer *) userp;
+
+  if (!buffer->received)
+  {
+    buffer->received = 1;
+    WEATHER_PROBE2 (first_byte, buffer, realsize);
+  }
+
+  // an error page is not worth a buffer, the start of it explains enough
+  if (buffer->http_status >= 400)
+  {
+    size_t keep = RESPONSE_ERROR_CAPTURE - buffer->size;
+    if (keep > realsize)
+      keep = realsize;
+    memcpy (buffer->data + buffer->size, contents, keep);
+    buffer->size += keep;
+    buffer->data[buffer->size] = '\0';
+    return keep == realsize ? realsize : 0;
+  }
+
+  // one byte stays free for the terminator
+  if (buffer->size + realsize >= buffer->capacity)
+  {
+    size_t new_size = buffer->capacity * 2;
+    while (new_size <= buffer->size + realsize
+	   && new_size < buffer->max_response_size)
+      new_size *= 2;
+
+    // the last doubling stops at the limit instead of failing past it
+    if (new_size > buffer->max_response_size)
+      new_size = buffer->max_response_size;
+    if (new_size <= buffer->size + realsize || new_size <= buffer->capacity)
+      return 0; // this will tell libcurl there was an error
+
+    size_t growth = new_size - buffer->capacity;
+    if (buffer->budget
+	&& !budget_charge (buffer->budget, growth, buffer->overdraft))
+      return CURL_WRITEFUNC_PAUSE; // curl hands the chunk over again later
+
+    char *new_data = realloc (buffer->data, new_size);
+    if (!new_data)
+    {
+      if (buffer->budget)
+	budget_release (buffer->budget, growth);
+      return 0; // this will tell libcurl there was an error
+    }
+
+    buffer->data = new_data;
+    buffer->capacity = new_size;
+    if (buffer->budget)
+      buffer->charged += growth;
+  }
+
+  memcpy (buffer->data + buffer->size, contents, realsize);
+  buffer->size += realsize;
+  buffer->data[buffer->size] = '\0';
+  WEATHER_PROBE3 (write_chunk, buffer, realsize, buffer->size);
+
+  return realsize;
+}
+
+size_t
+header_callback (char *buffer, size_t size, size_t nitems, void *userp)
+{
+  size_t realsize = size * nitems;
+  ResponseBuffer *response = userp;
+
+  // "HTTP/1.1 404 Not Found", interim 1xx responses come through here too
+  if (realsize > 5 && strncmp (buffer, "HTTP/", 5) == 0)
+  {
+    const char *space = memchr (buffer, ' ', realsize);
+    long code = 0;
+    for (const char *digit = space ? space + 1 : buffer + realsize;
+	 digit < buffer + realsize && *digit >= '0' && *digit <= '9'; digit++)
+      code = code * 10 + (*digit - '0');
+    response->http_status = code;
+
+    // nothing of the body has arrived yet, the capture starts empty
+    if (code >= 400)
+    {
+      response->size = 0;
+      response->data[0] = '\0';
+    }
+  }
+
+  return realsize;
+}
+
+WEATHER_ERROR
+transfer_status (const ResponseBuffer *response, CURLcode result)
+{
+  long code = response->http_status;
+  if (code < 400)
+    return CURLE_OK == result ? WEATHER_SUCCESS : WEATHER_ERROR_NETWORK;
+
+  switch (code)
+  {
+  case 401:
+  case 403:
+    return WEATHER_ERROR_HTTP_AUTH;
+  case 404:
+    return WEATHER_ERROR_HTTP_NOT_FOUND;
+  case 429:
+    return WEATHER_ERROR_HTTP_RATE_LIMIT;
+  default:
+    return code >= 500 ? WEATHER_ERROR_HTTP_SERVER : WEATHER_ERROR_HTTP_CLIENT;
+  }
+}
+
+WEATHER_ERROR
+setup_easy_handle (CURL *curl, const char *url, const WeatherConfig *config,
+		   ResponseBuffer *response)
+{
+  if (!curl || !url || !config || !response)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  response->http_status = 0;
+  response->received = 0;
+  curl_easy_setopt (curl, CURLOPT_URL, url);
+  curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, write_callback);
+  curl_easy_setopt (curl, CURLOPT_WRITEDATA, response);
+  curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, header_callback);
+  curl_easy_setopt (curl, CURLOPT_HEADERDATA, response);
+  curl_easy_setopt (curl, CURLOPT_USERNAME, config->username);
+  curl_easy_setopt (curl, CURLOPT_PASSWORD, config->password);
+  curl_easy_setopt (curl, CURLOPT_TIMEOUT, 30L);
+  curl_easy_setopt (curl, CURLOPT_SSL_VERIFYPEER, 1L);
+  curl_easy_setopt (curl, CURLOPT_SSL_VERIFYHOST, 2L);
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+perform_request (const char *url, const WeatherConfig *config,
+		 ResponseBuffer *response)
+{
+  if (!url || !config || !response)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  // the thread's own handle, so its connections, tls sessions and the ca
+  // store libcurl parsed for it carry over to the next call. reset drops the
+  // options of the last one and keeps all of those
+  CURL *curl = thread_handle ();
+  if (!curl)
+    return WEATHER_ERROR_NETWORK;
+
+  curl_easy_reset (curl);
+  return perform_with_handle (curl, url, config, response);
+}
+
+WEATHER_ERROR
+perform_with_handle (CURL *curl, const char *url, const WeatherConfig *config,
+		     ResponseBuffer *response)
+{
+  if (!curl || !url || !config || !response)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  setup_easy_handle (curl, url, config, response);
+
+  TraceSpan span;
+  trace_begin (&span, "perform_request");
+  WEATHER_PROBE2 (request_start, response, url);
+
+  metrics_count (METRIC_REQUESTS, 1);
+  double started = metrics_now ();
+
+  int64_t started_ns = trace_now_ns ();
+  CURLcode res = curl_easy_perform (curl);
+
+  metrics_observe (METRIC_REQUEST_SECONDS, metrics_now () - started);
+  metrics_count (METRIC_RESPONSE_BYTES, response->size);
+
+  WEATHER_ERROR status = transfer_status (response, res);
+  WEATHER_PROBE3 (transfer_end, response, status, response->size);
+  if (WEATHER_SUCCESS != status)
+    metrics_error (status);
+  trace_transfer_phases (&span, curl, started_ns);
+  trace_end (&span, status);
+
+  return status;
+}
+
+WEATHER_ERROR
+process_json (const char *json_data, json_t **processed_root)
+{
+  if (!json_data || !processed_root)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  TraceSpan span;
+  trace_begin (&span, "process_json");
+
+  double started = metrics_now ();
+  WEATHER_PROBE1 (decode_start, json_data);
+  json_t *root = json_loads (json_data, 0, NULL);
+  WEATHER_PROBE1 (decode_end, root ? WEATHER_SUCCESS : WEATHER_ERROR_JSON);
+  metrics_observe (METRIC_DECODE_SECONDS, metrics_now () - started);
+  if (!root)
+  {
+    metrics_error (WEATHER_ERROR_JSON);
+    trace_end (&span, WEATHER_ERROR_JSON);
+    return WEATHER_ERROR_JSON;
+  }
+
+  json_object_del (root, "user");     // dont want to leak my API key / Name
+  json_object_del (root, "password"); // dont want to leak my API key / Name
+  json_object_del (root,
+		   "credentials"); // dont want to leak my API key / Name
+
+  trace_end (&span, WEATHER_SUCCESS);
+  *processed_root = root;
+  return WEATHER_SUCCESS;
+}
+
+void
+trace_transfer_phases (const TraceSpan *span, CURL *curl, int64_t start_ns)
+{
+  if (!span || !span->sampled || !curl)
+    return;
+
+  // curl's timings are microseconds since the start, each one where a
+  // phase ends
+  static const struct
+  {
+    CURLINFO info;
+    const char *name;
+  } PHASES[] = {
+#if CURL_AT_LEAST_VERSION(8, 6, 0)
+    {CURLINFO_QUEUE_TIME_T, "queue"},
+#endif
+    {CURLINFO_NAMELOOKUP_TIME_T, "dns"},
+    {CURLINFO_CONNECT_TIME_T, "connect"},
+    {CURLINFO_APPCONNECT_TIME_T, "tls"},
+    {CURLINFO_PRETRANSFER_TIME_T, "pretransfer"},
+    {CURLINFO_STARTTRANSFER_TIME_T, "wait"},
+    {CURLINFO_TOTAL_TIME_T, "transfer"},
+  };
+
+  curl_off_t mark = 0;
+  for (size_t i = 0; i < sizeof (PHASES) / sizeof (PHASES[0]); i++)
+  {
+    curl_off_t end = 0;
+    if (CURLE_OK != curl_easy_getinfo (curl, PHASES[i].info, &end)
+	|| end <= mark)
+      continue;
+
+    trace_record (span, PHASES[i].name, start_ns + (int64_t) mark * 1000,
+		  start_ns + (int64_t) end * 1000, WEATHER_SUCCESS);
+    mark = end;
+  }
+}
+
+WEATHER_ERROR
+cleanup_response_buffer (ResponseBuffer *buffer)
+{
+  if (!buffer)
+    return WEATHER_SUCCESS;
+
+  // a body taken over by someone else is no longer ours to account for
+  if (buffer->budget && buffer->charged)
+  {
+    budget_release (buffer->budget, buffer->charged);
+    buffer->charged = 0;
+  }
+
+  if (buffer->data)
+  {
+    free (buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+  }
+  return WEATHER_SUCCESS;
+}
+
+static void
+create_thread_handle_key (void)
+{
+  thread_handle_ready
+    = pthread_key_create (&thread_handle_key, release_thread_handle) == 0;
+}
+
+static void
+release_thread_handle (void *value)
+{
+  curl_easy_cleanup (value);
+}
+
+static CURL *
+thread_handle (void)
+{
+  pthread_once (&thread_handle_once, create_thread_handle_key);
+  if (!thread_handle_ready)
+    return NULL;
+
+  CURL *curl = pthread_getspecific (thread_handle_key);
+  if (curl)
+    return curl;
+
+  curl = curl_easy_init ();
+  if (curl && pthread_setspecific (thread_handle_key, curl) != 0)
+  {
+    curl_easy_cleanup (curl);
+    curl = NULL;
+  }
+  return curl;
+}
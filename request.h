@@ -0,0 +1,80 @@
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include <stddef.h>
+#include <curl/curl.h>
+#include <jansson.h>
+
+#include "budget.h"
+#include "trace.h"
+#include "weather.h"
+
+// an error status switches the write callback from buffering the body to
+// keeping this much of it for the message, the transfer is aborted past it
+#define RESPONSE_ERROR_CAPTURE 512
+
+typedef struct
+{
+  char *data;
+  size_t size;
+  size_t capacity;
+  size_t max_response_size;
+  // optional, charged for the capacity. when it runs out the write callback
+  // pauses the transfer unless overdraft is set, resuming is up to the owner
+  MemoryBudget *budget;
+  size_t charged;
+  int overdraft;
+  long http_status; // 0 until the status line arrived
+  int received; // first_byte fired, a paused first chunk comes back again
+} ResponseBuffer;
+
+typedef struct
+{
+  const char *username;
+  const char *password;
+  const char *datetime;
+  const char *parameters;
+  const char *location;
+  const char *format;
+} WeatherConfig;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR cleanup_response_buffer (ResponseBuffer *buffer);
+
+WEATHER_ERROR init_response_buffer (ResponseBuffer *buffer);
+WEATHER_ERROR validate_config (const WeatherConfig *config);
+WEATHER_ERROR construct_url (const WeatherConfig *config, char *url, size_t url_size);
+// this is the callback for the opts that libcurl needs
+size_t write_callback (void *contents, size_t size, size_t nmemb, void *userp);
+// watches the status line, userp is the ResponseBuffer
+size_t header_callback (char *buffer, size_t size, size_t nitems, void *userp);
+// what a finished transfer amounts to. an http error status wins over the
+// curl result, which is a write error when the capture cut the body short.
+// nothing here prints, the start of an error body stays in the response for
+// the caller to show
+WEATHER_ERROR transfer_status (const ResponseBuffer *response, CURLcode result);
+// the options every transfer gets, shared by perform_request and the engine
+WEATHER_ERROR setup_easy_handle (CURL *curl, const char *url, const WeatherConfig *config, ResponseBuffer *response);
+// on a handle of the calling thread's own, kept until the thread exits, so
+// connections, tls sessions and the parsed ca bundle are reused from one
+// call to the next on the same thread
+WEATHER_ERROR perform_request (const char *url, const WeatherConfig *config, ResponseBuffer *response);
+// same as perform_request on a handle the caller keeps
+WEATHER_ERROR perform_with_handle (CURL *curl, const char *url, const WeatherConfig *config, ResponseBuffer *response);
+WEATHER_ERROR process_json (const char *json_data, json_t **processed_root);
+// writes the phases of a finished transfer (queue, dns, connect, tls,
+// pretransfer, wait, transfer) as children of span, from curl's timings.
+// start_ns is when the transfer was handed to curl. phases a reused
+// connection skipped are left out
+void trace_transfer_phases (const TraceSpan *span, CURL *curl, int64_t start_ns);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,418 @@
+#include <math.h>
+#include <string.h>
+
+#include "decode.h"
+#include "request.h"
+#include "route.h"
+
+#define ROUTE_POLL_MS 1000
+#define ROUTE_FORMAT "csv?route=true"
+#define ROUTE_COORDINATE_TOLERANCE 1e-5
+
+// what a csv column holds, parameters are numbered from 0
+#define COLUMN_SKIP -1
+#define COLUMN_LAT -2
+#define COLUMN_LON -3
+#define COLUMN_TIME -4
+
+typedef struct
+{
+  RouteResult *result;
+  const RoutePoint *points;
+  const char **names; // the parameters, pointing into the query
+  size_t *lengths;
+  size_t outstanding;
+} RouteState;
+
+typedef struct
+{
+  RouteState *state;
+  size_t first; // point
+  size_t count;
+  WEATHER_ERROR status;
+} RouteBatch;
+
+// clang-format off
+static WEATHER_ERROR plan (const RouteQuery *query, size_t overhead, RouteBatch **batches, size_t *nbatches);
+static WEATHER_ERROR build_url (const RouteQuery *query, const RouteBatch *batch, size_t max_url_length, char *url);
+static void on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+static WEATHER_ERROR parse_csv (const RouteBatch *batch, const char *text);
+static int *read_header (const RouteState *state, const char **at, size_t *nfields);
+static const char *field_end (const char *at);
+static WEATHER_ERROR point_text (const RoutePoint *point, char *time, char *location);
+// clang-format on
+
+WEATHER_ERROR
+route_fetch (RequestEngine *engine, const RouteQuery *query,
+	     RouteResult *result)
+{
+  if (!engine || !query || !result || !query->parameters
+      || !*query->parameters || (!query->points && query->npoints))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  size_t max_url_length = query->max_url_length ? query->max_url_length
+						 : ROUTE_DEFAULT_URL_LENGTH;
+  if (max_url_length > ENGINE_MAX_URL_LENGTH)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (result, 0, sizeof (*result));
+  result->npoints = query->npoints;
+  result->nparameters = 1;
+  for (const char *p = query->parameters; *p; p++)
+    result->nparameters += *p == ',';
+
+  // the url without dates and locations, every point adds to it
+  char *url = malloc (max_url_length);
+  if (!url)
+    return WEATHER_ERROR_INVALID_MEMORY;
+  WeatherConfig config = {.datetime = "",
+			  .parameters = query->parameters,
+			  .location = "",
+			  .format = ROUTE_FORMAT};
+  WEATHER_ERROR status = construct_url (&config, url, max_url_length);
+  size_t overhead = strlen (url);
+
+  RouteState state = {.result = result, .points = query->points};
+  RouteBatch *batches = NULL;
+  size_t nbatches = 0;
+  size_t cells = result->nparameters * query->npoints;
+  state.names = malloc (result->nparameters * sizeof (char *));
+  state.lengths = malloc (result->nparameters * sizeof (size_t));
+  result->values = malloc ((cells ? cells : 1) * sizeof (double));
+  if (WEATHER_SUCCESS == status
+      && (!state.names || !state.lengths || !result->values))
+    status = WEATHER_ERROR_INVALID_MEMORY;
+  if (WEATHER_SUCCESS == status)
+    status = plan (query, overhead, &batches, &nbatches);
+
+  if (WEATHER_SUCCESS == status)
+  {
+    for (size_t i = 0; i < cells; i++)
+      result->values[i] = NAN;
+
+    const char *name = query->parameters;
+    for (size_t p = 0; p < result->nparameters; p++)
+    {
+      const char *comma = strchr (name, ',');
+      state.names[p] = name;
+      state.lengths[p] = comma ? (size_t) (comma - name) : strlen (name);
+      if (!comma)
+	break; // the last one
+      name = comma + 1;
+    }
+
+    // every stretch goes out before the first one is waited for
+    for (size_t b = 0; b < nbatches; b++)
+    {
+      batches[b].state = &state;
+      batches[b].status = build_url (query, &batches[b], max_url_length, url);
+      if (WEATHER_SUCCESS != batches[b].status)
+	continue;
+
+      state.outstanding++;
+      WEATHER_ERROR submitted = engine_submit (
+	engine, url, ENGINE_PRIORITY_STANDARD, on_fetched, &batches[b]);
+      if (WEATHER_SUCCESS != submitted)
+      {
+	state.outstanding--;
+	batches[b].status = submitted;
+      }
+    }
+    result->requests = nbatches;
+
+    while (state.outstanding && WEATHER_SUCCESS == status)
+      status = engine_perform (engine, ROUTE_POLL_MS, NULL);
+
+    // the callbacks point at the batches, none may be left behind
+    for (size_t b = 0; b < nbatches && state.outstanding; b++)
+      engine_cancel (engine, &batches[b]);
+  }
+
+  WEATHER_ERROR failure = WEATHER_SUCCESS;
+  for (size_t b = 0; b < nbatches; b++)
+  {
+    if (WEATHER_SUCCESS == batches[b].status)
+      continue;
+    if (WEATHER_SUCCESS == failure)
+      failure = batches[b].status;
+    result->failed += batches[b].count;
+  }
+  if (WEATHER_SUCCESS == status && nbatches && result->failed == query->npoints)
+    status = failure;
+
+  free (batches);
+  free (state.names);
+  free (state.lengths);
+  free (url);
+  if (WEATHER_SUCCESS != status)
+    route_free (result);
+  return status;
+}
+
+void
+route_free (RouteResult *result)
+{
+  if (!result)
+    return;
+
+  free (result->values);
+  memset (result, 0, sizeof (*result));
+}
+
+static WEATHER_ERROR
+plan (const RouteQuery *query, size_t overhead, RouteBatch **batches,
+      size_t *nbatches)
+{
+  size_t max_url_length = query->max_url_length ? query->max_url_length
+						 : ROUTE_DEFAULT_URL_LENGTH;
+  size_t capacity = 0;
+  size_t length = overhead;
+
+  // greedy: a point joins the current request while the url still fits
+  for (size_t i = 0; i < query->npoints; i++)
+  {
+    char time[32];
+    char location[64];
+    WEATHER_ERROR status = point_text (&query->points[i], time, location);
+    if (WEATHER_SUCCESS != status)
+      return status;
+
+    RouteBatch *current = *nbatches ? &(*batches)[*nbatches - 1] : NULL;
+    size_t added = strlen (time) + strlen (location);
+    if (current && length + added + 2 < max_url_length)
+    {
+      current->count++;
+      length += added + 2;
+      continue;
+    }
+
+    if (overhead + added >= max_url_length)
+      return WEATHER_ERROR_URL_CONSTRUCTION;
+
+    if (*nbatches == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 16;
+      RouteBatch *larger = realloc (*batches, capacity * sizeof (RouteBatch));
+      if (!larger)
+	return WEATHER_ERROR_INVALID_MEMORY;
+      *batches = larger;
+    }
+    (*batches)[(*nbatches)++] = (RouteBatch){.first = i, .count = 1};
+    length = overhead + added;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+build_url (const RouteQuery *query, const RouteBatch *batch,
+	   size_t max_url_length, char *url)
+{
+  // dates and locations pair up by position
+  char *dates = malloc (max_url_length);
+  char *locations = malloc (max_url_length);
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  if (!dates || !locations)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+
+  size_t dates_length = 0;
+  size_t locations_length = 0;
+  for (size_t i = 0; i < batch->count && WEATHER_SUCCESS == status; i++)
+  {
+    char time[32];
+    char location[64];
+    status = point_text (&query->points[batch->first + i], time, location);
+    if (WEATHER_SUCCESS != status)
+      break;
+
+    // plan made sure the whole url fits, so the parts do too
+    dates_length += snprintf (dates + dates_length,
+			      max_url_length - dates_length, "%s%s",
+			      i ? "," : "", time);
+    locations_length += snprintf (locations + locations_length,
+				  max_url_length - locations_length, "%s%s",
+				  i ? "+" : "", location);
+  }
+
+  if (WEATHER_SUCCESS == status)
+  {
+    WeatherConfig config = {.datetime = dates,
+			    .parameters = query->parameters,
+			    .location = locations,
+			    .format = ROUTE_FORMAT};
+    status = construct_url (&config, url, max_url_length);
+  }
+
+  free (dates);
+  free (locations);
+  return status;
+}
+
+static void
+on_fetched (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  RouteBatch *batch = userdata;
+  batch->state->outstanding--;
+
+  if (WEATHER_SUCCESS == status)
+    status = parse_csv (batch, request->response.data);
+
+  // nothing half written stays behind
+  if (WEATHER_SUCCESS != status)
+  {
+    RouteResult *result = batch->state->result;
+    for (size_t p = 0; p < result->nparameters; p++)
+      for (size_t i = 0; i < batch->count; i++)
+	result->values[p * result->npoints + batch->first + i] = NAN;
+  }
+  batch->status = status;
+}
+
+static WEATHER_ERROR
+parse_csv (const RouteBatch *batch, const char *text)
+{
+  if (!text)
+    return WEATHER_ERROR_JSON;
+
+  const RouteState *state = batch->state;
+  RouteResult *result = state->result;
+  const char *at = text;
+  size_t nfields = 0;
+  int *columns = read_header (state, &at, &nfields);
+  if (!columns)
+    return WEATHER_ERROR_JSON;
+
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  for (size_t row = 0; row < batch->count && WEATHER_SUCCESS == status; row++)
+  {
+    size_t index = batch->first + row;
+    const RoutePoint *point = &state->points[index];
+
+    for (size_t f = 0; f < nfields; f++)
+    {
+      const char *end = field_end (at);
+      // a row needs all its fields, only the last one may end the line
+      if ((f + 1 < nfields) != (*end == ';'))
+      {
+	status = WEATHER_ERROR_JSON;
+	break;
+      }
+
+      char *parsed = (char *) at;
+      double number = 0;
+      int64_t time = 0;
+      if (COLUMN_TIME == columns[f])
+      {
+	char copy[64];
+	size_t length = (size_t) (end - at);
+	if (length >= sizeof (copy))
+	  status = WEATHER_ERROR_JSON;
+	else
+	{
+	  memcpy (copy, at, length);
+	  copy[length] = '\0';
+	  status = decode_parse_time (copy, &time);
+	}
+	if (WEATHER_SUCCESS == status && time != point->time)
+	  status = WEATHER_ERROR_JSON;
+	parsed = (char *) end;
+      }
+      else if (COLUMN_SKIP == columns[f])
+	parsed = (char *) end;
+      else
+	number = strtod (at, &parsed);
+
+      if (WEATHER_SUCCESS == status
+	  && (parsed != end
+	      || (COLUMN_LAT == columns[f]
+		  && fabs (number - point->lat) > ROUTE_COORDINATE_TOLERANCE)
+	      || (COLUMN_LON == columns[f]
+		  && fabs (number - point->lon) > ROUTE_COORDINATE_TOLERANCE)))
+	status = WEATHER_ERROR_JSON;
+      if (WEATHER_SUCCESS != status)
+	break;
+
+      if (columns[f] >= 0)
+	result->values[(size_t) columns[f] * result->npoints + index] = number;
+      // the last field takes the whole line ending with it, \r\n included
+      at = f + 1 < nfields ? end + 1 : end + strspn (end, "\r\n");
+    }
+  }
+
+  // a row more than there were points means the answer is not ours
+  if (WEATHER_SUCCESS == status && *at)
+    status = WEATHER_ERROR_JSON;
+
+  free (columns);
+  return status;
+}
+
+static int *
+read_header (const RouteState *state, const char **at, size_t *nfields)
+{
+  const char *line = *at;
+  const char *end = line + strcspn (line, "\r\n");
+  if (end == line)
+    return NULL;
+
+  *nfields = 1;
+  for (const char *p = line; p < end; p++)
+    *nfields += *p == ';';
+
+  int *columns = malloc (*nfields * sizeof (int));
+  size_t found = 0;
+  if (!columns)
+    return NULL;
+
+  for (size_t f = 0; f < *nfields; f++)
+  {
+    const char *stop = field_end (line);
+    size_t length = (size_t) (stop - line);
+    columns[f] = COLUMN_SKIP;
+
+    if (length == 3 && memcmp (line, "lat", 3) == 0)
+      columns[f] = COLUMN_LAT;
+    else if (length == 3 && memcmp (line, "lon", 3) == 0)
+      columns[f] = COLUMN_LON;
+    else if (length == 9 && memcmp (line, "validdate", 9) == 0)
+      columns[f] = COLUMN_TIME;
+    else
+      for (size_t p = 0; p < state->result->nparameters; p++)
+	if (length == state->lengths[p]
+	    && memcmp (line, state->names[p], length) == 0)
+	{
+	  columns[f] = (int) p;
+	  found++;
+	  break;
+	}
+
+    line = stop + 1;
+  }
+
+  // every parameter needs its column
+  if (found != state->result->nparameters)
+  {
+    free (columns);
+    return NULL;
+  }
+
+  *at = end;
+  while (**at == '\r' || **at == '\n')
+    (*at)++;
+  return columns;
+}
+
+static const char *
+field_end (const char *at)
+{
+  return at + strcspn (at, ";\r\n");
+}
+
+static WEATHER_ERROR
+point_text (const RoutePoint *point, char *time, char *location)
+{
+  WEATHER_ERROR status = decode_format_time (point->time, time, 32);
+  if (WEATHER_SUCCESS == status)
+    status = decode_format_location (point->lat, point->lon, location, 64);
+  return status;
+}
@@ -0,0 +1,61 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+#include "weather.h"
+
+// weather along a route: one value per parameter for each (lat, lon, time)
+// point. the api pairs the n-th date with the n-th location when the query
+// carries route=true, so a single request answers a whole stretch of the
+// route. points are packed into as few requests as max_url_length allows,
+// the requests run concurrently on the engine, and the answers come back
+// as csv that is scanned once, straight into the result columns at the
+// position of each point. no json is involved.
+//
+// every row is checked against the point it is meant to answer (location
+// and time), a request whose rows do not line up fails as a whole.
+#define ROUTE_DEFAULT_URL_LENGTH ENGINE_MAX_URL_LENGTH
+
+typedef struct
+{
+  double lat;
+  double lon;
+  int64_t time; // unix seconds
+} RoutePoint;
+
+typedef struct
+{
+  const char *parameters; // comma separated, as in any query
+  const RoutePoint *points;
+  size_t npoints;
+  size_t max_url_length; // 0 for ROUTE_DEFAULT_URL_LENGTH
+} RouteQuery;
+
+typedef struct
+{
+  size_t npoints;
+  size_t nparameters;
+  double *values; // a column of npoints per parameter, in the points' order
+  size_t requests;
+  size_t failed; // points whose request failed, their values are NaN
+} RouteResult;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// drives the engine until the whole route is answered. fails when no
+// request succeeded, a partly answered route comes back with failed set
+WEATHER_ERROR route_fetch (RequestEngine *engine, const RouteQuery *query, RouteResult *result);
+void route_free (RouteResult *result);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,343 @@
+#include <string.h>
+#include <time.h>
+
+#include "canonical.h"
+#include "metrics.h"
+#include "scheduler.h"
+
+typedef struct
+{
+  size_t count;
+  Subscription *members[];
+} FireGroup;
+
+// clang-format off
+static void arm (Scheduler *scheduler, Subscription *subscription, int64_t now);
+static int64_t random_between (Scheduler *scheduler, int64_t low, int64_t high);
+static WEATHER_ERROR submit_group (Scheduler *scheduler, Subscription **members, size_t count);
+static void on_group_done (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+static void release (Subscription *subscription);
+static int compare_urls (const void *a, const void *b);
+static int compare_due (const void *a, const void *b);
+// clang-format on
+
+WEATHER_ERROR
+scheduler_init (Scheduler *scheduler, RequestEngine *engine, int64_t now)
+{
+  if (!scheduler || !engine || now < 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (scheduler, 0, sizeof (*scheduler));
+  timerwheel_init (&scheduler->wheel, (uint64_t) now);
+  scheduler->engine = engine;
+  scheduler->rng = (uint64_t) now * 0x9E3779B97F4A7C15ULL | 1;
+  return WEATHER_SUCCESS;
+}
+
+void
+scheduler_cleanup (Scheduler *scheduler)
+{
+  if (!scheduler)
+    return;
+
+  while (scheduler->subscriptions)
+    scheduler_unsubscribe (scheduler, scheduler->subscriptions);
+  memset (scheduler, 0, sizeof (*scheduler));
+}
+
+WEATHER_ERROR
+scheduler_subscribe (Scheduler *scheduler, const WeatherConfig *query,
+		     int64_t interval, int64_t jitter,
+		     SubscriptionCallback callback, void *userdata,
+		     Subscription **subscription)
+{
+  if (!scheduler || !query || !callback || interval <= 0 || jitter < 0
+      || jitter >= interval)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  Subscription *created = calloc (1, sizeof (*created));
+  if (!created)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  // the url as asked for is only kept as a hash, to tell how many requests
+  // canonicalization saves
+  CanonicalQuery canonical;
+  WEATHER_ERROR status
+    = construct_url (query, created->url, sizeof (created->url));
+  if (WEATHER_SUCCESS == status)
+  {
+    created->query_hash = weather_hash (created->url);
+    status = canonical_query (query, scheduler->grid, &canonical);
+  }
+  if (WEATHER_SUCCESS == status)
+    status = construct_url (&canonical.config, created->url,
+			    sizeof (created->url));
+  if (WEATHER_SUCCESS != status)
+  {
+    free (created);
+    return status;
+  }
+
+  if (canonical.rewritten)
+    metrics_count (METRIC_CANONICAL_REWRITES, 1);
+  created->url_hash = weather_hash (created->url);
+  created->interval = interval;
+  created->jitter = jitter;
+  created->callback = callback;
+  created->userdata = userdata;
+
+  // spread first runs over the interval instead of firing all at once
+  int64_t now = (int64_t) scheduler->wheel.current;
+  created->nominal = now + random_between (scheduler, 0, interval - 1);
+  timerwheel_add (&scheduler->wheel, &created->timer,
+		  (uint64_t) created->nominal);
+
+  created->next = scheduler->subscriptions;
+  if (scheduler->subscriptions)
+    scheduler->subscriptions->prev = created;
+  scheduler->subscriptions = created;
+  scheduler->count++;
+
+  if (subscription)
+    *subscription = created;
+  return WEATHER_SUCCESS;
+}
+
+void
+scheduler_unsubscribe (Scheduler *scheduler, Subscription *subscription)
+{
+  if (!scheduler || !subscription || subscription->cancelled)
+    return;
+
+  timerwheel_remove (&scheduler->wheel, &subscription->timer);
+
+  if (subscription->prev)
+    subscription->prev->next = subscription->next;
+  else
+    scheduler->subscriptions = subscription->next;
+  if (subscription->next)
+    subscription->next->prev = subscription->prev;
+  scheduler->count--;
+
+  subscription->cancelled = 1;
+  release (subscription);
+}
+
+WEATHER_ERROR
+scheduler_poll (Scheduler *scheduler, int64_t now)
+{
+  if (!scheduler || now < 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  TimerEntry *expired = timerwheel_advance (&scheduler->wheel, (uint64_t) now);
+  if (!expired)
+    return WEATHER_SUCCESS;
+
+  size_t count = 0;
+  for (TimerEntry *entry = expired; entry; entry = entry->next)
+    count++;
+
+  Subscription **due = malloc (count * sizeof (*due));
+  if (!due)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  // the expired list is threaded through the entries, collect them before
+  // re-arming reuses those links
+  size_t n = 0;
+  for (TimerEntry *entry = expired; entry; entry = entry->next)
+    due[n++] = (Subscription *) entry;
+
+  for (size_t i = 0; i < count; i++)
+    arm (scheduler, due[i], now);
+
+  // identical queries end up next to each other and share one request
+  qsort (due, count, sizeof (*due), compare_due);
+
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  size_t start = 0;
+  while (start < count)
+  {
+    // every other spelling in the group would have been a request of its own
+    size_t spellings = 1;
+    size_t end = start + 1;
+    for (; end < count && compare_urls (&due[start], &due[end]) == 0; end++)
+      spellings += due[end]->query_hash != due[end - 1]->query_hash;
+
+    if (spellings > 1)
+    {
+      scheduler->canonical_shared += spellings - 1;
+      metrics_count (METRIC_CANONICAL_DEDUP_HITS, spellings - 1);
+    }
+
+    WEATHER_ERROR group_status
+      = submit_group (scheduler, &due[start], end - start);
+    if (WEATHER_SUCCESS != group_status)
+      status = group_status;
+    start = end;
+  }
+
+  scheduler->fired += count;
+  free (due);
+  return status;
+}
+
+int64_t
+scheduler_next_wakeup (const Scheduler *scheduler)
+{
+  uint64_t next = timerwheel_next_expiry (&scheduler->wheel);
+  return next > (uint64_t) INT64_MAX ? INT64_MAX : (int64_t) next;
+}
+
+WEATHER_ERROR
+scheduler_run (Scheduler *scheduler)
+{
+  if (!scheduler || !scheduler->engine)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  while (!scheduler->stop && WEATHER_SUCCESS == status)
+  {
+    int64_t now = (int64_t) time (NULL);
+    status = scheduler_poll (scheduler, now);
+    if (WEATHER_SUCCESS != status)
+      break;
+
+    // sleep until the next subscription is due, transfers and
+    // scheduler_stop wake the engine up earlier
+    int64_t wait_ms = (scheduler_next_wakeup (scheduler) - now) * 1000;
+    if (wait_ms > SCHEDULER_MAX_SLEEP_MS || wait_ms < 0)
+      wait_ms = SCHEDULER_MAX_SLEEP_MS;
+
+    status = engine_perform (scheduler->engine, (int) wait_ms, NULL);
+  }
+
+  return status;
+}
+
+void
+scheduler_stop (Scheduler *scheduler)
+{
+  scheduler->stop = 1;
+  if (scheduler->engine && scheduler->engine->multi)
+    curl_multi_wakeup (scheduler->engine->multi);
+}
+
+static void
+arm (Scheduler *scheduler, Subscription *subscription, int64_t now)
+{
+  // runs missed while we were busy are dropped rather than fired in a burst
+  do
+    subscription->nominal += subscription->interval;
+  while (subscription->nominal <= now);
+
+  int64_t due = subscription->nominal
+		+ random_between (scheduler, -subscription->jitter,
+				  subscription->jitter);
+  timerwheel_add (&scheduler->wheel, &subscription->timer,
+		  (uint64_t) (due > now ? due : now + 1));
+}
+
+static int64_t
+random_between (Scheduler *scheduler, int64_t low, int64_t high)
+{
+  if (high <= low)
+    return low;
+
+  // xorshift64*, plenty for spreading timers
+  uint64_t x = scheduler->rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  scheduler->rng = x;
+
+  uint64_t span = (uint64_t) (high - low) + 1;
+  return low + (int64_t) ((x * 0x2545F4914F6CDD1DULL) % span);
+}
+
+static WEATHER_ERROR
+submit_group (Scheduler *scheduler, Subscription **members, size_t count)
+{
+  FireGroup *group = malloc (sizeof (*group) + count * sizeof (*members));
+  if (!group)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  group->count = count;
+  for (size_t i = 0; i < count; i++)
+  {
+    group->members[i] = members[i];
+    members[i]->inflight++;
+  }
+
+  WEATHER_ERROR status
+    = engine_submit (scheduler->engine, members[0]->url,
+		     ENGINE_PRIORITY_STANDARD, on_group_done, group);
+  if (WEATHER_SUCCESS != status)
+  {
+    for (size_t i = 0; i < count; i++)
+      members[i]->inflight--;
+    free (group);
+    return status;
+  }
+
+  scheduler->requests++;
+  return WEATHER_SUCCESS;
+}
+
+static void
+on_group_done (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  FireGroup *group = userdata;
+
+  json_t *root = NULL;
+  if (WEATHER_SUCCESS == status)
+    status = process_json (request->response.data, &root);
+
+  for (size_t i = 0; i < group->count; i++)
+  {
+    Subscription *subscription = group->members[i];
+    subscription->inflight--;
+
+    if (subscription->cancelled)
+      release (subscription);
+    else
+      subscription->callback (subscription, status, root,
+			      subscription->userdata);
+  }
+
+  if (root)
+    json_decref (root);
+  free (group);
+}
+
+static void
+release (Subscription *subscription)
+{
+  if (subscription->cancelled && subscription->inflight == 0)
+    free (subscription);
+}
+
+static int
+compare_urls (const void *a, const void *b)
+{
+  const Subscription *sa = *(Subscription *const *) a;
+  const Subscription *sb = *(Subscription *const *) b;
+
+  if (sa->url_hash != sb->url_hash)
+    return sa->url_hash < sb->url_hash ? -1 : 1;
+  return strcmp (sa->url, sb->url);
+}
+
+static int
+compare_due (const void *a, const void *b)
+{
+  // spellings of the same query next to each other within its group
+  int order = compare_urls (a, b);
+  if (order)
+    return order;
+
+  const Subscription *sa = *(Subscription *const *) a;
+  const Subscription *sb = *(Subscription *const *) b;
+  if (sa->query_hash != sb->query_hash)
+    return sa->query_hash < sb->query_hash ? -1 : 1;
+  return 0;
+}
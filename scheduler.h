@@ -0,0 +1,91 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <jansson.h>
+
+#include "engine.h"
+#include "request.h"
+#include "timerwheel.h"
+#include "weather.h"
+
+// periodic subscriptions driven by a timer wheel with one second ticks.
+// every subscription fires every interval seconds, shifted by a random
+// jitter of up to +-jitter seconds so that subscriptions with the same
+// interval do not all hit the api in the same second. the first run is
+// spread uniformly over the first interval for the same reason.
+//
+// everything that comes due in the same poll is submitted to the engine
+// together, and subscriptions asking for the exact same url share a single
+// request whose result is handed to each of them. queries are canonicalized
+// (canonical.h) when subscribing, so the same query spelled differently
+// shares the request too. points are snapped to grid degrees, which is 0
+// (off) unless set after scheduler_init.
+#define SCHEDULER_MAX_SLEEP_MS 60000
+
+typedef struct Subscription Subscription;
+
+// root is NULL unless status is WEATHER_SUCCESS and only valid during the call
+typedef void (*SubscriptionCallback) (Subscription *subscription,
+				      WEATHER_ERROR status, const json_t *root,
+				      void *userdata);
+
+struct Subscription
+{
+  TimerEntry timer; // must stay first, the wheel hands back timer entries
+  char url[API_MAX_URL_LENGTH]; // canonical
+  uint64_t url_hash;
+  uint64_t query_hash; // of the url as subscribed
+  int64_t interval;
+  int64_t jitter;
+  int64_t nominal; // next due time before jitter is applied
+  SubscriptionCallback callback;
+  void *userdata;
+
+  int inflight; // requests carrying this subscription
+  int cancelled; // unsubscribed while in flight, freed on completion
+  struct Subscription *prev;
+  struct Subscription *next;
+};
+
+typedef struct
+{
+  TimerWheel wheel;
+  RequestEngine *engine;
+  Subscription *subscriptions;
+  size_t count;
+  uint64_t rng;
+  volatile int stop;
+  double grid;
+
+  size_t fired; // subscription runs
+  size_t requests; // requests submitted for them
+  size_t canonical_shared; // saved only because of canonicalization
+} Scheduler;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR scheduler_init (Scheduler *scheduler, RequestEngine *engine, int64_t now);
+void scheduler_cleanup (Scheduler *scheduler);
+// only datetime, parameters, location and format of query are used
+WEATHER_ERROR scheduler_subscribe (Scheduler *scheduler, const WeatherConfig *query, int64_t interval, int64_t jitter, SubscriptionCallback callback, void *userdata, Subscription **subscription);
+void scheduler_unsubscribe (Scheduler *scheduler, Subscription *subscription);
+// submits everything due at or before now
+WEATHER_ERROR scheduler_poll (Scheduler *scheduler, int64_t now);
+// INT64_MAX when there is nothing scheduled
+int64_t scheduler_next_wakeup (const Scheduler *scheduler);
+// polls and drives the engine until scheduler_stop is called
+WEATHER_ERROR scheduler_run (Scheduler *scheduler);
+// safe to call from another thread
+void scheduler_stop (Scheduler *scheduler);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,311 @@
+#include "decode.h"
+#include "schema.h"
+
+#define SCHEMA_INITIAL_CAPACITY 64
+
+// clang-format off
+static void skip_space (SchemaCursor *cursor);
+static int accept (SchemaCursor *cursor, char c);
+static int expect_key (SchemaCursor *cursor, const char *key, size_t length);
+static int read_string (SchemaCursor *cursor, const char **text, size_t *length);
+static int read_number (SchemaCursor *cursor, double *value);
+static int skip_value (SchemaCursor *cursor);
+static int parse_time (const char *text, size_t length, int64_t *time);
+static int digits (const char *text, int count);
+static int grow (SchemaAxis *axis, double **column, size_t *capacity);
+// clang-format on
+
+WEATHER_ERROR
+schema_begin (SchemaCursor *cursor, const char *text, size_t size)
+{
+  if (!cursor || !text)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  cursor->at = text;
+  cursor->end = text + size;
+  if (!accept (cursor, '{'))
+    return WEATHER_ERROR_JSON;
+
+  // version, user, dateGenerated and status are of no interest
+  do
+  {
+    const char *key;
+    size_t length;
+    if (!read_string (cursor, &key, &length) || !accept (cursor, ':'))
+      return WEATHER_ERROR_JSON;
+    if (length == 4 && memcmp (key, "data", 4) == 0)
+      return accept (cursor, '[') ? WEATHER_SUCCESS : WEATHER_ERROR_JSON;
+    if (!skip_value (cursor))
+      return WEATHER_ERROR_JSON;
+  } while (accept (cursor, ','));
+
+  return WEATHER_ERROR_JSON;
+}
+
+WEATHER_ERROR
+schema_column (SchemaCursor *cursor, size_t index, const char *parameter,
+	       size_t length, SchemaAxis *axis, double **column)
+{
+  if (!cursor || !parameter || !axis || !column)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  const char *name;
+  size_t name_length;
+  double lat, lon;
+  if ((index && !accept (cursor, ',')) || !accept (cursor, '{')
+      || !expect_key (cursor, "parameter", 9)
+      || !read_string (cursor, &name, &name_length) || name_length != length
+      || memcmp (name, parameter, length) != 0 || !accept (cursor, ',')
+      || !expect_key (cursor, "coordinates", 11) || !accept (cursor, '[')
+      || !accept (cursor, '{') || !expect_key (cursor, "lat", 3)
+      || !read_number (cursor, &lat) || !accept (cursor, ',')
+      || !expect_key (cursor, "lon", 3) || !read_number (cursor, &lon)
+      || !accept (cursor, ',') || !expect_key (cursor, "dates", 5)
+      || !accept (cursor, '['))
+    return WEATHER_ERROR_JSON;
+
+  // every later column has to line up with the first, point for point
+  size_t capacity = 0;
+  if (index == 0)
+  {
+    axis->lat = lat;
+    axis->lon = lon;
+    axis->count = 0;
+  }
+  else
+  {
+    if (lat != axis->lat || lon != axis->lon)
+      return WEATHER_ERROR_JSON;
+    *column = malloc ((axis->count ? axis->count : 1) * sizeof (double));
+    if (!*column)
+      return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  size_t count = 0;
+  if (!accept (cursor, ']'))
+  {
+    do
+    {
+      const char *date;
+      size_t date_length;
+      int64_t time;
+      double value;
+      if (!accept (cursor, '{') || !expect_key (cursor, "date", 4)
+	  || !read_string (cursor, &date, &date_length)
+	  || !parse_time (date, date_length, &time) || !accept (cursor, ',')
+	  || !expect_key (cursor, "value", 5) || !read_number (cursor, &value)
+	  || !accept (cursor, '}'))
+	return WEATHER_ERROR_JSON;
+
+      if (index == 0)
+      {
+	if (count == capacity && !grow (axis, column, &capacity))
+	  return WEATHER_ERROR_INVALID_MEMORY;
+	axis->times[count] = time;
+	axis->count = count + 1;
+      }
+      else if (count >= axis->count || axis->times[count] != time)
+	return WEATHER_ERROR_JSON;
+
+      (*column)[count++] = value;
+    } while (accept (cursor, ','));
+
+    if (!accept (cursor, ']'))
+      return WEATHER_ERROR_JSON;
+  }
+
+  // a second location ends up here too, the ']' is where it would start
+  if (count != axis->count || !accept (cursor, '}') || !accept (cursor, ']')
+      || !accept (cursor, '}'))
+    return WEATHER_ERROR_JSON;
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+schema_end (SchemaCursor *cursor)
+{
+  if (!cursor)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  // more parameters than the schema knows about
+  return accept (cursor, ']') ? WEATHER_SUCCESS : WEATHER_ERROR_JSON;
+}
+
+static void
+skip_space (SchemaCursor *cursor)
+{
+  while (cursor->at < cursor->end
+	 && (*cursor->at == ' ' || *cursor->at == '\n' || *cursor->at == '\r'
+	     || *cursor->at == '\t'))
+    cursor->at++;
+}
+
+static int
+accept (SchemaCursor *cursor, char c)
+{
+  skip_space (cursor);
+  if (cursor->at >= cursor->end || *cursor->at != c)
+    return 0;
+  cursor->at++;
+  return 1;
+}
+
+static int
+expect_key (SchemaCursor *cursor, const char *key, size_t length)
+{
+  skip_space (cursor);
+  if ((size_t) (cursor->end - cursor->at) < length + 2 || cursor->at[0] != '"'
+      || memcmp (cursor->at + 1, key, length) != 0
+      || cursor->at[length + 1] != '"')
+    return 0;
+  cursor->at += length + 2;
+  return accept (cursor, ':');
+}
+
+static int
+read_string (SchemaCursor *cursor, const char **text, size_t *length)
+{
+  if (!accept (cursor, '"'))
+    return 0;
+
+  // escapes are stepped over, not decoded. none of the strings compared
+  // here have any
+  const char *start = cursor->at;
+  while (cursor->at < cursor->end && *cursor->at != '"')
+    cursor->at += *cursor->at == '\\' ? 2 : 1;
+  if (cursor->at >= cursor->end)
+    return 0;
+
+  *text = start;
+  *length = (size_t) (cursor->at - start);
+  cursor->at++;
+  return 1;
+}
+
+static int
+read_number (SchemaCursor *cursor, double *value)
+{
+  skip_space (cursor);
+  if (cursor->at >= cursor->end)
+    return 0;
+
+  char *end;
+  *value = strtod (cursor->at, &end);
+  if (end == cursor->at || end > cursor->end)
+    return 0;
+  cursor->at = end;
+  return 1;
+}
+
+static int
+skip_value (SchemaCursor *cursor)
+{
+  skip_space (cursor);
+
+  // brackets are only counted, a mismatch is caught by whoever parses next
+  size_t depth = 0;
+  do
+  {
+    if (cursor->at >= cursor->end)
+      return 0;
+
+    const char *text;
+    size_t length;
+    switch (*cursor->at)
+    {
+    case '"':
+      if (!read_string (cursor, &text, &length))
+	return 0;
+      break;
+    case '{':
+    case '[':
+      depth++;
+      cursor->at++;
+      break;
+    case '}':
+    case ']':
+      if (depth == 0)
+	return 0;
+      depth--;
+      cursor->at++;
+      break;
+    default:
+      if (depth == 0 && *cursor->at == ',')
+	return 0;
+      cursor->at++;
+      // a bare number or literal ends where the next token starts
+      while (depth == 0 && cursor->at < cursor->end && *cursor->at != ','
+	     && *cursor->at != '}' && *cursor->at != ']')
+	cursor->at++;
+      break;
+    }
+  } while (depth);
+
+  return 1;
+}
+
+static int
+parse_time (const char *text, size_t length, int64_t *time)
+{
+  // the api always writes 2024-10-23T00:00:00Z, anything else takes the
+  // long way
+  if (length == 20 && text[4] == '-' && text[7] == '-' && text[10] == 'T'
+      && text[13] == ':' && text[16] == ':' && text[19] == 'Z')
+  {
+    int year = digits (text, 4);
+    int month = digits (text + 5, 2);
+    int day = digits (text + 8, 2);
+    int hour = digits (text + 11, 2);
+    int minute = digits (text + 14, 2);
+    int second = digits (text + 17, 2);
+    if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31
+	|| hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0
+	|| second > 60)
+      return 0;
+
+    *time = decode_days_from_civil (year, (unsigned) month, (unsigned) day)
+	      * 86400
+	    + hour * 3600 + minute * 60 + second;
+    return 1;
+  }
+
+  char copy[64];
+  if (length >= sizeof (copy))
+    return 0;
+  memcpy (copy, text, length);
+  copy[length] = '\0';
+  return WEATHER_SUCCESS == decode_parse_time (copy, time);
+}
+
+static int
+digits (const char *text, int count)
+{
+  int value = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (text[i] < '0' || text[i] > '9')
+      return -1;
+    value = value * 10 + (text[i] - '0');
+  }
+  return value;
+}
+
+static int
+grow (SchemaAxis *axis, double **column, size_t *capacity)
+{
+  size_t larger = *capacity ? *capacity * 2 : SCHEMA_INITIAL_CAPACITY;
+
+  int64_t *times = realloc (axis->times, larger * sizeof (int64_t));
+  if (!times)
+    return 0;
+  axis->times = times;
+
+  double *values = realloc (*column, larger * sizeof (double));
+  if (!values)
+    return 0;
+  *column = values;
+
+  *capacity = larger;
+  return 1;
+}
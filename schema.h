@@ -0,0 +1,110 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weather.h"
+
+// decoders specialised at compile time for queries whose parameter list is
+// fixed in the source. a schema is an x-macro of column names and the api
+// parameters (units included) that fill them:
+//
+//   #define FORECAST_SCHEMA(X)
+//     X (temperature, "t_2m:C")
+//     X (precipitation, "precip_1h:mm")
+//   SCHEMA_DEFINE (Forecast, forecast, FORECAST_SCHEMA)
+//
+// defines a struct of arrays, one column per parameter on a shared time axis
+//
+//   typedef struct { SchemaAxis axis; double *temperature;
+//                    double *precipitation; } Forecast;
+//
+// along with forecast_decode, forecast_free and forecast_parameters (the
+// comma separated list to put in the query).
+//
+// the decoder reads the response text as it comes, no json document is
+// built. it expects exactly what the api answers to that query: the
+// parameters in schema order, one location, the same dates for each. the
+// decode is unrolled per column at compile time, every key is checked at
+// its expected place with a single compare and every value goes straight
+// into its column. a response of any other shape fails with
+// WEATHER_ERROR_JSON, decode_series still reads it.
+
+typedef struct
+{
+  double lat;
+  double lon;
+  size_t count;
+  int64_t *times; // unix seconds
+} SchemaAxis;
+
+typedef struct
+{
+  const char *at;
+  const char *end;
+} SchemaCursor;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// text has to be nul terminated at size, response buffers are
+WEATHER_ERROR schema_begin (SchemaCursor *cursor, const char *text, size_t size);
+// the first column sets the axis, later ones have to match it
+WEATHER_ERROR schema_column (SchemaCursor *cursor, size_t index, const char *parameter, size_t length, SchemaAxis *axis, double **column);
+WEATHER_ERROR schema_end (SchemaCursor *cursor);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#define SCHEMA_MEMBER(name, parameter) double *name;
+#define SCHEMA_PARAMETER(name, parameter) "," parameter
+#define SCHEMA_FREE(name, parameter) free (out->name);
+#define SCHEMA_COLUMN(name, parameter)                                         \
+  if (WEATHER_SUCCESS == status)                                               \
+    status = schema_column (&cursor, index++, parameter,                       \
+			    sizeof (parameter) - 1, &out->axis, &out->name);
+
+#define SCHEMA_DEFINE(Type, prefix, SCHEMA)                                    \
+  typedef struct                                                               \
+  {                                                                            \
+    SchemaAxis axis;                                                           \
+    SCHEMA (SCHEMA_MEMBER)                                                     \
+  } Type;                                                                      \
+                                                                               \
+  static const char prefix##_parameter_list[] = "" SCHEMA (SCHEMA_PARAMETER);  \
+                                                                               \
+  static inline const char *prefix##_parameters (void)                         \
+  {                                                                            \
+    return prefix##_parameter_list + 1;                                        \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_free (Type *out)                                 \
+  {                                                                            \
+    free (out->axis.times);                                                    \
+    SCHEMA (SCHEMA_FREE)                                                       \
+    memset (out, 0, sizeof (*out));                                            \
+  }                                                                            \
+                                                                               \
+  static inline WEATHER_ERROR prefix##_decode (const char *text, size_t size,  \
+					       Type *out)                      \
+  {                                                                            \
+    SchemaCursor cursor;                                                       \
+    size_t index = 0;                                                          \
+    memset (out, 0, sizeof (*out));                                            \
+    WEATHER_ERROR status = schema_begin (&cursor, text, size);                 \
+    SCHEMA (SCHEMA_COLUMN)                                                     \
+    if (WEATHER_SUCCESS == status)                                             \
+      status = schema_end (&cursor);                                           \
+    if (WEATHER_SUCCESS != status)                                             \
+      prefix##_free (out);                                                     \
+    return status;                                                             \
+  }
+
+#endif
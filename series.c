@@ -0,0 +1,456 @@
+#include <string.h>
+
+#include "series.h"
+
+#define SERIES_INITIAL_BYTES 64
+#define SERIES_INITIAL_BLOCKS 1
+
+// clang-format off
+static WEATHER_ERROR reserve_bits (CompressedSeries *series, size_t nbits);
+static void write_bits (CompressedSeries *series, uint64_t value, int nbits);
+static uint64_t read_bits (const uint8_t *data, size_t *bit_pos, int nbits);
+static WEATHER_ERROR open_block (CompressedSeries *series, int64_t time, double value);
+static void write_time (CompressedSeries *series, int64_t time);
+static void write_value (CompressedSeries *series, uint64_t bits);
+static void read_point (SeriesIterator *it, int64_t *time, double *value);
+// clang-format on
+
+static uint64_t
+double_to_bits (double value)
+{
+  uint64_t bits;
+  memcpy (&bits, &value, sizeof (bits));
+  return bits;
+}
+
+static double
+bits_to_double (uint64_t bits)
+{
+  double value;
+  memcpy (&value, &bits, sizeof (value));
+  return value;
+}
+
+WEATHER_ERROR
+series_init (CompressedSeries *series)
+{
+  if (!series)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (series, 0, sizeof (*series));
+  series->data = calloc (1, SERIES_INITIAL_BYTES);
+  series->blocks = malloc (SERIES_INITIAL_BLOCKS * sizeof (SeriesBlock));
+  if (!series->data || !series->blocks)
+  {
+    series_cleanup (series);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  series->capacity = SERIES_INITIAL_BYTES;
+  series->block_capacity = SERIES_INITIAL_BLOCKS;
+  return WEATHER_SUCCESS;
+}
+
+void
+series_cleanup (CompressedSeries *series)
+{
+  if (!series)
+    return;
+
+  free (series->data);
+  free (series->blocks);
+  memset (series, 0, sizeof (*series));
+}
+
+size_t
+series_memory_usage (const CompressedSeries *series)
+{
+  if (!series)
+    return 0;
+
+  return sizeof (*series) + series->capacity
+	 + series->block_capacity * sizeof (SeriesBlock);
+}
+
+WEATHER_ERROR
+series_shrink_to_fit (CompressedSeries *series)
+{
+  if (!series || !series->data)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  size_t bytes = (series->bit_size + 7) / 8;
+  size_t nblocks = series->nblocks;
+  if (bytes == 0 || nblocks == 0)
+    return WEATHER_SUCCESS;
+
+  uint8_t *new_data = realloc (series->data, bytes);
+  if (!new_data)
+    return WEATHER_ERROR_INVALID_MEMORY;
+  series->data = new_data;
+  series->capacity = bytes;
+
+  SeriesBlock *new_blocks
+    = realloc (series->blocks, nblocks * sizeof (SeriesBlock));
+  if (!new_blocks)
+    return WEATHER_ERROR_INVALID_MEMORY;
+  series->blocks = new_blocks;
+  series->block_capacity = nblocks;
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+series_append (CompressedSeries *series, int64_t time, double value)
+{
+  if (!series || !series->data)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  SeriesBlock *block = series->nblocks ? &series->blocks[series->nblocks - 1]
+				       : NULL;
+
+  if (block && time < block->last_time)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  if (!block || block->count == SERIES_BLOCK_POINTS)
+    return open_block (series, time, value);
+
+  // worst case is a 4 bit prefix + 64 bit dod and 2 + 5 + 6 + 64 bits value
+  WEATHER_ERROR status = reserve_bits (series, 68 + 77);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  write_time (series, time);
+  write_value (series, double_to_bits (value));
+
+  block->last_time = time;
+  block->count++;
+  series->count++;
+  return WEATHER_SUCCESS;
+}
+
+void
+series_iter_init (SeriesIterator *it, const CompressedSeries *series)
+{
+  memset (it, 0, sizeof (*it));
+  it->series = series;
+  if (series && series->nblocks)
+    it->bit_pos = series->blocks[0].bit_offset;
+}
+
+int
+series_iter_next (SeriesIterator *it, int64_t *time, double *value)
+{
+  const CompressedSeries *series = it->series;
+  if (!series || it->block >= series->nblocks)
+    return 0;
+
+  if (it->index == series->blocks[it->block].count)
+  {
+    if (++it->block >= series->nblocks)
+      return 0;
+    it->index = 0;
+    it->bit_pos = series->blocks[it->block].bit_offset;
+  }
+
+  read_point (it, time, value);
+  return 1;
+}
+
+size_t
+series_find_block (const CompressedSeries *series, int64_t time)
+{
+  if (!series || series->nblocks == 0)
+    return 0;
+
+  size_t lo = 0;
+  size_t hi = series->nblocks;
+  while (hi - lo > 1)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (series->blocks[mid].first_time <= time)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  // a block ending on time holds some of its points too
+  while (lo > 0 && series->blocks[lo - 1].last_time >= time)
+    lo--;
+  return lo;
+}
+
+size_t
+series_decode_block (const CompressedSeries *series, size_t block,
+		     int64_t *times, double *values)
+{
+  if (!series || block >= series->nblocks)
+    return 0;
+
+  SeriesIterator it;
+  series_iter_init (&it, series);
+  it.block = block;
+  it.bit_pos = series->blocks[block].bit_offset;
+
+  uint32_t count = series->blocks[block].count;
+  for (uint32_t i = 0; i < count; i++)
+    read_point (&it, &times[i], &values[i]);
+
+  return count;
+}
+
+WEATHER_ERROR
+series_decode_range (const CompressedSeries *series, int64_t from, int64_t to,
+		     int64_t *times, double *values, size_t max_points,
+		     size_t *npoints)
+{
+  if (!series || !times || !values || !npoints || from > to)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  *npoints = 0;
+  if (series->nblocks == 0)
+    return WEATHER_SUCCESS;
+
+  SeriesIterator it;
+  series_iter_init (&it, series);
+  it.block = series_find_block (series, from);
+  it.bit_pos = series->blocks[it.block].bit_offset;
+
+  int64_t time;
+  double value;
+  while (series_iter_next (&it, &time, &value))
+  {
+    if (time > to)
+      break;
+    if (time < from)
+      continue;
+    if (*npoints == max_points)
+      return WEATHER_ERROR_INVALID_MEMORY;
+
+    times[*npoints] = time;
+    values[*npoints] = value;
+    (*npoints)++;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+static WEATHER_ERROR
+reserve_bits (CompressedSeries *series, size_t nbits)
+{
+  size_t needed = (series->bit_size + nbits + 7) / 8;
+  if (needed <= series->capacity)
+    return WEATHER_SUCCESS;
+
+  size_t new_capacity = series->capacity * 2;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+
+  uint8_t *new_data = realloc (series->data, new_capacity);
+  if (!new_data)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  // write_bits ors into the buffer so the new tail has to start zeroed
+  memset (new_data + series->capacity, 0, new_capacity - series->capacity);
+  series->data = new_data;
+  series->capacity = new_capacity;
+  return WEATHER_SUCCESS;
+}
+
+static void
+write_bits (CompressedSeries *series, uint64_t value, int nbits)
+{
+  while (nbits > 0)
+  {
+    size_t byte = series->bit_size >> 3;
+    int room = 8 - (int) (series->bit_size & 7);
+    int take = nbits < room ? nbits : room;
+    uint8_t chunk = (uint8_t) ((value >> (nbits - take)) & ((1u << take) - 1));
+
+    series->data[byte] |= (uint8_t) (chunk << (room - take));
+    series->bit_size += take;
+    nbits -= take;
+  }
+}
+
+static uint64_t
+read_bits (const uint8_t *data, size_t *bit_pos, int nbits)
+{
+  uint64_t value = 0;
+  while (nbits > 0)
+  {
+    size_t byte = *bit_pos >> 3;
+    int room = 8 - (int) (*bit_pos & 7);
+    int take = nbits < room ? nbits : room;
+    uint8_t chunk = (uint8_t) (data[byte] >> (room - take)) & ((1u << take) - 1);
+
+    value = (value << take) | chunk;
+    *bit_pos += take;
+    nbits -= take;
+  }
+  return value;
+}
+
+static WEATHER_ERROR
+open_block (CompressedSeries *series, int64_t time, double value)
+{
+  if (series->nblocks == series->block_capacity)
+  {
+    size_t new_capacity = series->block_capacity * 2;
+    SeriesBlock *new_blocks
+      = realloc (series->blocks, new_capacity * sizeof (SeriesBlock));
+    if (!new_blocks)
+      return WEATHER_ERROR_INVALID_MEMORY;
+
+    series->blocks = new_blocks;
+    series->block_capacity = new_capacity;
+  }
+
+  // blocks start on a byte boundary so they can be decoded independently
+  series->bit_size = (series->bit_size + 7) & ~(size_t) 7;
+
+  WEATHER_ERROR status = reserve_bits (series, 128);
+  if (WEATHER_SUCCESS != status)
+    return status;
+
+  SeriesBlock *block = &series->blocks[series->nblocks++];
+  block->first_time = time;
+  block->last_time = time;
+  block->bit_offset = series->bit_size;
+  block->count = 1;
+
+  uint64_t bits = double_to_bits (value);
+  write_bits (series, (uint64_t) time, 64);
+  write_bits (series, bits, 64);
+
+  series->prev_time = time;
+  series->prev_delta = 0;
+  series->prev_value = bits;
+  series->prev_leading = -1;
+  series->prev_trailing = 0;
+  series->count++;
+  return WEATHER_SUCCESS;
+}
+
+static void
+write_time (CompressedSeries *series, int64_t time)
+{
+  int64_t delta = time - series->prev_time;
+  int64_t dod = delta - series->prev_delta;
+
+  if (dod == 0)
+    write_bits (series, 0x0, 1);
+  else if (dod >= -63 && dod <= 64)
+  {
+    write_bits (series, 0x2, 2);
+    write_bits (series, (uint64_t) (dod + 63), 7);
+  }
+  else if (dod >= -255 && dod <= 256)
+  {
+    write_bits (series, 0x6, 3);
+    write_bits (series, (uint64_t) (dod + 255), 9);
+  }
+  else if (dod >= -2047 && dod <= 2048)
+  {
+    write_bits (series, 0xe, 4);
+    write_bits (series, (uint64_t) (dod + 2047), 12);
+  }
+  else
+  {
+    write_bits (series, 0xf, 4);
+    write_bits (series, (uint64_t) dod, 64);
+  }
+
+  series->prev_time = time;
+  series->prev_delta = delta;
+}
+
+static void
+write_value (CompressedSeries *series, uint64_t bits)
+{
+  uint64_t xor = bits ^ series->prev_value;
+  series->prev_value = bits;
+
+  if (xor == 0)
+  {
+    write_bits (series, 0x0, 1);
+    return;
+  }
+
+  int leading = __builtin_clzll (xor);
+  int trailing = __builtin_ctzll (xor);
+  if (leading > 31)
+    leading = 31; // only 5 bits to store it in
+
+  if (series->prev_leading >= 0 && leading >= series->prev_leading
+      && trailing >= series->prev_trailing)
+  {
+    // fits in the previous window, reuse it
+    int meaningful = 64 - series->prev_leading - series->prev_trailing;
+    write_bits (series, 0x2, 2);
+    write_bits (series, xor >> series->prev_trailing, meaningful);
+    return;
+  }
+
+  int meaningful = 64 - leading - trailing;
+  write_bits (series, 0x3, 2);
+  write_bits (series, (uint64_t) leading, 5);
+  write_bits (series, (uint64_t) (meaningful & 63), 6); // 64 is stored as 0
+  write_bits (series, xor >> trailing, meaningful);
+
+  series->prev_leading = leading;
+  series->prev_trailing = trailing;
+}
+
+static void
+read_point (SeriesIterator *it, int64_t *time, double *value)
+{
+  const uint8_t *data = it->series->data;
+
+  if (it->index == 0)
+  {
+    it->prev_time = (int64_t) read_bits (data, &it->bit_pos, 64);
+    it->prev_value = read_bits (data, &it->bit_pos, 64);
+    it->prev_delta = 0;
+    it->prev_leading = -1;
+    it->prev_trailing = 0;
+    it->index++;
+
+    *time = it->prev_time;
+    *value = bits_to_double (it->prev_value);
+    return;
+  }
+
+  int64_t dod;
+  if (read_bits (data, &it->bit_pos, 1) == 0)
+    dod = 0;
+  else if (read_bits (data, &it->bit_pos, 1) == 0)
+    dod = (int64_t) read_bits (data, &it->bit_pos, 7) - 63;
+  else if (read_bits (data, &it->bit_pos, 1) == 0)
+    dod = (int64_t) read_bits (data, &it->bit_pos, 9) - 255;
+  else if (read_bits (data, &it->bit_pos, 1) == 0)
+    dod = (int64_t) read_bits (data, &it->bit_pos, 12) - 2047;
+  else
+    dod = (int64_t) read_bits (data, &it->bit_pos, 64);
+
+  it->prev_delta += dod;
+  it->prev_time += it->prev_delta;
+
+  if (read_bits (data, &it->bit_pos, 1) == 1)
+  {
+    if (read_bits (data, &it->bit_pos, 1) == 1)
+    {
+      it->prev_leading = (int) read_bits (data, &it->bit_pos, 5);
+      int meaningful = (int) read_bits (data, &it->bit_pos, 6);
+      if (meaningful == 0)
+	meaningful = 64;
+      it->prev_trailing = 64 - it->prev_leading - meaningful;
+    }
+
+    int meaningful = 64 - it->prev_leading - it->prev_trailing;
+    uint64_t xor = read_bits (data, &it->bit_pos, meaningful);
+    it->prev_value ^= xor << it->prev_trailing;
+  }
+
+  it->index++;
+  *time = it->prev_time;
+  *value = bits_to_double (it->prev_value);
+}
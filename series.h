@@ -0,0 +1,89 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "weather.h"
+
+// compressed time series (gorilla style): timestamps are stored as
+// delta-of-delta and values as the xor against the previous value, so a
+// smooth hourly series costs a couple of bits per timestamp and a handful of
+// bits per value instead of 16 bytes per point.
+//
+// points are grouped into blocks of SERIES_BLOCK_POINTS. every block starts
+// byte aligned with a raw timestamp and value so it can be decoded on its own,
+// which is what gives us random access without decoding from the start.
+#define SERIES_BLOCK_POINTS 128
+
+typedef struct
+{
+  int64_t first_time; // unix seconds of the first point in the block
+  int64_t last_time;
+  size_t bit_offset; // where the block starts in the bitstream
+  uint32_t count;
+} SeriesBlock;
+
+typedef struct
+{
+  uint8_t *data;
+  size_t bit_size; // bits written so far
+  size_t capacity; // bytes allocated in data
+
+  SeriesBlock *blocks;
+  size_t nblocks;
+  size_t block_capacity;
+  size_t count; // total points
+
+  // encoder state for the block that is currently being appended to
+  int64_t prev_time;
+  int64_t prev_delta;
+  uint64_t prev_value;
+  int prev_leading;
+  int prev_trailing;
+} CompressedSeries;
+
+typedef struct
+{
+  const CompressedSeries *series;
+  size_t block;
+  uint32_t index; // point index inside the current block
+  size_t bit_pos;
+
+  int64_t prev_time;
+  int64_t prev_delta;
+  uint64_t prev_value;
+  int prev_leading;
+  int prev_trailing;
+} SeriesIterator;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR series_init (CompressedSeries *series);
+void series_cleanup (CompressedSeries *series);
+// timestamps have to be non decreasing, anything else is rejected
+WEATHER_ERROR series_append (CompressedSeries *series, int64_t time, double value);
+size_t series_memory_usage (const CompressedSeries *series);
+// releases the spare capacity, appending after this still works
+WEATHER_ERROR series_shrink_to_fit (CompressedSeries *series);
+
+void series_iter_init (SeriesIterator *it, const CompressedSeries *series);
+int series_iter_next (SeriesIterator *it, int64_t *time, double *value);
+
+// index of the first block that may contain time. equal timestamps can run
+// across a block boundary, so that is not always the last one starting at
+// or before it
+size_t series_find_block (const CompressedSeries *series, int64_t time);
+// decodes a whole block, times and values need room for SERIES_BLOCK_POINTS
+size_t series_decode_block (const CompressedSeries *series, size_t block, int64_t *times, double *values);
+WEATHER_ERROR series_decode_range (const CompressedSeries *series, int64_t from, int64_t to, int64_t *times, double *values, size_t max_points, size_t *npoints);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
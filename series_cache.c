@@ -0,0 +1,523 @@
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "probes.h"
+#include "series_cache.h"
+
+#define SERIES_CACHE_INITIAL_BUCKETS 64
+
+// clang-format off
+static char *make_key (const char *parameter, const char *location);
+static SeriesCacheEntry *find_entry (SeriesCache *cache, const char *key, uint64_t hash);
+static WEATHER_ERROR grow_buckets (SeriesCache *cache);
+static void lru_unlink (SeriesCache *cache, SeriesCacheEntry *entry);
+static void lru_push_front (SeriesCache *cache, SeriesCacheEntry *entry);
+static void remove_entry (SeriesCache *cache, SeriesCacheEntry *entry);
+static void evict (SeriesCache *cache, const SeriesCacheEntry *keep);
+static WEATHER_ERROR merge_points (CompressedSeries *series, const int64_t *times, const double *values, size_t npoints);
+static int expired (const SeriesCache *cache, const SeriesCover *cover, int64_t now);
+static int lines_up (const SeriesInterval *interval, const SeriesInterval *range);
+static int64_t floor_mod (int64_t a, int64_t b);
+// clang-format on
+
+WEATHER_ERROR
+series_cache_init (SeriesCache *cache, size_t max_memory)
+{
+  if (!cache || max_memory == 0)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (cache, 0, sizeof (*cache));
+  cache->buckets
+    = calloc (SERIES_CACHE_INITIAL_BUCKETS, sizeof (SeriesCacheEntry *));
+  if (!cache->buckets)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  cache->nbuckets = SERIES_CACHE_INITIAL_BUCKETS;
+  cache->max_memory = max_memory;
+  return WEATHER_SUCCESS;
+}
+
+void
+series_cache_cleanup (SeriesCache *cache)
+{
+  if (!cache)
+    return;
+
+  while (cache->lru_head)
+    remove_entry (cache, cache->lru_head);
+
+  free (cache->buckets);
+  memset (cache, 0, sizeof (*cache));
+}
+
+WEATHER_ERROR
+series_cache_put (SeriesCache *cache, const char *parameter,
+		  const char *location, const int64_t *times,
+		  const double *values, size_t npoints)
+{
+  if (!cache || !parameter || !location || (npoints && (!times || !values)))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  char *key = make_key (parameter, location);
+  if (!key)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  uint64_t hash = weather_hash (key);
+  SeriesCacheEntry *entry = find_entry (cache, key, hash);
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+
+  if (entry)
+  {
+    free (key);
+    cache->memory_used -= series_memory_usage (&entry->series);
+    status = merge_points (&entry->series, times, values, npoints);
+    if (WEATHER_SUCCESS == status)
+      status = series_shrink_to_fit (&entry->series);
+    cache->memory_used += series_memory_usage (&entry->series);
+    lru_unlink (cache, entry);
+    lru_push_front (cache, entry);
+  }
+  else
+  {
+    if (cache->count >= cache->nbuckets)
+    {
+      status = grow_buckets (cache);
+      if (WEATHER_SUCCESS != status)
+      {
+	free (key);
+	return status;
+      }
+    }
+
+    entry = calloc (1, sizeof (*entry));
+    if (!entry)
+    {
+      free (key);
+      return WEATHER_ERROR_INVALID_MEMORY;
+    }
+
+    entry->key = key;
+    entry->hash = hash;
+    status = series_init (&entry->series);
+    if (WEATHER_SUCCESS == status)
+      status = merge_points (&entry->series, times, values, npoints);
+    if (WEATHER_SUCCESS == status)
+      status = series_shrink_to_fit (&entry->series);
+    if (WEATHER_SUCCESS != status)
+    {
+      series_cleanup (&entry->series);
+      free (entry->key);
+      free (entry);
+      return status;
+    }
+
+    size_t bucket = hash % cache->nbuckets;
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    cache->count++;
+    cache->memory_used += series_memory_usage (&entry->series);
+    lru_push_front (cache, entry);
+  }
+
+  evict (cache, entry);
+  return status;
+}
+
+const CompressedSeries *
+series_cache_get (SeriesCache *cache, const char *parameter,
+		  const char *location)
+{
+  if (!cache || !parameter || !location)
+    return NULL;
+
+  char *key = make_key (parameter, location);
+  if (!key)
+    return NULL;
+
+  SeriesCacheEntry *entry = find_entry (cache, key, weather_hash (key));
+  if (entry)
+    WEATHER_PROBE2 (cache_hit, "series", key);
+  else
+    WEATHER_PROBE2 (cache_miss, "series", key);
+  free (key);
+
+  if (!entry)
+  {
+    cache->misses++;
+    metrics_count (METRIC_SERIES_CACHE_MISSES, 1);
+    return NULL;
+  }
+
+  cache->hits++;
+  metrics_count (METRIC_SERIES_CACHE_HITS, 1);
+  lru_unlink (cache, entry);
+  lru_push_front (cache, entry);
+  return &entry->series;
+}
+
+WEATHER_ERROR
+series_cache_cover (SeriesCache *cache, const char *parameter,
+		    const char *location, const SeriesInterval *range)
+{
+  if (!cache || !parameter || !location || !range || range->step <= 0
+      || range->end < range->start)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  char *key = make_key (parameter, location);
+  if (!key)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  SeriesCacheEntry *entry = find_entry (cache, key, weather_hash (key));
+  free (key);
+  // nothing to vouch for when the points are not here
+  if (!entry)
+    return WEATHER_SUCCESS;
+
+  SeriesCover merged = {.range = *range, .recorded = (int64_t) time (NULL)};
+  merged.range.end -= (range->end - range->start) % range->step;
+
+  // ranges on the same step that overlap or touch fold into one, dated by
+  // the older of the two. expired ones go, the rest stay as they are
+  size_t kept = 0;
+  for (size_t i = 0; i < entry->ncovered; i++)
+  {
+    const SeriesCover *other = &entry->covered[i];
+    if (expired (cache, other, merged.recorded))
+      continue;
+
+    int64_t step = merged.range.step;
+    if (other->range.step == step
+	&& floor_mod (other->range.start - merged.range.start, step) == 0
+	&& other->range.start <= merged.range.end + step
+	&& merged.range.start <= other->range.end + step)
+    {
+      if (other->range.start < merged.range.start)
+	merged.range.start = other->range.start;
+      if (other->range.end > merged.range.end)
+	merged.range.end = other->range.end;
+      if (other->recorded < merged.recorded)
+	merged.recorded = other->recorded;
+      continue;
+    }
+    entry->covered[kept++] = *other;
+  }
+
+  SeriesCover *larger
+    = realloc (entry->covered, (kept + 1) * sizeof (SeriesCover));
+  if (!larger)
+  {
+    entry->ncovered = kept;
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  size_t at = kept;
+  while (at > 0 && larger[at - 1].range.start > merged.range.start)
+  {
+    larger[at] = larger[at - 1];
+    at--;
+  }
+  larger[at] = merged;
+  entry->covered = larger;
+  entry->ncovered = kept + 1;
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+series_cache_gaps (SeriesCache *cache, const char *parameter,
+		   const char *location, const SeriesInterval *range,
+		   SeriesInterval **gaps, size_t *ngaps)
+{
+  if (!cache || !parameter || !location || !range || !gaps || !ngaps
+      || range->step <= 0 || range->end < range->start)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  *gaps = NULL;
+  *ngaps = 0;
+
+  char *key = make_key (parameter, location);
+  if (!key)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  SeriesCacheEntry *entry = find_entry (cache, key, weather_hash (key));
+  free (key);
+
+  size_t ncovered = entry ? entry->ncovered : 0;
+  *gaps = malloc ((ncovered + 1) * sizeof (SeriesInterval));
+  if (!*gaps)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  // in point indices of the range. the ranges are sorted by start, so
+  // where each one begins in the range only ever moves forward
+  int64_t last = (range->end - range->start) / range->step;
+  int64_t next = 0; // the first point nothing vouched for yet
+  int64_t now = (int64_t) time (NULL);
+  for (size_t i = 0; i < ncovered && next <= last; i++)
+  {
+    const SeriesInterval *interval = &entry->covered[i].range;
+    if (expired (cache, &entry->covered[i], now)
+	|| !lines_up (interval, range) || interval->end < range->start
+	|| interval->start > range->end)
+      continue;
+
+    int64_t first = interval->start <= range->start
+		      ? 0
+		      : (interval->start - range->start + range->step - 1)
+			  / range->step;
+    int64_t through = (interval->end - range->start) / range->step;
+    if (first > next)
+      (*gaps)[(*ngaps)++]
+	= (SeriesInterval){.start = range->start + next * range->step,
+			   .end = range->start + (first - 1) * range->step,
+			   .step = range->step};
+    if (through + 1 > next)
+      next = through + 1;
+  }
+
+  if (next <= last)
+    (*gaps)[(*ngaps)++]
+      = (SeriesInterval){.start = range->start + next * range->step,
+			 .end = range->start + last * range->step,
+			 .step = range->step};
+
+  if (!*ngaps)
+  {
+    free (*gaps);
+    *gaps = NULL;
+  }
+  return WEATHER_SUCCESS;
+}
+
+static char *
+make_key (const char *parameter, const char *location)
+{
+  size_t len = strlen (parameter) + strlen (location) + 2;
+  char *key = malloc (len);
+  if (key)
+    snprintf (key, len, "%s@%s", parameter, location);
+  return key;
+}
+
+static SeriesCacheEntry *
+find_entry (SeriesCache *cache, const char *key, uint64_t hash)
+{
+  for (SeriesCacheEntry *entry = cache->buckets[hash % cache->nbuckets]; entry;
+       entry = entry->next)
+  {
+    if (entry->hash == hash && strcmp (entry->key, key) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+static WEATHER_ERROR
+grow_buckets (SeriesCache *cache)
+{
+  size_t new_count = cache->nbuckets * 2;
+  SeriesCacheEntry **new_buckets = calloc (new_count, sizeof (*new_buckets));
+  if (!new_buckets)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  for (size_t i = 0; i < cache->nbuckets; i++)
+  {
+    SeriesCacheEntry *entry = cache->buckets[i];
+    while (entry)
+    {
+      SeriesCacheEntry *next = entry->next;
+      size_t bucket = entry->hash % new_count;
+      entry->next = new_buckets[bucket];
+      new_buckets[bucket] = entry;
+      entry = next;
+    }
+  }
+
+  free (cache->buckets);
+  cache->buckets = new_buckets;
+  cache->nbuckets = new_count;
+  return WEATHER_SUCCESS;
+}
+
+static void
+lru_unlink (SeriesCache *cache, SeriesCacheEntry *entry)
+{
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    cache->lru_head = entry->lru_next;
+
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    cache->lru_tail = entry->lru_prev;
+
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void
+lru_push_front (SeriesCache *cache, SeriesCacheEntry *entry)
+{
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->lru_prev = entry;
+  cache->lru_head = entry;
+  if (!cache->lru_tail)
+    cache->lru_tail = entry;
+}
+
+static void
+remove_entry (SeriesCache *cache, SeriesCacheEntry *entry)
+{
+  SeriesCacheEntry **link = &cache->buckets[entry->hash % cache->nbuckets];
+  while (*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+
+  lru_unlink (cache, entry);
+  cache->memory_used -= series_memory_usage (&entry->series);
+  cache->count--;
+
+  series_cleanup (&entry->series);
+  free (entry->covered);
+  free (entry->key);
+  free (entry);
+}
+
+static void
+evict (SeriesCache *cache, const SeriesCacheEntry *keep)
+{
+  // never evict the entry that was just written, even if it is over budget
+  // on its own
+  while (cache->memory_used > cache->max_memory && cache->lru_tail
+	 && cache->lru_tail != keep)
+  {
+    remove_entry (cache, cache->lru_tail);
+    cache->evictions++;
+  }
+}
+
+static WEATHER_ERROR
+merge_points (CompressedSeries *series, const int64_t *times,
+	      const double *values, size_t npoints)
+{
+  if (npoints == 0)
+    return WEATHER_SUCCESS;
+
+  int64_t last = series->nblocks ? series->blocks[series->nblocks - 1].last_time
+				 : INT64_MIN;
+
+  // common case, newer data is appended to the end
+  int in_order = times[0] > last;
+  for (size_t i = 1; in_order && i < npoints; i++)
+    in_order = times[i] > times[i - 1];
+
+  if (in_order)
+  {
+    for (size_t i = 0; i < npoints; i++)
+    {
+      WEATHER_ERROR status = series_append (series, times[i], values[i]);
+      if (WEATHER_SUCCESS != status)
+	return status;
+    }
+    return WEATHER_SUCCESS;
+  }
+
+  // overlapping or unordered input, decode and rebuild the series
+  size_t total = series->count + npoints;
+  int64_t *all_times = malloc (total * sizeof (int64_t));
+  double *all_values = malloc (total * sizeof (double));
+  size_t *order = malloc (npoints * sizeof (size_t));
+  if (!all_times || !all_values || !order)
+  {
+    free (all_times);
+    free (all_values);
+    free (order);
+    return WEATHER_ERROR_INVALID_MEMORY;
+  }
+
+  size_t nold = 0;
+  SeriesIterator it;
+  series_iter_init (&it, series);
+  while (series_iter_next (&it, &all_times[nold], &all_values[nold]))
+    nold++;
+
+  // insertion sort of the new points by index, inputs are small and mostly
+  // sorted already
+  for (size_t i = 0; i < npoints; i++)
+  {
+    size_t j = i;
+    while (j > 0 && times[order[j - 1]] > times[i])
+    {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  CompressedSeries merged;
+  WEATHER_ERROR status = series_init (&merged);
+  size_t a = 0;
+  size_t b = 0;
+  while (WEATHER_SUCCESS == status && (a < nold || b < npoints))
+  {
+    int64_t time;
+    double value;
+
+    if (b < npoints
+	&& (a == nold || times[order[b]] <= all_times[a]))
+    {
+      time = times[order[b]];
+      value = values[order[b]];
+      if (a < nold && all_times[a] == time)
+	a++; // new value replaces the cached one
+      b++;
+      // later duplicates in the input win
+      while (b < npoints && times[order[b]] == time)
+	value = values[order[b++]];
+    }
+    else
+    {
+      time = all_times[a];
+      value = all_values[a++];
+    }
+
+    status = series_append (&merged, time, value);
+  }
+
+  free (all_times);
+  free (all_values);
+  free (order);
+
+  if (WEATHER_SUCCESS != status)
+  {
+    series_cleanup (&merged);
+    return status;
+  }
+
+  series_cleanup (series);
+  *series = merged;
+  return WEATHER_SUCCESS;
+}
+
+static int
+expired (const SeriesCache *cache, const SeriesCover *cover, int64_t now)
+{
+  return cache->max_age > 0 && now - cover->recorded > cache->max_age;
+}
+
+static int
+lines_up (const SeriesInterval *interval, const SeriesInterval *range)
+{
+  // every point of range that falls inside interval is one of its points.
+  // a range of one point has no step to speak of, coverage_fetch gives it 1
+  return (range->start == range->end || range->step % interval->step == 0)
+	 && floor_mod (range->start - interval->start, interval->step) == 0;
+}
+
+static int64_t
+floor_mod (int64_t a, int64_t b)
+{
+  int64_t mod = a % b;
+  return mod < 0 ? mod + b : mod;
+}
@@ -0,0 +1,86 @@
+#ifndef SERIES_CACHE_H
+#define SERIES_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "series.h"
+
+// cache of decoded series keyed by parameter + location. series are kept
+// compressed so a long lived process can hold far more locations in the
+// same amount of memory, least recently used entries go first once
+// max_memory is reached.
+//
+// next to the points every entry remembers the time ranges it is known to
+// be complete over, so a query overlapping an earlier one only has to ask
+// the api for the parts that are missing. forecasts change with every model
+// run, set max_age to stop vouching for a range that many seconds after it
+// was recorded (0, the default, vouches for ever). the points stay until a
+// newer put replaces them.
+
+// every point from start to end, step seconds apart
+typedef struct
+{
+  int64_t start;
+  int64_t end;
+  int64_t step;
+} SeriesInterval;
+
+typedef struct
+{
+  SeriesInterval range;
+  int64_t recorded; // unix seconds
+} SeriesCover;
+
+typedef struct SeriesCacheEntry
+{
+  char *key;
+  uint64_t hash;
+  CompressedSeries series;
+  SeriesCover *covered; // sorted by start
+  size_t ncovered;
+  struct SeriesCacheEntry *next; // hash chain
+  struct SeriesCacheEntry *lru_prev;
+  struct SeriesCacheEntry *lru_next;
+} SeriesCacheEntry;
+
+typedef struct
+{
+  SeriesCacheEntry **buckets;
+  size_t nbuckets;
+  size_t count;
+  size_t memory_used;
+  size_t max_memory;
+  int64_t max_age;
+  SeriesCacheEntry *lru_head; // most recently used
+  SeriesCacheEntry *lru_tail;
+
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+} SeriesCache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+WEATHER_ERROR series_cache_init (SeriesCache *cache, size_t max_memory);
+void series_cache_cleanup (SeriesCache *cache);
+// merges the points into the cached series, new values win on equal timestamps
+WEATHER_ERROR series_cache_put (SeriesCache *cache, const char *parameter, const char *location, const int64_t *times, const double *values, size_t npoints);
+// returns NULL on a miss, the pointer is valid until the next put
+const CompressedSeries *series_cache_get (SeriesCache *cache, const char *parameter, const char *location);
+// records that the cached series holds every point of the range, for after
+// the points of a query that asked for exactly that range were put
+WEATHER_ERROR series_cache_cover (SeriesCache *cache, const char *parameter, const char *location, const SeriesInterval *range);
+// the parts of range no earlier cover vouches for, in order. a range covered
+// with a step that divides its own counts, as long as the points line up
+WEATHER_ERROR series_cache_gaps (SeriesCache *cache, const char *parameter, const char *location, const SeriesInterval *range, SeriesInterval **gaps, size_t *ngaps);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
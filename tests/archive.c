@@ -0,0 +1,249 @@
+// the archive on disk: appends and range reads, points arriving out of
+// order, and two processes writing the same segment at once.
+#include <sys/wait.h>
+
+#include "../archive.c"
+#include "test.h"
+
+#define WRITER_POINTS 2000
+
+// clang-format off
+static char *make_root (void);
+static void remove_root (char *root);
+static int read_all (WeatherArchive *archive, int64_t from, int64_t to, int64_t **times, double **values, size_t *count);
+static void append_one (WeatherArchive *archive, int64_t time, double value);
+// clang-format on
+
+static void
+test_round_trip (void)
+{
+  char *root = make_root ();
+  WeatherArchive archive;
+  CHECK_STATUS (WEATHER_SUCCESS, archive_open (&archive, root));
+
+  int64_t times[1200];
+  double values[1200];
+  for (size_t i = 0; i < 1200; i++)
+  {
+    times[i] = (int64_t) i * 3600;
+    values[i] = (double) i / 4;
+  }
+  CHECK_STATUS (WEATHER_SUCCESS, archive_append (&archive, "t_2m:C", "47,8",
+						 times, values, 1200));
+  // already there, skipped
+  CHECK_STATUS (WEATHER_SUCCESS, archive_append (&archive, "t_2m:C", "47,8",
+						 times, values, 600));
+
+  size_t count = 0;
+  CHECK_STATUS (WEATHER_SUCCESS, archive_count (&archive, "t_2m:C", "47,8",
+						100 * 3600, 1100 * 3600,
+						&count));
+  CHECK (count == 1001);
+
+  int64_t *read_times = NULL;
+  double *read_values = NULL;
+  CHECK (read_all (&archive, 100 * 3600, 1100 * 3600, &read_times,
+		   &read_values, &count));
+  CHECK (count == 1001);
+  for (size_t i = 0; i < count; i++)
+    CHECK (read_times[i] == (int64_t) (100 + i) * 3600
+	   && read_values[i] == (double) (100 + i) / 4);
+
+  // a buffer sized for fewer points than are in range
+  CHECK_STATUS (WEATHER_ERROR_INVALID_MEMORY,
+		archive_read (&archive, "t_2m:C", "47,8", 0, 1100 * 3600,
+			      read_times, read_values, 10, &count));
+  free (read_times);
+  free (read_values);
+
+  // nothing archived for another key is not an error
+  CHECK_STATUS (WEATHER_SUCCESS, archive_count (&archive, "t_2m:C", "0,0", 0,
+						INT64_MAX, &count));
+  CHECK (count == 0);
+
+  archive_close (&archive);
+  remove_root (root);
+}
+
+static void
+test_out_of_order (void)
+{
+  char *root = make_root ();
+  WeatherArchive archive;
+  CHECK_STATUS (WEATHER_SUCCESS, archive_open (&archive, root));
+
+  const int64_t times[] = {0, 7200, 14400, 3600, 10800, -3600};
+  const double values[] = {0, 2, 4, 1, 3, -1};
+  CHECK_STATUS (WEATHER_SUCCESS,
+		archive_append (&archive, "t_2m:C", "47,8", times, values, 6));
+
+  // stragglers are merged into the open chunk instead of starting new ones
+  ArchiveSegment *segment = archive.segments;
+  CHECK (segment && segment_header (segment)->nchunks == 1);
+  CHECK (segment
+	 && segment->map_size
+	      == sizeof (ArchiveHeader) + sizeof (ArchiveChunk));
+
+  int64_t *read_times = NULL;
+  double *read_values = NULL;
+  size_t count = 0;
+  CHECK (read_all (&archive, INT64_MIN, INT64_MAX, &read_times, &read_values,
+		   &count));
+  CHECK (count == 6);
+  for (size_t i = 0; i < count; i++)
+    CHECK (read_times[i] == ((int64_t) i - 1) * 3600
+	   && read_values[i] == (double) i - 1);
+  free (read_times);
+  free (read_values);
+
+  archive_close (&archive);
+  remove_root (root);
+}
+
+static void
+test_growth_and_stragglers (void)
+{
+  char *root = make_root ();
+  WeatherArchive archive;
+  CHECK_STATUS (WEATHER_SUCCESS, archive_open (&archive, root));
+
+  // three chunks and a bit, on even hours
+  size_t npoints = 3 * ARCHIVE_CHUNK_POINTS + 10;
+  for (size_t i = 0; i < npoints; i++)
+    append_one (&archive, (int64_t) i * 7200, (double) i * 2);
+
+  // the file doubled instead of growing a chunk at a time
+  ArchiveSegment *segment = archive.segments;
+  CHECK (segment && segment_header (segment)->nchunks == 4);
+  CHECK (segment
+	 && segment->map_size
+	      == sizeof (ArchiveHeader) + 4 * sizeof (ArchiveChunk));
+
+  // odd hours inside the full chunks push points on down the chain
+  for (int64_t hour = 1; hour < 1200; hour += 2)
+    append_one (&archive, hour * 3600, (double) hour);
+  append_one (&archive, 3600, -1); // already there
+
+  CHECK (segment && segment_header (segment)->nchunks == 5);
+  for (size_t c = 1; segment && c < segment_header (segment)->nchunks; c++)
+    CHECK (segment_chunk (segment, c - 1)->max_time
+	   < segment_chunk (segment, c)->min_time);
+
+  int64_t *read_times = NULL;
+  double *read_values = NULL;
+  size_t count = 0;
+  CHECK (read_all (&archive, 0, 1199 * 3600, &read_times, &read_values,
+		   &count));
+  CHECK (count == 1200);
+  for (size_t i = 0; i < count; i++)
+    CHECK (read_times[i] == (int64_t) i * 3600 && read_values[i] == (double) i);
+  free (read_times);
+  free (read_values);
+
+  CHECK_STATUS (WEATHER_SUCCESS, archive_count (&archive, "t_2m:C", "47,8",
+						INT64_MIN, INT64_MAX, &count));
+  CHECK (count == npoints + 600);
+
+  archive_close (&archive);
+  remove_root (root);
+}
+
+static void
+test_two_writers (void)
+{
+  // both processes keep their own mapping while the other one grows the
+  // file, the even points come from the child and the odd ones from us
+  char *root = make_root ();
+  WeatherArchive archive;
+  CHECK_STATUS (WEATHER_SUCCESS, archive_open (&archive, root));
+  append_one (&archive, -1, -1);
+
+  fflush (NULL);
+  pid_t child = fork ();
+  if (child == 0)
+  {
+    WeatherArchive own;
+    int failed = WEATHER_SUCCESS != archive_open (&own, root);
+    for (int64_t i = 0; !failed && i < WRITER_POINTS; i += 2)
+      failed = WEATHER_SUCCESS
+	       != archive_append (&own, "t_2m:C", "47,8", &i,
+				  &(double){(double) i}, 1);
+    archive_close (&own);
+    _exit (failed);
+  }
+
+  for (int64_t i = 1; i < WRITER_POINTS; i += 2)
+    append_one (&archive, i, (double) i);
+
+  int exit_status = -1;
+  CHECK (child > 0 && waitpid (child, &exit_status, 0) == child);
+  CHECK (WIFEXITED (exit_status) && WEXITSTATUS (exit_status) == 0);
+
+  int64_t *read_times = NULL;
+  double *read_values = NULL;
+  size_t count = 0;
+  CHECK (read_all (&archive, 0, INT64_MAX, &read_times, &read_values, &count));
+  CHECK (count == WRITER_POINTS);
+  for (size_t i = 0; i < count; i++)
+    CHECK (read_times[i] == (int64_t) i && read_values[i] == (double) i);
+  free (read_times);
+  free (read_values);
+
+  archive_close (&archive);
+  remove_root (root);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_round_trip);
+  RUN_TEST (test_out_of_order);
+  RUN_TEST (test_growth_and_stragglers);
+  RUN_TEST (test_two_writers);
+  return test_exit_status ();
+}
+
+static char *
+make_root (void)
+{
+  char *root = strdup ("/tmp/meteomatics-archive-XXXXXX");
+  if (!root || !mkdtemp (root))
+  {
+    perror ("mkdtemp");
+    exit (EXIT_FAILURE);
+  }
+  return root;
+}
+
+static void
+remove_root (char *root)
+{
+  char command[256];
+  snprintf (command, sizeof (command), "rm -rf '%s'", root);
+  CHECK (system (command) == 0);
+  free (root);
+}
+
+static int
+read_all (WeatherArchive *archive, int64_t from, int64_t to, int64_t **times,
+	  double **values, size_t *count)
+{
+  size_t archived = 0;
+  if (WEATHER_SUCCESS
+      != archive_count (archive, "t_2m:C", "47,8", from, to, &archived))
+    return 0;
+
+  *times = malloc ((archived + 1) * sizeof (int64_t));
+  *values = malloc ((archived + 1) * sizeof (double));
+  return *times && *values
+	 && WEATHER_SUCCESS
+	      == archive_read (archive, "t_2m:C", "47,8", from, to, *times,
+			       *values, archived, count);
+}
+
+static void
+append_one (WeatherArchive *archive, int64_t time, double value)
+{
+  CHECK_STATUS (WEATHER_SUCCESS, archive_append (archive, "t_2m:C", "47,8",
+						 &time, &value, 1));
+}
@@ -0,0 +1,72 @@
+// the memory budget: refusals at the limit, forced overdrafts, and what the
+// metrics registry makes of them.
+#include "../budget.c"
+#include "test.h"
+
+// clang-format off
+static int rendered (const char *line);
+// clang-format on
+
+static void
+test_charges (void)
+{
+  MemoryBudget budget;
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, budget_init (&budget, 0));
+  CHECK_STATUS (WEATHER_SUCCESS, budget_init (&budget, 1000));
+
+  CHECK (budget_charge (&budget, 600, 0));
+  CHECK (!budget_charge (&budget, 600, 0));
+  CHECK (budget_available (&budget, 400) && !budget_available (&budget, 401));
+  CHECK (budget_charge (&budget, 600, 1));
+  CHECK (atomic_load (&budget.used) == 1200
+	 && atomic_load (&budget.peak) == 1200);
+  CHECK (atomic_load (&budget.refused) == 1
+	 && atomic_load (&budget.overdrafts) == 1);
+
+  uint64_t generation = budget_generation (&budget);
+  budget_release (&budget, 1200);
+  CHECK (budget_generation (&budget) == generation + 1);
+  CHECK (atomic_load (&budget.used) == 0
+	 && atomic_load (&budget.peak) == 1200);
+}
+
+static void
+test_metrics (void)
+{
+  // the registry is process wide, test_charges already went through it
+  MemoryBudget budget;
+  CHECK_STATUS (WEATHER_SUCCESS, budget_init (&budget, 100));
+  CHECK (budget_charge (&budget, 40, 0));
+  CHECK (!budget_charge (&budget, 80, 0));
+
+  CHECK (rendered ("meteomatics_budget_used_bytes 40\n"));
+  CHECK (rendered ("meteomatics_budget_peak_bytes 1200\n"));
+  CHECK (rendered ("meteomatics_budget_refused_total 2\n"));
+  CHECK (rendered ("meteomatics_budget_overdrafts_total 1\n"));
+  budget_release (&budget, 40);
+  CHECK (rendered ("meteomatics_budget_used_bytes 0\n"));
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_charges);
+  RUN_TEST (test_metrics);
+  return test_exit_status ();
+}
+
+static int
+rendered (const char *line)
+{
+  char *text = NULL;
+  size_t size = 0;
+  FILE *stream = open_memstream (&text, &size);
+  if (!stream)
+    return 0;
+
+  int found = WEATHER_SUCCESS == metrics_render (stream);
+  fclose (stream);
+  found = found && text && strstr (text, line);
+  free (text);
+  return found;
+}
@@ -0,0 +1,100 @@
+// one spelling per query: parameters sorted and listed once, times in utc
+// with their steps in the shortest form, points snapped to the grid. what
+// cannot be read keeps its spelling, an empty parameter is refused.
+#include "../canonical.c"
+#include "test.h"
+
+// clang-format off
+static int spelled (const char *datetime, const char *parameters, const char *location, double grid, const char *expected);
+// clang-format on
+
+static void
+test_parameters (void)
+{
+  CHECK (spelled ("now", "t_2m:C, precip_1h:mm,t_2m:C", "47,8", 0,
+		  "now|precip_1h:mm,t_2m:C|47,8"));
+  CHECK (spelled ("now", "t_2m:C", "47,8", 0, "now|t_2m:C|47,8"));
+
+  // strtok would have made these t_2m:C,precip_1h:mm without a word
+  const char *empty[] = {"t_2m:C,,precip_1h:mm", ",t_2m:C", "t_2m:C,", " ",
+			 ""};
+  for (size_t i = 0; i < sizeof (empty) / sizeof (empty[0]); i++)
+  {
+    WeatherConfig query = {.datetime = "now",
+			   .parameters = empty[i],
+			   .location = "47,8",
+			   .format = "json"};
+    CanonicalQuery canonical;
+    CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		  canonical_query (&query, 0, &canonical));
+  }
+}
+
+static void
+test_datetime (void)
+{
+  // the range ends on its last step, which is spelled in days and hours
+  CHECK (spelled ("2024-10-23T00:00:00Z--2024-10-23T23:30:00Z:PT60M",
+		  "t_2m:C", "47,8", 0,
+		  "2024-10-23T00:00:00Z--2024-10-23T23:00:00Z:PT1H|t_2m:C|47,8"));
+  CHECK (spelled ("2024-10-23T00:00:00Z--2024-10-30T00:00:00Z:PT30H",
+		  "t_2m:C", "47,8", 0,
+		  "2024-10-23T00:00:00Z--2024-10-29T06:00:00Z:P1DT6H|t_2m:C|"
+		  "47,8"));
+  CHECK (spelled (" 2024-10-23T06:00:00Z", "t_2m:C", "47,8", 0,
+		  "2024-10-23T06:00:00Z|t_2m:C|47,8"));
+  CHECK (spelled ("now--now+2H", "t_2m:C", "47,8", 0,
+		  "now--now+2H|t_2m:C|47,8"));
+}
+
+static void
+test_location (void)
+{
+  CHECK (spelled ("now", "t_2m:C", "47.0, 8.50", 0, "now|t_2m:C|47,8.5"));
+  CHECK (spelled ("now", "t_2m:C", "47.3,8.2+-0.1,-0.2", 0.5,
+		  "now|t_2m:C|47.5,8+0,0"));
+  // grids and named places keep their spelling
+  CHECK (spelled ("now", "t_2m:C", "47.0,8_46,9:0.1,0.1", 0.5,
+		  "now|t_2m:C|47.0,8_46,9:0.1,0.1"));
+  CHECK (spelled ("now", "t_2m:C", "postal_CH8000", 0.5,
+		  "now|t_2m:C|postal_CH8000"));
+
+  WeatherConfig query = {.datetime = "now",
+			 .parameters = "t_2m:C",
+			 .location = "47,8",
+			 .format = "json"};
+  CanonicalQuery canonical;
+  CHECK_STATUS (WEATHER_SUCCESS, canonical_query (&query, 0, &canonical));
+  CHECK (!canonical.rewritten);
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		canonical_query (&query, -1, &canonical));
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		canonical_query (&query, NAN, &canonical));
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_parameters);
+  RUN_TEST (test_datetime);
+  RUN_TEST (test_location);
+  return test_exit_status ();
+}
+
+static int
+spelled (const char *datetime, const char *parameters, const char *location,
+	 double grid, const char *expected)
+{
+  WeatherConfig query = {.datetime = datetime,
+			 .parameters = parameters,
+			 .location = location,
+			 .format = "json"};
+  CanonicalQuery canonical;
+  if (WEATHER_SUCCESS != canonical_query (&query, grid, &canonical))
+    return 0;
+
+  char text[3 * API_MAX_URL_LENGTH];
+  snprintf (text, sizeof (text), "%s|%s|%s", canonical.config.datetime,
+	    canonical.config.parameters, canonical.config.location);
+  return strcmp (text, expected) == 0;
+}
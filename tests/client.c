@@ -0,0 +1,250 @@
+// the client's series cache: what a response puts in is answered from the
+// cache afterwards, as long as it covers the whole query, however the query
+// is spelled once it is canonical. nothing here goes near the network,
+// every query that would is only checked for a miss.
+#include "../client.c"
+#include "test.h"
+
+#define START 1729641600 // 2024-10-23T00:00:00Z
+
+// clang-format off
+static void store_hours (WeatherClient *client, const char *parameter, int64_t first, int64_t last);
+static void store_at (WeatherClient *client, const char *url, int64_t now, const char *parameter, int64_t first, int64_t last);
+static int answered (WeatherClient *client, const char *datetime, const char *parameters, size_t npoints);
+// clang-format on
+
+static void
+test_fetch_from_cache (void)
+{
+  WeatherClient client;
+  SeriesCache cache;
+  CHECK_STATUS (WEATHER_SUCCESS, client_init (&client, "user", "secret"));
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  client_set_cache (&client, &cache);
+
+  store_hours (&client, "t_2m:C", 0, 47);
+  store_hours (&client, "precip_1h:mm", 0, 23);
+
+  // through client_fetch, the whole range is there
+  WeatherConfig query
+    = {.datetime = "2024-10-23T00:00:00Z--2024-10-23T23:00:00Z:PT1H",
+       .parameters = "t_2m:C,precip_1h:mm",
+       .location = "47.0,8",
+       .format = "json"};
+  json_t *root = NULL;
+  CHECK_STATUS (WEATHER_SUCCESS, client_fetch (&client, &query, &root));
+  WeatherSeries *series = NULL;
+  size_t nseries = 0;
+  CHECK (root
+	 && WEATHER_SUCCESS == decode_series (root, &series, &nseries));
+  CHECK (nseries == 2 && series[0].count == 24 && series[1].count == 24);
+  for (size_t i = 0; nseries == 2 && i < 24; i++)
+  {
+    CHECK (series[0].times[i] == START + (int64_t) i * 3600);
+    CHECK (series[0].values[i] == (double) i);
+    CHECK (series[1].values[i] == (double) i);
+  }
+  decode_free_series (series, nseries);
+  json_decref (root);
+
+  // a coarser step on the same hours is covered too
+  CHECK (answered (&client, "2024-10-23T00:00:00Z--2024-10-24T23:00:00Z:PT6H",
+		   "t_2m:C", 8));
+  // ranges going past what was stored and parameters never stored miss
+  CHECK (!answered (&client, "2024-10-23T00:00:00Z--2024-10-24T23:00:00Z:PT1H",
+		    "t_2m:C,precip_1h:mm", 0));
+  CHECK (!answered (&client, "2024-10-23T00:00:00Z--2024-10-23T03:00:00Z:PT1H",
+		    "wind_speed_10m:ms", 0));
+
+  client_cleanup (&client);
+  series_cache_cleanup (&cache);
+}
+
+static void
+test_max_age (void)
+{
+  WeatherClient client;
+  SeriesCache cache;
+  CHECK_STATUS (WEATHER_SUCCESS, client_init (&client, "user", "secret"));
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  client_set_cache (&client, &cache);
+  cache.max_age = 600;
+
+  store_hours (&client, "t_2m:C", 0, 5);
+  const char *hours = "2024-10-23T00:00:00Z--2024-10-23T05:00:00Z:PT1H";
+  CHECK (answered (&client, hours, "t_2m:C", 6));
+
+  // recorded long ago, the cover no longer vouches for the points
+  SeriesCacheEntry *entry = cache.lru_head;
+  CHECK (entry && entry->ncovered == 1);
+  if (entry && entry->ncovered == 1)
+    entry->covered[0].recorded -= 601;
+  CHECK (!answered (&client, hours, "t_2m:C", 0));
+
+  // fresh data brings it back
+  store_hours (&client, "t_2m:C", 0, 5);
+  CHECK (answered (&client, hours, "t_2m:C", 6));
+
+  client_cleanup (&client);
+  series_cache_cleanup (&cache);
+}
+
+static void
+test_grid (void)
+{
+  // a point near the stored one is answered once both snap to the grid
+  WeatherClient client;
+  SeriesCache cache;
+  CHECK_STATUS (WEATHER_SUCCESS, client_init (&client, "user", "secret"));
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  client_set_cache (&client, &cache);
+  client_set_grid (&client, 0.5);
+  store_hours (&client, "t_2m:C", 0, 5);
+
+  WeatherConfig query
+    = {.datetime = "2024-10-23T00:00:00Z--2024-10-23T05:00:00Z:PT60M",
+       .parameters = " t_2m:C",
+       .location = "47.2, 7.9",
+       .format = "json"};
+  json_t *root = NULL;
+  CHECK_STATUS (WEATHER_SUCCESS, client_fetch (&client, &query, &root));
+  WeatherSeries *series = NULL;
+  size_t nseries = 0;
+  CHECK (root
+	 && WEATHER_SUCCESS == decode_series (root, &series, &nseries));
+  CHECK (nseries == 1 && series[0].count == 6 && series[0].lat == 47
+	 && series[0].lon == 8);
+  decode_free_series (series, nseries);
+  json_decref (root);
+
+  // a grid canonical_query refuses fails the query before the cache
+  client_set_grid (&client, -1);
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		client_fetch (&client, &query, &root));
+
+  client_cleanup (&client);
+  series_cache_cleanup (&cache);
+}
+
+static void
+test_warm_plans (void)
+{
+  WeatherClient client;
+  SeriesCache cache;
+  Prefetcher prefetcher;
+  CHECK_STATUS (WEATHER_SUCCESS, client_init (&client, "user", "secret"));
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  CHECK_STATUS (WEATHER_SUCCESS, prefetch_init (&prefetcher, 3600));
+  client_set_cache (&client, &cache);
+  client_set_prefetcher (&client, &prefetcher);
+
+  // client_fetch records the query by its url, even when the cache answers
+  store_hours (&client, "t_2m:C", 0, 5);
+  WeatherConfig query
+    = {.datetime = "2024-10-23T00:00:00Z--2024-10-23T05:00:00Z:PT1H",
+       .parameters = "t_2m:C",
+       .location = "47,8",
+       .format = "json"};
+  char url[API_MAX_URL_LENGTH];
+  CHECK_STATUS (WEATHER_SUCCESS, construct_url (&query, url, sizeof (url)));
+  for (int i = 0; i < 3; i++)
+  {
+    json_t *root = NULL;
+    CHECK_STATUS (WEATHER_SUCCESS, client_fetch (&client, &query, &root));
+    CHECK (root);
+    json_decref (root);
+  }
+  CHECK (prefetcher.count == 1);
+
+  // each hour new data shows up shortly after the hour, the responses
+  // teach the prefetcher when to warm
+  int64_t hour = (int64_t) time (NULL);
+  hour -= hour % 3600;
+  for (int64_t cycle = 0; cycle < PREFETCH_MIN_OBSERVATIONS + 1; cycle++)
+  {
+    int64_t now = hour + cycle * 3600;
+    prefetch_record_query (&prefetcher, url, now);
+    store_at (&client, url, now + 600, "t_2m:C", cycle, cycle + 5);
+  }
+  int64_t offset = 0;
+  CHECK (prefetch_publication_offset (&prefetcher, &offset));
+
+  // due in the next cycle once the run should be out, which is what
+  // client_warm would fetch. no engine, nothing leaves the process
+  const char *keys[CLIENT_WARM_MAX];
+  size_t nkeys = 0;
+  int64_t next = hour + (PREFETCH_MIN_OBSERVATIONS + 1) * 3600;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		prefetch_due (&prefetcher, next + offset + 3000, keys,
+			      CLIENT_WARM_MAX, &nkeys));
+  CHECK (nkeys == 1 && strcmp (keys[0], url) == 0);
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		client_warm (&client, NULL, next, NULL));
+
+  client_cleanup (&client);
+  prefetch_cleanup (&prefetcher);
+  series_cache_cleanup (&cache);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_fetch_from_cache);
+  RUN_TEST (test_max_age);
+  RUN_TEST (test_grid);
+  RUN_TEST (test_warm_plans);
+  return test_exit_status ();
+}
+
+static void
+store_hours (WeatherClient *client, const char *parameter, int64_t first,
+	     int64_t last)
+{
+  store_at (client, "url", START, parameter, first, last);
+}
+
+static void
+store_at (WeatherClient *client, const char *url, int64_t now,
+	  const char *parameter, int64_t first, int64_t last)
+{
+  int64_t times[64];
+  double values[64];
+  WeatherSeries series = {.parameter = (char *) parameter,
+			  .location = "47,8",
+			  .lat = 47,
+			  .lon = 8,
+			  .times = times,
+			  .values = values};
+  for (int64_t hour = first; hour <= last; hour++, series.count++)
+  {
+    times[series.count] = START + hour * 3600;
+    values[series.count] = (double) hour;
+  }
+
+  json_t *root = NULL;
+  CHECK_STATUS (WEATHER_SUCCESS, decode_build_json (&series, 1, &root));
+  store_in_cache (client, url, now, root);
+  json_decref (root);
+}
+
+static int
+answered (WeatherClient *client, const char *datetime, const char *parameters,
+	  size_t npoints)
+{
+  WeatherConfig query = {.datetime = datetime,
+			 .parameters = parameters,
+			 .location = "47,8",
+			 .format = "json"};
+  json_t *root = NULL;
+  if (WEATHER_SUCCESS != answer_from_cache (client, &query, &root) || !root)
+    return 0;
+
+  WeatherSeries *series = NULL;
+  size_t nseries = 0;
+  int complete = WEATHER_SUCCESS == decode_series (root, &series, &nseries);
+  for (size_t i = 0; complete && i < nseries; i++)
+    complete = series[i].count == npoints;
+  decode_free_series (series, nseries);
+  json_decref (root);
+  return complete;
+}
@@ -0,0 +1,169 @@
+// time ranges answered from the series cache: cached points come back
+// without a request, a single point in time included, and parameters that
+// miss the same part of a range share its request. nothing here goes near
+// the network, the gaps are only planned.
+#include "../coverage.c"
+#include "test.h"
+
+#define START 1729641600 // 2024-10-23T00:00:00Z
+
+// clang-format off
+static void cache_hours (SeriesCache *cache, const char *parameter, int64_t first, int64_t last);
+static CoverageQuery hours (const char *parameters, int64_t first, int64_t last);
+// clang-format on
+
+static void
+test_from_cache (void)
+{
+  SeriesCache cache;
+  RequestEngine engine;
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  CHECK_STATUS (WEATHER_SUCCESS, engine_init (&engine, "user", "secret", 1));
+  cache_hours (&cache, "t_2m:C", 0, 48);
+  cache_hours (&cache, "precip_1h:mm", 0, 48);
+
+  CoverageQuery query = hours ("t_2m:C,precip_1h:mm", 24, 48);
+  CoverageResult result;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		coverage_fetch (&cache, &engine, &query, &result));
+  CHECK (result.requests == 0 && result.points_fetched == 0);
+  CHECK (result.points_cached == 50 && result.nseries == 2);
+  for (size_t p = 0; p < result.nseries; p++)
+  {
+    CHECK (result.series[p].count == 25);
+    for (size_t i = 0; i < result.series[p].count; i++)
+      CHECK (result.series[p].times[i] == START + (int64_t) (24 + i) * 3600
+	     && result.series[p].values[i] == (double) (24 + i));
+  }
+  CHECK (strcmp (result.series[0].parameter, "t_2m:C") == 0);
+  coverage_free (&result);
+
+  // a coarser step on the same hours needs nothing either
+  query.step = 6 * 3600;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		coverage_fetch (&cache, &engine, &query, &result));
+  CHECK (result.requests == 0 && result.points_cached == 10);
+  coverage_free (&result);
+
+  engine_cleanup (&engine);
+  series_cache_cleanup (&cache);
+}
+
+static void
+test_single_point (void)
+{
+  // a single point goes in with step 1, an hourly cover still vouches for it
+  SeriesCache cache;
+  RequestEngine engine;
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  CHECK_STATUS (WEATHER_SUCCESS, engine_init (&engine, "user", "secret", 1));
+  cache_hours (&cache, "t_2m:C", 0, 23);
+
+  CoverageQuery query = hours ("t_2m:C", 5, 5);
+  query.step = 0;
+  CoverageResult result;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		coverage_fetch (&cache, &engine, &query, &result));
+  CHECK (result.requests == 0 && result.points_cached == 1);
+  CHECK (result.nseries == 1 && result.series[0].count == 1
+	 && result.series[0].times[0] == START + 5 * 3600
+	 && result.series[0].values[0] == 5.0);
+  coverage_free (&result);
+
+  // off the hour, the cover knows nothing of it
+  SeriesInterval half_past = {START + 1800, START + 1800, 1};
+  SeriesInterval *gaps = NULL;
+  size_t ngaps = 0;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_cache_gaps (&cache, "t_2m:C", "47,8", &half_past, &gaps,
+				   &ngaps));
+  CHECK (ngaps == 1);
+  free (gaps);
+
+  engine_cleanup (&engine);
+  series_cache_cleanup (&cache);
+}
+
+static void
+test_shared_gaps (void)
+{
+  SeriesCache cache;
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  cache_hours (&cache, "t_2m:C", 0, 48);
+  cache_hours (&cache, "precip_1h:mm", 0, 48);
+
+  // both miss 49 to 72, wind has nothing cached
+  CoverageQuery query = hours ("t_2m:C,precip_1h:mm,wind_speed_10m:ms", 24, 72);
+  CoverageResult result = {0};
+  CoverageState state = {.cache = &cache, .result = &result};
+  state.range = (SeriesInterval){query.start, query.end, query.step};
+  state.npoints = 49;
+  snprintf (state.location, sizeof (state.location), "47,8");
+  CHECK_STATUS (WEATHER_SUCCESS, init_series (&state, &query));
+
+  CoverageRequest *requests = NULL;
+  size_t nrequests = 0;
+  size_t capacity = 0;
+  for (size_t p = 0; p < result.nseries; p++)
+    CHECK_STATUS (WEATHER_SUCCESS,
+		  add_gaps (&state, p, &requests, &nrequests, &capacity));
+
+  CHECK (nrequests == 2);
+  if (nrequests == 2)
+  {
+    CHECK (requests[0].range.start == START + 49 * 3600
+	   && requests[0].range.end == START + 72 * 3600);
+    CHECK (requests[0].missing[0] && requests[0].missing[1]
+	   && !requests[0].missing[2]);
+    CHECK (requests[1].range.start == START + 24 * 3600
+	   && requests[1].range.end == START + 72 * 3600);
+    CHECK (!requests[1].missing[0] && !requests[1].missing[1]
+	   && requests[1].missing[2]);
+  }
+
+  for (size_t r = 0; r < nrequests; r++)
+    free (requests[r].missing);
+  free (requests);
+  free (state.sources);
+  coverage_free (&result);
+  series_cache_cleanup (&cache);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_from_cache);
+  RUN_TEST (test_single_point);
+  RUN_TEST (test_shared_gaps);
+  return test_exit_status ();
+}
+
+static void
+cache_hours (SeriesCache *cache, const char *parameter, int64_t first,
+	     int64_t last)
+{
+  int64_t times[128];
+  double values[128];
+  size_t count = 0;
+  for (int64_t hour = first; hour <= last; hour++, count++)
+  {
+    times[count] = START + hour * 3600;
+    values[count] = (double) hour;
+  }
+  SeriesInterval covered = {START + first * 3600, START + last * 3600, 3600};
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_put (cache, parameter, "47,8",
+						   times, values, count));
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_cache_cover (cache, parameter, "47,8", &covered));
+}
+
+static CoverageQuery
+hours (const char *parameters, int64_t first, int64_t last)
+{
+  return (CoverageQuery){.parameters = parameters,
+			 .lat = 47,
+			 .lon = 8,
+			 .start = START + first * 3600,
+			 .end = START + last * 3600,
+			 .step = 3600};
+}
@@ -0,0 +1,156 @@
+// the ensemble statistics: mean, spread, min, max and percentiles per
+// timestep over the members present, every lane sorted on its own, and a
+// model that is missing or answered other timesteps left out. the
+// answers are put together by hand, nothing goes near the network.
+#include "../ensemble.c"
+#include "test.h"
+
+#define START 1729641600 // 2024-10-23T00:00:00Z
+#define COUNT 5 // one full vector and a padded one
+#define NMODELS 4
+
+// clang-format off
+static double member_value (size_t model, size_t t);
+static int near (double a, double b);
+static WeatherSeries series_of (const char *parameter, int64_t *times, double *values);
+// clang-format on
+
+static void
+test_compute (void)
+{
+  int64_t times[COUNT];
+  for (size_t t = 0; t < COUNT; t++)
+    times[t] = START + (int64_t) t * 3600;
+  WeatherSeries like = series_of ("t_2m:C", times, NULL);
+
+  static const double levels[] = {0, 0.25, 0.5, 1};
+  EnsembleSeries series = {0};
+  CHECK_STATUS (WEATHER_SUCCESS, init_series (&series, &like, NMODELS, 4));
+  CHECK (series.stride == 8
+	 && (uintptr_t) series.members % ENSEMBLE_ALIGN == 0);
+
+  // three members present, an odd count, and model 1 left out with NaN
+  for (size_t m = 0; m < NMODELS; m++)
+  {
+    series.present[m] = m != 1;
+    series.nmembers += series.present[m];
+    for (size_t t = 0; t < COUNT; t++)
+      series.members[m * series.stride + t] = member_value (m, t);
+  }
+
+  Lane *sorted = aligned_alloc (ENSEMBLE_ALIGN, NMODELS * sizeof (Lane));
+  CHECK (sorted);
+  if (sorted)
+    compute (&series, NMODELS, levels, 4, sorted);
+  free (sorted);
+
+  // the members of timestep t are t, t + 1 and t + 5 in an order that
+  // changes from one timestep to the next
+  for (size_t t = 0; t < COUNT; t++)
+  {
+    double base = (double) t;
+    CHECK (near (series.mean[t], base + 2));
+    CHECK (near (series.spread[t], sqrt (14.0 / 3)));
+    CHECK (series.min[t] == base && series.max[t] == base + 5);
+    CHECK (near (series.percentiles[t], base));
+    CHECK (near (series.percentiles[series.stride + t], base + 0.5));
+    CHECK (near (series.percentiles[2 * series.stride + t], base + 1));
+    CHECK (near (series.percentiles[3 * series.stride + t], base + 5));
+  }
+
+  free (series.times);
+  free (series.present);
+  free (series.members);
+}
+
+static void
+test_assemble (void)
+{
+  int64_t times[COUNT];
+  int64_t other[COUNT];
+  double values[NMODELS][COUNT];
+  for (size_t t = 0; t < COUNT; t++)
+  {
+    times[t] = START + (int64_t) t * 3600;
+    other[t] = times[t] + 1800;
+    for (size_t m = 0; m < NMODELS; m++)
+      values[m][t] = member_value (m, t);
+  }
+
+  // model 1 answered other timesteps, model 3 failed
+  WeatherSeries answers[NMODELS];
+  for (size_t m = 0; m < NMODELS; m++)
+    answers[m] = series_of ("t_2m:C", m == 1 ? other : times, values[m]);
+
+  WEATHER_ERROR status[NMODELS]
+    = {WEATHER_SUCCESS, WEATHER_SUCCESS, WEATHER_SUCCESS,
+       WEATHER_ERROR_HTTP_NOT_FOUND};
+  double levels[] = {0.5};
+  Ensemble ensemble = {.nmodels = NMODELS,
+		       .status = status,
+		       .percentiles = levels,
+		       .npercentiles = 1};
+  EnsembleMember members[NMODELS];
+  for (size_t m = 0; m < NMODELS; m++)
+    members[m] = (EnsembleMember){
+      .ensemble = &ensemble, .model = m, .series = &answers[m], .nseries = 1};
+
+  CHECK_STATUS (WEATHER_SUCCESS, assemble (&ensemble, members));
+  CHECK (ensemble.nseries == 1);
+  if (ensemble.nseries == 1)
+  {
+    EnsembleSeries *series = &ensemble.series[0];
+    CHECK (series->nmembers == 2 && series->present[0] && !series->present[1]
+	   && series->present[2] && !series->present[3]);
+    CHECK (strcmp (series->parameter, "t_2m:C") == 0);
+    for (size_t t = 0; t < COUNT; t++)
+    {
+      double a = values[0][t], b = values[2][t];
+      CHECK (isnan (series->members[series->stride + t]));
+      CHECK (isnan (series->members[3 * series->stride + t]));
+      CHECK (near (series->mean[t], (a + b) / 2));
+      CHECK (near (series->spread[t], fabs (a - b) / 2));
+      CHECK (near (series->percentiles[t], (a + b) / 2));
+    }
+  }
+
+  // the status array is the test's, only the series go
+  free_series (&ensemble);
+  CHECK (!ensemble.series && !ensemble.nseries);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_compute);
+  RUN_TEST (test_assemble);
+  return test_exit_status ();
+}
+
+static double
+member_value (size_t model, size_t t)
+{
+  static const double offsets[] = {0, 1, 5};
+  if (model == 1)
+    return NAN;
+  size_t rank = model ? model - 1 : 0;
+  return (double) t + offsets[(rank + t) % 3];
+}
+
+static int
+near (double a, double b)
+{
+  return fabs (a - b) < 1e-9;
+}
+
+static WeatherSeries
+series_of (const char *parameter, int64_t *times, double *values)
+{
+  return (WeatherSeries){.parameter = (char *) parameter,
+			 .location = "47,8",
+			 .lat = 47,
+			 .lon = 8,
+			 .times = times,
+			 .values = values,
+			 .count = COUNT};
+}
@@ -0,0 +1,176 @@
+// the grid tile cache: regions put together from cached tiles, the csv of a
+// tile, and eviction. every tile a query needs is cached before it runs, so
+// the engine never has anything to send.
+#include "../grid_cache.c"
+#include "test.h"
+
+#define TIME 1729641600 // 2024-10-23T00:00:00Z
+
+// clang-format off
+static void put_tile (GridCache *cache, const GridQuery *query, int64_t row, int64_t col);
+static double sample (int64_t lat, int64_t lon);
+// clang-format on
+
+static void
+test_region_from_tiles (void)
+{
+  GridCache cache;
+  RequestEngine engine;
+  CHECK_STATUS (WEATHER_SUCCESS, grid_cache_init (&cache, 1 << 24));
+  CHECK_STATUS (WEATHER_SUCCESS, engine_init (&engine, "user", "secret", 1));
+
+  // a box around the origin at one degree touches four tiles, two of them
+  // at negative tile indices
+  GridQuery query = {.parameter = "t_2m:C",
+		     .time = TIME,
+		     .lat_min = -2.5,
+		     .lat_max = 3,
+		     .lon_min = -1,
+		     .lon_max = 2.2,
+		     .res_lat = 1,
+		     .res_lon = 1};
+  for (int64_t row = -1; row <= 0; row++)
+    for (int64_t col = -1; col <= 0; col++)
+      put_tile (&cache, &query, row, col);
+
+  GridRegion region;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		grid_cache_fetch (&cache, &engine, &query, &region));
+  CHECK (region.rows == 6 && region.cols == 4);
+  CHECK (region.lat_first == 3 && region.lon_first == -1);
+  CHECK (region.tiles == 4 && region.tiles_fetched == 0);
+  CHECK (cache.hits == 4 && cache.misses == 0);
+
+  // north to south, west to east
+  for (size_t r = 0; region.values && r < region.rows; r++)
+    for (size_t c = 0; c < region.cols; c++)
+      CHECK (region.values[r * region.cols + c]
+	     == sample (3 - (int64_t) r, -1 + (int64_t) c));
+  grid_region_free (&region);
+
+  // a resolution no tile was cached at is not answered by these
+  query.res_lat = query.res_lon = 0.5;
+  char *key = make_key (&query, 0, 0);
+  CHECK (key && !find_tile (&cache, key, weather_hash (key)));
+  free (key);
+
+  engine_cleanup (&engine);
+  grid_cache_cleanup (&cache);
+}
+
+static void
+test_parse_tile (void)
+{
+  GridQuery query = {.parameter = "t_2m:C", .res_lat = 0.5, .res_lon = 0.5};
+  GridAssembly assembly = {.query = &query};
+  GridFetch fetch = {.assembly = &assembly, .row = 0, .col = -1};
+  double *values = malloc (GRID_TILE_SIZE * sizeof (double));
+  CHECK (values);
+  if (!values)
+    return;
+
+  // points land at their offset in the tile, the rest stay NaN
+  CHECK_STATUS (WEATHER_SUCCESS,
+		parse_tile (&fetch,
+			    "validdate;2024-10-23T00:00:00Z\r\n"
+			    "parameter;t_2m:C\r\n"
+			    "data;-1;-0.5\r\n"
+			    "1;11.5;12.5\r\n"
+			    "0.5;9.5;10.5\r\n",
+			    values));
+  size_t east = GRID_TILE_CELLS - 1;
+  CHECK (values[2 * GRID_TILE_CELLS + east - 1] == 11.5);
+  CHECK (values[2 * GRID_TILE_CELLS + east] == 12.5);
+  CHECK (values[GRID_TILE_CELLS + east - 1] == 9.5);
+  CHECK (values[GRID_TILE_CELLS + east] == 10.5);
+  CHECK (isnan (values[0]));
+
+  // off the lattice, outside the tile, a value short
+  CHECK_STATUS (WEATHER_ERROR_JSON,
+		parse_tile (&fetch, "data;-0.7\n1;11.5\n", values));
+  CHECK_STATUS (WEATHER_ERROR_JSON,
+		parse_tile (&fetch, "data;0.5\n1;11.5\n", values));
+  CHECK_STATUS (WEATHER_ERROR_JSON,
+		parse_tile (&fetch, "data;-1;-0.5\n1;11.5\n", values));
+  CHECK_STATUS (WEATHER_ERROR_JSON, parse_tile (&fetch, "1;11.5\n", values));
+  free (values);
+}
+
+static void
+test_eviction (void)
+{
+  // room for two tiles, the least recently used one goes
+  GridCache cache;
+  size_t tile_size = GRID_TILE_SIZE * sizeof (double) + sizeof (GridTile);
+  CHECK_STATUS (WEATHER_SUCCESS, grid_cache_init (&cache, 2 * tile_size + 256));
+  GridQuery query = {.parameter = "t_2m:C", .res_lat = 1, .res_lon = 1};
+
+  put_tile (&cache, &query, 0, 0);
+  put_tile (&cache, &query, 0, 1);
+  char *first = make_key (&query, 0, 0);
+  GridTile *tile = NULL;
+  if (first)
+    tile = find_tile (&cache, first, weather_hash (first));
+  CHECK (tile);
+  if (tile)
+  {
+    lru_unlink (&cache, tile);
+    lru_push_front (&cache, tile);
+  }
+  put_tile (&cache, &query, 0, 2);
+
+  CHECK (cache.count == 2 && cache.evictions == 1);
+  CHECK (cache.memory_used <= cache.max_memory);
+  CHECK (first && find_tile (&cache, first, weather_hash (first)));
+  char *second = make_key (&query, 0, 1);
+  CHECK (second && !find_tile (&cache, second, weather_hash (second)));
+  free (first);
+  free (second);
+  grid_cache_cleanup (&cache);
+}
+
+static void
+test_tile_of (void)
+{
+  CHECK (tile_of (0) == 0 && tile_of (GRID_TILE_CELLS - 1) == 0);
+  CHECK (tile_of (GRID_TILE_CELLS) == 1);
+  CHECK (tile_of (-1) == -1 && tile_of (-GRID_TILE_CELLS) == -1);
+  CHECK (tile_of (-GRID_TILE_CELLS - 1) == -2);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_region_from_tiles);
+  RUN_TEST (test_parse_tile);
+  RUN_TEST (test_eviction);
+  RUN_TEST (test_tile_of);
+  return test_exit_status ();
+}
+
+static void
+put_tile (GridCache *cache, const GridQuery *query, int64_t row, int64_t col)
+{
+  double *values = malloc (GRID_TILE_SIZE * sizeof (double));
+  char *key = make_key (query, row, col);
+  CHECK (values && key);
+  if (!values || !key)
+  {
+    free (values);
+    free (key);
+    return;
+  }
+
+  // tiles run south to north
+  for (int64_t i = 0; i < GRID_TILE_CELLS; i++)
+    for (int64_t j = 0; j < GRID_TILE_CELLS; j++)
+      values[i * GRID_TILE_CELLS + j] = sample (row * GRID_TILE_CELLS + i,
+						col * GRID_TILE_CELLS + j);
+  CHECK_STATUS (WEATHER_SUCCESS, insert (cache, key, values));
+}
+
+static double
+sample (int64_t lat, int64_t lon)
+{
+  return (double) (lat * 1000 + lon);
+}
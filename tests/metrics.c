@@ -0,0 +1,157 @@
+// the metrics endpoint: a scrape gets the rendered registry, and running out
+// of descriptors makes the accept loop wait instead of spinning. the file
+// export leaves nothing but the file itself behind.
+#include <dirent.h>
+#include <sys/resource.h>
+
+#include "../metrics.c"
+#include "test.h"
+
+// clang-format off
+static int connect_to (const MetricsServer *server);
+static int scrape (int fd, const char *expected);
+static double cpu_seconds (void);
+// clang-format on
+
+static void
+test_scrape (void)
+{
+  metrics_count (METRIC_REQUESTS, 3);
+
+  MetricsServer server;
+  CHECK_STATUS (WEATHER_SUCCESS, metrics_serve (&server, 0));
+  CHECK (scrape (connect_to (&server), "meteomatics_requests_total 3\n"));
+  metrics_stop (&server);
+  CHECK (!server.running);
+}
+
+static void
+test_out_of_descriptors (void)
+{
+  MetricsServer server;
+  CHECK_STATUS (WEATHER_SUCCESS, metrics_serve (&server, 0));
+  int client = connect_to (&server);
+  CHECK (client >= 0);
+
+  // the lowest free descriptor becomes the limit, so accept has no room
+  struct rlimit saved;
+  CHECK (getrlimit (RLIMIT_NOFILE, &saved) == 0);
+  int lowest = dup (0);
+  close (lowest);
+  struct rlimit tight
+    = {.rlim_cur = (rlim_t) lowest, .rlim_max = saved.rlim_max};
+  CHECK (setrlimit (RLIMIT_NOFILE, &tight) == 0);
+
+  double before = cpu_seconds ();
+  struct timespec wait = {.tv_nsec = 500 * 1000000L};
+  nanosleep (&wait, NULL);
+  CHECK (cpu_seconds () - before < 0.1);
+
+  // with descriptors back the waiting client is served
+  CHECK (setrlimit (RLIMIT_NOFILE, &saved) == 0);
+  CHECK (scrape (client, "meteomatics_in_flight"));
+  metrics_stop (&server);
+}
+
+static void
+test_write_file (void)
+{
+  char directory[] = "/tmp/metrics.XXXXXX";
+  CHECK (mkdtemp (directory));
+  char path[64];
+  snprintf (path, sizeof (path), "%s/client.prom", directory);
+
+  // written twice, the second replaces the first
+  metrics_count (METRIC_REQUESTS, 1);
+  CHECK_STATUS (WEATHER_SUCCESS, metrics_write_file (path));
+  CHECK_STATUS (WEATHER_SUCCESS, metrics_write_file (path));
+  struct stat written;
+  CHECK (stat (path, &written) == 0 && (written.st_mode & 0777) == 0644);
+
+  char text[8192] = {0};
+  FILE *stream = fopen (path, "r");
+  CHECK (stream);
+  if (stream)
+  {
+    fread (text, 1, sizeof (text) - 1, stream);
+    fclose (stream);
+  }
+  CHECK (strstr (text, "meteomatics_requests_total"));
+
+  // no temporaries left next to it
+  size_t entries = 0;
+  DIR *listing = opendir (directory);
+  CHECK (listing);
+  for (struct dirent *entry; listing && (entry = readdir (listing));)
+    if (entry->d_name[0] != '.')
+      entries++;
+  if (listing)
+    closedir (listing);
+  CHECK (entries == 1);
+
+  // a directory that is not there
+  char missing[80];
+  snprintf (missing, sizeof (missing), "%s/gone/client.prom", directory);
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, metrics_write_file (missing));
+
+  unlink (path);
+  rmdir (directory);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_scrape);
+  RUN_TEST (test_out_of_descriptors);
+  RUN_TEST (test_write_file);
+  return test_exit_status ();
+}
+
+static int
+connect_to (const MetricsServer *server)
+{
+  struct sockaddr_in address;
+  socklen_t length = sizeof (address);
+  if (getsockname (server->fd, (struct sockaddr *) &address, &length) != 0)
+    return -1;
+
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd >= 0
+      && connect (fd, (struct sockaddr *) &address, sizeof (address)) != 0)
+  {
+    close (fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static int
+scrape (int fd, const char *expected)
+{
+  if (fd < 0)
+    return 0;
+
+  const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+  char response[1 << 16];
+  size_t size = 0;
+  if (write (fd, request, sizeof (request) - 1) == sizeof (request) - 1)
+  {
+    ssize_t n;
+    while (size < sizeof (response) - 1
+	   && (n = read (fd, response + size, sizeof (response) - 1 - size)) > 0)
+      size += (size_t) n;
+  }
+  close (fd);
+  response[size] = '\0';
+  return strncmp (response, "HTTP/1.0 200 OK\r\n", 17) == 0
+	 && strstr (response, expected);
+}
+
+static double
+cpu_seconds (void)
+{
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+	 + (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
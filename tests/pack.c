@@ -0,0 +1,180 @@
+// packs: what pack_write lays out comes back through a view, through a
+// mapped file, and a damaged pack is refused instead of read past its end.
+#include <dirent.h>
+
+#include "../pack.c"
+#include "test.h"
+
+// clang-format off
+static void two_series (WeatherSeries *series, int64_t *times, double *values);
+static int same_series (const PackSeries *packed, const WeatherSeries *series);
+static size_t files_in (const char *directory);
+// clang-format on
+
+static void
+test_round_trip (void)
+{
+  int64_t times[6];
+  double values[6];
+  WeatherSeries series[2];
+  two_series (series, times, values);
+
+  size_t size = pack_size (series, 2);
+  uint64_t *buffer = calloc (1, size + PACK_ALIGN);
+  CHECK (buffer);
+  if (!buffer)
+    return;
+  CHECK_STATUS (WEATHER_ERROR_INVALID_MEMORY,
+		pack_write (series, 2, buffer, size - 1));
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		pack_write (series, 2, (char *) buffer + 1, size));
+  CHECK_STATUS (WEATHER_SUCCESS, pack_write (series, 2, buffer, size));
+
+  PackView view;
+  CHECK_STATUS (WEATHER_SUCCESS, pack_view (&view, buffer, size));
+  CHECK (pack_count (&view) == 2);
+  PackSeries packed;
+  for (size_t i = 0; i < 2; i++)
+  {
+    CHECK_STATUS (WEATHER_SUCCESS, pack_series (&view, i, &packed));
+    CHECK (same_series (&packed, &series[i]));
+  }
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, pack_series (&view, 2, &packed));
+  free (buffer);
+}
+
+static void
+test_damaged (void)
+{
+  int64_t times[6];
+  double values[6];
+  WeatherSeries series[2];
+  two_series (series, times, values);
+
+  size_t size = pack_size (series, 2);
+  uint64_t *buffer = calloc (1, size);
+  CHECK (buffer);
+  if (!buffer)
+    return;
+  PackView view;
+  PackHeader *header = (PackHeader *) buffer;
+  PackEntry *entries
+    = (PackEntry *) ((uint8_t *) buffer + align_up (sizeof (PackHeader)));
+
+  // cut short
+  CHECK_STATUS (WEATHER_SUCCESS, pack_write (series, 2, buffer, size));
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		pack_view (&view, buffer, size - 8));
+
+  // another major version
+  header->major++;
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, pack_view (&view, buffer, size));
+
+  // a column running past the end
+  CHECK_STATUS (WEATHER_SUCCESS, pack_write (series, 2, buffer, size));
+  entries[1].count += 1;
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, pack_view (&view, buffer, size));
+
+  // a string without its terminator inside the pack
+  CHECK_STATUS (WEATHER_SUCCESS, pack_write (series, 2, buffer, size));
+  entries[0].location_offset = size - 1;
+  memset ((uint8_t *) buffer + size - 8, 'x', 8);
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, pack_view (&view, buffer, size));
+  free (buffer);
+}
+
+static void
+test_save_and_map (void)
+{
+  int64_t times[6];
+  double values[6];
+  WeatherSeries series[2];
+  two_series (series, times, values);
+
+  char directory[] = "/tmp/meteomatics-pack-XXXXXX";
+  CHECK (mkdtemp (directory));
+  char path[64];
+  snprintf (path, sizeof (path), "%s/forecast.pack", directory);
+
+  // twice, the second one replaces the first without leaving anything behind
+  CHECK_STATUS (WEATHER_SUCCESS, pack_save (path, series, 1));
+  CHECK_STATUS (WEATHER_SUCCESS, pack_save (path, series, 2));
+  CHECK (files_in (directory) == 1);
+  struct stat info;
+  CHECK (stat (path, &info) == 0 && (info.st_mode & 0777) == 0644);
+
+  PackView view;
+  CHECK_STATUS (WEATHER_SUCCESS, pack_map (&view, path));
+  CHECK (pack_count (&view) == 2);
+  PackSeries packed;
+  CHECK_STATUS (WEATHER_SUCCESS, pack_series (&view, 1, &packed));
+  CHECK (same_series (&packed, &series[1]));
+  pack_unmap (&view);
+  CHECK (!view.map);
+
+  // nowhere to put the temporary file
+  char missing[80];
+  snprintf (missing, sizeof (missing), "%s/gone/forecast.pack", directory);
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, pack_save (missing, series, 2));
+
+  unlink (path);
+  CHECK (rmdir (directory) == 0);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_round_trip);
+  RUN_TEST (test_damaged);
+  RUN_TEST (test_save_and_map);
+  return test_exit_status ();
+}
+
+static void
+two_series (WeatherSeries *series, int64_t *times, double *values)
+{
+  for (int i = 0; i < 6; i++)
+  {
+    times[i] = 1729641600 + (i % 3) * 3600;
+    values[i] = i * 0.5 - 1;
+  }
+  series[0] = (WeatherSeries){.parameter = "t_2m:C",
+			      .location = "47,8",
+			      .lat = 47,
+			      .lon = 8,
+			      .times = times,
+			      .values = values,
+			      .count = 3};
+  series[1] = (WeatherSeries){.parameter = "precip_1h:mm",
+			      .location = "47.5,8.25",
+			      .lat = 47.5,
+			      .lon = 8.25,
+			      .times = times + 3,
+			      .values = values + 3,
+			      .count = 3};
+}
+
+static int
+same_series (const PackSeries *packed, const WeatherSeries *series)
+{
+  int same = strcmp (packed->parameter, series->parameter) == 0
+	     && strcmp (packed->location, series->location) == 0
+	     && packed->lat == series->lat && packed->lon == series->lon
+	     && packed->count == series->count;
+  for (size_t i = 0; same && i < series->count; i++)
+    same = packed->times[i] == series->times[i]
+	   && packed->values[i] == series->values[i];
+  return same;
+}
+
+static size_t
+files_in (const char *directory)
+{
+  DIR *dir = opendir (directory);
+  size_t count = 0;
+  for (struct dirent *entry; dir && (entry = readdir (dir));)
+    count += entry->d_name[0] != '.';
+  if (dir)
+    closedir (dir);
+  return count;
+}
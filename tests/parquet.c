@@ -0,0 +1,137 @@
+// parquet files: the layout around the footer, row groups cut at
+// row_group_rows, and writers of one path that never see each other's file.
+#include <dirent.h>
+
+#include "../parquet.c"
+#include "test.h"
+
+// clang-format off
+static void hours (WeatherSeries *series, const char *parameter, int64_t *times, double *values, size_t count);
+static int well_formed (const char *path);
+static size_t files_in (const char *directory);
+// clang-format on
+
+static void
+test_row_groups (void)
+{
+  char directory[] = "/tmp/meteomatics-parquet-XXXXXX";
+  CHECK (mkdtemp (directory));
+  char path[64];
+  snprintf (path, sizeof (path), "%s/backfill.parquet", directory);
+
+  int64_t times[10];
+  double values[10];
+  WeatherSeries series[2];
+  hours (&series[0], "t_2m:C", times, values, 10);
+  hours (&series[1], "precip_1h:mm", times, values, 3);
+
+  ParquetWriter writer;
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_open (&writer, path, 4));
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_write_series (&writer, series, 2));
+  CHECK (writer.ngroups == 3 && writer.rows == 1);
+  CHECK (access (path, F_OK) != 0); // nothing there before the footer
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_close (&writer));
+
+  CHECK (well_formed (path));
+  struct stat info;
+  CHECK (stat (path, &info) == 0 && (info.st_mode & 0777) == 0644);
+  CHECK (files_in (directory) == 1);
+  unlink (path);
+  CHECK (rmdir (directory) == 0);
+}
+
+static void
+test_two_writers (void)
+{
+  // both open before either closes, the last rename wins and nothing of
+  // the other one is left around
+  char directory[] = "/tmp/meteomatics-parquet-XXXXXX";
+  CHECK (mkdtemp (directory));
+  char path[64];
+  snprintf (path, sizeof (path), "%s/backfill.parquet", directory);
+
+  int64_t times[8];
+  double values[8];
+  WeatherSeries series;
+  hours (&series, "t_2m:C", times, values, 8);
+
+  ParquetWriter first, second;
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_open (&first, path, 0));
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_open (&second, path, 0));
+  CHECK (strcmp (first.temporary, second.temporary) != 0);
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_write_series (&first, &series, 1));
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_write_series (&second, &series, 1));
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_close (&first));
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_close (&second));
+  CHECK (well_formed (path));
+  CHECK (files_in (directory) == 1);
+
+  // a failed writer leaves nothing behind either
+  unlink (path);
+  CHECK_STATUS (WEATHER_SUCCESS, parquet_open (&first, path, 0));
+  series.parameter = NULL;
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		parquet_write_series (&first, &series, 1));
+  first.failed = 1; // as after a short write
+  CHECK (WEATHER_SUCCESS != parquet_close (&first));
+  CHECK (files_in (directory) == 0);
+  CHECK (rmdir (directory) == 0);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_row_groups);
+  RUN_TEST (test_two_writers);
+  return test_exit_status ();
+}
+
+static void
+hours (WeatherSeries *series, const char *parameter, int64_t *times,
+       double *values, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    times[i] = 1729641600 + (int64_t) i * 3600;
+    values[i] = (double) i / 2;
+  }
+  *series = (WeatherSeries){.parameter = (char *) parameter,
+			    .location = "47,8",
+			    .lat = 47,
+			    .lon = 8,
+			    .times = times,
+			    .values = values,
+			    .count = count};
+}
+
+static int
+well_formed (const char *path)
+{
+  // PAR1, the pages, the footer, its length and PAR1 again
+  FILE *file = fopen (path, "rb");
+  if (!file)
+    return 0;
+  char head[4], tail[8];
+  int ok = fread (head, 4, 1, file) == 1 && fseek (file, -8, SEEK_END) == 0
+	   && fread (tail, 8, 1, file) == 1;
+  long size = ftell (file);
+  fclose (file);
+
+  uint32_t footer = (uint8_t) tail[0] | (uint8_t) tail[1] << 8
+		    | (uint8_t) tail[2] << 16 | (uint32_t) (uint8_t) tail[3] << 24;
+  return ok && memcmp (head, PARQUET_MAGIC, 4) == 0
+	 && memcmp (tail + 4, PARQUET_MAGIC, 4) == 0 && footer > 0
+	 && footer < (uint32_t) size - 12;
+}
+
+static size_t
+files_in (const char *directory)
+{
+  DIR *dir = opendir (directory);
+  size_t count = 0;
+  for (struct dirent *entry; dir && (entry = readdir (dir));)
+    count += entry->d_name[0] != '.';
+  if (dir)
+    closedir (dir);
+  return count;
+}
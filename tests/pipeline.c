@@ -0,0 +1,90 @@
+// the pipeline's engine side: a body the fetched queue has no room for
+// still reaches the consumer as a failed result, and only what the sink
+// queue cannot take either is counted as dropped. the queues are set up
+// by hand without a decoder, so nothing is taken off them behind our back.
+#include "../pipeline.c"
+#include "test.h"
+
+// clang-format off
+static FetchedBody *submitted (Pipeline *pipeline, void *userdata);
+static void complete (Pipeline *pipeline, void *userdata, WEATHER_ERROR status);
+// clang-format on
+
+static void
+test_no_room (void)
+{
+  Pipeline pipeline = {0};
+  CHECK_STATUS (WEATHER_SUCCESS, queue_init (&pipeline.fetched, 1, 0));
+  CHECK_STATUS (WEATHER_SUCCESS, queue_init (&pipeline.decoded, 1, 0));
+  int first, second, third;
+
+  // queued for the decoder, then refused and handed to the consumer, then
+  // refused with the sink full as well
+  complete (&pipeline, &first, WEATHER_SUCCESS);
+  complete (&pipeline, &second, WEATHER_SUCCESS);
+  complete (&pipeline, &third, WEATHER_ERROR_NETWORK);
+  CHECK (queue_count (&pipeline.fetched) == 1);
+  CHECK (queue_count (&pipeline.decoded) == 1);
+  CHECK (atomic_load (&pipeline.dropped) == 1);
+
+  void *item = NULL;
+  CHECK_STATUS (WEATHER_SUCCESS, queue_pop (&pipeline.decoded, &item, 0));
+  PipelineResult *result = item;
+  CHECK (result && result->userdata == &second
+	 && result->status == WEATHER_ERROR_INVALID_MEMORY && !result->series);
+  pipeline_free_result (result);
+
+  // a failed transfer keeps its own status, a closed pipeline refuses
+  queue_close (&pipeline.fetched);
+  complete (&pipeline, &third, WEATHER_ERROR_NETWORK);
+  CHECK_STATUS (WEATHER_SUCCESS, queue_pop (&pipeline.decoded, &item, 0));
+  result = item;
+  CHECK (result && result->userdata == &third
+	 && result->status == WEATHER_ERROR_NETWORK);
+  pipeline_free_result (result);
+
+  CHECK_STATUS (WEATHER_SUCCESS, queue_pop (&pipeline.fetched, &item, 0));
+  FetchedBody *fetched = item;
+  CHECK (fetched && fetched->userdata == &first && fetched->body
+	 && fetched->result);
+  if (fetched)
+    free_fetched (fetched);
+  queue_cleanup (&pipeline.fetched);
+  queue_cleanup (&pipeline.decoded);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_no_room);
+  return test_exit_status ();
+}
+
+static FetchedBody *
+submitted (Pipeline *pipeline, void *userdata)
+{
+  // what pipeline_submit hands the engine
+  FetchedBody *fetched = calloc (1, sizeof (*fetched));
+  if (fetched)
+    fetched->result = calloc (1, sizeof (PipelineResult));
+  CHECK (fetched && fetched->result);
+  if (!fetched || !fetched->result)
+    exit (EXIT_FAILURE);
+  fetched->pipeline = pipeline;
+  fetched->userdata = userdata;
+  return fetched;
+}
+
+static void
+complete (Pipeline *pipeline, void *userdata, WEATHER_ERROR status)
+{
+  EngineRequest request;
+  memset (&request, 0, sizeof (request));
+  if (WEATHER_SUCCESS == status)
+  {
+    request.response.data = strdup ("{}");
+    request.response.size = 2;
+  }
+  on_fetched (&request, status, submitted (pipeline, userdata));
+  free (request.response.data);
+}
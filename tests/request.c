@@ -0,0 +1,108 @@
+// the response buffer behind every transfer: growing past its capacity,
+// pausing when the memory budget says no, what a resumed chunk does, and
+// failing without a word on stderr.
+#include <unistd.h>
+
+#include "../request.c"
+#include "test.h"
+
+static void
+test_large_chunk (void)
+{
+  // one chunk bigger than several doublings of the buffer
+  ResponseBuffer buffer;
+  CHECK_STATUS (WEATHER_SUCCESS, init_response_buffer (&buffer));
+  size_t size = API_INITIAL_BUFFER_SIZE * 5 + 3;
+  char *chunk = malloc (size);
+  CHECK (chunk);
+  if (!chunk)
+    return;
+  memset (chunk, 'x', size);
+
+  CHECK (write_callback (chunk, 1, size, &buffer) == size);
+  CHECK (buffer.size == size && buffer.capacity > size);
+  CHECK (buffer.data[size - 1] == 'x' && buffer.data[size] == '\0');
+  CHECK (buffer.received);
+  free (chunk);
+  cleanup_response_buffer (&buffer);
+}
+
+static void
+test_paused_first_chunk (void)
+{
+  // the budget has no room for the growth the first chunk needs
+  MemoryBudget budget;
+  CHECK_STATUS (WEATHER_SUCCESS, budget_init (&budget, 1));
+  ResponseBuffer buffer;
+  CHECK_STATUS (WEATHER_SUCCESS, init_response_buffer (&buffer));
+  buffer.budget = &budget;
+
+  size_t size = API_INITIAL_BUFFER_SIZE * 2;
+  char *chunk = calloc (1, size);
+  CHECK (chunk);
+  if (!chunk)
+    return;
+
+  CHECK (write_callback (chunk, 1, size, &buffer) == CURL_WRITEFUNC_PAUSE);
+  CHECK (buffer.size == 0 && buffer.received);
+  CHECK (atomic_load (&budget.used) == 0 && atomic_load (&budget.refused) == 1);
+
+  // curl hands the same chunk over again on resume, by then there is room.
+  // first_byte went out the first time, received keeps it from repeating
+  budget.limit = 1 << 20;
+  CHECK (write_callback (chunk, 1, size, &buffer) == size);
+  CHECK (buffer.size == size && buffer.received);
+  CHECK (atomic_load (&budget.used) == buffer.charged);
+
+  free (chunk);
+  cleanup_response_buffer (&buffer);
+  CHECK (atomic_load (&budget.used) == 0);
+}
+
+static void
+test_errors_are_quiet (void)
+{
+  // library code reports through its return values, printing is up to the
+  // program. stderr goes to a file for the duration
+  FILE *captured = tmpfile ();
+  CHECK (captured);
+  if (!captured)
+    return;
+  fflush (stderr);
+  int saved = dup (STDERR_FILENO);
+  dup2 (fileno (captured), STDERR_FILENO);
+
+  WeatherConfig anonymous = {.username = "", .password = NULL};
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG, validate_config (&anonymous));
+
+  ResponseBuffer buffer;
+  CHECK_STATUS (WEATHER_SUCCESS, init_response_buffer (&buffer));
+  buffer.max_response_size = API_INITIAL_BUFFER_SIZE;
+  char chunk[API_INITIAL_BUFFER_SIZE] = {0};
+  CHECK (write_callback (chunk, 1, sizeof (chunk), &buffer) == 0);
+  CHECK_STATUS (WEATHER_ERROR_NETWORK,
+		transfer_status (&buffer, CURLE_WRITE_ERROR));
+  buffer.http_status = 404;
+  CHECK_STATUS (WEATHER_ERROR_HTTP_NOT_FOUND,
+		transfer_status (&buffer, CURLE_OK));
+  cleanup_response_buffer (&buffer);
+
+  json_t *root = NULL;
+  CHECK_STATUS (WEATHER_ERROR_JSON, process_json ("{\"data\": [", &root));
+  CHECK (!root);
+
+  fflush (stderr);
+  dup2 (saved, STDERR_FILENO);
+  close (saved);
+  CHECK (lseek (fileno (captured), 0, SEEK_END) == 0);
+  fclose (captured);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_large_chunk);
+  RUN_TEST (test_paused_first_chunk);
+  RUN_TEST (test_errors_are_quiet);
+  return test_exit_status ();
+}
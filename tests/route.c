@@ -0,0 +1,174 @@
+// route answers: the csv lands in the columns of its points, rows that do
+// not line up with their points fail the request, and the points are
+// packed into requests that each fit the url limit.
+#include "../route.c"
+#include "test.h"
+
+#define START 1729641600 // 2024-10-23T00:00:00Z
+
+// clang-format off
+static WEATHER_ERROR parse (RouteResult *result, const RoutePoint *points, size_t npoints, const char *parameters, const char *text);
+// clang-format on
+
+static const RoutePoint POINTS[] = {
+  {47.0, 8.0, START},
+  {47.5, 8.5, START + 3600},
+  {48.0, 9.0, START + 7200},
+};
+
+static void
+test_parse_rows (void)
+{
+  RouteResult result;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		parse (&result, POINTS, 3, "t_2m:C,precip_1h:mm",
+		       "validdate;lat;lon;precip_1h:mm;t_2m:C\n"
+		       "2024-10-23T00:00:00Z;47;8;0.25;11.5\n"
+		       "2024-10-23T01:00:00Z;47.5;8.5;0.5;12.5\n"
+		       "2024-10-23T02:00:00Z;48;9;0.75;13.5\n"));
+  // columns follow the query's order, not the answer's
+  for (size_t i = 0; i < 3; i++)
+  {
+    CHECK (result.values[i] == 11.5 + (double) i);
+    CHECK (result.values[3 + i] == 0.25 * (double) (i + 1));
+  }
+  free (result.values);
+}
+
+static void
+test_crlf_and_skipped (void)
+{
+  // windows line endings, and a column nobody asked for that is not a number
+  RouteResult result;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		parse (&result, POINTS, 2, "t_2m:C",
+		       "station;validdate;lat;lon;t_2m:C\r\n"
+		       "zurich;2024-10-23T00:00:00Z;47;8;11.5\r\n"
+		       "basel;2024-10-23T01:00:00Z;47.5;8.5;12.5\r\n"));
+  CHECK (result.values[0] == 11.5 && result.values[1] == 12.5);
+  free (result.values);
+
+  CHECK_STATUS (WEATHER_SUCCESS,
+		parse (&result, POINTS, 1, "t_2m:C",
+		       "validdate;lat;lon;t_2m:C\r\n"
+		       "2024-10-23T00:00:00Z;47;8;11.5"));
+  CHECK (result.values[0] == 11.5);
+  free (result.values);
+}
+
+static void
+test_rows_not_lining_up (void)
+{
+  RouteResult result;
+  const char *header = "validdate;lat;lon;t_2m:C\n";
+  const char *wrong[] = {
+    // another time, another place
+    "2024-10-23T05:00:00Z;47;8;11.5\n2024-10-23T01:00:00Z;47.5;8.5;12.5\n",
+    "2024-10-23T00:00:00Z;46;8;11.5\n2024-10-23T01:00:00Z;47.5;8.5;12.5\n",
+    // a field short, a row short, a row too many, not a number
+    "2024-10-23T00:00:00Z;47;8\n2024-10-23T01:00:00Z;47.5;8.5;12.5\n",
+    "2024-10-23T00:00:00Z;47;8;11.5\n",
+    "2024-10-23T00:00:00Z;47;8;11.5\n2024-10-23T01:00:00Z;47.5;8.5;12.5\n"
+    "2024-10-23T02:00:00Z;48;9;13.5\n",
+    "2024-10-23T00:00:00Z;47;8;warm\n2024-10-23T01:00:00Z;47.5;8.5;12.5\n",
+  };
+  for (size_t i = 0; i < sizeof (wrong) / sizeof (wrong[0]); i++)
+  {
+    char text[512];
+    snprintf (text, sizeof (text), "%s%s", header, wrong[i]);
+    CHECK_STATUS (WEATHER_ERROR_JSON,
+		  parse (&result, POINTS, 2, "t_2m:C", text));
+    free (result.values);
+  }
+
+  // a parameter the answer has no column for
+  CHECK_STATUS (WEATHER_ERROR_JSON,
+		parse (&result, POINTS, 1, "t_2m:C,precip_1h:mm",
+		       "validdate;lat;lon;t_2m:C\n"
+		       "2024-10-23T00:00:00Z;47;8;11.5\n"));
+  free (result.values);
+}
+
+static void
+test_plan (void)
+{
+  RoutePoint points[200];
+  for (size_t i = 0; i < 200; i++)
+    points[i] = (RoutePoint){45.0 + (double) i / 100, 8.0, START + 3600 * i};
+  RouteQuery query = {.parameters = "t_2m:C",
+		      .points = points,
+		      .npoints = 200,
+		      .max_url_length = 1024};
+
+  WeatherConfig config = {.datetime = "",
+			  .parameters = query.parameters,
+			  .location = "",
+			  .format = ROUTE_FORMAT};
+  char url[1024];
+  CHECK_STATUS (WEATHER_SUCCESS, construct_url (&config, url, sizeof (url)));
+
+  // every point in exactly one request, and every request fits
+  RouteBatch *batches = NULL;
+  size_t nbatches = 0;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		plan (&query, strlen (url), &batches, &nbatches));
+  CHECK (nbatches > 1);
+  size_t next = 0;
+  for (size_t b = 0; b < nbatches; b++)
+  {
+    CHECK (batches[b].first == next && batches[b].count > 0);
+    next += batches[b].count;
+    CHECK_STATUS (WEATHER_SUCCESS,
+		  build_url (&query, &batches[b], sizeof (url), url));
+    CHECK (strlen (url) < sizeof (url));
+  }
+  CHECK (next == 200);
+  free (batches);
+
+  // a single point that cannot fit
+  query.max_url_length = 64;
+  batches = NULL;
+  nbatches = 0;
+  CHECK_STATUS (WEATHER_ERROR_URL_CONSTRUCTION,
+		plan (&query, 60, &batches, &nbatches));
+  free (batches);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_parse_rows);
+  RUN_TEST (test_crlf_and_skipped);
+  RUN_TEST (test_rows_not_lining_up);
+  RUN_TEST (test_plan);
+  return test_exit_status ();
+}
+
+static WEATHER_ERROR
+parse (RouteResult *result, const RoutePoint *points, size_t npoints,
+       const char *parameters, const char *text)
+{
+  // the state route_fetch sets up, for one request covering every point
+  const char *names[4];
+  size_t lengths[4];
+  memset (result, 0, sizeof (*result));
+  result->npoints = npoints;
+  for (const char *name = parameters; name; result->nparameters++)
+  {
+    const char *comma = strchr (name, ',');
+    names[result->nparameters] = name;
+    lengths[result->nparameters]
+      = comma ? (size_t) (comma - name) : strlen (name);
+    name = comma ? comma + 1 : NULL;
+  }
+  result->values = malloc (npoints * result->nparameters * sizeof (double));
+  if (!result->values)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  RouteState state = {.result = result,
+		      .points = points,
+		      .names = names,
+		      .lengths = lengths};
+  RouteBatch batch = {.state = &state, .first = 0, .count = npoints};
+  return parse_csv (&batch, text);
+}
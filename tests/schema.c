@@ -0,0 +1,135 @@
+// the compile time decoder on the cli's default schema: an answer in
+// schema order fills the columns, anything else is refused and leaves
+// nothing behind for decode_series to pick up after it.
+#include "../schema.c"
+#include "default_schema.h"
+#include "test.h"
+
+#define START 1729641600 // 2024-10-23T00:00:00Z
+
+// clang-format off
+static char *answer (const char *const *parameters, size_t nparameters, int shifted);
+static WEATHER_ERROR decoded (const char *const *parameters, size_t nparameters, int shifted, DefaultForecast *forecast);
+// clang-format on
+
+static void
+test_schema_order (void)
+{
+  CHECK (strcmp (default_forecast_parameters (),
+		 "precip_1h:mm,t_2m:C,wind_speed_10m:ms")
+	 == 0);
+
+  const char *const parameters[]
+    = {"precip_1h:mm", "t_2m:C", "wind_speed_10m:ms"};
+  DefaultForecast forecast;
+  CHECK_STATUS (WEATHER_SUCCESS, decoded (parameters, 3, 0, &forecast));
+  CHECK (forecast.axis.count == 2 && forecast.axis.lat == 47.25
+	 && forecast.axis.lon == 8.5);
+  CHECK (forecast.axis.times && forecast.axis.times[0] == START
+	 && forecast.axis.times[1] == START + 3600);
+  const double *columns[] = {forecast.precipitation, forecast.temperature,
+			     forecast.wind_speed};
+  for (size_t p = 0; p < 3; p++)
+    CHECK (columns[p] && columns[p][0] == (double) p * 10 + 0.5
+	   && columns[p][1] == (double) p * 10 + 1.5);
+  default_forecast_free (&forecast);
+}
+
+static void
+test_column_order (void)
+{
+  // the order DEFAULT_PARAMETERS is written in, not the one the api answers
+  const char *const parameters[]
+    = {"t_2m:C", "precip_1h:mm", "wind_speed_10m:ms"};
+  DefaultForecast forecast;
+  CHECK_STATUS (WEATHER_ERROR_JSON, decoded (parameters, 3, 0, &forecast));
+  CHECK (!forecast.axis.times && !forecast.precipitation
+	 && !forecast.temperature && !forecast.wind_speed);
+}
+
+static void
+test_missing_parameter (void)
+{
+  DefaultForecast forecast;
+  const char *const short_one[] = {"precip_1h:mm", "t_2m:C"};
+  CHECK_STATUS (WEATHER_ERROR_JSON, decoded (short_one, 2, 0, &forecast));
+  CHECK (!forecast.axis.times && !forecast.precipitation
+	 && !forecast.temperature);
+
+  const char *const gap[] = {"precip_1h:mm", "wind_speed_10m:ms"};
+  CHECK_STATUS (WEATHER_ERROR_JSON, decoded (gap, 2, 0, &forecast));
+
+  // and one the schema does not know about
+  const char *const extra[]
+    = {"precip_1h:mm", "t_2m:C", "wind_speed_10m:ms", "msl_pressure:hPa"};
+  CHECK_STATUS (WEATHER_ERROR_JSON, decoded (extra, 4, 0, &forecast));
+  CHECK (!forecast.axis.times && !forecast.wind_speed);
+}
+
+static void
+test_dates_not_lining_up (void)
+{
+  const char *const parameters[]
+    = {"precip_1h:mm", "t_2m:C", "wind_speed_10m:ms"};
+  DefaultForecast forecast;
+  CHECK_STATUS (WEATHER_ERROR_JSON, decoded (parameters, 3, 1, &forecast));
+  CHECK (!forecast.axis.times);
+
+  CHECK_STATUS (WEATHER_ERROR_JSON,
+		default_forecast_decode ("{\"data\":[", 9, &forecast));
+  CHECK_STATUS (WEATHER_ERROR_JSON,
+		default_forecast_decode ("[]", 2, &forecast));
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_schema_order);
+  RUN_TEST (test_column_order);
+  RUN_TEST (test_missing_parameter);
+  RUN_TEST (test_dates_not_lining_up);
+  return test_exit_status ();
+}
+
+static char *
+answer (const char *const *parameters, size_t nparameters, int shifted)
+{
+  // what the api sends, leading keys included. shifted moves the dates of
+  // every column after the first an hour on
+  size_t capacity = 256 + nparameters * 256;
+  char *text = malloc (capacity);
+  if (!text)
+    return NULL;
+
+  size_t length = (size_t) snprintf (
+    text, capacity,
+    "{\"version\":\"3.0\",\"user\":\"user\",\"status\":\"OK\",\"data\":[");
+  for (size_t p = 0; p < nparameters; p++)
+  {
+    int hour = p && shifted ? 1 : 0;
+    length += (size_t) snprintf (
+      text + length, capacity - length,
+      "%s{\"parameter\":\"%s\",\"coordinates\":[{\"lat\":47.25,"
+      "\"lon\":8.5,\"dates\":[{\"date\":\"2024-10-23T%02d:00:00Z\","
+      "\"value\":%g},{\"date\":\"2024-10-23T%02d:00:00Z\",\"value\":%g}]}]}",
+      p ? "," : "", parameters[p], hour, (double) p * 10 + 0.5, hour + 1,
+      (double) p * 10 + 1.5);
+  }
+  snprintf (text + length, capacity - length, "]}");
+  return text;
+}
+
+static WEATHER_ERROR
+decoded (const char *const *parameters, size_t nparameters, int shifted,
+	 DefaultForecast *forecast)
+{
+  char *text = answer (parameters, nparameters, shifted);
+  CHECK (text);
+  if (!text)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  WEATHER_ERROR status
+    = default_forecast_decode (text, strlen (text), forecast);
+  free (text);
+  return status;
+}
@@ -0,0 +1,168 @@
+// round trips through the compressed series: every timestamp and value has
+// to come back bit for bit, sequentially, per block and by range.
+#include <math.h>
+
+#include "../series.c"
+#include "test.h"
+
+#define HOURS (24 * 30)
+
+// clang-format off
+static void fill (CompressedSeries *series, size_t count, int64_t start, int64_t step);
+static double sample (size_t i);
+static int same_bits (double a, double b);
+// clang-format on
+
+static void
+test_round_trip (void)
+{
+  CompressedSeries series;
+  CHECK_STATUS (WEATHER_SUCCESS, series_init (&series));
+  fill (&series, HOURS, 1729641600, 3600);
+  CHECK (series.count == HOURS);
+  CHECK (series.nblocks
+	 == (HOURS + SERIES_BLOCK_POINTS - 1) / SERIES_BLOCK_POINTS);
+
+  SeriesIterator it;
+  series_iter_init (&it, &series);
+  int64_t time;
+  double value;
+  size_t count = 0;
+  while (series_iter_next (&it, &time, &value))
+  {
+    CHECK (time == 1729641600 + (int64_t) count * 3600);
+    CHECK (same_bits (value, sample (count)));
+    count++;
+  }
+  CHECK (count == HOURS);
+
+  // well under the 16 bytes a raw point takes
+  CHECK_STATUS (WEATHER_SUCCESS, series_shrink_to_fit (&series));
+  CHECK (series_memory_usage (&series) < HOURS * 16 / 2);
+  series_cleanup (&series);
+}
+
+static void
+test_awkward_values (void)
+{
+  const double values[] = {0.0, -0.0, NAN, INFINITY, -INFINITY, 1e-308,
+			   -1.5, 1.5, 1.5, 0x1p-1074, 1e308, 42.0};
+  const int64_t times[] = {-86400, -1, 0, 1, 2, 3600, 3600, 3601, 1L << 40,
+			   (1L << 40) + 1, (1L << 40) + 7200, INT64_MAX / 2};
+  size_t count = sizeof (values) / sizeof (values[0]);
+
+  CompressedSeries series;
+  CHECK_STATUS (WEATHER_SUCCESS, series_init (&series));
+  for (size_t i = 0; i < count; i++)
+    CHECK_STATUS (WEATHER_SUCCESS,
+		  series_append (&series, times[i], values[i]));
+  CHECK_STATUS (WEATHER_ERROR_INVALID_CONFIG,
+		series_append (&series, times[count - 1] - 1, 0));
+
+  int64_t decoded_times[SERIES_BLOCK_POINTS];
+  double decoded_values[SERIES_BLOCK_POINTS];
+  CHECK (series_decode_block (&series, 0, decoded_times, decoded_values)
+	 == count);
+  for (size_t i = 0; i < count; i++)
+  {
+    CHECK (decoded_times[i] == times[i]);
+    CHECK (same_bits (decoded_values[i], values[i]));
+  }
+  series_cleanup (&series);
+}
+
+static void
+test_decode_range (void)
+{
+  CompressedSeries series;
+  CHECK_STATUS (WEATHER_SUCCESS, series_init (&series));
+  fill (&series, HOURS, 0, 3600);
+  CHECK_STATUS (WEATHER_SUCCESS, series_shrink_to_fit (&series));
+
+  int64_t times[HOURS];
+  double values[HOURS];
+  size_t npoints = 0;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_decode_range (&series, 200 * 3600, 300 * 3600 - 1, times,
+				     values, HOURS, &npoints));
+  CHECK (npoints == 100);
+  for (size_t i = 0; i < npoints; i++)
+  {
+    CHECK (times[i] == (int64_t) (200 + i) * 3600);
+    CHECK (same_bits (values[i], sample (200 + i)));
+  }
+
+  CHECK_STATUS (WEATHER_ERROR_INVALID_MEMORY,
+		series_decode_range (&series, 0, 10 * 3600, times, values, 5,
+				     &npoints));
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_decode_range (&series, -7200, -3600, times, values,
+				     HOURS, &npoints));
+  CHECK (npoints == 0);
+
+  // appending still works after the shrink
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_append (&series, HOURS * 3600, sample (HOURS)));
+  CHECK (series.count == HOURS + 1);
+  series_cleanup (&series);
+}
+
+static void
+test_duplicate_across_blocks (void)
+{
+  // the first block ends on the time the second one starts with
+  CompressedSeries series;
+  CHECK_STATUS (WEATHER_SUCCESS, series_init (&series));
+  fill (&series, SERIES_BLOCK_POINTS, 0, 60);
+  int64_t shared = (SERIES_BLOCK_POINTS - 1) * 60;
+  CHECK_STATUS (WEATHER_SUCCESS, series_append (&series, shared, -1.0));
+  CHECK_STATUS (WEATHER_SUCCESS, series_append (&series, shared + 60, -2.0));
+  CHECK (series.nblocks == 2);
+  CHECK (series_find_block (&series, shared) == 0);
+  CHECK (series_find_block (&series, shared + 60) == 1);
+
+  int64_t times[4];
+  double values[4];
+  size_t npoints = 0;
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_decode_range (&series, shared, shared + 60, times,
+				     values, 4, &npoints));
+  CHECK (npoints == 3);
+  CHECK (times[0] == shared && same_bits (values[0],
+					   sample (SERIES_BLOCK_POINTS - 1)));
+  CHECK (times[1] == shared && values[1] == -1.0);
+  CHECK (times[2] == shared + 60 && values[2] == -2.0);
+  series_cleanup (&series);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_round_trip);
+  RUN_TEST (test_awkward_values);
+  RUN_TEST (test_decode_range);
+  RUN_TEST (test_duplicate_across_blocks);
+  return test_exit_status ();
+}
+
+static void
+fill (CompressedSeries *series, size_t count, int64_t start, int64_t step)
+{
+  for (size_t i = 0; i < count; i++)
+    CHECK_STATUS (WEATHER_SUCCESS,
+		  series_append (series, start + (int64_t) i * step,
+				 sample (i)));
+}
+
+static double
+sample (size_t i)
+{
+  // a temperature like curve, rounded the way the api sends it
+  return round ((12.0 + 6.0 * sin ((double) i * M_PI / 12.0)) * 10.0) / 10.0;
+}
+
+static int
+same_bits (double a, double b)
+{
+  return memcmp (&a, &b, sizeof (a)) == 0;
+}
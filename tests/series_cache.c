@@ -0,0 +1,156 @@
+// the series cache: merging puts, eviction, and which parts of a range the
+// recorded coverage vouches for.
+#include "../series_cache.c"
+#include "test.h"
+
+// clang-format off
+static void put_hours (SeriesCache *cache, const char *parameter, int64_t first, int64_t last);
+static int gaps_are (SeriesCache *cache, const char *parameter, SeriesInterval range, const SeriesInterval *expected, size_t nexpected);
+// clang-format on
+
+static void
+test_put_and_merge (void)
+{
+  SeriesCache cache;
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  CHECK (!series_cache_get (&cache, "t_2m:C", "47,8"));
+
+  put_hours (&cache, "t_2m:C", 10, 19);
+  put_hours (&cache, "t_2m:C", 0, 14); // overlaps, goes through the rebuild
+  const int64_t times[] = {5 * 3600, 30 * 3600};
+  const double values[] = {-5.0, 30.0};
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_put (&cache, "t_2m:C", "47,8",
+						   times, values, 2));
+
+  const CompressedSeries *series = series_cache_get (&cache, "t_2m:C", "47,8");
+  CHECK (series && series->count == 21);
+
+  SeriesIterator it;
+  series_iter_init (&it, series);
+  int64_t time, previous = -1;
+  double value;
+  while (series_iter_next (&it, &time, &value))
+  {
+    CHECK (time > previous); // every timestamp once
+    CHECK (value == (time == 5 * 3600 ? -5.0 : (double) time / 3600));
+    previous = time;
+  }
+  CHECK (cache.hits == 1 && cache.misses == 1);
+  series_cache_cleanup (&cache);
+}
+
+static void
+test_eviction (void)
+{
+  SeriesCache cache;
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 4096));
+
+  char location[32];
+  for (int i = 0; i < 64; i++)
+  {
+    snprintf (location, sizeof (location), "%d,8", i);
+    const int64_t times[] = {0, 3600, 7200};
+    const double values[] = {i, i + 1, i + 2};
+    CHECK_STATUS (WEATHER_SUCCESS, series_cache_put (&cache, "t_2m:C",
+						     location, times, values,
+						     3));
+    CHECK (cache.memory_used <= cache.max_memory);
+  }
+
+  // the newest stay, the oldest went first
+  CHECK (cache.evictions > 0 && cache.count + cache.evictions == 64);
+  CHECK (series_cache_get (&cache, "t_2m:C", "63,8"));
+  CHECK (!series_cache_get (&cache, "t_2m:C", "0,8"));
+  series_cache_cleanup (&cache);
+}
+
+static void
+test_gaps (void)
+{
+  SeriesCache cache;
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_init (&cache, 1 << 20));
+  SeriesInterval day = {0, 23 * 3600, 3600};
+
+  // nothing cached, the whole range is missing
+  CHECK (gaps_are (&cache, "t_2m:C", day, &day, 1));
+
+  // hours 0 to 48 cached, 24 to 72 asked for
+  put_hours (&cache, "t_2m:C", 0, 48);
+  SeriesInterval cached = {0, 48 * 3600, 3600};
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_cache_cover (&cache, "t_2m:C", "47,8", &cached));
+  SeriesInterval later = {24 * 3600, 72 * 3600, 3600};
+  SeriesInterval missing = {49 * 3600, 72 * 3600, 3600};
+  CHECK (gaps_are (&cache, "t_2m:C", later, &missing, 1));
+  CHECK (gaps_are (&cache, "t_2m:C", day, NULL, 0));
+
+  // a coarser step on the same phase is covered, another phase is not
+  SeriesInterval six_hourly = {0, 48 * 3600, 6 * 3600};
+  CHECK (gaps_are (&cache, "t_2m:C", six_hourly, NULL, 0));
+  SeriesInterval off_phase = {1800, 7 * 3600 + 1800, 3600};
+  CHECK (gaps_are (&cache, "t_2m:C", off_phase, &off_phase, 1));
+
+  // a hole in the middle, touching ranges on one step merge
+  put_hours (&cache, "t_2m:C", 60, 80);
+  SeriesInterval tail = {60 * 3600, 80 * 3600, 3600};
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_cache_cover (&cache, "t_2m:C", "47,8", &tail));
+  SeriesInterval hole = {49 * 3600, 59 * 3600, 3600};
+  SeriesInterval all = {0, 80 * 3600, 3600};
+  CHECK (gaps_are (&cache, "t_2m:C", all, &hole, 1));
+
+  put_hours (&cache, "t_2m:C", 49, 59);
+  CHECK_STATUS (WEATHER_SUCCESS,
+		series_cache_cover (&cache, "t_2m:C", "47,8", &hole));
+  CHECK (gaps_are (&cache, "t_2m:C", all, NULL, 0));
+  SeriesCacheEntry *entry
+    = find_entry (&cache, "t_2m:C@47,8", weather_hash ("t_2m:C@47,8"));
+  CHECK (entry && entry->ncovered == 1);
+
+  // other parameters know nothing of it
+  CHECK (gaps_are (&cache, "precip_1h:mm", day, &day, 1));
+  series_cache_cleanup (&cache);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_put_and_merge);
+  RUN_TEST (test_eviction);
+  RUN_TEST (test_gaps);
+  return test_exit_status ();
+}
+
+static void
+put_hours (SeriesCache *cache, const char *parameter, int64_t first,
+	   int64_t last)
+{
+  int64_t times[128];
+  double values[128];
+  size_t count = 0;
+  for (int64_t hour = first; hour <= last; hour++, count++)
+  {
+    times[count] = hour * 3600;
+    values[count] = (double) hour;
+  }
+  CHECK_STATUS (WEATHER_SUCCESS, series_cache_put (cache, parameter, "47,8",
+						   times, values, count));
+}
+
+static int
+gaps_are (SeriesCache *cache, const char *parameter, SeriesInterval range,
+	  const SeriesInterval *expected, size_t nexpected)
+{
+  SeriesInterval *gaps = NULL;
+  size_t ngaps = 0;
+  if (WEATHER_SUCCESS
+      != series_cache_gaps (cache, parameter, "47,8", &range, &gaps, &ngaps))
+    return 0;
+
+  int same = ngaps == nexpected;
+  for (size_t i = 0; same && i < ngaps; i++)
+    same = gaps[i].start == expected[i].start && gaps[i].end == expected[i].end
+	   && gaps[i].step == expected[i].step;
+  free (gaps);
+  return same;
+}
@@ -0,0 +1,40 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// checks shared by the tests. a failed check is reported and counted, the
+// test carries on so one run shows every failure. every test includes the
+// source it covers (see the Makefile), which puts its statics in reach
+
+static int test_failures;
+
+#define CHECK(condition)                                                       \
+  do                                                                           \
+  {                                                                            \
+    if (!(condition))                                                          \
+    {                                                                          \
+      fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,        \
+	       #condition);                                                    \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_STATUS(expected, call) CHECK ((expected) == (call))
+
+#define RUN_TEST(test)                                                         \
+  do                                                                           \
+  {                                                                            \
+    int before = test_failures;                                                \
+    test ();                                                                   \
+    printf ("%-48s %s\n", #test, before == test_failures ? "ok" : "FAILED");   \
+  } while (0)
+
+static inline int
+test_exit_status (void)
+{
+  return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,118 @@
+// the c++ headers end to end: the client wrapper fetches and decodes a
+// series, and a coroutine on the async client does the same through the
+// engine. the transport is a file:// url to a canned answer, so the
+// transfers are real curl transfers that never leave the machine.
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+#include "meteomatics.hpp"
+#include "meteomatics_async.hpp"
+#include "test.h"
+
+#define ANSWER                                                                 \
+  "{\"version\":\"3.0\",\"status\":\"OK\",\"data\":[{\"parameter\":"          \
+  "\"t_2m:C\",\"coordinates\":[{\"lat\":47.4,\"lon\":9.4,\"dates\":["         \
+  "{\"date\":\"2024-10-23T00:00:00Z\",\"value\":11.5},"                        \
+  "{\"date\":\"2024-10-23T01:00:00Z\",\"value\":12.5}]}]}]}"
+
+// clang-format off
+static int expected_series (const meteomatics::SeriesSet &set);
+static meteomatics::Task<meteomatics::Result<meteomatics::SeriesSet>> fetch_file (meteomatics::AsyncClient &client, std::string url);
+// clang-format on
+
+static std::string answer_url;
+
+static void
+test_client (void)
+{
+  auto client = meteomatics::Client::create ("user", "secret");
+  CHECK (client);
+  if (!client)
+    return;
+
+  auto body = client->get (answer_url);
+  CHECK (body && *body == ANSWER);
+  if (!body)
+    return;
+
+  auto root = meteomatics::Json::parse (std::string (*body).c_str ());
+  CHECK (root);
+  if (!root)
+    return;
+  auto series = meteomatics::SeriesSet::decode (*root);
+  CHECK (series && expected_series (*series));
+
+  // an error comes back as a value, not an exception
+  auto missing = client->get ("file:///nonexistent/answer.json");
+  CHECK (!missing && missing.error () == meteomatics::make_error (
+			 WEATHER_ERROR_NETWORK));
+}
+
+static void
+test_coroutine (void)
+{
+  auto client = meteomatics::AsyncClient::create ("user", "secret", 4);
+  CHECK (client);
+  if (!client)
+    return;
+
+  auto series = client->run (fetch_file (*client, answer_url));
+  CHECK (series && expected_series (*series));
+
+  // a stop requested before the await never reaches the engine
+  std::stop_source source;
+  source.request_stop ();
+  auto response = client->run (
+    [] (meteomatics::AsyncClient &client, std::string url,
+	std::stop_token stop) -> meteomatics::Task<bool> {
+      auto response = co_await client.get (std::move (url), stop);
+      co_return !response
+	&& response.error ()
+	     == meteomatics::make_error (WEATHER_ERROR_CANCELLED);
+    }(*client, answer_url, source.get_token ()));
+  CHECK (response);
+}
+
+int
+main (void)
+{
+  char path[] = "/tmp/meteomatics-answer.XXXXXX";
+  int fd = mkstemp (path);
+  CHECK (fd >= 0);
+  if (fd < 0)
+    return test_exit_status ();
+  CHECK (write (fd, ANSWER, sizeof (ANSWER) - 1) == sizeof (ANSWER) - 1);
+  close (fd);
+  answer_url = std::string ("file://") + path;
+
+  RUN_TEST (test_client);
+  RUN_TEST (test_coroutine);
+
+  unlink (path);
+  return test_exit_status ();
+}
+
+static int
+expected_series (const meteomatics::SeriesSet &set)
+{
+  if (set.size () != 1)
+    return 0;
+  meteomatics::SeriesView series = set[0];
+  return series.parameter == "t_2m:C" && series.lat == 47.4
+	 && series.lon == 9.4 && series.times.size () == 2
+	 && series.times[0] == 1729641600 && series.times[1] == 1729645200
+	 && series.values[0] == 11.5 && series.values[1] == 12.5;
+}
+
+static meteomatics::Task<meteomatics::Result<meteomatics::SeriesSet>>
+fetch_file (meteomatics::AsyncClient &client, std::string url)
+{
+  auto response = co_await client.get (std::move (url));
+  if (!response)
+    co_return response.error ();
+  auto root = response->json ();
+  if (!root)
+    co_return root.error ();
+  co_return meteomatics::SeriesSet::decode (*root);
+}
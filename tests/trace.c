@@ -0,0 +1,254 @@
+// spans: nesting on one thread, detached spans that overlap it, and the
+// phases of a real transfer against the metrics endpoint on localhost.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "../trace.c"
+#include "engine.h"
+#include "metrics.h"
+#include "request.h"
+#include "test.h"
+
+// clang-format off
+static void serve (MetricsServer *server, char *url, size_t url_size);
+static void on_done (EngineRequest *request, WEATHER_ERROR status, void *userdata);
+static char *make_path (void);
+static json_t *load_spans (const char *path);
+static json_t *find_span (json_t *spans, const char *name);
+static int child_of (json_t *span, json_t *parent);
+static long long nanos (json_t *span, const char *key);
+// clang-format on
+
+static void
+test_detached (void)
+{
+  char *path = make_path ();
+  CHECK_STATUS (WEATHER_SUCCESS, trace_open (path, TRACE_FORMAT_OTLP, 1.0));
+
+  TraceSpan outer, detached, inner;
+  trace_begin (&outer, "outer");
+  trace_begin_detached (&detached, "detached");
+  trace_begin (&inner, "inner");
+  trace_end (&inner, WEATHER_SUCCESS);
+  int64_t now = trace_now_ns ();
+  trace_record (&detached, "phase", now - 1000, now, WEATHER_SUCCESS);
+  trace_end (&outer, WEATHER_SUCCESS);
+  trace_end (&detached, WEATHER_ERROR_NETWORK); // after its parent, on purpose
+  CHECK (!current);
+  trace_close ();
+
+  json_t *spans = load_spans (path);
+  CHECK (json_array_size (spans) == 4);
+  json_t *root = find_span (spans, "outer");
+  CHECK (root && !*json_string_value (json_object_get (root, "parentSpanId")));
+  CHECK (child_of (find_span (spans, "detached"), root));
+  CHECK (child_of (find_span (spans, "inner"), root));
+  CHECK (child_of (find_span (spans, "phase"),
+		   find_span (spans, "detached")));
+  json_decref (spans);
+  unlink (path);
+  free (path);
+}
+
+static void
+test_transfer_phases (void)
+{
+  MetricsServer server;
+  char url[64];
+  serve (&server, url, sizeof (url));
+
+  char *path = make_path ();
+  CHECK_STATUS (WEATHER_SUCCESS, trace_open (path, TRACE_FORMAT_OTLP, 1.0));
+  CURL *curl = curl_easy_init ();
+  ResponseBuffer response;
+  CHECK_STATUS (WEATHER_SUCCESS, init_response_buffer (&response));
+  WeatherConfig credentials = {.username = "user", .password = "secret"};
+  CHECK_STATUS (WEATHER_SUCCESS,
+		perform_with_handle (curl, url, &credentials, &response));
+  cleanup_response_buffer (&response);
+  curl_easy_cleanup (curl);
+  trace_close ();
+  metrics_stop (&server);
+
+  // every phase there is sits inside the request, one after the other
+  json_t *spans = load_spans (path);
+  json_t *request = find_span (spans, "perform_request");
+  CHECK (request);
+  CHECK (find_span (spans, "connect") && find_span (spans, "transfer"));
+  long long previous = nanos (request, "startTimeUnixNano");
+  size_t phases = 0;
+  json_t *span;
+  size_t i;
+  json_array_foreach (spans, i, span)
+  {
+    if (span == request)
+      continue;
+    CHECK (child_of (span, request));
+    CHECK (nanos (span, "startTimeUnixNano") >= previous);
+    previous = nanos (span, "endTimeUnixNano");
+    phases++;
+  }
+  CHECK (phases >= 2 && previous <= nanos (request, "endTimeUnixNano"));
+  json_decref (spans);
+  unlink (path);
+  free (path);
+}
+
+static void
+test_engine_requests (void)
+{
+  MetricsServer server;
+  char url[64];
+  serve (&server, url, sizeof (url));
+
+  // the engine's transfers overlap, each one still gets its own span
+  char *path = make_path ();
+  CHECK_STATUS (WEATHER_SUCCESS, trace_open (path, TRACE_FORMAT_OTLP, 1.0));
+  TraceSpan batch;
+  trace_begin (&batch, "batch");
+  RequestEngine engine;
+  CHECK_STATUS (WEATHER_SUCCESS, engine_init (&engine, "user", "secret", 1));
+  int outstanding = 2;
+  CHECK_STATUS (WEATHER_SUCCESS, engine_submit (&engine, url,
+						ENGINE_PRIORITY_STANDARD,
+						on_done, &outstanding));
+  CHECK_STATUS (WEATHER_SUCCESS, engine_submit (&engine, url,
+						ENGINE_PRIORITY_STANDARD,
+						on_done, &outstanding));
+  while (outstanding)
+    CHECK_STATUS (WEATHER_SUCCESS, engine_perform (&engine, 1000, NULL));
+  engine_cleanup (&engine);
+  trace_end (&batch, WEATHER_SUCCESS);
+  trace_close ();
+  metrics_stop (&server);
+
+  json_t *spans = load_spans (path);
+  json_t *root = find_span (spans, "batch");
+  size_t requests = 0, queued = 0;
+  json_t *span;
+  size_t i;
+  json_array_foreach (spans, i, span)
+  {
+    const char *name = json_string_value (json_object_get (span, "name"));
+    if (strcmp (name, "engine_request") != 0)
+      continue;
+    requests++;
+    CHECK (child_of (span, root));
+
+    json_t *phase;
+    size_t j;
+    json_array_foreach (spans, j, phase)
+    {
+      if (!child_of (phase, span))
+	continue;
+      queued += strcmp (json_string_value (json_object_get (phase, "name")),
+			"engine_queue")
+		== 0;
+      CHECK (nanos (phase, "startTimeUnixNano")
+	     >= nanos (span, "startTimeUnixNano"));
+      CHECK (nanos (phase, "endTimeUnixNano")
+	     <= nanos (span, "endTimeUnixNano"));
+    }
+  }
+  CHECK (requests == 2 && queued == 2);
+  json_decref (spans);
+  unlink (path);
+  free (path);
+}
+
+int
+main (void)
+{
+  RUN_TEST (test_detached);
+  RUN_TEST (test_transfer_phases);
+  RUN_TEST (test_engine_requests);
+  return test_exit_status ();
+}
+
+static void
+serve (MetricsServer *server, char *url, size_t url_size)
+{
+  CHECK_STATUS (WEATHER_SUCCESS, metrics_serve (server, 0));
+  struct sockaddr_in address;
+  socklen_t length = sizeof (address);
+  CHECK (getsockname (server->fd, (struct sockaddr *) &address, &length) == 0);
+  snprintf (url, url_size, "http://127.0.0.1:%d/metrics",
+	    ntohs (address.sin_port));
+}
+
+static void
+on_done (EngineRequest *request, WEATHER_ERROR status, void *userdata)
+{
+  (void) request;
+  CHECK_STATUS (WEATHER_SUCCESS, status);
+  (*(int *) userdata)--;
+}
+
+static char *
+make_path (void)
+{
+  char *path = strdup ("/tmp/meteomatics-trace-XXXXXX");
+  int fd = path ? mkstemp (path) : -1;
+  if (fd < 0)
+  {
+    perror ("mkstemp");
+    exit (EXIT_FAILURE);
+  }
+  close (fd);
+  return path;
+}
+
+static json_t *
+load_spans (const char *path)
+{
+  // one ExportTraceServiceRequest per line, one span in each
+  json_t *spans = json_array ();
+  FILE *stream = fopen (path, "r");
+  char line[4096];
+  while (stream && fgets (line, sizeof (line), stream))
+  {
+    json_t *export = json_loads (line, 0, NULL);
+    json_t *resource = json_array_get (json_object_get (export,
+							"resourceSpans"), 0);
+    json_t *scope = json_array_get (json_object_get (resource, "scopeSpans"),
+				    0);
+    json_t *span = json_array_get (json_object_get (scope, "spans"), 0);
+    CHECK (span);
+    if (span)
+      json_array_append (spans, span);
+    json_decref (export);
+  }
+  if (stream)
+    fclose (stream);
+  return spans;
+}
+
+static json_t *
+find_span (json_t *spans, const char *name)
+{
+  json_t *span;
+  size_t i;
+  json_array_foreach (spans, i, span)
+  {
+    if (strcmp (json_string_value (json_object_get (span, "name")), name) == 0)
+      return span;
+  }
+  return NULL;
+}
+
+static int
+child_of (json_t *span, json_t *parent)
+{
+  return span && parent
+	 && json_equal (json_object_get (span, "traceId"),
+			json_object_get (parent, "traceId"))
+	 && json_equal (json_object_get (span, "parentSpanId"),
+			json_object_get (parent, "spanId"));
+}
+
+static long long
+nanos (json_t *span, const char *key)
+{
+  const char *text = json_string_value (json_object_get (span, key));
+  return text ? strtoll (text, NULL, 10) : -1;
+}
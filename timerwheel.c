@@ -0,0 +1,233 @@
+#include <string.h>
+
+#include "timerwheel.h"
+
+#define SLOT_MASK (TIMERWHEEL_SLOTS - 1)
+
+// clang-format off
+static void place (TimerWheel *wheel, TimerEntry *entry);
+static void push (TimerEntry **list, TimerEntry *entry);
+static void cascade (TimerWheel *wheel, int level, size_t slot);
+// clang-format on
+
+void
+timerwheel_init (TimerWheel *wheel, uint64_t now)
+{
+  memset (wheel, 0, sizeof (*wheel));
+  wheel->current = now;
+}
+
+void
+timerwheel_add (TimerWheel *wheel, TimerEntry *entry, uint64_t expires)
+{
+  if (entry->list)
+    timerwheel_remove (wheel, entry);
+
+  entry->expires = expires > wheel->current ? expires : wheel->current + 1;
+  place (wheel, entry);
+  wheel->count++;
+}
+
+void
+timerwheel_remove (TimerWheel *wheel, TimerEntry *entry)
+{
+  if (!entry->list)
+    return;
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    *entry->list = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+
+  // keep the occupancy bitmap in sync when a slot runs empty
+  if (!*entry->list && entry->list != &wheel->overflow)
+  {
+    size_t index = (size_t) (entry->list - &wheel->slots[0][0]);
+    wheel->occupied[index / TIMERWHEEL_SLOTS]
+      &= ~(1ULL << (index % TIMERWHEEL_SLOTS));
+  }
+
+  entry->prev = NULL;
+  entry->next = NULL;
+  entry->list = NULL;
+  wheel->count--;
+}
+
+TimerEntry *
+timerwheel_advance (TimerWheel *wheel, uint64_t now)
+{
+  TimerEntry *expired = NULL;
+  TimerEntry **tail = &expired;
+
+  while (wheel->current < now)
+  {
+    uint64_t tick = wheel->current + 1;
+    size_t index = tick & SLOT_MASK;
+
+    // nothing can happen before the next level 0 slot that is in use or the
+    // next cascade, skip straight there
+    if (index != 0)
+    {
+      uint64_t pending = wheel->occupied[0] >> index;
+      if (!pending)
+      {
+	uint64_t boundary = (tick | SLOT_MASK) + 1;
+	wheel->current = boundary - 1 < now ? boundary - 1 : now;
+	continue;
+      }
+
+      tick += (uint64_t) __builtin_ctzll (pending);
+      if (tick > now)
+      {
+	wheel->current = now;
+	break;
+      }
+      index = tick & SLOT_MASK;
+    }
+
+    wheel->current = tick;
+
+    if (index == 0)
+    {
+      for (int level = 1; level < TIMERWHEEL_LEVELS; level++)
+      {
+	size_t slot
+	  = (tick >> (level * TIMERWHEEL_SLOT_BITS)) & SLOT_MASK;
+	cascade (wheel, level, slot);
+	if (slot != 0)
+	  break;
+
+	if (level == TIMERWHEEL_LEVELS - 1)
+	{
+	  // the whole wheel wrapped, overflow timers may fit now
+	  TimerEntry *entry = wheel->overflow;
+	  wheel->overflow = NULL;
+	  while (entry)
+	  {
+	    TimerEntry *next = entry->next;
+	    place (wheel, entry);
+	    entry = next;
+	  }
+	}
+      }
+    }
+
+    TimerEntry *entry = wheel->slots[0][index];
+    wheel->slots[0][index] = NULL;
+    wheel->occupied[0] &= ~(1ULL << index);
+
+    while (entry)
+    {
+      TimerEntry *next = entry->next;
+      entry->prev = NULL;
+      entry->next = NULL;
+      entry->list = NULL;
+      wheel->count--;
+
+      *tail = entry;
+      tail = &entry->next;
+      entry = next;
+    }
+  }
+
+  return expired;
+}
+
+uint64_t
+timerwheel_next_expiry (const TimerWheel *wheel)
+{
+  if (wheel->count == 0)
+    return UINT64_MAX;
+
+  uint64_t next = UINT64_MAX;
+  uint64_t current = wheel->current;
+
+  for (int level = 0; level < TIMERWHEEL_LEVELS; level++)
+  {
+    uint64_t occupied = wheel->occupied[level];
+    if (!occupied)
+      continue;
+
+    int shift = level * TIMERWHEEL_SLOT_BITS;
+    size_t index = (current >> shift) & SLOT_MASK;
+    uint64_t base = (current >> (shift + TIMERWHEEL_SLOT_BITS))
+		    << (shift + TIMERWHEEL_SLOT_BITS);
+
+    // the slot for the current index on level 0 was already processed, on
+    // the upper levels it was cascaded when its span started, so in both
+    // cases only later slots (or the next round) count
+    uint64_t later = index + 1 < TIMERWHEEL_SLOTS
+		       ? occupied & (~0ULL << (index + 1))
+		       : 0;
+    uint64_t start;
+    if (later)
+      start = base + ((uint64_t) __builtin_ctzll (later) << shift);
+    else
+      start = base + (1ULL << (shift + TIMERWHEEL_SLOT_BITS))
+	      + ((uint64_t) __builtin_ctzll (occupied) << shift);
+
+    if (start < next)
+      next = start;
+  }
+
+  if (wheel->overflow)
+  {
+    // overflow timers are looked at again when the top level wraps
+    int top = TIMERWHEEL_LEVELS * TIMERWHEEL_SLOT_BITS;
+    uint64_t wrap = ((current >> top) + 1) << top;
+    if (wrap < next)
+      next = wrap;
+  }
+
+  return next;
+}
+
+static void
+place (TimerWheel *wheel, TimerEntry *entry)
+{
+  uint64_t delta = entry->expires > wheel->current
+		     ? entry->expires - wheel->current
+		     : 0;
+
+  for (int level = 0; level < TIMERWHEEL_LEVELS; level++)
+  {
+    int shift = level * TIMERWHEEL_SLOT_BITS;
+    if (delta >> (shift + TIMERWHEEL_SLOT_BITS) == 0)
+    {
+      size_t slot = (entry->expires >> shift) & SLOT_MASK;
+      push (&wheel->slots[level][slot], entry);
+      wheel->occupied[level] |= 1ULL << slot;
+      return;
+    }
+  }
+
+  push (&wheel->overflow, entry);
+}
+
+static void
+push (TimerEntry **list, TimerEntry *entry)
+{
+  entry->prev = NULL;
+  entry->next = *list;
+  if (*list)
+    (*list)->prev = entry;
+  *list = entry;
+  entry->list = list;
+}
+
+static void
+cascade (TimerWheel *wheel, int level, size_t slot)
+{
+  TimerEntry *entry = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~(1ULL << slot);
+
+  while (entry)
+  {
+    TimerEntry *next = entry->next;
+    place (wheel, entry);
+    entry = next;
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// hierarchical timer wheel: TIMERWHEEL_LEVELS wheels of TIMERWHEEL_SLOTS
+// slots each, level n slots are TIMERWHEEL_SLOTS^n ticks wide. adding and
+// removing a timer is O(1), a timer only moves down a level when its slot on
+// the level above comes due. timers further out than the whole wheel wait in
+// an overflow list until the top level wraps around.
+//
+// entries are embedded in the caller's structs, the wheel never allocates.
+#define TIMERWHEEL_SLOT_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+#define TIMERWHEEL_LEVELS 4
+
+typedef struct TimerEntry
+{
+  uint64_t expires; // tick
+  struct TimerEntry *prev;
+  struct TimerEntry *next;
+  struct TimerEntry **list; // list head the entry is on, NULL when idle
+} TimerEntry;
+
+typedef struct
+{
+  uint64_t current; // last tick that was processed
+  TimerEntry *slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+  uint64_t occupied[TIMERWHEEL_LEVELS]; // bit per non empty slot
+  TimerEntry *overflow;
+  size_t count;
+} TimerWheel;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+void timerwheel_init (TimerWheel *wheel, uint64_t now);
+// expires at or before the current tick fires on the next advance
+void timerwheel_add (TimerWheel *wheel, TimerEntry *entry, uint64_t expires);
+void timerwheel_remove (TimerWheel *wheel, TimerEntry *entry);
+// processes every tick up to now and returns the expired entries chained
+// through next, in expiry order
+TimerEntry *timerwheel_advance (TimerWheel *wheel, uint64_t now);
+// earliest tick at which advance can return something, UINT64_MAX when empty
+uint64_t timerwheel_next_expiry (const TimerWheel *wheel);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "tls_cache.h"
+
+#define TLS_CACHE_MAGIC "WXTS"
+#define TLS_CACHE_VERSION 1
+#define TLS_CACHE_MAX_FIELD (64 * 1024) // anything bigger is not a ticket
+
+typedef struct
+{
+  TlsSessionCache *cache;
+  FILE *file;
+} TlsExport;
+
+// clang-format off
+static void lock_data (CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+static void unlock_data (CURL *handle, curl_lock_data data, void *userptr);
+#if TLS_CACHE_HAVE_PERSISTENCE
+static WEATHER_ERROR load (TlsSessionCache *cache);
+static void persistence_unavailable (TlsSessionCache *cache);
+static CURLcode export_one (CURL *handle, void *userptr, const char *session_key, const unsigned char *shmac, size_t shmac_len, const unsigned char *sdata, size_t sdata_len, curl_off_t valid_until, int ietf_tls_id, const char *alpn, size_t earlydata_max);
+static int write_field (FILE *file, const void *data, size_t len);
+static void *read_field (FILE *file, size_t *len);
+#endif
+// clang-format on
+
+WEATHER_ERROR
+tls_cache_init (TlsSessionCache *cache, const char *path)
+{
+  if (!cache)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  memset (cache, 0, sizeof (*cache));
+  cache->share = curl_share_init ();
+  if (!cache->share)
+    return WEATHER_ERROR_INVALID_MEMORY;
+
+  if (path)
+  {
+    cache->path = strdup (path);
+    if (!cache->path)
+    {
+      curl_share_cleanup (cache->share);
+      return WEATHER_ERROR_INVALID_MEMORY;
+    }
+  }
+
+  // handles on different threads reach into the share at the same time
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    pthread_mutex_init (&cache->locks[i], NULL);
+  curl_share_setopt (cache->share, CURLSHOPT_LOCKFUNC, lock_data);
+  curl_share_setopt (cache->share, CURLSHOPT_UNLOCKFUNC, unlock_data);
+  curl_share_setopt (cache->share, CURLSHOPT_USERDATA, cache);
+  curl_share_setopt (cache->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+#if TLS_CACHE_HAVE_PERSISTENCE
+  if (cache->path && WEATHER_SUCCESS != load (cache))
+    ERROR ("Ignoring unreadable TLS session file\n");
+#endif
+
+  return WEATHER_SUCCESS;
+}
+
+void
+tls_cache_cleanup (TlsSessionCache *cache)
+{
+  if (!cache || !cache->share)
+    return;
+
+  if (cache->path && WEATHER_SUCCESS != tls_cache_save (cache))
+    ERROR ("Failed to save TLS sessions\n");
+
+  // every attached handle has to be gone by now
+  curl_share_cleanup (cache->share);
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    pthread_mutex_destroy (&cache->locks[i]);
+  free (cache->path);
+  memset (cache, 0, sizeof (*cache));
+}
+
+WEATHER_ERROR
+tls_cache_attach (TlsSessionCache *cache, CURL *easy)
+{
+  if (!cache || !cache->share || !easy)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  if (CURLE_OK != curl_easy_setopt (easy, CURLOPT_SHARE, cache->share))
+    return WEATHER_ERROR_NETWORK;
+  curl_easy_setopt (easy, CURLOPT_SSL_SESSIONID_CACHE, 1L);
+  return WEATHER_SUCCESS;
+}
+
+#if TLS_CACHE_HAVE_PERSISTENCE
+
+WEATHER_ERROR
+tls_cache_save (TlsSessionCache *cache)
+{
+  if (!cache || !cache->share || !cache->path)
+    return WEATHER_ERROR_INVALID_CONFIG;
+  if (cache->unavailable)
+    return WEATHER_SUCCESS; // the sessions stay in the share
+
+  char temporary[4096];
+  int len
+    = snprintf (temporary, sizeof (temporary), "%s.XXXXXX", cache->path);
+  if (len < 0 || (size_t) len >= sizeof (temporary))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  // the tickets resume sessions, nobody else gets to read them. mkstemp
+  // creates the file 0600 and never opens one that is already there
+  int fd = mkstemp (temporary);
+  FILE *file = fd >= 0 ? fdopen (fd, "wb") : NULL;
+  if (!file)
+  {
+    if (fd >= 0)
+    {
+      close (fd);
+      unlink (temporary);
+    }
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  uint32_t version = TLS_CACHE_VERSION;
+  if (fwrite (TLS_CACHE_MAGIC, 4, 1, file) != 1
+      || fwrite (&version, sizeof (version), 1, file) != 1)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+
+  // export goes through an easy handle attached to the share
+  CURL *easy = curl_easy_init ();
+  CURLcode exported = CURLE_OK;
+  TlsExport export = {.cache = cache, .file = file};
+  cache->exported = 0;
+  if (WEATHER_SUCCESS == status
+      && (!easy || WEATHER_SUCCESS != tls_cache_attach (cache, easy)))
+    status = WEATHER_ERROR_NETWORK;
+  if (WEATHER_SUCCESS == status)
+    exported = curl_easy_ssls_export (easy, export_one, &export);
+  if (CURLE_NOT_BUILT_IN == exported)
+    persistence_unavailable (cache);
+  else if (CURLE_OK != exported)
+    status = WEATHER_ERROR_NETWORK;
+  if (easy)
+    curl_easy_cleanup (easy);
+
+  if (fclose (file) != 0 && WEATHER_SUCCESS == status)
+    status = WEATHER_ERROR_INVALID_MEMORY;
+
+  // an unavailable export leaves the last good file alone
+  if (WEATHER_SUCCESS != status || cache->unavailable
+      || rename (temporary, cache->path) != 0)
+  {
+    unlink (temporary);
+    if (WEATHER_SUCCESS == status && !cache->unavailable)
+      status = WEATHER_ERROR_INVALID_CONFIG;
+  }
+  if (WEATHER_SUCCESS == status && !cache->unavailable)
+    metrics_count (METRIC_TLS_SESSIONS_EXPORTED, cache->exported);
+
+  return status;
+}
+
+static WEATHER_ERROR
+load (TlsSessionCache *cache)
+{
+  FILE *file = fopen (cache->path, "rb");
+  if (!file)
+    return WEATHER_SUCCESS; // first run
+
+  char magic[4];
+  uint32_t version;
+  if (fread (magic, 4, 1, file) != 1
+      || memcmp (magic, TLS_CACHE_MAGIC, 4) != 0
+      || fread (&version, sizeof (version), 1, file) != 1
+      || version != TLS_CACHE_VERSION)
+  {
+    fclose (file);
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  CURL *easy = curl_easy_init ();
+  if (!easy || WEATHER_SUCCESS != tls_cache_attach (cache, easy))
+  {
+    if (easy)
+      curl_easy_cleanup (easy);
+    fclose (file);
+    return WEATHER_ERROR_NETWORK;
+  }
+
+  WEATHER_ERROR status = WEATHER_SUCCESS;
+  int64_t now = (int64_t) time (NULL);
+  int64_t valid_until;
+
+  while (fread (&valid_until, sizeof (valid_until), 1, file) == 1)
+  {
+    size_t key_len, shmac_len, data_len;
+    char *key = read_field (file, &key_len);
+    unsigned char *shmac = read_field (file, &shmac_len);
+    unsigned char *data = read_field (file, &data_len);
+
+    if (!key || !shmac || !data)
+      status = WEATHER_ERROR_INVALID_CONFIG;
+    else if (valid_until == 0 || valid_until > now)
+    {
+      // the key is stored with its terminator, an empty one means none
+      CURLcode imported = curl_easy_ssls_import (
+	easy, key_len > 1 ? key : NULL, shmac_len ? shmac : NULL, shmac_len,
+	data, data_len);
+      if (CURLE_OK == imported)
+	cache->imported++;
+      else if (CURLE_NOT_BUILT_IN == imported)
+	persistence_unavailable (cache);
+    }
+
+    free (key);
+    free (shmac);
+    free (data);
+    if (WEATHER_SUCCESS != status || cache->unavailable)
+      break;
+  }
+
+  curl_easy_cleanup (easy);
+  fclose (file);
+  metrics_count (METRIC_TLS_SESSIONS_IMPORTED, cache->imported);
+  return status;
+}
+
+static void
+persistence_unavailable (TlsSessionCache *cache)
+{
+  // not an error, the cache still works within the process
+  if (!cache->unavailable)
+    ERROR ("libcurl cannot export TLS sessions, not keeping them on disk\n");
+  cache->unavailable = 1;
+}
+
+static CURLcode
+export_one (CURL *handle, void *userptr, const char *session_key,
+	    const unsigned char *shmac, size_t shmac_len,
+	    const unsigned char *sdata, size_t sdata_len, curl_off_t valid_until,
+	    int ietf_tls_id, const char *alpn, size_t earlydata_max)
+{
+  (void) handle;
+  (void) ietf_tls_id;
+  (void) alpn;
+  (void) earlydata_max;
+
+  TlsExport *export = userptr;
+  FILE *file = export->file;
+  int64_t expires = (int64_t) valid_until;
+  const char *key = session_key ? session_key : "";
+
+  if (fwrite (&expires, sizeof (expires), 1, file) != 1
+      || !write_field (file, key, strlen (key) + 1)
+      || !write_field (file, shmac, shmac_len)
+      || !write_field (file, sdata, sdata_len))
+    return CURLE_WRITE_ERROR;
+
+  export->cache->exported++;
+  return CURLE_OK;
+}
+
+static int
+write_field (FILE *file, const void *data, size_t len)
+{
+  uint32_t stored = (uint32_t) len;
+  return len <= TLS_CACHE_MAX_FIELD
+	 && fwrite (&stored, sizeof (stored), 1, file) == 1
+	 && (len == 0 || fwrite (data, len, 1, file) == 1);
+}
+
+static void *
+read_field (FILE *file, size_t *len)
+{
+  uint32_t stored;
+  if (fread (&stored, sizeof (stored), 1, file) != 1
+      || stored > TLS_CACHE_MAX_FIELD)
+    return NULL;
+
+  // one spare byte so empty fields still get a pointer
+  unsigned char *data = malloc (stored + 1);
+  if (!data)
+    return NULL;
+  if (stored && fread (data, stored, 1, file) != 1)
+  {
+    free (data);
+    return NULL;
+  }
+
+  data[stored] = '\0'; // keys are used as strings
+  *len = stored;
+  return data;
+}
+
+#else
+
+WEATHER_ERROR
+tls_cache_save (TlsSessionCache *cache)
+{
+  // nothing to save with this libcurl, the sessions stay in the share
+  return cache && cache->share ? WEATHER_SUCCESS : WEATHER_ERROR_INVALID_CONFIG;
+}
+
+#endif
+
+static void
+lock_data (CURL *handle, curl_lock_data data, curl_lock_access access,
+	   void *userptr)
+{
+  (void) handle;
+  (void) access;
+  TlsSessionCache *cache = userptr;
+  pthread_mutex_lock (&cache->locks[data]);
+}
+
+static void
+unlock_data (CURL *handle, curl_lock_data data, void *userptr)
+{
+  (void) handle;
+  TlsSessionCache *cache = userptr;
+  pthread_mutex_unlock (&cache->locks[data]);
+}
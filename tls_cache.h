@@ -0,0 +1,53 @@
+#ifndef TLS_CACHE_H
+#define TLS_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <curl/curl.h>
+
+#include "weather.h"
+
+// tls session resumption across handles and across runs. every handle
+// attached to the cache shares one curl share object holding the tls
+// sessions, so a new handle resumes the session an earlier one negotiated
+// instead of doing a full handshake.
+//
+// with libcurl 8.12 or newer the session tickets are also written to a file
+// on tls_cache_save and read back on tls_cache_init, which lets a short lived
+// process like the cli skip the full handshake on its next run. older
+// libcurl has no api to get at the tickets, there the cache only works
+// within the process and the file is left alone. the same goes for a newer
+// libcurl built without ticket export (CURLE_NOT_BUILT_IN), which is found
+// out at the first import or export and logged once.
+#define TLS_CACHE_HAVE_PERSISTENCE (LIBCURL_VERSION_NUM >= 0x080c00)
+
+typedef struct
+{
+  CURLSH *share;
+  pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+  char *path; // NULL keeps the sessions in memory only
+  size_t imported; // sessions read back from the file
+  size_t exported; // sessions written by the last save
+  int unavailable; // libcurl turned out to lack persistence
+} TlsSessionCache;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// a missing or unreadable ticket file is not an error, it just starts empty
+WEATHER_ERROR tls_cache_init (TlsSessionCache *cache, const char *path);
+// saves first when there is a path
+void tls_cache_cleanup (TlsSessionCache *cache);
+WEATHER_ERROR tls_cache_attach (TlsSessionCache *cache, CURL *easy);
+// written to a temporary of its own next to the path and renamed over it,
+// readable by the owner only. both counts also go to the metrics
+WEATHER_ERROR tls_cache_save (TlsSessionCache *cache);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_SERVICE_NAME "meteomatics-c-client"
+
+static atomic_int enabled;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *output;
+static TRACE_FORMAT output_format;
+static double keep_rate;
+static size_t written;
+
+static _Thread_local TraceSpan *current;
+static _Thread_local uint64_t rng;
+
+// clang-format off
+static uint64_t random_id (void);
+static void write_span (const TraceSpan *span, int64_t end_ns, WEATHER_ERROR status);
+// clang-format on
+
+WEATHER_ERROR
+trace_open (const char *path, TRACE_FORMAT format, double sample_rate)
+{
+  if (!path || sample_rate < 0 || sample_rate > 1
+      || (TRACE_FORMAT_CHROME != format && TRACE_FORMAT_OTLP != format))
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  pthread_mutex_lock (&trace_lock);
+  if (output)
+  {
+    pthread_mutex_unlock (&trace_lock);
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  output = fopen (path, "w");
+  if (!output)
+  {
+    pthread_mutex_unlock (&trace_lock);
+    ERROR ("Failed to open trace file\n");
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+
+  output_format = format;
+  keep_rate = sample_rate;
+  written = 0;
+  if (TRACE_FORMAT_CHROME == format)
+    fputs ("{\"traceEvents\":[\n", output);
+  atomic_store (&enabled, 1);
+  pthread_mutex_unlock (&trace_lock);
+
+  return WEATHER_SUCCESS;
+}
+
+void
+trace_close (void)
+{
+  pthread_mutex_lock (&trace_lock);
+  atomic_store (&enabled, 0);
+  if (output)
+  {
+    if (TRACE_FORMAT_CHROME == output_format)
+      fputs ("\n]}\n", output);
+    fclose (output);
+    output = NULL;
+  }
+  pthread_mutex_unlock (&trace_lock);
+}
+
+void
+trace_begin (TraceSpan *span, const char *name)
+{
+  memset (span, 0, sizeof (*span));
+  span->name = name;
+
+  // span_id stays 0 and trace_end has nothing to undo
+  if (!atomic_load_explicit (&enabled, memory_order_relaxed))
+    return;
+
+  span->parent = current;
+  if (span->parent)
+  {
+    span->trace_id[0] = span->parent->trace_id[0];
+    span->trace_id[1] = span->parent->trace_id[1];
+    span->parent_id = span->parent->span_id;
+    span->sampled = span->parent->sampled;
+  }
+  else
+  {
+    span->trace_id[0] = random_id ();
+    span->trace_id[1] = random_id ();
+    span->sampled
+      = (double) (random_id () >> 11) / (double) (1ULL << 53) < keep_rate;
+  }
+
+  // unsampled spans are still pushed so their children know to skip too
+  span->span_id = random_id ();
+  current = span;
+  if (span->sampled)
+    span->start_ns = trace_now_ns ();
+}
+
+void
+trace_end (TraceSpan *span, WEATHER_ERROR status)
+{
+  if (!span || !span->span_id)
+    return;
+
+  if (!span->detached)
+    current = span->parent;
+  if (span->sampled)
+    write_span (span, trace_now_ns (), status);
+}
+
+void
+trace_begin_detached (TraceSpan *span, const char *name)
+{
+  trace_begin (span, name);
+  if (!span->span_id)
+    return;
+
+  // the parent may well be gone by the time this one ends
+  current = span->parent;
+  span->parent = NULL;
+  span->detached = 1;
+}
+
+void
+trace_record (const TraceSpan *parent, const char *name, int64_t start_ns,
+	      int64_t end_ns, WEATHER_ERROR status)
+{
+  if (!parent || !parent->span_id || !parent->sampled)
+    return;
+
+  TraceSpan span = {.name = name,
+		    .trace_id = {parent->trace_id[0], parent->trace_id[1]},
+		    .span_id = random_id (),
+		    .parent_id = parent->span_id,
+		    .start_ns = start_ns,
+		    .sampled = 1};
+  write_span (&span, end_ns, status);
+}
+
+int64_t
+trace_now_ns (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_REALTIME, &now);
+  return (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static uint64_t
+random_id (void)
+{
+  if (!rng)
+  {
+    // every thread starts from its own clock reading and stack address
+    rng = (uint64_t) trace_now_ns () ^ ((uint64_t) (uintptr_t) &rng << 16);
+    rng |= 1;
+  }
+
+  // splitmix64, 0 means "no span" so it is never handed out
+  uint64_t z = (rng += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return z ? z : 1;
+}
+
+static void
+write_span (const TraceSpan *span, int64_t end_ns, WEATHER_ERROR status)
+{
+  pthread_mutex_lock (&trace_lock);
+  if (!output)
+  {
+    pthread_mutex_unlock (&trace_lock);
+    return;
+  }
+
+  unsigned long long trace_hi = span->trace_id[0];
+  unsigned long long trace_lo = span->trace_id[1];
+  unsigned long long span_id = span->span_id;
+  unsigned long long parent_id = span->parent_id;
+
+  if (TRACE_FORMAT_CHROME == output_format)
+  {
+    // complete events, microseconds
+    fprintf (output,
+	     "%s{\"name\":\"%s\",\"cat\":\"meteomatics\",\"ph\":\"X\","
+	     "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld,"
+	     "\"args\":{\"trace_id\":\"%016llx%016llx\","
+	     "\"span_id\":\"%016llx\",\"parent_id\":\"%016llx\","
+	     "\"status\":%d}}",
+	     written ? ",\n" : "", span->name, (double) span->start_ns / 1e3,
+	     (double) (end_ns - span->start_ns) / 1e3, (long) getpid (),
+	     (long) syscall (SYS_gettid), trace_hi, trace_lo, span_id,
+	     parent_id, (int) status);
+  }
+  else
+  {
+    // a root span leaves parentSpanId empty, the way otlp spells "none"
+    char parent[17] = "";
+    if (parent_id)
+      snprintf (parent, sizeof (parent), "%016llx", parent_id);
+
+    fprintf (output,
+	     "{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+	     "{\"key\":\"service.name\",\"value\":{\"stringValue\":\"%s\"}}]},"
+	     "\"scopeSpans\":[{\"scope\":{\"name\":\"meteomatics\"},"
+	     "\"spans\":[{\"traceId\":\"%016llx%016llx\","
+	     "\"spanId\":\"%016llx\",\"parentSpanId\":\"%s\","
+	     "\"name\":\"%s\",\"kind\":1,"
+	     "\"startTimeUnixNano\":\"%lld\",\"endTimeUnixNano\":\"%lld\","
+	     "\"attributes\":[{\"key\":\"weather.error\","
+	     "\"value\":{\"intValue\":\"%d\"}}],"
+	     "\"status\":{\"code\":%d}}]}]}]}\n",
+	     TRACE_SERVICE_NAME, trace_hi, trace_lo, span_id, parent, span->name,
+	     (long long) span->start_ns, (long long) end_ns, (int) status,
+	     WEATHER_SUCCESS == status ? 1 : 2);
+  }
+
+  written++;
+  pthread_mutex_unlock (&trace_lock);
+}
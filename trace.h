@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "weather.h"
+
+// lightweight tracing of the request path. spans nest per thread: a span
+// begun while another one is open on the same thread becomes its child, a
+// span begun with nothing open starts a new trace. whether a trace is kept
+// is decided once at its root, so sampled traces are always complete.
+//
+// finished spans are written as they end, either as chrome trace events
+// (load the file in chrome://tracing or perfetto) or as otlp json lines, one
+// ExportTraceServiceRequest per span, the layout of the otel file exporter.
+// with tracing off trace_begin is a single atomic load.
+//
+// transfers that overlap on one thread, like the engine's, get detached
+// spans: they take the current span as parent but never become current
+// themselves, so they can end in any order. phases only known after the
+// fact (dns, connect, ...) are written with trace_record.
+
+typedef enum
+{
+  TRACE_FORMAT_CHROME,
+  TRACE_FORMAT_OTLP
+} TRACE_FORMAT;
+
+typedef struct TraceSpan
+{
+  const char *name; // not copied, use string literals
+  uint64_t trace_id[2];
+  uint64_t span_id;
+  uint64_t parent_id; // 0 for the root
+  int64_t start_ns;
+  int sampled;
+  int detached;
+  struct TraceSpan *parent;
+} TraceSpan;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+// sample_rate is the fraction of traces kept, between 0 and 1
+WEATHER_ERROR trace_open (const char *path, TRACE_FORMAT format, double sample_rate);
+void trace_close (void);
+void trace_begin (TraceSpan *span, const char *name);
+// spans have to end in the reverse order they began in
+void trace_end (TraceSpan *span, WEATHER_ERROR status);
+void trace_begin_detached (TraceSpan *span, const char *name);
+// writes a child of parent that ran from start_ns to end_ns, if parent is
+// sampled. times are trace_now_ns readings
+void trace_record (const TraceSpan *parent, const char *name, int64_t start_ns, int64_t end_ns, WEATHER_ERROR status);
+int64_t trace_now_ns (void);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "transport.h"
+
+// clang-format off
+static int parse_long (const char *text, size_t len, long *value);
+// clang-format on
+
+void
+transport_defaults (TransportOptions *options)
+{
+  if (!options)
+    return;
+
+  memset (options, 0, sizeof (*options));
+  options->keepalive = 1;
+  options->keepalive_idle = TRANSPORT_DEFAULT_KEEPALIVE_IDLE;
+  options->keepalive_interval = TRANSPORT_DEFAULT_KEEPALIVE_INTERVAL;
+  options->nodelay = 1;
+}
+
+WEATHER_ERROR
+transport_parse (TransportOptions *options, const char *spec)
+{
+  if (!options || !spec)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  const char *cursor = spec;
+  while (*cursor)
+  {
+    const char *end = strchr (cursor, ',');
+    if (!end)
+      end = cursor + strlen (cursor);
+
+    const char *equals = memchr (cursor, '=', end - cursor);
+    long value;
+    if (!equals || !parse_long (equals + 1, end - equals - 1, &value)
+	|| value < 0)
+      return WEATHER_ERROR_INVALID_CONFIG;
+
+    size_t key_len = equals - cursor;
+    if (key_len == 9 && strncmp (cursor, "keepalive", 9) == 0)
+    {
+      options->keepalive = value > 0;
+      if (value > 0)
+	options->keepalive_idle = value;
+    }
+    else if (key_len == 8 && strncmp (cursor, "interval", 8) == 0)
+      options->keepalive_interval = value;
+    else if (key_len == 7 && strncmp (cursor, "nodelay", 7) == 0)
+      options->nodelay = value != 0;
+    else if (key_len == 6 && strncmp (cursor, "buffer", 6) == 0)
+    {
+      if (value > CURL_MAX_READ_SIZE)
+	return WEATHER_ERROR_INVALID_CONFIG;
+      options->buffer_size = value;
+    }
+    else if (key_len == 8 && strncmp (cursor, "eyeballs", 8) == 0)
+      options->happy_eyeballs_ms = value;
+    else
+      return WEATHER_ERROR_INVALID_CONFIG;
+
+    cursor = *end ? end + 1 : end;
+  }
+
+  return WEATHER_SUCCESS;
+}
+
+WEATHER_ERROR
+transport_apply (const TransportOptions *options, CURL *easy)
+{
+  if (!options || !easy)
+    return WEATHER_ERROR_INVALID_CONFIG;
+
+  CURLcode res = curl_easy_setopt (easy, CURLOPT_TCP_KEEPALIVE,
+				   options->keepalive ? 1L : 0L);
+  if (CURLE_OK == res && options->keepalive)
+  {
+    curl_easy_setopt (easy, CURLOPT_TCP_KEEPIDLE, options->keepalive_idle);
+    curl_easy_setopt (easy, CURLOPT_TCP_KEEPINTVL,
+		      options->keepalive_interval);
+  }
+  if (CURLE_OK == res)
+    res = curl_easy_setopt (easy, CURLOPT_TCP_NODELAY,
+			    options->nodelay ? 1L : 0L);
+  // curl clamps anything below its minimum, above the maximum is an error
+  if (CURLE_OK == res && options->buffer_size > 0)
+    res = curl_easy_setopt (easy, CURLOPT_BUFFERSIZE, options->buffer_size);
+  if (CURLE_OK == res && options->happy_eyeballs_ms > 0)
+    res = curl_easy_setopt (easy, CURLOPT_HAPPY_EYEBALLS_TIMEOUT_MS,
+			    options->happy_eyeballs_ms);
+
+  if (CURLE_OK != res)
+  {
+    ERROR (curl_easy_strerror (res));
+    return WEATHER_ERROR_INVALID_CONFIG;
+  }
+  return WEATHER_SUCCESS;
+}
+
+static int
+parse_long (const char *text, size_t len, long *value)
+{
+  char digits[32];
+  if (len == 0 || len >= sizeof (digits))
+    return 0;
+
+  memcpy (digits, text, len);
+  digits[len] = '\0';
+
+  char *end;
+  *value = strtol (digits, &end, 10);
+  return *end == '\0';
+}
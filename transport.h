@@ -0,0 +1,49 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <curl/curl.h>
+
+#include "weather.h"
+
+// socket level knobs for a handle. point queries are a few hundred bytes
+// and mostly latency, grid downloads are megabytes and mostly throughput,
+// so the two want different settings. transport_defaults gives what suits
+// a long running process talking to one api host: keepalive probes so idle
+// pooled connections notice a dead peer, nagle off and curl's own receive
+// buffer size and happy eyeballs delay.
+//
+// the buffer size is how much curl asks the socket for per read, a bigger
+// one means fewer reads on large bodies. write_callback is still handed at
+// most CURL_MAX_WRITE_SIZE per call whatever it is set to.
+#define TRANSPORT_DEFAULT_KEEPALIVE_IDLE 60 // seconds
+#define TRANSPORT_DEFAULT_KEEPALIVE_INTERVAL 30 // seconds
+
+typedef struct
+{
+  int keepalive;
+  long keepalive_idle; // seconds before the first probe
+  long keepalive_interval; // seconds between probes
+  int nodelay;
+  long buffer_size; // bytes, 0 keeps curl's default
+  long happy_eyeballs_ms; // 0 keeps curl's default
+} TransportOptions;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// clang-format off
+void transport_defaults (TransportOptions *options);
+// comma separated key=value pairs on top of what is already set, e.g.
+// "keepalive=0,nodelay=1,buffer=262144,eyeballs=100". keepalive takes the
+// idle seconds, 0 turns it off
+WEATHER_ERROR transport_parse (TransportOptions *options, const char *spec);
+// set once on a handle, setup_easy_handle leaves these alone
+WEATHER_ERROR transport_apply (const TransportOptions *options, CURL *easy);
+// clang-format on
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
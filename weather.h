@@ -0,0 +1,66 @@
+#ifndef WEATHER_H
+#define WEATHER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ERROR(msg)                                                             \
+  do                                                                           \
+  {                                                                            \
+    fprintf (stderr, "Error: %s at %s:%d\n", msg, __FILE__, __LINE__);         \
+  } while (0)
+
+#define ERROR_EXIT(msg)                                                        \
+  do                                                                           \
+  {                                                                            \
+    ERROR (msg);                                                               \
+    exit (EXIT_FAILURE);                                                       \
+  } while (0)
+
+#define API_MAX_URL_LENGTH 512
+#define API_MAX_RESPONSE_SIZE (10 * 1024 * 1024) // 10MB
+#define API_INITIAL_BUFFER_SIZE 4096
+
+typedef enum
+{
+  WEATHER_SUCCESS = 0,
+  WEATHER_ERROR_INVALID_CONFIG = -1,
+  WEATHER_ERROR_INVALID_MEMORY = -2,
+  WEATHER_ERROR_URL_CONSTRUCTION = -3,
+  WEATHER_ERROR_NETWORK = -4,
+  WEATHER_ERROR_JSON = -5,
+  // the api answered with an error status, see transfer_status
+  WEATHER_ERROR_HTTP_CLIENT = -6, // 4xx not covered below, a bad query
+  WEATHER_ERROR_HTTP_AUTH = -7, // 401 and 403
+  WEATHER_ERROR_HTTP_NOT_FOUND = -8,
+  WEATHER_ERROR_HTTP_RATE_LIMIT = -9, // 429, worth retrying later
+  WEATHER_ERROR_HTTP_SERVER = -10, // 5xx
+  WEATHER_ERROR_CANCELLED = -11 // withdrawn by the caller before it finished
+} WEATHER_ERROR;
+
+typedef const char *const IMMUTABLE_CHAR_PTR;
+
+#define WEATHER_HASH_SEED 14695981039346656037ULL
+
+// fnv-1a, pass WEATHER_HASH_SEED or the result of a previous call as hash
+static inline uint64_t
+weather_hash_bytes (const void *data, size_t size, uint64_t hash)
+{
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < size; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static inline uint64_t
+weather_hash (const char *text)
+{
+  return weather_hash_bytes (text, strlen (text), WEATHER_HASH_SEED);
+}
+
+#endif